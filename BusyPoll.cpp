@@ -0,0 +1,225 @@
+/*
+ * BusyPoll.cpp
+ *
+ *  Low latency receive thread for one data channel: spinning on the socket instead of sleeping in epoll,
+ *  pinned to its own core, with the latency of the frames (kernel arrival -> handler) measured.
+ */
+
+#include "BusyPoll.hpp"
+#include "Logger.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <time.h>
+#include <cerrno>
+#include <chrono>
+#include <string>
+
+namespace net {
+
+namespace { // for internal use only
+
+inline void relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+inline uint64_t realtimeNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// empty polls between the checks of the socket state in SPIN mode
+constexpr uint64_t HANGUP_CHECK_POLLS = 4096u;
+
+} // end namespace
+
+LatencyHistogram::LatencyHistogram() {
+    reset();
+}
+
+std::size_t LatencyHistogram::bucket(uint64_t ns) {
+    if (ns < SUB_BUCKETS) return static_cast<std::size_t>(ns);
+    const std::size_t msb = 63u - static_cast<std::size_t>(__builtin_clzll(ns));
+    // 2 bits below the msb select the quarter of the octave
+    const std::size_t sub = static_cast<std::size_t>(ns >> (msb - 2u)) & (SUB_BUCKETS - 1u);
+    const std::size_t n = (msb - 1u) * SUB_BUCKETS + sub;
+    return (n < BUCKETS) ? n : (BUCKETS - 1u);
+}
+
+uint64_t LatencyHistogram::bucketLimit(std::size_t bucket) {
+    if (bucket < SUB_BUCKETS) return bucket;
+    const std::size_t msb = bucket / SUB_BUCKETS + 1u;
+    const uint64_t sub = bucket % SUB_BUCKETS;
+    return (((SUB_BUCKETS + sub + 1u) << (msb - 2u)) - 1u);
+}
+
+void LatencyHistogram::record(uint64_t ns) {
+    ChannelMetrics::add(_buckets[bucket(ns)], 1);
+    ChannelMetrics::add(_count, 1);
+    ChannelMetrics::add(_sum, ns);
+    if (ns < _min.load(std::memory_order_relaxed)) _min.store(ns, std::memory_order_relaxed);
+    if (ns > _max.load(std::memory_order_relaxed)) _max.store(ns, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::recordSince(uint64_t rx_time_ns) {
+    if (!rx_time_ns) return;
+    const uint64_t now = realtimeNs();
+    // CLOCK_REALTIME can step back (NTP)
+    record((now > rx_time_ns) ? (now - rx_time_ns) : 0);
+}
+
+void LatencyHistogram::reset() {
+    for (auto& bucket : _buckets) bucket.store(0, std::memory_order_relaxed);
+    _count.store(0, std::memory_order_relaxed);
+    _sum.store(0, std::memory_order_relaxed);
+    _min.store(UINT64_MAX, std::memory_order_relaxed);
+    _max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::count() const {
+    return (_count.load(std::memory_order_relaxed));
+}
+
+uint64_t LatencyHistogram::min() const {
+    return (count() ? _min.load(std::memory_order_relaxed) : 0);
+}
+
+uint64_t LatencyHistogram::max() const {
+    return (_max.load(std::memory_order_relaxed));
+}
+
+double LatencyHistogram::mean() const {
+    const uint64_t n = count();
+    return (n ? static_cast<double>(_sum.load(std::memory_order_relaxed)) / n : 0.0);
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+    uint64_t total = 0;
+    for (const auto& bucket : _buckets) total += bucket.load(std::memory_order_relaxed);
+    if (!total) return 0;
+
+    const uint64_t rank = static_cast<uint64_t>(p * static_cast<double>(total - 1)) + 1u;
+    uint64_t seen = 0;
+    for (std::size_t n = 0; n < BUCKETS; n++) {
+        seen += _buckets[n].load(std::memory_order_relaxed);
+        if (seen >= rank) return std::min(bucketLimit(n), max());
+    }
+    return max();
+}
+
+BusyPollReceiver::BusyPollReceiver(NetDevice& device, const BusyPollConfig& config, Receive receive, Lost lost) throw(std::exception) :
+        _device(device),
+        _config(config),
+        _receive(std::move(receive)),
+        _lost(std::move(lost)),
+        _wakefd(-1),
+        _stop(false),
+        _running(false),
+        _stats() {
+
+    if ((_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        throw std::runtime_error("BusyPollReceiver: cannot create eventfd, error: " + std::to_string(errno));
+
+    if (_config.socket_busy_poll_us)
+        _device.setBusyPoll(_config.socket_busy_poll_us, _config.prefer_busy_poll, _config.busy_poll_budget);
+    if (_config.measure_latency && (_device.getRxTimestamping() == rx_timestamping::NONE))
+        _device.setRxTimestamping(rx_timestamping::SOFTWARE);
+}
+
+BusyPollReceiver::~BusyPollReceiver() {
+    stop();
+    ::close(_wakefd);
+}
+
+void BusyPollReceiver::start() throw(std::exception) {
+    if (_thread.joinable()) return;
+    _stop = false;
+    _running = true;
+    _thread = std::thread(&BusyPollReceiver::run, this);
+
+    if (_config.cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(_config.cpu, &cpus);
+        const int error = pthread_setaffinity_np(_thread.native_handle(), sizeof(cpus), &cpus);
+        if (error) {
+            stop();
+            throw std::runtime_error("BusyPollReceiver: cannot pin the thread to cpu " + std::to_string(_config.cpu)
+                    + ", error: " + std::to_string(error));
+        }
+    }
+}
+
+void BusyPollReceiver::stop() {
+    if (!_thread.joinable()) return;
+    _stop = true;
+    // from the handler, the thread can't join itself - it ends when the handler returns
+    if (isCurrentThread()) return;
+    const uint64_t one = 1;
+    if (::write(_wakefd, &one, sizeof(one)) < 0) { /* counter is full, the thread is woken anyway */ }
+    _thread.join();
+    uint64_t value;
+    if (::read(_wakefd, &value, sizeof(value)) < 0) { /* nothing to reset */ }
+}
+
+void BusyPollReceiver::run() {
+    const auto spin_time = std::chrono::microseconds(_config.spin_us);
+    auto last_data = std::chrono::steady_clock::now();
+    uint64_t empty = 0;
+    bool lost = false;
+
+    try {
+        while (!_stop.load(std::memory_order_relaxed)) {
+            if (_receive(*this)) {
+                ChannelMetrics::add(_stats.receives, 1);
+                if (_config.mode == busy_poll_mode::ADAPTIVE) last_data = std::chrono::steady_clock::now();
+                continue;
+            }
+            ChannelMetrics::add(_stats.empty_polls, 1);
+
+            if ((_config.mode == busy_poll_mode::ADAPTIVE) && ((std::chrono::steady_clock::now() - last_data) > spin_time)) {
+                ChannelMetrics::add(_stats.sleeps, 1);
+                if (!wait(-1)) break;
+                // spin again after the wakeup, next data usually come soon
+                last_data = std::chrono::steady_clock::now();
+            }
+            // recv of the closed socket returns 0 as on no data, check it from time to time
+            else if (!(++empty % HANGUP_CHECK_POLLS) && !wait(0)) break;
+            else relax();
+        }
+        // closed by the peer - the rest of the data, if any
+        if (!_stop.load(std::memory_order_relaxed)) {
+            lost = true;
+            _receive(*this);
+        }
+    }
+    catch (std::exception& e) {
+        NETLOG_ERROR("{} busy poll receive stopped: {}", _device.getName(), e.what());
+        lost = true;
+    }
+    _running = false;
+    if (lost && _lost) _lost();
+}
+
+bool BusyPollReceiver::wait(int timeout_ms) {
+    struct pollfd fds[2];
+    fds[0].fd = _device.getPollFd();
+    fds[0].events = POLLIN | POLLRDHUP;
+    fds[0].revents = 0;
+    fds[1].fd = _wakefd;
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+    // level triggered, data which came after the last receive wake us immediately
+    if (::poll(fds, 2, timeout_ms) <= 0) return true;
+    return !(fds[0].revents & (POLLRDHUP | POLLHUP | POLLERR));
+}
+
+} // namespace net
@@ -0,0 +1,158 @@
+/*
+ * BusyPoll.hpp
+ *
+ *  Low latency receive thread for one data channel: spinning on the socket instead of sleeping in epoll,
+ *  pinned to its own core, with the latency of the frames (kernel arrival -> handler) measured.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_BUSY_POLL_HPP_
+#define SRC_PISA_NETDEVICES_BUSY_POLL_HPP_
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <stdexcept>
+
+#include "NetDevice.hpp"
+
+namespace net {
+
+enum class busy_poll_mode {
+    SPIN = 0u,  // never sleeps, one core at 100%
+    ADAPTIVE,   // spins for spin_us after the last data, then sleeps in poll() until the next data
+};
+
+struct BusyPollConfig {
+    busy_poll_mode mode = busy_poll_mode::ADAPTIVE;
+    int cpu = -1;                       // core of the receive thread, -1 - not pinned
+    unsigned spin_us = 200u;            // ADAPTIVE - spinning time before going to sleep
+    // socket options (see NetDevice::setBusyPoll), 0 - not set. Require CAP_NET_ADMIN
+    // and help only with the NIC queue served by NAPI (not on the loopback)
+    int socket_busy_poll_us = 50;
+    bool prefer_busy_poll = true;
+    int busy_poll_budget = 0;           // packets per socket busy poll, 0 - kernel default
+    // enable software RX timestamps on the device when it has none (needed for the latency)
+    bool measure_latency = true;
+};
+
+/*
+ * Histogram of the latencies, 4 buckets per power of two (max error 25%), 1 ns .. ~68 s.
+ * Single writer (receive thread), read from any thread - values are approximate while it runs.
+ */
+class LatencyHistogram {
+    public:
+        static constexpr std::size_t SUB_BUCKETS = 4u;
+        static constexpr std::size_t BUCKETS = 35u * SUB_BUCKETS;
+
+        LatencyHistogram();
+
+        LatencyHistogram(const LatencyHistogram&) = delete;
+        LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+        void record(uint64_t ns);
+        // latency from the kernel timestamp (CLOCK_REALTIME ns) till now, 0 (no timestamp) is ignored
+        void recordSince(uint64_t rx_time_ns);
+        void reset();
+
+        uint64_t count() const;
+        uint64_t min() const;
+        uint64_t max() const;
+        double mean() const;
+        // upper bound of the bucket with the percentile, p from 0.0 to 1.0
+        uint64_t percentile(double p) const;
+
+    private:
+        static std::size_t bucket(uint64_t ns);
+        static uint64_t bucketLimit(std::size_t bucket);
+
+        std::atomic<uint64_t> _buckets[BUCKETS];
+        std::atomic<uint64_t> _count;
+        std::atomic<uint64_t> _sum;
+        std::atomic<uint64_t> _min;
+        std::atomic<uint64_t> _max;
+};
+
+struct BusyPollStats {
+    std::atomic<uint64_t> receives;     // receive calls returning frames
+    std::atomic<uint64_t> empty_polls;  // receive calls with no frames
+    std::atomic<uint64_t> sleeps;       // ADAPTIVE - poll() calls after the spin time
+};
+
+/*
+ * Dedicated thread calling receive() in a loop. receive has to read the device until it's drained
+ * (or isStopping) and return the number of frames, before the frames are handed over it should call
+ * latency().recordSince(device.getRxTimestamp()). Exception from receive or hang up of the socket
+ * ends the thread, lost() is called from it then.
+ *
+ * stop() from the thread itself (receive or lost) only ends the loop, the thread is joined by the next
+ * stop() from another thread or by the destructor - the object has to outlive the call, don't destroy it there.
+ *
+ * Latency is one sample per handed over batch, from the timestamp of the last recv in it - with more recvs
+ * in one batch (drain mode) the older data waited longer than recorded, the histogram is the latency of the
+ * newest data.
+ *
+ * Compared to the reactor (epoll_wait sleep + wakeup of the thread, ~tens of us) the spinning thread
+ * sees the data as soon as the kernel queues them, for the cost of the whole core.
+ *
+ * Example usage:
+ *
+ *    net::BusyPollConfig config;
+ *    config.cpu = 3;
+ *    lpps.startBusyPoll(lpps_receiver::lpps_channels::CHANNEL_1, config, handler);
+ *    ...
+ *    const net::LatencyHistogram& latency = lpps.getBusyPoll(lpps_receiver::lpps_channels::CHANNEL_1)->latency();
+ *    std::cout << latency.percentile(0.99) << " ns" << std::endl;
+ *    lpps.stopBusyPoll(lpps_receiver::lpps_channels::CHANNEL_1);
+ */
+class BusyPollReceiver {
+    public:
+        using Receive = std::function<std::size_t(BusyPollReceiver& receiver)>;
+        using Lost = std::function<void()>;
+
+        // sets the socket options of the (connected) device, thread is started by start()
+        BusyPollReceiver(NetDevice& device, const BusyPollConfig& config, Receive receive, Lost lost = nullptr) throw(std::exception);
+        ~BusyPollReceiver();
+
+        BusyPollReceiver(const BusyPollReceiver&) = delete;
+        BusyPollReceiver& operator=(const BusyPollReceiver&) = delete;
+
+        // throws when the thread can't be pinned to config.cpu
+        void start() throw(std::exception);
+        // joins the thread, called from the thread only requests the end
+        void stop();
+
+        inline bool isRunning() const { return (_running.load(std::memory_order_relaxed));}
+        inline bool isStopping() const { return (_stop.load(std::memory_order_relaxed));}
+        // true in the receive thread (receive, lost)
+        inline bool isCurrentThread() const { return (std::this_thread::get_id() == _thread.get_id());}
+        inline LatencyHistogram& latency() { return (_latency);}
+        inline const BusyPollStats& stats() const { return (_stats);}
+        inline const BusyPollConfig& config() const { return (_config);}
+
+    private:
+        void run();
+        /*
+         * wait for the data or stop(), timeout_ms = 0 - only check the socket
+         * return false when the socket was closed by the peer or has an error
+         */
+        bool wait(int timeout_ms);
+
+        NetDevice& _device;
+        BusyPollConfig _config;
+        Receive _receive;
+        Lost _lost;
+        // wakes the sleeping thread on stop()
+        int _wakefd;
+        std::atomic<bool> _stop;
+        std::atomic<bool> _running;
+        std::thread _thread;
+
+        LatencyHistogram _latency;
+        BusyPollStats _stats;
+};
+
+} // namespace net
+
+#endif /* SRC_PISA_NETDEVICES_BUSY_POLL_HPP_ */
@@ -0,0 +1,333 @@
+/*
+ * CaptureFile.cpp
+ *
+ *  Raw capture of the data channels, written to disk asynchronously.
+ */
+
+#include "CaptureFile.hpp"
+#include "Logger.hpp"
+#include "StreamFramer.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+
+namespace net {
+
+namespace { // for internal use only
+
+// gaps waiting for the writer, the IO thread keeps dropping when it's full
+constexpr std::size_t MAX_GAPS = 64u;
+
+uint64_t realtimeNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec));
+}
+
+std::string errorText(const std::string& path, const std::string& what) {
+    return ("capture " + path + ": " + what + ", " + std::strerror(errno));
+}
+
+} // end namespace
+
+CaptureWriter::CaptureWriter(const std::string& path, const FrameFormat& format, std::size_t ntp_offset,
+        const std::string& name, std::size_t buffer_len) throw(std::exception) :
+        _path(path),
+        _fd(-1),
+        _index_fd(-1),
+        _offset(0),
+        _header(),
+        _ring(buffer_len),
+        _gaps(MAX_GAPS),
+        _drop_pos(0),
+        _drop_len(0),
+        _written(0),
+        _chunks(0),
+        _total_lost(0),
+        _run(true) {
+
+    if ((format.magic_len > MAX_MAGIC_LEN) || ((ntp_offset + sizeof(uint64_t)) > format.frame_len))
+        throw std::runtime_error("capture " + path + ": invalid frame format");
+
+    std::memcpy(_header.magic, CAPTURE_MAGIC, sizeof(_header.magic));
+    _header.version = CAPTURE_VERSION;
+    _header.header_len = sizeof(CaptureHeader);
+    std::memcpy(_header.frame_magic, format.magic, format.magic_len);
+    _header.frame_magic_len = static_cast<uint32_t>(format.magic_len);
+    _header.frame_len = static_cast<uint32_t>(format.frame_len);
+    _header.payload_offset = static_cast<uint32_t>(format.payload_offset);
+    _header.ntp_offset = static_cast<uint32_t>(ntp_offset);
+    _header.start_time_ns = realtimeNs();
+    std::strncpy(_header.name, name.c_str(), sizeof(_header.name) - 1);
+
+    if ((_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+        throw std::runtime_error(errorText(path, "cannot create file"));
+    const std::string index_path = path + CAPTURE_INDEX_SUFFIX;
+    if ((_index_fd = ::open(index_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+        const std::string error = errorText(index_path, "cannot create file");
+        ::close(_fd);
+        throw std::runtime_error(error);
+    }
+
+    try {
+        writeAll(_fd, &_header, sizeof(_header));
+    }
+    catch (std::exception& e) {
+        ::close(_fd);
+        ::close(_index_fd);
+        throw;
+    }
+    _offset = sizeof(_header);
+
+    _thread = std::thread(&CaptureWriter::run, this);
+}
+
+CaptureWriter::~CaptureWriter() {
+    close();
+}
+
+void CaptureWriter::write(const uint8_t* data, std::size_t len) {
+    if (_drop_len) {
+        // stream stays broken until the gap is queued, data go on from its position
+        if ((len > _ring.writable()) || !_gaps.push(Gap { _drop_pos, _drop_len })) {
+            _drop_len += len;
+            return;
+        }
+        _drop_len = 0;
+    }
+    if (len > _ring.writable()) {
+        // writer is behind, drop it - remember where the stream is broken
+        _drop_pos = _ring.tail();
+        _drop_len = len;
+        return;
+    }
+    std::memcpy(_ring.writePtr(), data, len);
+    _ring.commit(len);
+}
+
+void CaptureWriter::close() {
+    if (!_thread.joinable()) return;
+
+    // drop at the very end goes to an empty chunk
+    if (_drop_len && _gaps.push(Gap { _drop_pos, _drop_len })) _drop_len = 0;
+    _run.store(false);
+    _thread.join();
+
+    ::fsync(_fd);
+    ::close(_fd);
+    ::close(_index_fd);
+    _fd = -1;
+    _index_fd = -1;
+}
+
+CaptureStats CaptureWriter::stats() const {
+    return CaptureStats { _written.load(), _chunks.load(), _total_lost.load() };
+}
+
+void CaptureWriter::run() {
+    auto last_flush = std::chrono::steady_clock::now();
+    uint64_t lost = 0;
+    Gap gap;
+    bool has_gap = false;
+
+    while (true) {
+        const bool running = _run.load();
+        const auto now = std::chrono::steady_clock::now();
+
+        if (!has_gap) has_gap = _gaps.pop(gap);
+        if (has_gap && (gap.pos == _ring.head())) {
+            // everything before the gap is written, dropped bytes go to the header of the next chunk
+            lost += gap.lost;
+            has_gap = false;
+            continue;
+        }
+        // data before the gap go to one chunk, the rest to the next one
+        const uint64_t pos = has_gap ? gap.pos : _ring.tail();
+        const std::size_t staged = static_cast<std::size_t>(pos - _ring.head());
+
+        if (has_gap || !running || (staged >= CAPTURE_CHUNK_LEN)
+                || ((now - last_flush) >= std::chrono::milliseconds(CAPTURE_FLUSH_MS))) {
+            if (staged || lost) {
+                try {
+                    flush(pos, lost);
+                }
+                catch (std::exception& e) {
+                    // disk full or so, stop recording - receive path goes on
+                    NETLOG_ERROR("{}, capture stopped", e.what());
+                    return;
+                }
+                lost = 0;
+            }
+            last_flush = now;
+            if (!running && !has_gap) return;
+            if (has_gap) continue;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void CaptureWriter::flush(uint64_t pos, uint64_t lost) {
+    const uint64_t head = _ring.head();
+    const std::size_t len = static_cast<std::size_t>(pos - head);
+    const uint8_t* data = _ring.at(head);
+
+    ChunkHeader chunk;
+    std::memset(&chunk, 0, sizeof(chunk));
+    chunk.magic = CAPTURE_CHUNK_MAGIC;
+    chunk.length = static_cast<uint32_t>(len);
+    chunk.lost = lost;
+    chunk.rx_time_ns = realtimeNs();
+    chunk.first_frame = CAPTURE_NO_FRAME;
+
+    const std::size_t frame_len = _header.frame_len;
+    if (len >= frame_len) {
+        const std::size_t first = findMagic(data, len - frame_len + 1, _header.frame_magic, _header.frame_magic_len);
+        if (first < (len - frame_len + 1)) {
+            chunk.first_frame = static_cast<uint32_t>(first);
+            std::memcpy(&chunk.first_ntp, data + first + _header.ntp_offset, sizeof(chunk.first_ntp));
+        }
+    }
+
+    struct iovec iov[2];
+    iov[0].iov_base = &chunk;
+    iov[0].iov_len = sizeof(chunk);
+    iov[1].iov_base = const_cast<uint8_t*>(data);
+    iov[1].iov_len = len;
+
+    std::size_t total = sizeof(chunk) + len;
+    std::size_t done = 0;
+    while (done < total) {
+        const ssize_t ret = ::writev(_fd, iov, 2);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(errorText(_path, "write failed"));
+        }
+        done += static_cast<std::size_t>(ret);
+        // partial write, skip what is done
+        std::size_t skip = static_cast<std::size_t>(ret);
+        for (auto& io : iov) {
+            const std::size_t n = std::min(skip, io.iov_len);
+            io.iov_base = static_cast<uint8_t*>(io.iov_base) + n;
+            io.iov_len -= n;
+            skip -= n;
+        }
+    }
+
+    if (chunk.first_frame != CAPTURE_NO_FRAME) {
+        const CaptureIndexEntry entry = { chunk.first_ntp, _offset, chunk.rx_time_ns };
+        writeAll(_index_fd, &entry, sizeof(entry));
+    }
+
+    _offset += total;
+    _ring.consume(len);
+    _written.fetch_add(len, std::memory_order_relaxed);
+    _chunks.fetch_add(1, std::memory_order_relaxed);
+    _total_lost.fetch_add(lost, std::memory_order_relaxed);
+}
+
+void CaptureWriter::writeAll(int fd, const void* data, std::size_t len) {
+    const uint8_t* ptr = static_cast<const uint8_t*>(data);
+    while (len) {
+        const ssize_t ret = ::write(fd, ptr, len);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(errorText(_path, "write failed"));
+        }
+        ptr += ret;
+        len -= static_cast<std::size_t>(ret);
+    }
+}
+
+CaptureReader::CaptureReader(const std::string& path) throw(std::exception) :
+        _data(static_cast<const uint8_t*>(MAP_FAILED)),
+        _len(0),
+        _header(nullptr) {
+
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) throw std::runtime_error(errorText(path, "cannot open file"));
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        const std::string error = errorText(path, "cannot stat file");
+        ::close(fd);
+        throw std::runtime_error(error);
+    }
+    _len = static_cast<std::size_t>(st.st_size);
+    if (_len >= sizeof(CaptureHeader))
+        _data = static_cast<const uint8_t*>(mmap(nullptr, _len, PROT_READ, MAP_SHARED, fd, 0));
+    ::close(fd);
+
+    if (_data == MAP_FAILED)
+        throw std::runtime_error("capture " + path + ": cannot map file (too short?)");
+
+    _header = reinterpret_cast<const CaptureHeader*>(_data);
+    if (std::memcmp(_header->magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) || (_header->version != CAPTURE_VERSION)
+            || (_header->header_len < sizeof(CaptureHeader)) || (_header->header_len > _len)) {
+        munmap(const_cast<uint8_t*>(_data), _len);
+        throw std::runtime_error("capture " + path + ": not a capture file or unsupported version");
+    }
+    // sequential replay
+    madvise(const_cast<uint8_t*>(_data), _len, MADV_SEQUENTIAL);
+
+    loadIndex(path + CAPTURE_INDEX_SUFFIX);
+}
+
+CaptureReader::~CaptureReader() {
+    munmap(const_cast<uint8_t*>(_data), _len);
+}
+
+bool CaptureReader::chunkAt(uint64_t offset, Chunk& chunk) const {
+    if ((offset + sizeof(ChunkHeader)) > _len) return false;
+
+    const ChunkHeader* header = reinterpret_cast<const ChunkHeader*>(_data + offset);
+    if ((header->magic != CAPTURE_CHUNK_MAGIC) || ((offset + sizeof(ChunkHeader) + header->length) > _len))
+        return false;
+
+    chunk.header = header;
+    chunk.data = _data + offset + sizeof(ChunkHeader);
+    chunk.offset = offset;
+    chunk.next = offset + sizeof(ChunkHeader) + header->length;
+    return true;
+}
+
+uint64_t CaptureReader::seek(uint64_t ntp) const {
+    auto it = std::upper_bound(_index.begin(), _index.end(), ntp,
+            [](uint64_t key, const CaptureIndexEntry& entry) { return (key < entry.first_ntp); });
+    if (it == _index.begin()) return begin();
+    return (--it)->offset;
+}
+
+void CaptureReader::loadIndex(const std::string& path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0) {
+            // the last entry can be cut when the writer was killed
+            _index.resize(static_cast<std::size_t>(st.st_size) / sizeof(CaptureIndexEntry));
+            const std::size_t len = _index.size() * sizeof(CaptureIndexEntry);
+            if (::pread(fd, _index.data(), len, 0) != static_cast<ssize_t>(len)) _index.clear();
+        }
+        ::close(fd);
+        // entries of chunks not in the file (cut capture)
+        while (!_index.empty() && ((_index.back().offset + sizeof(ChunkHeader)) > _len))
+            _index.pop_back();
+        if (!_index.empty()) return;
+    }
+
+    // no index, rebuild it from the chunk headers
+    Chunk chunk;
+    for (uint64_t offset = begin(); chunkAt(offset, chunk); offset = chunk.next) {
+        if (chunk.header->first_frame != CAPTURE_NO_FRAME)
+            _index.push_back(CaptureIndexEntry { chunk.header->first_ntp, chunk.offset, chunk.header->rx_time_ns });
+    }
+}
+
+} // namespace net
@@ -0,0 +1,204 @@
+/*
+ * CaptureFile.hpp
+ *
+ *  Raw capture of the data channels, written to disk asynchronously.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_CAPTURE_FILE_HPP_
+#define SRC_PISA_NETDEVICES_CAPTURE_FILE_HPP_
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdexcept>
+
+#include "RingBuffer.hpp"
+#include "FrameScanner.hpp"
+#include "SpscQueue.hpp"
+
+namespace net {
+
+struct FrameFormat;
+
+/*
+ * REMEMBER LITTLE ENDIAN!!
+ * Capture file - append only, can be mapped as a whole:
+ *
+ * | CaptureHeader | ChunkHeader | raw bytes ... | ChunkHeader | raw bytes ... | ...
+ *
+ * Raw bytes are the stream exactly as received (fragments, junk, everything), chunk = one writer flush.
+ * Sparse index goes into a separate file (path + CAPTURE_INDEX_SUFFIX), one CaptureIndexEntry per chunk
+ * with a frame, sorted by the NTP timestamp of the first frame in the chunk. Index can be rebuilt from
+ * the chunk headers when it is lost (reader does it itself).
+ */
+constexpr char CAPTURE_MAGIC[8] = { 'P', 'I', 'S', 'A', 'C', 'A', 'P', 0 };
+constexpr uint32_t CAPTURE_VERSION = 1u;
+constexpr uint32_t CAPTURE_CHUNK_MAGIC = 0x4b4e4843u; // "CHNK"
+constexpr char CAPTURE_INDEX_SUFFIX[] = ".idx";
+// no frame in the chunk
+constexpr uint32_t CAPTURE_NO_FRAME = UINT32_MAX;
+
+// 4MB of staging memory, ~100 ms of a busy channel
+constexpr std::size_t CAPTURE_BUF_LENGTH = 4u * 1024u * 1024u;
+// writer flushes when it has so much data, or after CAPTURE_FLUSH_MS
+constexpr std::size_t CAPTURE_CHUNK_LEN = 256u * 1024u;
+constexpr unsigned CAPTURE_FLUSH_MS = 10u;
+
+struct CaptureHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_len;      // sizeof(CaptureHeader), chunks start here
+    uint8_t frame_magic[MAX_MAGIC_LEN];
+    uint32_t frame_magic_len;
+    uint32_t frame_len;
+    uint32_t payload_offset;
+    uint32_t ntp_offset;      // NTP timestamp of the frame, from the frame start
+    uint64_t start_time_ns;   // CLOCK_REALTIME when the capture started
+    char name[32];            // channel
+};
+
+struct ChunkHeader {
+    uint32_t magic;           // CAPTURE_CHUNK_MAGIC
+    uint32_t length;          // raw bytes following the header
+    uint64_t lost;            // bytes dropped right before this chunk (writer didn't keep up)
+    uint64_t rx_time_ns;      // CLOCK_REALTIME of the flush
+    uint64_t first_ntp;       // NTP timestamp (32.32) of the first frame, 0 without frame
+    uint32_t first_frame;     // offset of the first frame in the chunk, CAPTURE_NO_FRAME without frame
+    uint32_t reserved;
+};
+
+struct CaptureIndexEntry {
+    uint64_t first_ntp;
+    uint64_t offset;          // of the ChunkHeader in the capture file
+    uint64_t rx_time_ns;
+};
+
+static_assert(sizeof(CaptureHeader) == 80, "CaptureHeader layout");
+static_assert(sizeof(ChunkHeader) == 40, "ChunkHeader layout");
+static_assert(sizeof(CaptureIndexEntry) == 24, "CaptureIndexEntry layout");
+
+struct CaptureStats {
+    uint64_t bytes;           // written to the file (raw data)
+    uint64_t chunks;
+    uint64_t lost;            // dropped bytes
+};
+
+/*
+ * Records one data channel. write() is called from the IO thread (StreamFramer does it after every recv),
+ * it only copies the data into the staging ring - file writes are done by the writer thread.
+ * When the writer can't keep up and the staging ring is full, data are dropped (and counted in the next chunk),
+ * the receive path never waits for the disk. Once dropping, it goes on until the gap is handed to the writer,
+ * so ChunkHeader::lost is exactly the bytes missing between the two chunks.
+ *
+ * Example usage:
+ *
+ *    fbs.startCapture(fbs_receiver::fbs_channels::CHANNEL_1, "/data/fbs1.cap");
+ *    ...
+ *    fbs.stopCapture(fbs_receiver::fbs_channels::CHANNEL_1);  // flush and close
+ */
+class CaptureWriter {
+    public:
+        /*
+         * @param format - frames of the channel (to find the first frame of every chunk)
+         * @param ntp_offset - NTP timestamp of the frame (from the frame start), index key
+         */
+        CaptureWriter(const std::string& path, const FrameFormat& format, std::size_t ntp_offset,
+                const std::string& name = "", std::size_t buffer_len = CAPTURE_BUF_LENGTH) throw(std::exception);
+        ~CaptureWriter();
+
+        CaptureWriter(const CaptureWriter&) = delete;
+        CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+        // IO thread - copy received data, no syscall
+        void write(const uint8_t* data, std::size_t len);
+
+        // stop the writer thread, flush everything and close the files (called from destructor too)
+        void close();
+
+        // from the writer thread, approximate while running
+        CaptureStats stats() const;
+        inline const std::string& path() const { return (_path);}
+
+    private:
+        void run();
+        // write staged data up to pos as one chunk, lost - bytes dropped before it
+        void flush(uint64_t pos, uint64_t lost);
+        void writeAll(int fd, const void* data, std::size_t len);
+
+        std::string _path;
+        int _fd;
+        int _index_fd;
+        uint64_t _offset;         // file length
+        CaptureHeader _header;
+        RingBuffer _ring;
+
+        // data dropped by the IO thread: ring position of the gap and the bytes skipped there
+        struct Gap {
+            uint64_t pos;
+            uint64_t lost;
+        };
+        SpscQueue<Gap> _gaps;
+        // IO thread only - gap not handed to the writer yet (_drop_len 0 - none)
+        uint64_t _drop_pos;
+        uint64_t _drop_len;
+
+        std::atomic<uint64_t> _written;
+        std::atomic<uint64_t> _chunks;
+        std::atomic<uint64_t> _total_lost;
+
+        std::atomic<bool> _run;
+        std::thread _thread;
+};
+
+/*
+ * Read only access to the capture (file mapped as a whole).
+ */
+class CaptureReader {
+    public:
+        struct Chunk {
+            const ChunkHeader* header;
+            const uint8_t* data;
+            uint64_t offset;      // of the header
+            uint64_t next;        // offset of the next chunk
+        };
+
+        CaptureReader(const std::string& path) throw(std::exception);
+        ~CaptureReader();
+
+        CaptureReader(const CaptureReader&) = delete;
+        CaptureReader& operator=(const CaptureReader&) = delete;
+
+        inline const CaptureHeader& header() const { return (*_header);}
+        // offset of the first chunk
+        inline uint64_t begin() const { return (_header->header_len);}
+        inline uint64_t end() const { return (_len);}
+
+        /*
+         * @brief chunk at the file offset
+         * @return false at the end of file or when the chunk is incomplete (capture still written or cut)
+         */
+        bool chunkAt(uint64_t offset, Chunk& chunk) const;
+
+        /*
+         * @brief offset of the last chunk starting with frame timestamp <= ntp (binary search in the index)
+         * begin() when ntp precedes the capture
+         */
+        uint64_t seek(uint64_t ntp) const;
+
+        inline const std::vector<CaptureIndexEntry>& index() const { return (_index);}
+
+    private:
+        void loadIndex(const std::string& path);
+
+        const uint8_t* _data;
+        std::size_t _len;
+        const CaptureHeader* _header;
+        std::vector<CaptureIndexEntry> _index;
+};
+
+} // namespace net
+
+#endif /* SRC_PISA_NETDEVICES_CAPTURE_FILE_HPP_ */
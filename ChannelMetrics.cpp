@@ -0,0 +1,163 @@
+/*
+ * ChannelMetrics.cpp
+ *
+ *  Health counters of the devices/data channels, optionally placed in shared memory
+ *  so the monitoring process can read them without touching the receiver.
+ */
+
+#include "ChannelMetrics.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <cstring>
+#include <cerrno>
+#include <new>
+
+namespace net {
+
+namespace { // for internal use only
+
+std::string errorText(const std::string& name, const std::string& what) {
+    return ("metrics " + name + ": " + what + ", " + std::strerror(errno));
+}
+
+} // end namespace
+
+ChannelMetrics::ChannelMetrics() :
+        bytes(0),
+        frames(0),
+        resyncs(0),
+        resync_bytes(0),
+        fragments(0),
+        recv_calls(0),
+        recv_eagain(0),
+        exceptions(0),
+        connects(0) {
+    for (auto& bit : error_bits) bit.store(0, std::memory_order_relaxed);
+    std::memset(name, 0, sizeof(name));
+}
+
+void ChannelMetrics::setName(const std::string& _name) {
+    std::memset(name, 0, sizeof(name));
+    std::strncpy(name, _name.c_str(), sizeof(name) - 1);
+}
+
+MetricsSnapshot snapshot(const ChannelMetrics& metrics) {
+    MetricsSnapshot snap;
+    snap.bytes = metrics.bytes.load(std::memory_order_relaxed);
+    snap.frames = metrics.frames.load(std::memory_order_relaxed);
+    snap.resyncs = metrics.resyncs.load(std::memory_order_relaxed);
+    snap.resync_bytes = metrics.resync_bytes.load(std::memory_order_relaxed);
+    snap.fragments = metrics.fragments.load(std::memory_order_relaxed);
+    snap.recv_calls = metrics.recv_calls.load(std::memory_order_relaxed);
+    snap.recv_eagain = metrics.recv_eagain.load(std::memory_order_relaxed);
+    snap.exceptions = metrics.exceptions.load(std::memory_order_relaxed);
+    snap.connects = metrics.connects.load(std::memory_order_relaxed);
+    for (std::size_t bit = 0; bit < METRICS_ERROR_BITS; bit++)
+        snap.error_bits[bit] = metrics.error_bits[bit].load(std::memory_order_relaxed);
+    snap.name.assign(metrics.name, strnlen(metrics.name, sizeof(metrics.name)));
+    return snap;
+}
+
+MetricsRegion::MetricsRegion(const std::string& name, std::size_t slots) throw(std::exception) :
+        _name(name),
+        _base(MAP_FAILED),
+        _len(sizeof(MetricsHeader) + slots * sizeof(ChannelMetrics)),
+        _header(nullptr),
+        _slots(nullptr) {
+
+    const std::string shm_name = METRICS_SHM_PREFIX + name;
+    const int fd = shm_open(shm_name.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0) throw std::runtime_error(errorText(name, "cannot create shared memory"));
+
+    // left by the crashed process - start from zeros
+    if ((ftruncate(fd, 0) < 0) || (ftruncate(fd, static_cast<off_t>(_len)) < 0)) {
+        const std::string error = errorText(name, "cannot resize shared memory");
+        ::close(fd);
+        shm_unlink(shm_name.c_str());
+        throw std::runtime_error(error);
+    }
+    _base = mmap(nullptr, _len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (_base == MAP_FAILED) {
+        const std::string error = errorText(name, "cannot map shared memory");
+        shm_unlink(shm_name.c_str());
+        throw std::runtime_error(error);
+    }
+
+    _header = new (_base) MetricsHeader();
+    std::memcpy(_header->magic, METRICS_MAGIC, sizeof(_header->magic));
+    _header->version = METRICS_VERSION;
+    _header->slot_size = sizeof(ChannelMetrics);
+    _header->slots = static_cast<uint32_t>(slots);
+    _header->pid = static_cast<uint64_t>(getpid());
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    _header->start_time_ns = static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+    _header->used.store(0, std::memory_order_release);
+
+    _slots = reinterpret_cast<ChannelMetrics*>(static_cast<uint8_t*>(_base) + sizeof(MetricsHeader));
+}
+
+MetricsRegion::~MetricsRegion() {
+    munmap(_base, _len);
+    shm_unlink((METRICS_SHM_PREFIX + _name).c_str());
+}
+
+ChannelMetrics* MetricsRegion::allocate(const std::string& name) throw(std::exception) {
+    const uint32_t slot = _header->used.load(std::memory_order_relaxed);
+    if (slot >= _header->slots) throw std::runtime_error("metrics " + _name + ": no free slot for " + name);
+
+    ChannelMetrics* metrics = new (&_slots[slot]) ChannelMetrics();
+    metrics->setName(name);
+    // readers see the slot only after it's initialised
+    _header->used.store(slot + 1, std::memory_order_release);
+    return metrics;
+}
+
+MetricsReader::MetricsReader(const std::string& name) throw(std::exception) :
+        _base(MAP_FAILED),
+        _len(0),
+        _header(nullptr),
+        _slots(nullptr) {
+
+    const int fd = shm_open((METRICS_SHM_PREFIX + name).c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) throw std::runtime_error(errorText(name, "cannot open shared memory (receiver not running?)"));
+
+    struct stat st;
+    if ((fstat(fd, &st) < 0) || (static_cast<std::size_t>(st.st_size) < sizeof(MetricsHeader))) {
+        ::close(fd);
+        throw std::runtime_error("metrics " + name + ": invalid shared memory");
+    }
+    _len = static_cast<std::size_t>(st.st_size);
+    _base = mmap(nullptr, _len, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (_base == MAP_FAILED) throw std::runtime_error(errorText(name, "cannot map shared memory"));
+
+    _header = static_cast<const MetricsHeader*>(_base);
+    if (std::memcmp(_header->magic, METRICS_MAGIC, sizeof(METRICS_MAGIC)) || (_header->version != METRICS_VERSION)
+            || (_header->slot_size != sizeof(ChannelMetrics))
+            || ((sizeof(MetricsHeader) + _header->slots * sizeof(ChannelMetrics)) > _len)) {
+        munmap(const_cast<void*>(_base), _len);
+        throw std::runtime_error("metrics " + name + ": incompatible shared memory layout");
+    }
+    _slots = reinterpret_cast<const ChannelMetrics*>(static_cast<const uint8_t*>(_base) + sizeof(MetricsHeader));
+}
+
+MetricsReader::~MetricsReader() {
+    munmap(const_cast<void*>(_base), _len);
+}
+
+std::size_t MetricsReader::size() const {
+    return (_header->used.load(std::memory_order_acquire));
+}
+
+MetricsSnapshot MetricsReader::snapshot(std::size_t slot) const {
+    if (slot >= size()) throw std::out_of_range("metrics slot " + std::to_string(slot));
+    return net::snapshot(_slots[slot]);
+}
+
+} // namespace net
@@ -0,0 +1,150 @@
+/*
+ * ChannelMetrics.hpp
+ *
+ *  Health counters of the devices/data channels, optionally placed in shared memory
+ *  so the monitoring process can read them without touching the receiver.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_CHANNEL_METRICS_HPP_
+#define SRC_PISA_NETDEVICES_CHANNEL_METRICS_HPP_
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+namespace net {
+
+// counters are shared between processes, they have to be plain lock free atomics
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "64 bit atomics are not lock free");
+
+constexpr std::size_t METRICS_NAME_LEN = 32u;
+constexpr std::size_t METRICS_ERROR_BITS = 8u;
+// shm_open name is METRICS_SHM_PREFIX + region name
+constexpr char METRICS_SHM_PREFIX[] = "/pisa_metrics_";
+constexpr std::size_t METRICS_SLOTS = 16u;
+
+/*
+ * Counters of one device. Every counter has a single writer (the thread reading the channel,
+ * connect() for connects), so the update is a relaxed load + store - no locked instruction
+ * on the hot path. Readers (any thread, other process) see consistent single values, not a
+ * consistent set of them.
+ */
+struct alignas(64) ChannelMetrics {
+    std::atomic<uint64_t> bytes;            // received
+    std::atomic<uint64_t> frames;           // accepted by the framer
+    std::atomic<uint64_t> resyncs;          // lost alignment events
+    std::atomic<uint64_t> resync_bytes;     // skipped while searching for the header
+    std::atomic<uint64_t> fragments;        // receive calls leaving an incomplete frame
+    std::atomic<uint64_t> recv_calls;
+    std::atomic<uint64_t> recv_eagain;      // recv calls with no data
+    std::atomic<uint64_t> exceptions;       // receive failures (socket errors, lost connection)
+    std::atomic<uint64_t> connects;         // successful connects, reconnects = connects - 1
+    std::atomic<uint64_t> error_bits[METRICS_ERROR_BITS]; // LPPS frame errors, frames with bit n set
+    char name[METRICS_NAME_LEN];
+
+    ChannelMetrics();
+
+    // single writer increment
+    static inline void add(std::atomic<uint64_t>& counter, uint64_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+    void setName(const std::string& name);
+};
+
+// plain copy of the counters
+struct MetricsSnapshot {
+    uint64_t bytes;
+    uint64_t frames;
+    uint64_t resyncs;
+    uint64_t resync_bytes;
+    uint64_t fragments;
+    uint64_t recv_calls;
+    uint64_t recv_eagain;
+    uint64_t exceptions;
+    uint64_t connects;
+    uint64_t error_bits[METRICS_ERROR_BITS];
+    std::string name;
+};
+
+MetricsSnapshot snapshot(const ChannelMetrics& metrics);
+
+/*
+ * REMEMBER, the layout is shared with the other process:
+ * | MetricsHeader (64 B) | ChannelMetrics slot 0 | slot 1 | ... |
+ */
+constexpr char METRICS_MAGIC[8] = { 'P', 'I', 'S', 'A', 'M', 'E', 'T', 0 };
+constexpr uint32_t METRICS_VERSION = 1u;
+
+struct alignas(64) MetricsHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_size;                 // sizeof(ChannelMetrics)
+    uint32_t slots;                     // capacity
+    std::atomic<uint32_t> used;         // slots in use (published after the slot is initialised)
+    uint64_t pid;
+    uint64_t start_time_ns;             // CLOCK_REALTIME
+};
+
+/*
+ * Shared memory region with the metrics slots, created by the receiver process.
+ * Devices keep pointers to the slots, so the region has to outlive them.
+ *
+ * Example usage:
+ *
+ *    net::MetricsRegion metrics("station1");          // /dev/shm/pisa_metrics_station1
+ *    fbs.exportMetrics(metrics);
+ *
+ *    // monitoring process
+ *    net::MetricsReader reader("station1");
+ *    for (std::size_t n = 0; n < reader.size(); n++) {
+ *        net::MetricsSnapshot s = reader.snapshot(n);
+ *        ...
+ *    }
+ */
+class MetricsRegion {
+    public:
+        MetricsRegion(const std::string& name, std::size_t slots = METRICS_SLOTS) throw(std::exception);
+        ~MetricsRegion();
+
+        MetricsRegion(const MetricsRegion&) = delete;
+        MetricsRegion& operator=(const MetricsRegion&) = delete;
+
+        // new zeroed slot, throws when the region is full
+        ChannelMetrics* allocate(const std::string& name) throw(std::exception);
+
+        inline const std::string& name() const { return (_name);}
+
+    private:
+        std::string _name;
+        void* _base;
+        std::size_t _len;
+        MetricsHeader* _header;
+        ChannelMetrics* _slots;
+};
+
+// read only view of the region of another process
+class MetricsReader {
+    public:
+        MetricsReader(const std::string& name) throw(std::exception);
+        ~MetricsReader();
+
+        MetricsReader(const MetricsReader&) = delete;
+        MetricsReader& operator=(const MetricsReader&) = delete;
+
+        std::size_t size() const;
+        MetricsSnapshot snapshot(std::size_t slot) const;
+        inline const MetricsHeader& header() const { return (*_header);}
+
+    private:
+        const void* _base;
+        std::size_t _len;
+        const MetricsHeader* _header;
+        const ChannelMetrics* _slots;
+};
+
+} // namespace net
+
+#endif /* SRC_PISA_NETDEVICES_CHANNEL_METRICS_HPP_ */
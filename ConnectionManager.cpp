@@ -0,0 +1,179 @@
+/*
+ * ConnectionManager.cpp
+ *
+ *  Non blocking (re)connects of many devices, with deadlines and exponential backoff.
+ */
+
+#include "ConnectionManager.hpp"
+#include "Logger.hpp"
+
+#include <poll.h>
+#include <algorithm>
+
+namespace net {
+
+ConnectionManager::ConnectionManager(const ReconnectPolicy& policy, uint32_t seed) :
+        _policy(policy),
+        _random(seed) {
+}
+
+void ConnectionManager::add(std::shared_ptr<NetDevice> device, const std::string& hostname, int port, bool blocking,
+        Connected connected) {
+    if (find(*device)) remove(*device);
+
+    Entry entry;
+    entry.device = device;
+    entry.hostname = hostname;
+    entry.port = port;
+    entry.blocking = blocking;
+    entry.connected = std::move(connected);
+    entry.deadline = Clock::now();
+    entry.since = entry.deadline;
+    entry.backoff = _policy.backoff_min;
+    entry.stats = ConnectionStats { connection_state::WAITING, 0, 0, 0, 0 };
+    _entries.push_back(std::move(entry));
+}
+
+void ConnectionManager::remove(NetDevice& device) {
+    _entries.erase(std::remove_if(_entries.begin(), _entries.end(),
+            [&device](const Entry& entry) { return (entry.device.get() == &device); }), _entries.end());
+}
+
+void ConnectionManager::lost(NetDevice& device) {
+    Entry* entry = find(device);
+    if (!entry || (entry->stats.state != connection_state::CONNECTED)) return;
+
+    const auto now = Clock::now();
+    entry->stats.lost++;
+    // flapping connection keeps growing the backoff
+    if ((now - entry->since) > _policy.stable_time) {
+        entry->backoff = _policy.backoff_min;
+    }
+    close(*entry);
+    backoff(*entry, now);
+}
+
+std::size_t ConnectionManager::poll(int timeout_ms) {
+    auto now = Clock::now();
+
+    // callbacks after the loops, they can add/remove devices
+    std::vector<std::pair<Connected, std::shared_ptr<NetDevice>>> connected;
+
+    // lost connections, new attempts
+    for (auto& entry : _entries) {
+        if ((entry.stats.state == connection_state::CONNECTED) && entry.device->isStubbed()) lost(*entry.device);
+        if ((entry.stats.state == connection_state::WAITING) && (now >= entry.deadline) && start(entry, now)) {
+            if (entry.connected) connected.emplace_back(entry.connected, entry.device);
+        }
+    }
+
+    std::vector<struct pollfd> fds;
+    for (auto& entry : _entries) {
+        if (entry.stats.state == connection_state::CONNECTING)
+            fds.push_back(pollfd { entry.device->getSocket(), POLLOUT, 0 });
+    }
+    if (timeout_ms && !fds.empty()) {
+        ::poll(fds.data(), fds.size(), nextTimeoutMs(timeout_ms));
+        now = Clock::now();
+    }
+
+    std::size_t waiting = 0;
+    for (auto& entry : _entries) {
+        if (entry.stats.state == connection_state::CONNECTING) {
+            try {
+                if (entry.device->finishConnect()) {
+                    established(entry, now);
+                    if (entry.connected) connected.emplace_back(entry.connected, entry.device);
+                }
+                else if (now >= entry.deadline) {
+                    NETLOG_WARNING("{} connect to {}:{} timed out", entry.device->getName(), entry.hostname, entry.port);
+                    close(entry);
+                    retry(entry, now);
+                }
+            }
+            catch (std::exception& e) {
+                NETLOG_WARNING("{}", e.what());
+                retry(entry, now);
+            }
+        }
+        if (entry.stats.state != connection_state::CONNECTED) waiting++;
+    }
+
+    for (auto& callback : connected) callback.first(*callback.second);
+    return waiting;
+}
+
+int ConnectionManager::nextTimeoutMs(int max_ms) {
+    const auto now = Clock::now();
+    auto next = now + std::chrono::milliseconds(max_ms);
+    for (auto& entry : _entries) {
+        if (entry.stats.state != connection_state::CONNECTED) next = std::min(next, entry.deadline);
+    }
+    // rounded up, not to spin around the deadline
+    const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - now + std::chrono::microseconds(999));
+    return static_cast<int>(std::max<int64_t>(0, wait.count()));
+}
+
+ConnectionStats ConnectionManager::stats(NetDevice& device) {
+    Entry* entry = find(device);
+    if (!entry) throw std::out_of_range(device.getName() + " is not managed");
+    return entry->stats;
+}
+
+ConnectionManager::Entry* ConnectionManager::find(NetDevice& device) {
+    for (auto& entry : _entries) {
+        if (entry.device.get() == &device) return &entry;
+    }
+    return nullptr;
+}
+
+bool ConnectionManager::start(Entry& entry, Clock::time_point now) {
+    entry.stats.attempts++;
+    entry.device->setStubbed(false);
+    try {
+        // connected at once - rare, loopback
+        if (entry.device->startConnect(entry.hostname, entry.port, 0, entry.blocking)) {
+            established(entry, now);
+            return true;
+        }
+        entry.stats.state = connection_state::CONNECTING;
+        entry.deadline = now + _policy.connect_timeout;
+    }
+    catch (std::exception& e) {
+        NETLOG_WARNING("{}", e.what());
+        retry(entry, now);
+    }
+    return false;
+}
+
+void ConnectionManager::established(Entry& entry, Clock::time_point now) {
+    entry.stats.state = connection_state::CONNECTED;
+    entry.stats.failures_in_row = 0;
+    entry.since = now;
+}
+
+void ConnectionManager::retry(Entry& entry, Clock::time_point now) {
+    entry.stats.failures++;
+    entry.stats.failures_in_row++;
+    backoff(entry, now);
+}
+
+void ConnectionManager::backoff(Entry& entry, Clock::time_point now) {
+    entry.stats.state = connection_state::WAITING;
+
+    std::uniform_real_distribution<double> jitter(1.0 - _policy.jitter, 1.0 + _policy.jitter);
+    const auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(entry.backoff * jitter(_random));
+    entry.deadline = now + delay;
+
+    const auto next = std::chrono::duration_cast<std::chrono::milliseconds>(entry.backoff * _policy.backoff_multiplier);
+    entry.backoff = std::min(next, _policy.backoff_max);
+}
+
+void ConnectionManager::close(Entry& entry) {
+    // disconnect skips the stubbed devices
+    entry.device->setStubbed(false);
+    entry.device->disconnect();
+    entry.device->setStubbed(true);
+}
+
+} // namespace net
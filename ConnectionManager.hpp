@@ -0,0 +1,129 @@
+/*
+ * ConnectionManager.hpp
+ *
+ *  Non blocking (re)connects of many devices, with deadlines and exponential backoff.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_CONNECTION_MANAGER_HPP_
+#define SRC_PISA_NETDEVICES_CONNECTION_MANAGER_HPP_
+
+#include <cstdint>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "NetDevice.hpp"
+
+namespace net {
+
+enum class connection_state {
+    CONNECTING = 0u,    // handshake in progress
+    CONNECTED,
+    WAITING,            // backoff before the next attempt
+};
+
+struct ReconnectPolicy {
+    std::chrono::milliseconds connect_timeout = std::chrono::milliseconds(2000);
+    std::chrono::milliseconds backoff_min = std::chrono::milliseconds(100);
+    std::chrono::milliseconds backoff_max = std::chrono::milliseconds(30000);
+    double backoff_multiplier = 2.0;
+    // random +- part of the delay, so the devices lost together don't reconnect together
+    double jitter = 0.2;
+    // connection lost after so long is a new problem, backoff starts from backoff_min again
+    std::chrono::milliseconds stable_time = std::chrono::milliseconds(10000);
+};
+
+struct ConnectionStats {
+    connection_state state;
+    uint64_t attempts;      // connects started
+    uint64_t failures;      // refused, timed out
+    uint64_t lost;          // established connections lost
+    uint32_t failures_in_row; // since the last connect
+};
+
+/*
+ * Keeps the registered devices connected. Connects run in parallel and never block,
+ * so one dead or flapping receiver doesn't stall the others. The device keeps its settings
+ * (blocking mode, keepalive, RX backend, ...) through the reconnects, and the readers
+ * (StreamFramer) drop the fragment of the old stream by themselves.
+ *
+ * Lost connection is noticed when the device gets stubbed (receive failures do it, so do
+ * FbsReceiver/LppsReceiver on CHANNEL_LOST), or reported by lost().
+ *
+ * Not thread safe - call it from the thread using the devices, connected callback runs from poll().
+ *
+ * Example usage:
+ *
+ *    net::ConnectionManager connections;
+ *    fbs.connect_channel(connections, "10.0.0.5", fbs_receiver::fbs_channels::CHANNEL_1, 5031,
+ *            [&](fbs_receiver::fbs_channels channel) { fbs.attach(reactor, channel, handler); });
+ *    while (run) {
+ *        reactor.poll(connections.nextTimeoutMs(100));
+ *        connections.poll();
+ *    }
+ */
+class ConnectionManager {
+    public:
+        using Connected = std::function<void(NetDevice& device)>;
+
+        ConnectionManager(const ReconnectPolicy& policy = ReconnectPolicy(), uint32_t seed = std::random_device()());
+
+        ConnectionManager(const ConnectionManager&) = delete;
+        ConnectionManager& operator=(const ConnectionManager&) = delete;
+
+        // start connecting (in the next poll), connected - after every successful connect
+        void add(std::shared_ptr<NetDevice> device, const std::string& hostname, int port, bool blocking = false,
+                Connected connected = nullptr);
+        // no more reconnects, the device stays as it is
+        void remove(NetDevice& device);
+        // connection is broken - close it and reconnect after the backoff
+        void lost(NetDevice& device);
+
+        /*
+        @brief - start the connects which are due, finish the established ones, expire the hanging ones
+        @param timeout_ms - wait so long for the pending connects (0 - don't wait)
+        @return number of devices not connected
+        */
+        std::size_t poll(int timeout_ms = 0);
+
+        // time to the next deadline (connect timeout, end of backoff), not more than max_ms
+        int nextTimeoutMs(int max_ms);
+
+        ConnectionStats stats(NetDevice& device);
+        inline std::size_t size() const { return (_entries.size());}
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct Entry {
+            std::shared_ptr<NetDevice> device;
+            std::string hostname;
+            int port;
+            bool blocking;
+            Connected connected;
+            Clock::time_point deadline;     // of the connect or of the backoff
+            Clock::time_point since;        // connected since
+            std::chrono::milliseconds backoff;
+            ConnectionStats stats;
+        };
+
+        Entry* find(NetDevice& device);
+        // true - connected at once
+        bool start(Entry& entry, Clock::time_point now);
+        void established(Entry& entry, Clock::time_point now);
+        // failed attempt, wait for the backoff
+        void retry(Entry& entry, Clock::time_point now);
+        void backoff(Entry& entry, Clock::time_point now);
+        void close(Entry& entry);
+
+        ReconnectPolicy _policy;
+        std::minstd_rand _random;
+        std::vector<Entry> _entries;
+};
+
+} // namespace net
+
+#endif /* SRC_PISA_NETDEVICES_CONNECTION_MANAGER_HPP_ */
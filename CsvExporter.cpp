@@ -0,0 +1,206 @@
+/*
+ * CsvExporter.cpp
+ *
+ *  Buffered CSV export of the decoded frames, formatting in the caller, file IO in the writer thread.
+ */
+
+#include "CsvExporter.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <algorithm>
+
+namespace utils {
+
+const std::vector<std::string> FBS_CSV_HEADER = { "ntp_time", "tc1", "tc2", "tc3" };
+const std::vector<std::string> LPPS_CSV_HEADER = { "data_ntp_time", "pps_ntp_time", "lpps_data", "errors", "delay_cycles", "delay_ns" };
+
+namespace detail {
+
+namespace { // for internal use only
+
+// two digits at once
+const char DIGITS[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+} // end namespace
+
+char* formatUnsigned(char* out, uint64_t value) {
+    // backwards into a temporary, then one copy
+    char buf[20];
+    char* p = buf + sizeof(buf);
+    while (value >= 100u) {
+        const unsigned n = static_cast<unsigned>(value % 100u) * 2u;
+        value /= 100u;
+        *--p = DIGITS[n + 1];
+        *--p = DIGITS[n];
+    }
+    if (value >= 10u) {
+        const unsigned n = static_cast<unsigned>(value) * 2u;
+        *--p = DIGITS[n + 1];
+        *--p = DIGITS[n];
+    } else {
+        *--p = static_cast<char>('0' + value);
+    }
+    const std::size_t len = static_cast<std::size_t>(buf + sizeof(buf) - p);
+    std::memcpy(out, p, len);
+    return (out + len);
+}
+
+char* formatTimestamp(char* out, uint64_t ns) {
+    out = formatUnsigned(out, ns / 1000000000u);
+    *out++ = '.';
+    // 9 digits with the leading zeros
+    uint32_t fraction = static_cast<uint32_t>(ns % 1000000000u);
+    for (int n = 8; n >= 0; n--) {
+        out[n] = static_cast<char>('0' + fraction % 10u);
+        fraction /= 10u;
+    }
+    return (out + 9);
+}
+
+CsvSink::CsvSink(const std::string& path, const CsvExporterConfig& config) throw(std::exception) :
+        _config(config),
+        _path(path),
+        _fd(-1),
+        _writing(false),
+        _run(true),
+        _error(0),
+        _bytes(0),
+        _writes(0),
+        _stalls(0) {
+    if (_config.buffers < 2u) throw std::runtime_error("CsvExporter: at least 2 buffers needed (one filled, one written)");
+
+    _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (config.append ? O_APPEND : O_TRUNC), 0644);
+    if (_fd < 0) throw std::runtime_error("CsvExporter: cannot open " + path + ", error: " + std::to_string(errno));
+
+    for (std::size_t n = 0; n < _config.buffers; n++) {
+        _buffers.emplace_back(new Buffer { std::unique_ptr<char[]>(new char[_config.buffer_length]), 0u });
+        _free.push_back(_buffers.back().get());
+    }
+    _queued.reserve(_config.buffers);
+    _thread = std::thread(&CsvSink::run, this);
+}
+
+CsvSink::~CsvSink() {
+    close();
+}
+
+char* CsvSink::acquire() throw(std::exception) {
+    std::unique_lock<std::mutex> lock(_mtx);
+    checkError();
+    if (_free.empty()) {
+        _stalls.fetch_add(1, std::memory_order_relaxed);
+        _cv.wait(lock, [this]() { return (!_free.empty() || _error);});
+        checkError();
+    }
+    Buffer* buffer = _free.back();
+    _free.pop_back();
+    return (buffer->data.get());
+}
+
+char* CsvSink::submit(char* data, std::size_t len) throw(std::exception) {
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        checkError();
+        Buffer* buffer = find(data);
+        buffer->len = len;
+        _queued.push_back(buffer);
+    }
+    _cv.notify_all();
+    return acquire();
+}
+
+void CsvSink::sync() throw(std::exception) {
+    std::unique_lock<std::mutex> lock(_mtx);
+    _cv.wait(lock, [this]() { return ((_queued.empty() && !_writing) || _error);});
+    checkError();
+}
+
+void CsvSink::close() {
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (!_run) return;
+        _run = false;
+    }
+    _cv.notify_all();
+    _thread.join();
+    ::close(_fd);
+    _fd = -1;
+}
+
+CsvExporterStats CsvSink::stats() const {
+    return CsvExporterStats { 0u, _bytes.load(std::memory_order_relaxed), _writes.load(std::memory_order_relaxed),
+            _stalls.load(std::memory_order_relaxed) };
+}
+
+void CsvSink::run() {
+    std::unique_lock<std::mutex> lock(_mtx);
+    while (true) {
+        _cv.wait(lock, [this]() { return (!_queued.empty() || !_run);});
+        // queued buffers are written also after close
+        if (_queued.empty()) break;
+
+        Buffer* buffer = _queued.front();
+        _queued.erase(_queued.begin());
+        _writing = true;
+        lock.unlock();
+
+        int error = 0;
+        for (std::size_t done = 0; done < buffer->len; ) {
+            const ssize_t n = ::write(_fd, buffer->data.get() + done, buffer->len - done);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                error = errno;
+                break;
+            }
+            done += static_cast<std::size_t>(n);
+            _bytes.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+            _writes.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        lock.lock();
+        _writing = false;
+        if (error && !_error) _error = error;
+        _free.push_back(buffer);
+        _cv.notify_all();
+    }
+}
+
+CsvSink::Buffer* CsvSink::find(char* data) {
+    auto it = std::find_if(_buffers.begin(), _buffers.end(), [data](const std::unique_ptr<Buffer>& buffer) {
+        return (buffer->data.get() == data); });
+    if (it == _buffers.end()) throw std::runtime_error("CsvExporter: unknown buffer");
+    return it->get();
+}
+
+void CsvSink::checkError() {
+    if (_error) throw std::runtime_error("CsvExporter: cannot write " + _path + ", error: " + std::to_string(_error));
+}
+
+} // namespace detail
+
+void exportFbs(FbsCsvExporter& csv, const decoder::FbsColumns& columns) throw(std::exception) {
+    const std::size_t n = columns.size();
+    for (std::size_t i = 0; i < n; i++)
+        csv.write(CsvTimestamp { columns.ntp_ns[i] }, columns.tc1[i], columns.tc2[i], columns.tc3[i]);
+}
+
+void exportLpps(LppsCsvExporter& csv, const decoder::LppsColumns& columns) throw(std::exception) {
+    const std::size_t n = columns.size();
+    for (std::size_t i = 0; i < n; i++)
+        csv.write(CsvTimestamp { columns.data_ntp_ns[i] }, CsvTimestamp { columns.pps_ntp_ns[i] }, columns.lpps_data[i],
+                columns.errors[i], columns.delay_cycles[i], columns.delay_ns[i]);
+}
+
+} // namespace utils
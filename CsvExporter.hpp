@@ -0,0 +1,367 @@
+/*
+ * CsvExporter.hpp
+ *
+ *  Buffered CSV export of the decoded frames, formatting in the caller, file IO in the writer thread.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_CSV_EXPORTER_HPP_
+#define SRC_PISA_NETDEVICES_CSV_EXPORTER_HPP_
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <stdexcept>
+
+#include "FrameDecoder.hpp"
+
+namespace utils {
+
+// 1MB output buffers, the writer thread gets one write per buffer
+constexpr std::size_t CSV_BUF_LENGTH = 1024u * 1024u;
+constexpr std::size_t CSV_BUFFERS = 8u;
+
+struct CsvExporterConfig {
+    std::size_t buffer_length = CSV_BUF_LENGTH;
+    // all of them waiting for the disk - write() blocks (no row is ever dropped)
+    std::size_t buffers = CSV_BUFFERS;
+    // same as writeCsvLine
+    std::string separator = ", ";
+    // significant digits of the floating point columns (ostream default)
+    int precision = 6;
+    bool append = false;
+};
+
+struct CsvExporterStats {
+    uint64_t rows;
+    uint64_t bytes;           // written to the file
+    uint64_t writes;          // write calls of the writer thread
+    uint64_t stalls;          // write() waited for a free buffer
+};
+
+// ns timestamp column written as seconds with 9 decimals ("3912345678.000012345")
+struct CsvTimestamp {
+    uint64_t ns;
+};
+
+namespace detail { // for internal use only
+
+char* formatUnsigned(char* out, uint64_t value);
+
+inline char* formatSigned(char* out, int64_t value) {
+    if (value < 0) {
+        *out++ = '-';
+        // -INT64_MIN doesn't fit int64_t
+        return formatUnsigned(out, 0u - static_cast<uint64_t>(value));
+    }
+    return formatUnsigned(out, static_cast<uint64_t>(value));
+}
+
+char* formatTimestamp(char* out, uint64_t ns);
+
+/*
+ * Column spec: max_width - upper bound of the formatted value (0 - depends on the value, see width()),
+ * format() writes the value and returns the end, no terminating zero.
+ */
+template <typename T, typename Enable = void>
+struct CsvColumn;
+
+template <typename T>
+struct CsvColumn<T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value && !std::is_same<T, bool>::value
+        && !std::is_same<T, char>::value && !std::is_same<T, unsigned char>::value>::type> {
+    static constexpr std::size_t max_width = std::numeric_limits<T>::digits10 + 1;
+    static inline std::size_t width(const T&) { return (max_width);}
+    static inline char* format(char* out, const T& value, int) { return formatUnsigned(out, value);}
+};
+
+template <typename T>
+struct CsvColumn<T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value
+        && !std::is_same<T, char>::value && !std::is_same<T, signed char>::value>::type> {
+    static constexpr std::size_t max_width = std::numeric_limits<T>::digits10 + 2;
+    static inline std::size_t width(const T&) { return (max_width);}
+    static inline char* format(char* out, const T& value, int) { return formatSigned(out, value);}
+};
+
+// as ostream: char types are characters, bool is 0/1
+template <typename T>
+struct CsvColumn<T, typename std::enable_if<std::is_same<T, char>::value || std::is_same<T, signed char>::value
+        || std::is_same<T, unsigned char>::value || std::is_same<T, bool>::value>::type> {
+    static constexpr std::size_t max_width = 1u;
+    static inline std::size_t width(const T&) { return (max_width);}
+    static inline char* format(char* out, const T& value, int) {
+        *out++ = std::is_same<T, bool>::value ? (value ? '1' : '0') : static_cast<char>(value);
+        return (out);
+    }
+};
+
+// %g as ostream, snprintf needs the space for the terminating zero
+template <typename T>
+struct CsvColumn<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+    static constexpr std::size_t max_width = 48u;
+    static inline std::size_t width(const T&) { return (max_width);}
+    static inline char* format(char* out, const T& value, int precision) {
+        const int len = std::snprintf(out, max_width, "%.*g", precision, static_cast<double>(value));
+        return (out + ((len > 0) ? std::min(static_cast<std::size_t>(len), max_width - 1u) : 0u));
+    }
+};
+
+template <>
+struct CsvColumn<CsvTimestamp> {
+    static constexpr std::size_t max_width = 21u;
+    static inline std::size_t width(const CsvTimestamp&) { return (max_width);}
+    static inline char* format(char* out, const CsvTimestamp& value, int) { return formatTimestamp(out, value.ns);}
+};
+
+template <>
+struct CsvColumn<std::string> {
+    static constexpr std::size_t max_width = 0u;
+    static inline std::size_t width(const std::string& value) { return (value.size());}
+    static inline char* format(char* out, const std::string& value, int) {
+        std::memcpy(out, value.data(), value.size());
+        return (out + value.size());
+    }
+};
+
+template <>
+struct CsvColumn<const char*> {
+    static constexpr std::size_t max_width = 0u;
+    static inline std::size_t width(const char* value) { return (value ? std::strlen(value) : 0u);}
+    static inline char* format(char* out, const char* value, int) {
+        const std::size_t len = width(value);
+        if (len) std::memcpy(out, value, len);
+        return (out + len);
+    }
+};
+
+// upper bound of the row (without separators), known at compile time when there are no strings
+inline std::size_t rowWidth() { return (0u);}
+template <typename T, typename... RemArgs>
+inline std::size_t rowWidth(const T& value, const RemArgs&... args) {
+    return (CsvColumn<T>::width(value) + rowWidth(args...));
+}
+
+inline char* formatRow(char* out, const std::string&, int) { return (out);}
+template <typename T, typename... RemArgs>
+inline char* formatRow(char* out, const std::string& separator, int precision, const T& value, const RemArgs&... args) {
+    out = CsvColumn<T>::format(out, value, precision);
+    if (sizeof...(RemArgs)) {
+        std::memcpy(out, separator.data(), separator.size());
+        out += separator.size();
+    }
+    return formatRow(out, separator, precision, args...);
+}
+
+/*
+ * File and the writer thread. One producer fills the buffer it got from acquire(),
+ * submit() queues it for the writer and returns the next free one (waits when there's none).
+ */
+class CsvSink {
+    public:
+        CsvSink(const std::string& path, const CsvExporterConfig& config) throw(std::exception);
+        // close()
+        ~CsvSink();
+
+        CsvSink(const CsvSink&) = delete;
+        CsvSink& operator=(const CsvSink&) = delete;
+
+        // first buffer of the producer
+        char* acquire() throw(std::exception);
+        // len bytes of the buffer are queued, return the next buffer
+        char* submit(char* buffer, std::size_t len) throw(std::exception);
+        // wait until everything submitted is in the file
+        void sync() throw(std::exception);
+        // write what's queued, stop the writer thread, close the file
+        void close();
+
+        inline std::size_t bufferLength() const { return (_config.buffer_length);}
+        CsvExporterStats stats() const;
+
+    private:
+        struct Buffer {
+            std::unique_ptr<char[]> data;
+            std::size_t len;
+        };
+
+        void run();
+        // under _mtx
+        Buffer* find(char* data);
+        void checkError();
+
+        CsvExporterConfig _config;
+        std::string _path;
+        int _fd;
+
+        std::vector<std::unique_ptr<Buffer>> _buffers;
+        std::mutex _mtx;
+        std::condition_variable _cv;
+        std::vector<Buffer*> _free;
+        std::vector<Buffer*> _queued;     // in the order of submit
+        bool _writing;
+        bool _run;
+        int _error;
+
+        std::atomic<uint64_t> _bytes;
+        std::atomic<uint64_t> _writes;
+        std::atomic<uint64_t> _stalls;
+        std::thread _thread;
+};
+
+} // end namespace detail
+
+/*
+ * CSV writer for high row rates: the columns are given by the template arguments (as the arguments of
+ * writeCsvLine), numbers are formatted without streams directly into a large output buffer and
+ * the full buffers are written by the background thread, write() only formats and copies.
+ * Output is the same as of writeCsvLine (", " separated, floating point as %g), timestamps can be
+ * exported as CsvTimestamp (seconds.nanoseconds). Columns: integers, floating point, bool, char,
+ * std::string, const char*, CsvTimestamp (literals into const char* columns, std::string column would allocate).
+ *
+ * write() from one thread only. When the disk can't keep up write() waits for a free buffer,
+ * rows are never dropped. Write errors are reported by the next write()/flush() (std::runtime_error).
+ *
+ * Example usage:
+ *
+ *    utils::CsvExporter<double, const char*, int> csv("myfile.csv");
+ *    csv.header({"time", "name", "value"});
+ *    csv.write(2.5, "dataA", 13);
+ *    csv.write(4.1, "dataB", 5);
+ *    csv.close();
+ *
+ *    // decoded frames, see exportFbs/exportLpps
+ *    utils::FbsCsvExporter fbs_csv("/data/fbs1.csv");
+ *    fbs_csv.header(utils::FBS_CSV_HEADER);
+ *    decoder::decodeFbs(batch, columns);
+ *    utils::exportFbs(fbs_csv, columns);
+ */
+template <typename... Args>
+class CsvExporter {
+    public:
+        CsvExporter(const std::string& path, const CsvExporterConfig& config = CsvExporterConfig()) throw(std::exception) :
+                _sink(path, config),
+                _separator(config.separator),
+                _precision(config.precision),
+                _rows(0) {
+            if (_sink.bufferLength() < maxRow())
+                throw std::runtime_error("CsvExporter: buffer length " + std::to_string(_sink.bufferLength()) + " is less than a row");
+            _buffer = _sink.acquire();
+            _pos = _buffer;
+            _end = _buffer + _sink.bufferLength();
+        }
+
+        // close()
+        ~CsvExporter() {
+            close();
+        }
+
+        CsvExporter(const CsvExporter&) = delete;
+        CsvExporter& operator=(const CsvExporter&) = delete;
+
+        // column names, one row of strings
+        void header(const std::vector<std::string>& names) throw(std::exception) {
+            if (names.size() != sizeof...(Args)) throw std::runtime_error("CsvExporter: " + std::to_string(sizeof...(Args))
+                    + " columns, header has " + std::to_string(names.size()));
+            std::size_t len = 1u;
+            for (auto& name : names) len += name.size() + _separator.size();
+            reserve(len);
+            for (std::size_t n = 0; n < names.size(); n++) {
+                if (n) append(_separator.data(), _separator.size());
+                append(names[n].data(), names[n].size());
+            }
+            *_pos++ = '\n';
+        }
+
+        void write(const Args&... args) throw(std::exception) {
+            // strings make the row length variable, numbers only - it's constant
+            reserve(detail::rowWidth(args...) + separators());
+            _pos = detail::formatRow(_pos, _separator, _precision, args...);
+            *_pos++ = '\n';
+            _rows++;
+        }
+
+        // hand the buffered rows to the writer (and wait until they are written when sync)
+        void flush(bool sync = false) throw(std::exception) {
+            submit();
+            if (sync) _sink.sync();
+        }
+
+        void close() {
+            if (!_buffer) return;
+            try {
+                submit();
+            }
+            catch (std::exception& e) {
+                // write error, nothing to do in the destructor
+            }
+            _buffer = nullptr;
+            _sink.close();
+        }
+
+        CsvExporterStats stats() const {
+            CsvExporterStats stats = _sink.stats();
+            stats.rows = _rows;
+            return stats;
+        }
+
+    private:
+        inline std::size_t separators() const { return ((sizeof...(Args) - 1u) * _separator.size() + 1u);}
+
+        // longest row when there are no strings, otherwise a bound without them
+        inline std::size_t maxRow() const {
+            return (sumWidth<Args...>() + separators());
+        }
+
+        template <typename... T>
+        static constexpr typename std::enable_if<sizeof...(T) == 0, std::size_t>::type sumWidth() { return (0u);}
+        template <typename T, typename... RemArgs>
+        static constexpr std::size_t sumWidth() { return (detail::CsvColumn<T>::max_width + sumWidth<RemArgs...>());}
+
+        void reserve(std::size_t len) {
+            if (static_cast<std::size_t>(_end - _pos) >= len) return;
+            submit();
+            if (static_cast<std::size_t>(_end - _pos) < len)
+                throw std::runtime_error("CsvExporter: row of " + std::to_string(len) + " bytes doesn't fit the buffer");
+        }
+
+        inline void append(const char* data, std::size_t len) {
+            std::memcpy(_pos, data, len);
+            _pos += len;
+        }
+
+        void submit() {
+            if (_pos == _buffer) return;
+            _buffer = _sink.submit(_buffer, static_cast<std::size_t>(_pos - _buffer));
+            _pos = _buffer;
+            _end = _buffer + _sink.bufferLength();
+        }
+
+        detail::CsvSink _sink;
+        const std::string _separator;
+        const int _precision;
+        char* _buffer;
+        char* _pos;
+        char* _end;
+        uint64_t _rows;
+};
+
+// decoded frames, timestamps as seconds from the NTP epoch
+using FbsCsvExporter = CsvExporter<CsvTimestamp, uint32_t, uint32_t, uint32_t>;
+using LppsCsvExporter = CsvExporter<CsvTimestamp, CsvTimestamp, uint32_t, uint32_t, uint32_t, uint64_t>;
+
+extern const std::vector<std::string> FBS_CSV_HEADER;
+extern const std::vector<std::string> LPPS_CSV_HEADER;
+
+// one row per frame
+void exportFbs(FbsCsvExporter& csv, const decoder::FbsColumns& columns) throw(std::exception);
+void exportLpps(LppsCsvExporter& csv, const decoder::LppsColumns& columns) throw(std::exception);
+
+} // namespace utils
+
+#endif /* SRC_PISA_NETDEVICES_CSV_EXPORTER_HPP_ */
@@ -6,34 +6,37 @@
  */
 
 #include "FBS.hpp"
+#include "Logger.hpp"
 #include <memory>
 #include <sstream>
 #include <algorithm>
 #include <vector>
+#include <cstring>
 
 namespace fbs_receiver {
 
 FbsReceiver::FbsReceiver(std::string _name) :
         name(_name) {
-    //Initialize
-    rem_data_len = 0;
-    rem_data_start = 0;
-
     _main_socket = std::make_shared<net::NetDevice>(_name + "_main");
+    _scpi.reset(new net::ScpiChannel(_main_socket));
     _data_socket[fbs_channels::CHANNEL_1] = std::make_shared<net::NetDevice>(_name + "_data1");
     _data_socket[fbs_channels::CHANNEL_2] = std::make_shared<net::NetDevice>(_name + "_data2");
 
+    for (auto channel : { fbs_channels::CHANNEL_1, fbs_channels::CHANNEL_2 })
+        _framer[channel].reset(new net::ProtocolFramer<FbsProtocol>(_data_socket[channel]));
+
 }
 
 std::string FbsReceiver::sendIdnQuery() throw(std::exception) {
-    std::string query = "*IDN?" + net::NEWLINE;
-    const uint32_t bytesReceived = _main_socket->sendQuery(reinterpret_cast<const uint8_t*>(query.data()), query.size(), true);
+    // through the command channel - main socket can be non blocking, the answer is waited for by poll
+    std::future<std::string> idn = _scpi->query("*IDN?");
+    while (_scpi->poll(IDN_POLL_MS)) {}
+    const std::string answer = idn.get();
 
-    if ((bytesReceived < IDN_ACK_SIZE) || (!(bytesReceived))) {
+    if (answer.size() < IDN_ACK_SIZE) {
         throw std::runtime_error((name + ", sendQuery failed : invalid Acknowledge packet"));
     }
-    const std::vector<uint8_t>& vec = _main_socket->getBuffer();
-    return std::string(vec.begin(), vec.end());
+    return answer;
 }
 
 void FbsReceiver::sendAcq(bool activate, fbs_channels channel) {
@@ -50,7 +53,7 @@ uint8_t FbsReceiver::queryAcqAsync() {
              return NET_ERROR;
 
     std::string query = ":ACQ?" + net::NEWLINE;
-    std::cout << this->name << " Query FBS ACQ status:" << std::endl;
+    NETLOG_DEBUG("{} query FBS ACQ status", name);
     size_t bytes_send = 0;
     try {
          _main_socket->sendQueryNoResponse(reinterpret_cast<const uint8_t*>(query.data()), query.size());
@@ -60,14 +63,30 @@ uint8_t FbsReceiver::queryAcqAsync() {
     if (bytes_send == 0) return NET_ERROR;
      return 0;
 }
+std::future<std::pair<bool, bool>> FbsReceiver::queryAcq(std::chrono::milliseconds timeout) {
+    auto promise = std::make_shared<std::promise<std::pair<bool, bool>>>();
+    std::future<std::pair<bool, bool>> acq = promise->get_future();
+    const std::string receiver = name;
+
+    _scpi->query(":ACQ?", [promise, receiver](net::scpi_status status, const std::string& answer) {
+        //0,0
+        if ((status == net::scpi_status::OK) && (answer.size() >= 3) && (answer[1] == ','))
+            promise->set_value(std::make_pair((answer[0] == '1'), (answer[2] == '1')));
+        else promise->set_exception(std::make_exception_ptr(std::runtime_error((receiver + ", ACQ query failed : "
+                + ((status == net::scpi_status::OK) ? "invalid answer <" + answer + ">" : std::string("no answer"))))));
+    }, timeout);
+    return acq;
+}
+
 uint8_t FbsReceiver::readAcqAsync(std::pair<bool, bool>& acq) {
     size_t bytes_read =  _main_socket->receiveNB(0);
     auto data = _main_socket->getNBBuffer();
 
-    std::cout << "FBS " << name << " answer: <" << std::string(data->begin(), data->end()) << "> size:" << data->size() << std::endl;
+    // only the answer, not the whole buffer
+    NETLOG_DEBUG("FBS {} answer: <{}> size: {}", name, std::string(data->begin(), data->begin() + std::min(bytes_read, data->size())), bytes_read);
 
     if ((bytes_read != 4)) { //0,0\n
-        std::cout << name << " Acq query answer fail" << std::endl;
+        NETLOG_WARNING("{} ACQ query answer fail", name);
         acq = std::make_pair(false, false);
         return NET_ERROR;
     }
@@ -83,18 +102,169 @@ void FbsReceiver::connect(const std::string& hostname, int main_port) throw(std:
 }
 
 void FbsReceiver::connect_channel(const std::string& hostname, fbs_channels channel, int data_port) throw(std::exception) {
+    stopBusyPoll(channel);
     _data_socket[channel]->setStubbed(false);
     _data_socket[channel]->connect(hostname, data_port, false);//false = non blocking
 }
 
+void FbsReceiver::connect_channel(net::ConnectionManager& manager, const std::string& hostname, fbs_channels channel, int data_port,
+        std::function<void(fbs_channels channel)> connected) {
+    stopBusyPoll(channel);
+    // stubbed until the manager connects it
+    _data_socket[channel]->disconnect();
+    _data_socket[channel]->setStubbed(true);
+    manager.add(_data_socket[channel], hostname, data_port, false, [this, channel, connected](net::NetDevice&) {
+        // busy poll thread ended with the old connection
+        stopBusyPoll(channel);
+        if (connected) connected(channel);
+    });
+}
+
 void FbsReceiver::purgeSocket(fbs_channels channel) {
     if (_data_socket[channel]->isStubbed()) return;
-    _data_socket[channel]->receiveNB(0);
-    _data_socket[channel]->clearNBBuffer();
-    rem_data_start = 0;
-    rem_data_len = 0;
+    _framer[channel]->fill();
+    _framer[channel]->reset();
+}
+
+
+void FbsReceiver::attach(net::NetReactor& reactor, fbs_channels channel, FramesHandler handler) throw(std::exception) {
+    auto socket = _data_socket[channel];
+    if (socket->isStubbed())
+        throw std::runtime_error((name + ", attach failed : data channel is not connected"));
+
+    reactor.add(socket->getPollFd(), [this, &reactor, channel, socket, handler](uint32_t events) {
+        auto& frames = _rx_frames[channel];
+        uint8_t errors = 0;
+        try {
+            // edge triggered, read until the socket is empty
+            do {
+                errors = 0;
+                receiveFbsFrames(frames, channel, errors);
+                if (!frames.empty()) handler(channel, frames, errors);
+            } while (!socket->isDrained() && !socket->isStubbed());
+        }
+        catch (std::exception& e) {
+            events |= EPOLLERR;
+        }
+
+        if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            reactor.remove(socket->getPollFd());
+            // stubbed = lost, for the ConnectionManager
+            socket->setStubbed(true);
+            frames.clear();
+            handler(channel, frames, CHANNEL_LOST);
+        }
+    });
+}
+
+void FbsReceiver::detach(net::NetReactor& reactor, fbs_channels channel) {
+    reactor.remove(_data_socket[channel]->getPollFd());
+}
+
+net::rx_backend FbsReceiver::setRxBackend(fbs_channels channel, net::rx_backend backend) {
+    return _data_socket[channel]->setRxBackend(backend);
+}
+
+bool FbsReceiver::setRxTimestamping(fbs_channels channel, net::rx_timestamping mode) {
+    return _data_socket[channel]->setRxTimestamping(mode);
+}
+
+bool FbsReceiver::setRxDrain(fbs_channels channel, const net::DrainConfig& drain) {
+    // frames of one receive call stay in the ring, it has to take the whole budget
+    if (drain.max_bytes > _framer[channel]->ring().capacity()) {
+        _framer[channel].reset(new net::ProtocolFramer<FbsProtocol>(_data_socket[channel], drain.max_bytes));
+        _framer[channel]->setCapture(_capture[channel].get());
+    }
+    _framer[channel]->setDrain(drain);
+    return _data_socket[channel]->setRxBuffer(drain.rcvbuf, static_cast<int>(drain.rcvlowat_frames * REC_FRAME_LEN));
+}
+
+void FbsReceiver::startBusyPoll(fbs_channels channel, const net::BusyPollConfig& config, FramesHandler handler) throw(std::exception) {
+    auto socket = _data_socket[channel];
+    if (socket->isStubbed())
+        throw std::runtime_error((name + ", busy poll failed : data channel is not connected"));
+
+    stopBusyPoll(channel);
+    _busy_poll[channel].reset(new net::BusyPollReceiver(*socket, config,
+            [this, channel, socket, handler](net::BusyPollReceiver& busy) -> std::size_t {
+                auto& frames = _rx_frames[channel];
+                std::size_t nframes = 0;
+                uint8_t errors;
+                do {
+                    errors = 0;
+                    receiveFbsFrames(frames, channel, errors);
+                    if (!frames.empty()) {
+                        busy.latency().recordSince(socket->getRxTimestamp());
+                        handler(channel, frames, errors);
+                        nframes += frames.size();
+                    }
+                    // stopped (or restarted) from the handler, the channel can have a new thread already
+                } while (!socket->isDrained() && !socket->isStubbed() && !busy.isStopping());
+                return nframes;
+            },
+            [this, channel, socket, handler]() {
+                auto& frames = _rx_frames[channel];
+                socket->setStubbed(true);
+                frames.clear();
+                handler(channel, frames, CHANNEL_LOST);
+            }));
+    try {
+        _busy_poll[channel]->start();
+    }
+    catch (std::exception& e) {
+        stopBusyPoll(channel);
+        throw;
+    }
+}
+
+void FbsReceiver::stopBusyPoll(fbs_channels channel) {
+    // stopped from its handler before, that thread has ended since (unless it's still this one)
+    if (_busy_poll_ended[channel] && !_busy_poll_ended[channel]->isCurrentThread()) _busy_poll_ended[channel].reset();
+    if (!_busy_poll[channel]) return;
+    _busy_poll[channel]->stop();
+    if (_busy_poll[channel]->isCurrentThread()) {
+        // from the handler - not joined, the receiver has to live until its thread returns
+        _busy_poll_ended[channel] = std::move(_busy_poll[channel]);
+        return;
+    }
+    // joined, the thread used the socket and the framer until the end
+    _busy_poll[channel].reset();
+}
+
+void FbsReceiver::startCapture(fbs_channels channel, const std::string& path) throw(std::exception) {
+    stopCapture(channel);
+    _capture[channel].reset(new net::CaptureWriter(path, FBS_FORMAT, FBS_HEADER_LEN + FBS_NTP_OFFSET,
+            name + "_data" + std::to_string(static_cast<std::size_t>(channel) + 1)));
+    _framer[channel]->setCapture(_capture[channel].get());
+}
+
+void FbsReceiver::stopCapture(fbs_channels channel) {
+    _framer[channel]->setCapture(nullptr);
+    _capture[channel].reset();
+}
+
+void FbsReceiver::exportMetrics(net::MetricsRegion& region) throw(std::exception) {
+    _main_socket->setMetrics(region.allocate(_main_socket->getName()));
+    for (auto channel : { fbs_channels::CHANNEL_1, fbs_channels::CHANNEL_2 })
+        _data_socket[channel]->setMetrics(region.allocate(_data_socket[channel]->getName()));
 }
 
+std::shared_ptr<net::ReplayDevice> FbsReceiver::replay(fbs_channels channel, const std::string& path, net::replay_pace pace) throw(std::exception) {
+    auto device = std::make_shared<net::ReplayDevice>(name + "_replay" + std::to_string(static_cast<std::size_t>(channel) + 1), path, pace);
+    const net::CaptureHeader& header = device->reader().header();
+    if ((header.frame_len != FBS_FORMAT.frame_len) || (header.frame_magic_len != FBS_FORMAT.magic_len)
+            || std::memcmp(header.frame_magic, FBS_FORMAT.magic, FBS_FORMAT.magic_len))
+        throw std::runtime_error((name + ", replay failed : " + path + " is not FBS capture"));
+
+    stopBusyPoll(channel);
+    stopCapture(channel);
+    _data_socket[channel] = device;
+    // drain budget of the channel stays, with the ring for it
+    const net::DrainConfig drain = _framer[channel]->drain();
+    _framer[channel].reset(new net::ProtocolFramer<FbsProtocol>(device, std::max(net::RING_BUF_LENGTH, drain.max_bytes)));
+    _framer[channel]->setDrain(drain);
+    return device;
+}
 
 std::size_t FbsReceiver::receiveFbsFrames(std::vector<const uint8_t*>& frames, fbs_channels channel, uint8_t& errors) {
 
@@ -102,65 +272,19 @@ std::size_t FbsReceiver::receiveFbsFrames(std::vector<const uint8_t*>& frames, f
     if (_data_socket[channel]->isStubbed()) return 0;
 
     /*
-     write_start  - place where recv will start writing new data
-     write_end - place where recv stop writing new data
-     write_start - write_end = amount of received data
-     */
-
-    /*
-     When in past recv we received N bytes and only X<N bytes are frames, remaining data starts from X, and has len = N-X
-     first: copy reamining data from X to N  begining of the buffer.
-     This will no impact on the frames received before because they are copied in the previous cycle. Hope :>
+     Every channel has its own framer (receive ring + fragment of the last frame),
+     so the channels can be read in any order, or each from its own thread.
+     Frames returned in the previous call are released here, so pointers are valid until the next call.
      */
-    // we have to know how many data we received last cycle
-    // and where the remaining data starts
-    auto data = _data_socket[channel]->getNBBuffer();
-
-    std::copy_n((*data).begin() + rem_data_start, rem_data_len, (*data).begin());
-    size_t write_start = rem_data_len;
-
-    size_t write_end =  _data_socket[channel]->receiveNB(write_start);
-    size_t nframes = 0;
+    return _framer[channel]->receive(frames, errors);
+}
 
+std::size_t FbsReceiver::receiveFbsFrames(net::FrameBatch& batch, fbs_channels channel) {
 
-    if (write_end - write_start == 0) {
-        write_start = 0;
-        return 0;
-    }
+    batch.frames.clear();
+    if (_data_socket[channel]->isStubbed()) return 0;
 
-    // Analyze received buffer from start to write_end;
-    for (size_t i = 0; i < write_end;) {
-        // if below, there's no enough space to keep valid frame.
-        if ((write_end - i) < REC_FRAME_LEN) {
-            rem_data_len = write_end - i;
-            rem_data_start = i;
-            //std::cout << "remaining data start: " << rem_data_start << std::endl;
-            //std::cout << "remaining data len: " << rem_data_len << std::endl;
-
-            errors = 1;
-            return nframes;
-        }
-        /*
-         std::cout << std::dec << "index:" << i << " [";
-         for (size_t n = 0; n < REC_FRAME_LEN; n++) {
-         std::cout << std::setfill('0') << std::setw(2) << std::hex << (0xff & (unsigned int)(*data)[i + n]) << " ";
-         }
-         std::cout << std::dec << "]" << std::endl;
-         */
-
-        // shift from start find header
-        if (((*data)[i] == 0x01) && ((*data)[i + 1] == 'F') && ((*data)[i + 2] == 'B') && ((*data)[i + 3] == 'U')) {
-            nframes++;
-            frames.push_back(&(*data)[i + 4]);
-            i += REC_FRAME_LEN;
-        }
-        // if no header, move one byte
-        else i++;
-    }// for
-    //std::cout << "No remaining data" << std::endl;
-    return nframes;
-    errors = 0;
+    return _framer[channel]->receive(batch);
 }
 
 }// & fbs_receiver
-
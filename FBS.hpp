@@ -13,15 +13,29 @@
 #include <array>
 
 #include "NetDevice.hpp"
+#include "NetReactor.hpp"
+#include "StreamFramer.hpp"
+#include "FrameProtocol.hpp"
+#include "ReplayDevice.hpp"
+#include "BusyPoll.hpp"
+#include "ScpiChannel.hpp"
+#include "ConnectionManager.hpp"
 #include "pisa/utils/utils.hpp"
 #include <memory>
+#include <functional>
 
 namespace fbs_receiver {
 
 constexpr size_t IDN_ACK_SIZE = 29; //Astri Polska,123456,789,10.11
+constexpr int IDN_POLL_MS = 10; // sendIdnQuery waits for the answer in such steps
 constexpr ssize_t REC_FRAME_LEN = 40u; //320 bits, 4bytes + FBS_FRAME_LEN
 constexpr ssize_t FBS_FRAME_LEN = 36u; // Bytes, 224 bits frame + 64 bits NTP
+constexpr uint8_t FBS_MAGIC[] = { 0x01, 'F', 'B', 'U' };
+constexpr ssize_t FBS_HEADER_LEN = sizeof(FBS_MAGIC);
+constexpr net::FrameFormat FBS_FORMAT = { FBS_MAGIC, sizeof(FBS_MAGIC), REC_FRAME_LEN, FBS_HEADER_LEN };
 constexpr uint8_t NET_ERROR = 0x01;
+//errors passed to the reactor handler when the data channel is closed or broken
+constexpr uint8_t CHANNEL_LOST = 0x02;
 
 //constexpr int FBS_MAIN_PORT = 5025;
 //constexpr int FBS_CHANNEL1_PORT = 5031;
@@ -34,11 +48,33 @@ constexpr uint8_t NET_ERROR = 0x01;
 * 0x01 | 'F' 'B' 'U' | x x x x | x x x x | x x x x | x x x x | x x x x | x x x x | x x x x | x x x x x x x x
 */
 
+// field offsets in the payload (frame without the header, as returned by receiveFbsFrames)
+constexpr size_t FBS_TC1_OFFSET = 0u;
+constexpr size_t FBS_TC2_OFFSET = 12u;
+constexpr size_t FBS_TC3_OFFSET = 24u;
+constexpr size_t FBS_NTP_OFFSET = 28u;
+
+// frame layout for the framer and the decoder (FBS_FORMAT at compile time)
+struct FbsProtocol : net::FrameProtocol<REC_FRAME_LEN, FBS_HEADER_LEN, FBS_MAGIC[0], FBS_MAGIC[1], FBS_MAGIC[2], FBS_MAGIC[3]> {
+    using tc1 = net::FrameField<uint32_t, FBS_TC1_OFFSET>;
+    using tc2 = net::FrameField<uint32_t, FBS_TC2_OFFSET>;
+    using tc3 = net::FrameField<uint32_t, FBS_TC3_OFFSET>;
+    using ntp = net::FrameField<uint64_t, FBS_NTP_OFFSET>;
+};
+static_assert(FbsProtocol::magic_len == sizeof(FBS_MAGIC), "FbsProtocol: magic of FBS_MAGIC");
+
 enum class fbs_channels : std::size_t {
         CHANNEL_1 = 0u,
         CHANNEL_2,
 };
 
+/*
+ * @brief called from the reactor thread with frames parsed from one recv
+ * @param frames - pointers to the frames (payload, header skipped), valid only inside of the handler
+ * @param errors - as in receiveFbsFrames, CHANNEL_LOST when the channel was removed from the reactor
+ */
+using FramesHandler = std::function<void(fbs_channels channel, const std::vector<const uint8_t*>& frames, uint8_t errors)>;
+
 class FbsReceiver  {
     public:
         FbsReceiver(std::string name = "");
@@ -51,6 +87,13 @@ class FbsReceiver  {
          */
        void connect(const std::string& hostname, int main_port) throw(std::exception);
        void connect_channel(const std::string& hostname, fbs_channels channel, int data_port ) throw(std::exception);
+       /*
+        * data channel kept connected by the manager - connected in the background by manager.poll(),
+        * reconnected with backoff when lost (CHANNEL_LOST). connected is called after every connect,
+        * attach (or startBusyPoll) the channel there. Socket settings (setRxBackend, ...) survive the reconnects.
+        */
+       void connect_channel(net::ConnectionManager& manager, const std::string& hostname, fbs_channels channel, int data_port,
+               std::function<void(fbs_channels channel)> connected = nullptr);
        std::string sendIdnQuery() throw (std::exception);
        void sendAcq(bool activate, fbs_channels channel);
        /*
@@ -59,6 +102,17 @@ class FbsReceiver  {
        uint8_t queryAcqAsync();
        uint8_t readAcqAsync(std::pair<bool, bool>& acq);
 
+       /*
+        * ACQ status through the command channel, completed by commands().poll() (or ScpiChannel::pollAll
+        * for many receivers), throws from get() on timeout or lost connection. Don't mix with queryAcqAsync/readAcqAsync
+        */
+       std::future<std::pair<bool, bool>> queryAcq(std::chrono::milliseconds timeout = net::SCPI_TIMEOUT);
+       // pipelined commands on the main socket, see net::ScpiChannel
+       inline net::ScpiChannel& commands() { return (*_scpi);}
+       // sockets of the receiver, for the bring-up without the blocking connect (see fleet::FleetBringUp)
+       inline std::shared_ptr<net::NetDevice> getMainSocket() { return (_main_socket);}
+       inline std::shared_ptr<net::NetDevice> getDataSocket(fbs_channels channel) { return (_data_socket[channel]);}
+
 
        /*
        @brief - splitting buffer from recv into frames
@@ -67,15 +121,95 @@ class FbsReceiver  {
        @param errors -  0 - no errors, 1 - fragmented data waining for future analyse
        */
         std::size_t receiveFbsFrames(std::vector<const uint8_t*>& frames, fbs_channels channel, uint8_t& errors);
+
+        /*
+        @brief - frames for the other thread, see net::FrameBatchPool
+        frames are valid until the batch is released to its pool, batch.errors as errors above
+        */
+        std::size_t receiveFbsFrames(net::FrameBatch& batch, fbs_channels channel);
         void purgeSocket(fbs_channels channel);
 
+        // reassembly state and statistics of the channel
+        inline net::StreamFramer& getFramer(fbs_channels channel) { return (*_framer[channel]);}
+
+        /*
+        @brief - register connected data channel in the event loop, instead of polling receiveFbsFrames
+        handler is called every time new frames arrive. On hang up or socket error channel is removed
+        from the reactor and handler is called with no frames and errors = CHANNEL_LOST
+        */
+        void attach(net::NetReactor& reactor, fbs_channels channel, FramesHandler handler) throw(std::exception);
+        void detach(net::NetReactor& reactor, fbs_channels channel);
+
+        /*
+         * select how the data channel is read (recv, io_uring or zero copy), return the backend in use
+         * select before attach, the reactor waits on a different descriptor with io_uring
+         */
+        net::rx_backend setRxBackend(fbs_channels channel, net::rx_backend backend);
+
+        /*
+         * kernel RX timestamps of the data channel (FrameBatch::rx_time_ns), return false when not supported
+         * the channel is read by recv then (no io_uring), so select before attach as well
+         */
+        bool setRxTimestamping(fbs_channels channel, net::rx_timestamping mode);
+
+        /*
+         * drain mode of the data channel (see net::DrainConfig): receive keeps reading until the socket is drained
+         * or the budget is used, SO_RCVBUF/SO_RCVLOWAT (in frames) of the socket, also after reconnect.
+         * set before the channel is read, the framer is replaced when its ring is smaller than max_bytes.
+         * return false when the socket options were refused
+         */
+        bool setRxDrain(fbs_channels channel, const net::DrainConfig& drain);
+
+        /*
+        @brief - read the connected data channel by its own (pinned, spinning) thread instead of the reactor,
+        see net::BusyPollReceiver. handler is called from that thread, as from the reactor (CHANNEL_LOST too).
+        Don't use receiveFbsFrames/attach on the channel while it runs, connect_channel and replay stop it.
+        The handler (CHANNEL_LOST too) can stop or restart it (stopBusyPoll, connect_channel, startBusyPoll): the thread
+        can't join itself, it ends after the handler returns and is joined by the next stopBusyPoll/startBusyPoll
+        of the channel or by the destructor. Don't destroy the receiver from the handler.
+        */
+        void startBusyPoll(fbs_channels channel, const net::BusyPollConfig& config, FramesHandler handler) throw(std::exception);
+        void stopBusyPoll(fbs_channels channel);
+        // nullptr when not started or its thread has ended (stopped, connection lost),
+        // latency() - kernel arrival -> handler, one sample per handler call (see net::BusyPollReceiver)
+        inline net::BusyPollReceiver* getBusyPoll(fbs_channels channel) {
+            return ((_busy_poll[channel] && _busy_poll[channel]->isRunning()) ? _busy_poll[channel].get() : nullptr);
+        }
+
+        /*
+         * record raw data of the channel to the file (+ index file), see net::CaptureWriter
+         * call from the thread reading the channel (or before it starts), previous capture is closed
+         */
+        void startCapture(fbs_channels channel, const std::string& path) throw(std::exception);
+        void stopCapture(fbs_channels channel);
+
+        /*
+         * counters of the main and data sockets into the shared memory (name_main, name_data1, name_data2),
+         * see net::MetricsRegion - region has to outlive the receiver, export before connect
+         */
+        void exportMetrics(net::MetricsRegion& region) throw(std::exception);
+
+        /*
+         * replace the data channel with the capture file, frames are read as from the socket
+         * (connect_channel is not needed), return the device to check the end of the capture
+         */
+        std::shared_ptr<net::ReplayDevice> replay(fbs_channels channel, const std::string& path, net::replay_pace pace = net::replay_pace::FAST) throw(std::exception);
+
     private:
         std::shared_ptr<net::NetDevice> _main_socket;
+        std::unique_ptr<net::ScpiChannel> _scpi;
         utils::enum_array<fbs_channels, std::shared_ptr<net::NetDevice>,2> _data_socket;
+        //frames buffer for the reactor handlers, to not allocate on every event
+        utils::enum_array<fbs_channels, std::vector<const uint8_t*>,2> _rx_frames;
+        //reassembly state per channel, the fragment of the last frame stays there until next recv
+        utils::enum_array<fbs_channels, std::unique_ptr<net::ProtocolFramer<FbsProtocol>>,2> _framer;
+        //raw data recording, nullptr when not active
+        utils::enum_array<fbs_channels, std::unique_ptr<net::CaptureWriter>,2> _capture;
+        //busy poll thread, nullptr when the channel is read by the caller/reactor (destroyed first, uses the members above)
+        utils::enum_array<fbs_channels, std::unique_ptr<net::BusyPollReceiver>,2> _busy_poll;
+        // stopped from its own thread, joined later
+        utils::enum_array<fbs_channels, std::unique_ptr<net::BusyPollReceiver>,2> _busy_poll_ended;
         std::string name;
-        //remaining data from previous packet - len, position in packet
-        size_t rem_data_len;
-        size_t rem_data_start;
 
 
 };//class
@@ -0,0 +1,336 @@
+/*
+ * Fleet.cpp
+ *
+ *  Concurrent bring-up of many FBS/LPPS receivers: connect, identify and arm.
+ */
+
+#include "Fleet.hpp"
+
+#include <poll.h>
+#include <algorithm>
+
+namespace fleet {
+
+namespace { // for internal use only
+
+constexpr std::size_t CHANNELS = 2u;
+// connect() of the receivers: FBS main has 5 s receive timeout, LPPS none
+constexpr int FBS_MAIN_TIMEOUT = 5;
+
+template<typename Duration>
+std::chrono::microseconds us(Duration duration) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(duration);
+}
+
+void closeSocket(net::NetDevice& socket) {
+    // disconnect skips the stubbed devices
+    socket.setStubbed(false);
+    socket.disconnect();
+    socket.setStubbed(true);
+}
+
+} // end namespace
+
+const char* stageName(bringup_stage stage) {
+    switch (stage) {
+        case bringup_stage::WAITING: return "waiting";
+        case bringup_stage::CONNECTING: return "connect";
+        case bringup_stage::IDENTIFYING: return "identify";
+        case bringup_stage::ARMING: return "arm";
+        case bringup_stage::READY: return "ready";
+        default: return "failed";
+    }
+}
+
+struct FleetBringUp::Device {
+    BringUpResult result;
+    std::shared_ptr<net::NetDevice> main;
+    std::array<std::shared_ptr<net::NetDevice>, CHANNELS> data;
+    net::ScpiChannel* scpi;
+    bool main_blocking;
+    int main_timeout;
+    std::size_t idn_size;
+
+    // sockets still connecting
+    std::vector<std::shared_ptr<net::NetDevice>> pending;
+    Clock::time_point started;
+    Clock::time_point deadline;         // of the stage
+    Clock::time_point query_deadline;
+    Clock::time_point next_acq;
+    bool finished;
+
+    // one query at a time, set by the callback from scpi->poll()
+    bool waiting;
+    bool answered;
+    net::scpi_status status;
+    std::string answer;
+};
+
+FleetBringUp::FleetBringUp(const std::vector<DeviceSpec>& devices, const BringUpConfig& config) :
+        _config(config),
+        _started(Clock::now()),
+        _next(0),
+        _in_flight(0),
+        _unfinished(devices.size()) {
+    _config.max_in_flight = std::max<std::size_t>(_config.max_in_flight, 1u);
+    _devices.reserve(devices.size());
+
+    for (auto& spec : devices) {
+        auto device = std::make_shared<Device>();
+        device->result.spec = spec;
+        device->result.stage = bringup_stage::WAITING;
+        device->result.failed_stage = bringup_stage::WAITING;
+
+        if (spec.type == receiver_type::FBS) {
+            auto receiver = std::make_shared<fbs_receiver::FbsReceiver>(spec.name);
+            device->main = receiver->getMainSocket();
+            device->data[0] = receiver->getDataSocket(fbs_receiver::fbs_channels::CHANNEL_1);
+            device->data[1] = receiver->getDataSocket(fbs_receiver::fbs_channels::CHANNEL_2);
+            device->scpi = &receiver->commands();
+            device->main_blocking = false;
+            device->main_timeout = FBS_MAIN_TIMEOUT;
+            device->idn_size = fbs_receiver::IDN_ACK_SIZE;
+            device->result.fbs = receiver;
+        }
+        else {
+            auto receiver = std::make_shared<lpps_receiver::LppsReceiver>(spec.name);
+            device->main = receiver->getMainSocket();
+            device->data[0] = receiver->getDataSocket(lpps_receiver::lpps_channels::CHANNEL_1);
+            device->data[1] = receiver->getDataSocket(lpps_receiver::lpps_channels::CHANNEL_2);
+            device->scpi = &receiver->commands();
+            device->main_blocking = true;
+            device->main_timeout = 0;
+            device->idn_size = lpps_receiver::IDN_ACK_SIZE;
+            device->result.lpps = receiver;
+        }
+        device->finished = false;
+        device->waiting = false;
+        device->answered = false;
+        _devices.push_back(device);
+    }
+}
+
+std::vector<BringUpResult> FleetBringUp::run(Finished finished) {
+    while (poll(100, finished)) {}
+
+    std::vector<BringUpResult> results;
+    results.reserve(_devices.size());
+    for (auto& device : _devices) results.push_back(device->result);
+    return results;
+}
+
+std::size_t FleetBringUp::poll(int timeout_ms, Finished finished) {
+    auto now = Clock::now();
+    if (!_next) _started = now;
+    startWaiting(now, finished);
+
+    // sockets of all devices in one poll
+    std::vector<struct pollfd> fds;
+    for (auto& device : _devices) {
+        if (device->result.stage == bringup_stage::CONNECTING) {
+            for (auto& socket : device->pending) fds.push_back(pollfd { socket->getSocket(), POLLOUT, 0 });
+        }
+        else if (device->waiting && !device->finished) {
+            fds.push_back(pollfd { device->main->getPollFd(), POLLIN | POLLRDHUP, 0 });
+        }
+    }
+    if (timeout_ms && _in_flight) {
+        ::poll(fds.data(), fds.size(), waitMs(timeout_ms, now));
+        now = Clock::now();
+    }
+
+    for (auto& device : _devices) {
+        switch (device->result.stage) {
+            case bringup_stage::CONNECTING:
+                connecting(device, now);
+                break;
+            case bringup_stage::IDENTIFYING:
+            case bringup_stage::ARMING:
+                device->scpi->poll(0);
+                if (device->answered) answered(device, now);
+                if (device->result.stage != bringup_stage::ARMING) break;
+
+                if (now >= device->deadline) fail(*device, "channels not active in time");
+                else if (!device->waiting && (now >= device->next_acq)) query(device, ":ACQ?", now);
+                break;
+            default:
+                break;
+        }
+        if (!device->finished && ((device->result.stage == bringup_stage::READY) || (device->result.stage == bringup_stage::FAILED)))
+            finish(*device, now, finished);
+    }
+
+    // slots freed above, don't wait for the next poll
+    startWaiting(now, finished);
+    return _unfinished;
+}
+
+void FleetBringUp::startWaiting(Clock::time_point now, const Finished& finished) {
+    while ((_next < _devices.size()) && (_in_flight < _config.max_in_flight)) {
+        Device& device = *_devices[_next++];
+        start(device, now);
+        if (device.result.stage == bringup_stage::FAILED) finish(device, now, finished);
+    }
+}
+
+void FleetBringUp::start(Device& device, Clock::time_point now) {
+    const DeviceSpec& spec = device.result.spec;
+    _in_flight++;
+    device.started = now;
+    device.result.queued = us(now - _started);
+    device.result.stage = bringup_stage::CONNECTING;
+    device.deadline = now + _config.connect_timeout;
+
+    try {
+        device.main->setStubbed(false);
+        if (!device.main->startConnect(spec.hostname, spec.main_port, device.main_timeout, device.main_blocking))
+            device.pending.push_back(device.main);
+
+        for (std::size_t channel = 0; channel < CHANNELS; channel++) {
+            if (!spec.data_ports[channel]) continue;
+            device.data[channel]->setStubbed(false);
+            if (!device.data[channel]->startConnect(spec.hostname, spec.data_ports[channel], 0, false))
+                device.pending.push_back(device.data[channel]);
+        }
+    }
+    catch (std::exception& e) {
+        fail(device, e.what());
+    }
+}
+
+void FleetBringUp::connecting(const std::shared_ptr<Device>& device, Clock::time_point now) {
+    try {
+        device->pending.erase(std::remove_if(device->pending.begin(), device->pending.end(),
+                [](const std::shared_ptr<net::NetDevice>& socket) { return socket->finishConnect(); }), device->pending.end());
+    }
+    catch (std::exception& e) {
+        fail(*device, e.what());
+        return;
+    }
+
+    if (device->pending.empty()) {
+        device->result.connected = us(now - device->started);
+        device->result.stage = bringup_stage::IDENTIFYING;
+        query(device, "*IDN?", now);
+    }
+    else if (now >= device->deadline) {
+        fail(*device, device->pending.front()->getName() + " connect timed out");
+    }
+}
+
+void FleetBringUp::query(const std::shared_ptr<Device>& device, const std::string& command, Clock::time_point now) {
+    device->waiting = true;
+    device->answered = false;
+    device->query_deadline = now + _config.query_timeout;
+
+    // the device owns the receiver and with it this channel - no strong reference back, the receiver
+    // can outlive the bring-up (and the device) and complete the query when it's destroyed
+    std::weak_ptr<Device> weak = device;
+    device->scpi->query(command, [weak](net::scpi_status status, const std::string& answer) {
+        auto device = weak.lock();
+        if (!device) return;
+        device->answered = true;
+        device->status = status;
+        device->answer = answer;
+    }, _config.query_timeout);
+    // sent now, not with the next poll
+    device->scpi->flush();
+}
+
+void FleetBringUp::answered(const std::shared_ptr<Device>& device, Clock::time_point now) {
+    BringUpResult& result = device->result;
+    device->waiting = false;
+    device->answered = false;
+
+    if (device->status == net::scpi_status::LOST) {
+        fail(*device, "connection lost");
+        return;
+    }
+
+    if (result.stage == bringup_stage::IDENTIFYING) {
+        if (device->status != net::scpi_status::OK) {
+            fail(*device, "no answer to *IDN?");
+            return;
+        }
+        if (device->answer.size() < device->idn_size) {
+            fail(*device, "invalid *IDN? answer <" + device->answer + ">");
+            return;
+        }
+        result.idn = device->answer;
+        result.identified = us(now - device->started);
+        if (!_config.arm) {
+            result.stage = bringup_stage::READY;
+            return;
+        }
+
+        // ACQ of all channels and the first check in one send
+        for (std::size_t channel = 0; channel < CHANNELS; channel++) {
+            if (result.spec.data_ports[channel]) device->scpi->command("ACQ 1," + std::to_string(channel + 1));
+        }
+        result.stage = bringup_stage::ARMING;
+        device->deadline = now + _config.acq_timeout;
+        query(device, ":ACQ?", now);
+        return;
+    }
+
+    //0,0 - channel 1, channel 2; timed out query is just repeated
+    const std::string& answer = device->answer;
+    bool active = (device->status == net::scpi_status::OK) && (answer.size() >= 3) && (answer[1] == ',');
+    for (std::size_t channel = 0; active && (channel < CHANNELS); channel++) {
+        if (result.spec.data_ports[channel] && (answer[channel * 2] != '1')) active = false;
+    }
+    if (active) {
+        result.armed = us(now - device->started);
+        result.stage = bringup_stage::READY;
+    }
+    else device->next_acq = now + _config.acq_poll;
+}
+
+void FleetBringUp::fail(Device& device, const std::string& error) {
+    BringUpResult& result = device.result;
+    result.failed_stage = result.stage;
+    result.stage = bringup_stage::FAILED;
+    result.error = std::string(stageName(result.failed_stage)) + " : " + error;
+
+    // nobody polls the channel of the failed device anymore
+    device.scpi->cancel();
+    device.waiting = false;
+    device.answered = false;
+    closeSocket(*device.main);
+    for (auto& socket : device.data) closeSocket(*socket);
+    device.pending.clear();
+}
+
+void FleetBringUp::finish(Device& device, Clock::time_point now, const Finished& finished) {
+    device.finished = true;
+    device.result.total = us(now - device.started);
+    _in_flight--;
+    _unfinished--;
+    if (finished) finished(device.result);
+}
+
+int FleetBringUp::waitMs(int timeout_ms, Clock::time_point now) {
+    auto next = now + std::chrono::milliseconds(timeout_ms);
+    for (auto& device : _devices) {
+        if (device->finished) continue;
+        switch (device->result.stage) {
+            case bringup_stage::CONNECTING:
+                next = std::min(next, device->deadline);
+                break;
+            case bringup_stage::IDENTIFYING:
+            case bringup_stage::ARMING:
+                if (device->waiting) next = std::min(next, device->query_deadline);
+                if (device->result.stage != bringup_stage::ARMING) break;
+                next = std::min(next, device->deadline);
+                if (!device->waiting) next = std::min(next, device->next_acq);
+                break;
+            default:
+                break;
+        }
+    }
+    // rounded up, not to spin around the deadline
+    const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - now + std::chrono::microseconds(999));
+    return static_cast<int>(std::max<int64_t>(0, wait.count()));
+}
+
+} // namespace fleet
@@ -0,0 +1,139 @@
+/*
+ * Fleet.hpp
+ *
+ *  Concurrent bring-up of many FBS/LPPS receivers: connect, identify and arm.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_FLEET_HPP_
+#define SRC_PISA_NETDEVICES_FLEET_HPP_
+
+#include <cstdint>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "FBS.hpp"
+#include "LPPS.hpp"
+
+namespace fleet {
+
+enum class receiver_type {
+    FBS = 0u,
+    LPPS,
+};
+
+enum class bringup_stage {
+    WAITING = 0u,   // for a free in-flight slot
+    CONNECTING,     // main and data sockets
+    IDENTIFYING,    // *IDN?
+    ARMING,         // ACQ 1,n sent, :ACQ? until the channels report active
+    READY,
+    FAILED,
+};
+
+const char* stageName(bringup_stage stage);
+
+struct DeviceSpec {
+    receiver_type type;
+    std::string name;
+    std::string hostname;
+    int main_port;
+    std::array<int, 2> data_ports;  // 0 - channel not used (not connected nor armed)
+};
+
+struct BringUpConfig {
+    // devices in the bring-up at once, the rest waits - limits the descriptors and the SYN burst
+    std::size_t max_in_flight = 64u;
+    std::chrono::milliseconds connect_timeout = std::chrono::milliseconds(3000);
+    std::chrono::milliseconds query_timeout = std::chrono::milliseconds(1000);
+    // from the ACQ commands to the channels reported active
+    std::chrono::milliseconds acq_timeout = std::chrono::milliseconds(5000);
+    // :ACQ? repeated in such steps until the hardware reports the channels active
+    std::chrono::milliseconds acq_poll = std::chrono::milliseconds(20);
+    bool arm = true;
+};
+
+struct BringUpResult {
+    DeviceSpec spec;
+    // by spec.type, the other one is nullptr
+    std::shared_ptr<fbs_receiver::FbsReceiver> fbs;
+    std::shared_ptr<lpps_receiver::LppsReceiver> lpps;
+    bringup_stage stage;            // READY or FAILED when finished
+    bringup_stage failed_stage;     // where it failed
+    std::string error;
+    std::string idn;
+    // queued - from the start of the bring-up to the start of the device,
+    // the rest from the start of the device (0 - stage not reached)
+    std::chrono::microseconds queued;
+    std::chrono::microseconds connected;
+    std::chrono::microseconds identified;
+    std::chrono::microseconds armed;
+    std::chrono::microseconds total;
+};
+
+/*
+ * Bring-up of the whole fleet from one thread: connects, *IDN? and ACQ of all devices
+ * run concurrently (max_in_flight at once), nothing blocks on a single device. Cold start takes
+ * about one worst case round trip + ACQ latency of the hardware, not the sum over the devices.
+ *
+ * The sockets are set up as connect/connect_channel do it (FBS main non blocking, LPPS main blocking,
+ * data non blocking). Failed device has its sockets closed, the others are not affected.
+ *
+ * Example usage:
+ *
+ *    fleet::FleetBringUp bringup(devices);
+ *    auto results = bringup.run([&](const fleet::BringUpResult& result) {
+ *        if (result.stage == fleet::bringup_stage::READY) result.fbs->attach(reactor, fbs_receiver::fbs_channels::CHANNEL_1, handler);
+ *        else std::cerr << result.spec.name << " : " << result.error << std::endl;
+ *    });
+ */
+class FleetBringUp {
+    public:
+        // called once per device when it is READY or FAILED
+        using Finished = std::function<void(const BringUpResult& result)>;
+
+        FleetBringUp(const std::vector<DeviceSpec>& devices, const BringUpConfig& config = BringUpConfig());
+
+        FleetBringUp(const FleetBringUp&) = delete;
+        FleetBringUp& operator=(const FleetBringUp&) = delete;
+
+        // poll() until every device is finished, return all results (in the order of devices)
+        std::vector<BringUpResult> run(Finished finished = nullptr);
+
+        /*
+        @brief - one step of the bring-up, for the callers with their own loop
+        @param timeout_ms - wait so long for the sockets (0 - don't wait)
+        @return number of devices not finished yet
+        */
+        std::size_t poll(int timeout_ms, Finished finished = nullptr);
+
+    private:
+        using Clock = std::chrono::steady_clock;
+        struct Device;
+
+        // as many as max_in_flight allows
+        void startWaiting(Clock::time_point now, const Finished& finished);
+        void start(Device& device, Clock::time_point now);
+        void connecting(const std::shared_ptr<Device>& device, Clock::time_point now);
+        void query(const std::shared_ptr<Device>& device, const std::string& command, Clock::time_point now);
+        // answer of the query (or its failure) in the stage of the device
+        void answered(const std::shared_ptr<Device>& device, Clock::time_point now);
+        void finish(Device& device, Clock::time_point now, const Finished& finished);
+        void fail(Device& device, const std::string& error);
+        int waitMs(int timeout_ms, Clock::time_point now);
+
+        BringUpConfig _config;
+        Clock::time_point _started;
+        // the query callbacks have weak references, receivers can outlive the bring-up
+        std::vector<std::shared_ptr<Device>> _devices;
+        std::size_t _next;          // first device not started
+        std::size_t _in_flight;
+        std::size_t _unfinished;
+};
+
+} // namespace fleet
+
+#endif /* SRC_PISA_NETDEVICES_FLEET_HPP_ */
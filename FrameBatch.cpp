@@ -0,0 +1,42 @@
+/*
+ * FrameBatch.cpp
+ *
+ *  Frames handed off from the IO thread to the analysis threads.
+ */
+
+#include "FrameBatch.hpp"
+
+namespace net {
+
+FrameBatchPool::FrameBatchPool(std::size_t nbatches, std::size_t max_frames) :
+        _free(nbatches) {
+    _batches.reserve(nbatches);
+    for (std::size_t n = 0; n < nbatches; n++) {
+        std::unique_ptr<FrameBatch> batch(new FrameBatch());
+        batch->frames.reserve(max_frames);
+        batch->errors = 0;
+        batch->ring = nullptr;
+        batch->release_pos = 0;
+        batch->rx_time_ns = 0;
+        _free.push(batch.get());
+        _batches.push_back(std::move(batch));
+    }
+}
+
+FrameBatch* FrameBatchPool::acquire() {
+    FrameBatch* batch = nullptr;
+    if (!_free.pop(batch)) return nullptr;
+    batch->frames.clear();
+    batch->errors = 0;
+    batch->ring = nullptr;
+    batch->rx_time_ns = 0;
+    return batch;
+}
+
+void FrameBatchPool::release(FrameBatch* batch) {
+    if (batch->ring) batch->ring->releaseTo(batch->release_pos);
+    batch->ring = nullptr;
+    _free.push(batch);
+}
+
+} // namespace net
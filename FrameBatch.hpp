@@ -0,0 +1,91 @@
+/*
+ * FrameBatch.hpp
+ *
+ *  Frames handed off from the IO thread to the analysis threads.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_FRAME_BATCH_HPP_
+#define SRC_PISA_NETDEVICES_FRAME_BATCH_HPP_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "RingBuffer.hpp"
+#include "SpscQueue.hpp"
+
+namespace net {
+
+class FrameBatchPool;
+
+/*
+ * Frames of one receive call. Frames are not copied, they point into the receive ring of the channel,
+ * and the ring keeps them until the batch is returned to the pool (FrameBatchPool::release).
+ * Batches of one channel has to be released in the same order as they were received
+ * (it's natural with one SpscQueue per channel).
+ */
+struct FrameBatch {
+    // pointers to the frames (from FrameFormat::payload_offset), capacity is reserved by the pool
+    std::vector<const uint8_t*> frames;
+    // 0 - no errors, 1 - fragmented data waiting for the next batch
+    uint8_t errors;
+
+    // ring owning the frames, and position to release when the batch is done
+    RingBuffer* ring;
+    uint64_t release_pos;
+
+    // kernel arrival time of the newest data (CLOCK_REALTIME ns), 0 - timestamping is off, see NetDevice::setRxTimestamping
+    uint64_t rx_time_ns;
+
+    inline std::size_t size() const { return (frames.size());}
+    inline std::size_t capacity() const { return (frames.capacity());}
+
+    template <typename T>
+    inline const T* frame(std::size_t n) const { return (reinterpret_cast<const T*>(frames[n]));}
+};
+
+/*
+ * Preallocated batches. Producer (IO thread) acquires, consumer (analysis thread) releases,
+ * free batches go back through the SPSC queue, so in steady state there's no lock and no allocation.
+ *
+ * Example usage:
+ *
+ *    net::FrameBatchPool pool(64, 1024);
+ *    net::SpscQueue<net::FrameBatch*> queue(64);
+ *
+ *    // IO thread, unused batch is kept for the next call (only consumer releases)
+ *    if (!batch) batch = pool.acquire();
+ *    if (batch && fbs.receiveFbsFrames(*batch, fbs_receiver::fbs_channels::CHANNEL_1)) {
+ *        queue.push(batch); // queue capacity >= number of batches, never full
+ *        batch = nullptr;
+ *    }
+ *
+ *    // analysis thread
+ *    net::FrameBatch* batch;
+ *    while (queue.pop(batch)) {
+ *        for (auto frame : batch->frames) ...
+ *        pool.release(batch);
+ *    }
+ */
+class FrameBatchPool {
+    public:
+        FrameBatchPool(std::size_t nbatches, std::size_t max_frames);
+
+        FrameBatchPool(const FrameBatchPool&) = delete;
+        FrameBatchPool& operator=(const FrameBatchPool&) = delete;
+
+        // producer side (only one thread), nullptr when all batches are in use
+        FrameBatch* acquire();
+        // consumer side (only one thread), frees the ring data of the batch and returns it to the pool
+        void release(FrameBatch* batch);
+
+        inline std::size_t available() const { return (_free.size());}
+
+    private:
+        std::vector<std::unique_ptr<FrameBatch>> _batches;
+        SpscQueue<FrameBatch*> _free;
+};
+
+} // namespace net
+
+#endif /* SRC_PISA_NETDEVICES_FRAME_BATCH_HPP_ */
@@ -0,0 +1,175 @@
+/*
+ * FrameDecoder.cpp
+ *
+ *  Decoding of the received FBS/LPPS frames into columns (struct of arrays).
+ *  Fields are gathered from the frames first, then the time conversions run over the
+ *  contiguous columns (AVX2 when the cpu has it).
+ */
+
+#include "FrameDecoder.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define _FRAME_DECODER_X86
+#endif
+
+namespace decoder {
+
+namespace { // for internal use only
+
+constexpr uint64_t NS_PER_SEC = 1000000000ull;
+
+void ntpToNsScalar(const uint64_t* ntp, uint64_t* ns, std::size_t n) {
+    for (std::size_t i = 0; i < n; i++)
+        ns[i] = ntpToNs(ntp[i]);
+}
+
+void cyclesToNsScalar(const uint32_t* cycles, uint64_t* ns, std::size_t n) {
+    for (std::size_t i = 0; i < n; i++)
+        ns[i] = static_cast<uint64_t>(cycles[i]) * lpps_receiver::PRU_CYCLE_NS;
+}
+
+#ifdef _FRAME_DECODER_X86
+
+/*
+ * seconds and fraction are 32 bit, so both products fit _mm256_mul_epu32 (32x32 -> 64 bits):
+ * ns = sec * 1e9 + ((frac * 1e9 + 2^31) >> 32)
+ */
+__attribute__((target("avx2")))
+void ntpToNsAvx2(const uint64_t* ntp, uint64_t* ns, std::size_t n) {
+    const __m256i ns_per_sec = _mm256_set1_epi64x(static_cast<long long>(NS_PER_SEC));
+    const __m256i half = _mm256_set1_epi64x(0x80000000ll);
+    std::size_t i = 0;
+
+    for (; (i + 4) <= n; i += 4) {
+        const __m256i val = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ntp + i));
+        const __m256i sec = _mm256_mul_epu32(_mm256_srli_epi64(val, 32), ns_per_sec);
+        const __m256i frac = _mm256_srli_epi64(_mm256_add_epi64(_mm256_mul_epu32(val, ns_per_sec), half), 32);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(ns + i), _mm256_add_epi64(sec, frac));
+    }
+    ntpToNsScalar(ntp + i, ns + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void cyclesToNsAvx2(const uint32_t* cycles, uint64_t* ns, std::size_t n) {
+    const __m256i cycle_ns = _mm256_set1_epi64x(lpps_receiver::PRU_CYCLE_NS);
+    std::size_t i = 0;
+
+    for (; (i + 4) <= n; i += 4) {
+        const __m256i val = _mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(cycles + i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(ns + i), _mm256_mul_epu32(val, cycle_ns));
+    }
+    cyclesToNsScalar(cycles + i, ns + i, n - i);
+}
+
+#endif // _FRAME_DECODER_X86
+
+bool hasAvx2() {
+#ifdef _FRAME_DECODER_X86
+    static const bool avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2") != 0);
+    return avx2;
+#else
+    return false;
+#endif
+}
+
+// frames as lpps_frame pointers or as the byte pointers of a batch - the pointer array itself is never cast
+template <typename Frame>
+void decodeLppsFrames(const Frame* const* frames, std::size_t nframes, LppsColumns& columns) {
+    columns.resize(nframes);
+
+    uint32_t* lpps_data = columns.lpps_data.data();
+    uint32_t* errors = columns.errors.data();
+    uint32_t* delay = columns.delay_cycles.data();
+    uint64_t* data_ntp = columns.data_ntp_ns.data();
+    uint64_t* pps_ntp = columns.pps_ntp_ns.data();
+
+    // lpps_frame is packed, fields can be misaligned - FrameField loads them by memcpy
+    using lpps_receiver::LppsProtocol;
+    for (std::size_t n = 0; n < nframes; n++) {
+        const uint8_t* frame = reinterpret_cast<const uint8_t*>(frames[n]);
+        lpps_data[n] = LppsProtocol::lpps_data::get(frame);
+        errors[n] = LppsProtocol::errors::get(frame);
+        delay[n] = LppsProtocol::delay_cycles::get(frame);
+        data_ntp[n] = LppsProtocol::data_ntp::get(frame);
+        pps_ntp[n] = LppsProtocol::pps_ntp::get(frame);
+    }
+    ntpToNs(data_ntp, data_ntp, nframes);
+    ntpToNs(pps_ntp, pps_ntp, nframes);
+    cyclesToNs(delay, columns.delay_ns.data(), nframes);
+}
+
+} // end namespace
+
+void FbsColumns::resize(std::size_t n) {
+    tc1.resize(n);
+    tc2.resize(n);
+    tc3.resize(n);
+    ntp_ns.resize(n);
+}
+
+void LppsColumns::resize(std::size_t n) {
+    lpps_data.resize(n);
+    errors.resize(n);
+    delay_cycles.resize(n);
+    delay_ns.resize(n);
+    data_ntp_ns.resize(n);
+    pps_ntp_ns.resize(n);
+}
+
+void ntpToNs(const uint64_t* ntp, uint64_t* ns, std::size_t n) {
+#ifdef _FRAME_DECODER_X86
+    if (hasAvx2()) return ntpToNsAvx2(ntp, ns, n);
+#endif
+    ntpToNsScalar(ntp, ns, n);
+}
+
+void cyclesToNs(const uint32_t* cycles, uint64_t* ns, std::size_t n) {
+#ifdef _FRAME_DECODER_X86
+    if (hasAvx2()) return cyclesToNsAvx2(cycles, ns, n);
+#endif
+    cyclesToNsScalar(cycles, ns, n);
+}
+
+void decodeFbs(const uint8_t* const* frames, std::size_t nframes, FbsColumns& columns) {
+    using namespace fbs_receiver;
+    columns.resize(nframes);
+
+    uint32_t* tc1 = columns.tc1.data();
+    uint32_t* tc2 = columns.tc2.data();
+    uint32_t* tc3 = columns.tc3.data();
+    uint64_t* ntp = columns.ntp_ns.data();
+
+    for (std::size_t n = 0; n < nframes; n++) {
+        const uint8_t* frame = frames[n];
+        tc1[n] = FbsProtocol::tc1::get(frame);
+        tc2[n] = FbsProtocol::tc2::get(frame);
+        tc3[n] = FbsProtocol::tc3::get(frame);
+        ntp[n] = FbsProtocol::ntp::get(frame);
+    }
+    ntpToNs(ntp, ntp, nframes);
+}
+
+void decodeFbs(const std::vector<const uint8_t*>& frames, FbsColumns& columns) {
+    decodeFbs(frames.data(), frames.size(), columns);
+}
+
+void decodeFbs(const net::FrameBatch& batch, FbsColumns& columns) {
+    decodeFbs(batch.frames.data(), batch.frames.size(), columns);
+}
+
+void decodeLpps(const lpps_receiver::lpps_frame* const* frames, std::size_t nframes, LppsColumns& columns) {
+    decodeLppsFrames(frames, nframes, columns);
+}
+
+void decodeLpps(const std::vector<const lpps_receiver::lpps_frame*>& frames, LppsColumns& columns) {
+    decodeLpps(frames.data(), frames.size(), columns);
+}
+
+void decodeLpps(const net::FrameBatch& batch, LppsColumns& columns) {
+    decodeLppsFrames(batch.frames.data(), batch.frames.size(), columns);
+}
+
+} // namespace decoder
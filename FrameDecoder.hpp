@@ -0,0 +1,95 @@
+/*
+ * FrameDecoder.hpp
+ *
+ *  Decoding of the received FBS/LPPS frames into columns (struct of arrays).
+ */
+
+#ifndef SRC_PISA_NETDEVICES_FRAME_DECODER_HPP_
+#define SRC_PISA_NETDEVICES_FRAME_DECODER_HPP_
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "FBS.hpp"
+#include "LPPS.hpp"
+#include "FrameBatch.hpp"
+
+namespace decoder {
+
+// alignment of the columns, full cache line (and AVX-512 register)
+constexpr std::size_t COLUMN_ALIGN = 64u;
+
+template <typename T, std::size_t Align = COLUMN_ALIGN>
+struct AlignedAllocator {
+    using value_type = T;
+    template <typename U> struct rebind { using other = AlignedAllocator<U, Align>; };
+
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Align>&) {}
+
+    T* allocate(std::size_t n) {
+        void* ptr = nullptr;
+        if (posix_memalign(&ptr, Align, n * sizeof(T)) != 0) throw std::bad_alloc();
+        return static_cast<T*>(ptr);
+    }
+    void deallocate(T* ptr, std::size_t) { free(ptr);}
+
+    template <typename U> bool operator==(const AlignedAllocator<U, Align>&) const { return true;}
+    template <typename U> bool operator!=(const AlignedAllocator<U, Align>&) const { return false;}
+};
+
+template <typename T>
+using Column = std::vector<T, AlignedAllocator<T>>;
+
+// FBS frames, n-th element of every column comes from the n-th frame
+struct FbsColumns {
+    Column<uint32_t> tc1;
+    Column<uint32_t> tc2;
+    Column<uint32_t> tc3;
+    Column<uint64_t> ntp_ns; // ns from NTP epoch (1900-01-01)
+
+    inline std::size_t size() const { return (tc1.size());}
+    void resize(std::size_t n);
+};
+
+struct LppsColumns {
+    Column<uint32_t> lpps_data;
+    Column<uint32_t> errors;
+    Column<uint32_t> delay_cycles; // in PRU cycles
+    Column<uint64_t> delay_ns;
+    Column<uint64_t> data_ntp_ns;  // ns from NTP epoch (1900-01-01)
+    Column<uint64_t> pps_ntp_ns;
+
+    inline std::size_t size() const { return (lpps_data.size());}
+    void resize(std::size_t n);
+};
+
+/*
+ * @brief decode frames into columns, columns are resized to the number of frames
+ * @param frames - payload pointers from receiveFbsFrames
+ * Columns keep their capacity, reuse the same object to not allocate in steady state.
+ */
+void decodeFbs(const uint8_t* const* frames, std::size_t nframes, FbsColumns& columns);
+void decodeFbs(const std::vector<const uint8_t*>& frames, FbsColumns& columns);
+void decodeFbs(const net::FrameBatch& batch, FbsColumns& columns);
+
+void decodeLpps(const lpps_receiver::lpps_frame* const* frames, std::size_t nframes, LppsColumns& columns);
+void decodeLpps(const std::vector<const lpps_receiver::lpps_frame*>& frames, LppsColumns& columns);
+void decodeLpps(const net::FrameBatch& batch, LppsColumns& columns);
+
+/*
+ * NTP timestamp 32.32 fixed point (seconds | fraction) -> ns, rounded
+ * in place conversion (ntp == ns) is allowed
+ */
+void ntpToNs(const uint64_t* ntp, uint64_t* ns, std::size_t n);
+void cyclesToNs(const uint32_t* cycles, uint64_t* ns, std::size_t n);
+
+inline uint64_t ntpToNs(uint64_t ntp) {
+    return ((ntp >> 32) * 1000000000ull + (((ntp & 0xffffffffull) * 1000000000ull + 0x80000000ull) >> 32));
+}
+
+} // namespace decoder
+
+#endif /* SRC_PISA_NETDEVICES_FRAME_DECODER_HPP_ */
@@ -0,0 +1,150 @@
+/*
+ * FrameProtocol.hpp
+ *
+ *  Compile time description of the frame layout, framer specialized for it.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_FRAME_PROTOCOL_HPP_
+#define SRC_PISA_NETDEVICES_FRAME_PROTOCOL_HPP_
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "StreamFramer.hpp"
+#include "FrameScanner.hpp"
+
+namespace net {
+
+/*
+ * REMEMBER LITTLE ENDIAN!!
+ * Frame layout known at compile time: magic at the frame start, fixed frame length,
+ * frames returned from payload_offset. The magic is checked by one load of 4 (magic up to 4 bytes)
+ * or 8 bytes and one compare with the constant, frames of the aligned stream with the constant stride.
+ *
+ * Field layout of the protocol - FrameField types in the derived struct, used by the decoders.
+ *
+ * Example usage:
+ *
+ *    constexpr uint8_t XYZ_MAGIC[] = { 0x01, 'X', 'Y', 'Z' };
+ *    struct XyzProtocol : net::FrameProtocol<24u, sizeof(XYZ_MAGIC), XYZ_MAGIC[0], XYZ_MAGIC[1], XYZ_MAGIC[2], XYZ_MAGIC[3]> {
+ *        using counter = net::FrameField<uint32_t, 0u>;      // from the payload
+ *        using ntp = net::FrameField<uint64_t, 12u>;
+ *    };
+ *    net::ProtocolFramer<XyzProtocol> framer(device);
+ *    framer.receive(frames, errors);
+ *    for (auto frame : frames) ... XyzProtocol::counter::get(frame)
+ */
+// count() of fewer frames is inlined, longer runs go to net::countFrames
+constexpr std::size_t COUNT_VECTOR_MIN = 32u;
+
+template <std::size_t FrameLen, std::size_t PayloadOffset, uint8_t... Magic>
+struct FrameProtocol {
+    static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "FrameProtocol: magic word is little endian");
+    static_assert((sizeof...(Magic) > 0) && (sizeof...(Magic) <= MAX_MAGIC_LEN), "FrameProtocol: 1..MAX_MAGIC_LEN bytes of magic");
+    static_assert(PayloadOffset < FrameLen, "FrameProtocol: payload behind the frame");
+
+    static constexpr std::size_t frame_len = FrameLen;
+    static constexpr std::size_t payload_offset = PayloadOffset;
+    static constexpr std::size_t magic_len = sizeof...(Magic);
+    static constexpr uint8_t magic[magic_len] = { Magic... };
+
+    // magic as one word, loaded from the frame start (never behind the frame)
+    using Word = typename std::conditional<(magic_len <= 4u), uint32_t, uint64_t>::type;
+    static_assert(sizeof(Word) <= FrameLen, "FrameProtocol: frame shorter than the magic word");
+
+    static constexpr Word magicWord() {
+        Word word = 0;
+        for (std::size_t n = 0; n < magic_len; n++) word |= static_cast<Word>(magic[n]) << (8u * n);
+        return word;
+    }
+    static constexpr Word magicMask() {
+        return (magic_len == sizeof(Word)) ? static_cast<Word>(~static_cast<Word>(0)) : static_cast<Word>((static_cast<Word>(1) << (8u * magic_len)) - 1u);
+    }
+
+    static constexpr FrameFormat format() {
+        return FrameFormat { magic, magic_len, frame_len, payload_offset };
+    }
+
+    static inline bool match(const uint8_t* frame) {
+        Word word;
+        std::memcpy(&word, frame, sizeof(word));
+        return ((word & magicMask()) == magicWord());
+    }
+
+    // as net::countFrames, the stride is the constant frame_len
+    static inline std::size_t count(const uint8_t* data, std::size_t nframes) {
+        // long runs - gather of the vectorized scanner is faster than the loads one by one
+        if (nframes >= COUNT_VECTOR_MIN) return countFrames(data, nframes, frame_len, magic, magic_len);
+
+        std::size_t n = 0;
+        for (; (n + 4) <= nframes; n += 4) {
+            const uint8_t* p = data + n * frame_len;
+            if (!(match(p) & match(p + frame_len) & match(p + 2 * frame_len) & match(p + 3 * frame_len))) break;
+        }
+        for (; n < nframes; n++) {
+            if (!match(data + n * frame_len)) break;
+        }
+        return n;
+    }
+
+    // resynchronization is rare, the vectorized search of the scanner
+    static inline std::size_t find(const uint8_t* data, std::size_t npos) {
+        return findMagic(data, npos, magic, magic_len);
+    }
+};
+
+template <std::size_t FrameLen, std::size_t PayloadOffset, uint8_t... Magic>
+constexpr std::size_t FrameProtocol<FrameLen, PayloadOffset, Magic...>::frame_len;
+template <std::size_t FrameLen, std::size_t PayloadOffset, uint8_t... Magic>
+constexpr std::size_t FrameProtocol<FrameLen, PayloadOffset, Magic...>::payload_offset;
+template <std::size_t FrameLen, std::size_t PayloadOffset, uint8_t... Magic>
+constexpr std::size_t FrameProtocol<FrameLen, PayloadOffset, Magic...>::magic_len;
+template <std::size_t FrameLen, std::size_t PayloadOffset, uint8_t... Magic>
+constexpr uint8_t FrameProtocol<FrameLen, PayloadOffset, Magic...>::magic[];
+
+// field of the payload, unaligned little endian load
+template <typename T, std::size_t Offset>
+struct FrameField {
+    using type = T;
+    static constexpr std::size_t offset = Offset;
+
+    static inline T get(const uint8_t* payload) {
+        T val;
+        std::memcpy(&val, payload + Offset, sizeof(T));
+        return val;
+    }
+};
+
+/*
+ * StreamFramer with the frame checks of the protocol P (FrameProtocol) inlined,
+ * otherwise the same (capture, reconnects, statistics, batches).
+ * Call receive/parse through the ProtocolFramer, StreamFramer& gives the generic path.
+ */
+template <typename P>
+class ProtocolFramer : public StreamFramer {
+    public:
+        using Protocol = P;
+
+        ProtocolFramer(std::shared_ptr<NetDevice> device, std::size_t ring_capacity = RING_BUF_LENGTH) throw(std::exception) :
+                StreamFramer(device, P::format(), ring_capacity) {}
+
+        template <typename T>
+        std::size_t receive(std::vector<const T*>& frames, uint8_t& errors) {
+            return receiveFrames(P(), frames, errors);
+        }
+
+        std::size_t receive(FrameBatch& batch) {
+            return receiveBatch(P(), batch);
+        }
+
+        template <typename Visitor>
+        std::size_t parse(Visitor&& visit, uint8_t& errors, std::size_t max_frames = SIZE_MAX) {
+            return parseWith(P(), std::forward<Visitor>(visit), errors, max_frames);
+        }
+};
+
+} // namespace net
+
+#endif /* SRC_PISA_NETDEVICES_FRAME_PROTOCOL_HPP_ */
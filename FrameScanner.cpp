@@ -0,0 +1,202 @@
+/*
+ * FrameScanner.cpp
+ *
+ *  Frame header (magic) search in the received stream.
+ *  Implementation (AVX2, SSE2 or scalar) is selected once, on the first call, for the running cpu.
+ */
+
+#include "FrameScanner.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define _FRAME_SCANNER_X86
+#endif
+
+namespace net {
+
+namespace { // for internal use only
+
+using find_fn = std::size_t (*)(const uint8_t*, std::size_t, const uint8_t*, std::size_t);
+using count_fn = std::size_t (*)(const uint8_t*, std::size_t, std::size_t, const uint8_t*, std::size_t);
+
+inline uint32_t load32(const uint8_t* p) {
+    uint32_t val;
+    std::memcpy(&val, p, sizeof(val));
+    return val;
+}
+
+/*
+ * Magic as (max) two 32 bit words: bytes 0..3 and the last 4 bytes (overlapping for 5..7 bytes magic)
+ * Magic shorter than 4 bytes is compared with the mask.
+ */
+struct MagicWords {
+    uint32_t first;
+    uint32_t first_mask;
+    uint32_t last;
+    std::size_t last_offset;
+    bool two_words;
+
+    MagicWords(const uint8_t* magic, std::size_t magic_len) :
+            first(0), first_mask(0xffffffffu), last(0), last_offset(0), two_words(magic_len > 4) {
+        if (magic_len < 4) {
+            uint8_t buf[4] = { 0 };
+            std::memcpy(buf, magic, magic_len);
+            first = load32(buf);
+            first_mask = (1u << (8 * magic_len)) - 1;
+        }
+        else first = load32(magic);
+        if (two_words) {
+            last_offset = magic_len - 4;
+            last = load32(magic + last_offset);
+        }
+    }
+
+    inline bool match(const uint8_t* p) const {
+        return (((load32(p) & first_mask) == first) && (!two_words || (load32(p + last_offset) == last)));
+    }
+};
+
+inline bool middleMatch(const uint8_t* p, const uint8_t* magic, std::size_t magic_len) {
+    // first and last byte are already checked
+    return ((magic_len <= 2) || (std::memcmp(p + 1, magic + 1, magic_len - 2) == 0));
+}
+
+std::size_t findMagicScalar(const uint8_t* data, std::size_t npos, const uint8_t* magic, std::size_t magic_len) {
+    std::size_t i = 0;
+    while (i < npos) {
+        // memchr is vectorized in libc anyway
+        const void* p = std::memchr(data + i, magic[0], npos - i);
+        if (!p) return npos;
+        i = static_cast<std::size_t>(static_cast<const uint8_t*>(p) - data);
+        if ((data[i + magic_len - 1] == magic[magic_len - 1]) && middleMatch(data + i, magic, magic_len)) return i;
+        i++;
+    }
+    return npos;
+}
+
+std::size_t countFramesScalar(const uint8_t* data, std::size_t nframes, std::size_t stride, const uint8_t* magic, std::size_t magic_len) {
+    const MagicWords words(magic, magic_len);
+    std::size_t n = 0;
+
+    for (; (n + 4) <= nframes; n += 4) {
+        const uint8_t* p = data + n * stride;
+        if (!(words.match(p) && words.match(p + stride) && words.match(p + 2 * stride) && words.match(p + 3 * stride))) break;
+    }
+    for (; n < nframes; n++) {
+        if (!words.match(data + n * stride)) break;
+    }
+    return n;
+}
+
+#ifdef _FRAME_SCANNER_X86
+
+/*
+ * Compare 16 (32) positions at once: first byte of the magic at p[i] and the last one at p[i + magic_len - 1].
+ * Only positions where both match are checked with memcmp.
+ */
+__attribute__((target("sse2")))
+std::size_t findMagicSse2(const uint8_t* data, std::size_t npos, const uint8_t* magic, std::size_t magic_len) {
+    const __m128i first = _mm_set1_epi8(static_cast<char>(magic[0]));
+    const __m128i last = _mm_set1_epi8(static_cast<char>(magic[magic_len - 1]));
+    std::size_t i = 0;
+
+    for (; (i + 16) <= npos; i += 16) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + magic_len - 1));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last))));
+        while (mask) {
+            const std::size_t bit = static_cast<std::size_t>(__builtin_ctz(mask));
+            if (middleMatch(data + i + bit, magic, magic_len)) return (i + bit);
+            mask &= mask - 1;
+        }
+    }
+    return (i + findMagicScalar(data + i, npos - i, magic, magic_len));
+}
+
+__attribute__((target("avx2")))
+std::size_t findMagicAvx2(const uint8_t* data, std::size_t npos, const uint8_t* magic, std::size_t magic_len) {
+    const __m256i first = _mm256_set1_epi8(static_cast<char>(magic[0]));
+    const __m256i last = _mm256_set1_epi8(static_cast<char>(magic[magic_len - 1]));
+    std::size_t i = 0;
+
+    for (; (i + 32) <= npos; i += 32) {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + magic_len - 1));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last))));
+        while (mask) {
+            const std::size_t bit = static_cast<std::size_t>(__builtin_ctz(mask));
+            if (middleMatch(data + i + bit, magic, magic_len)) return (i + bit);
+            mask &= mask - 1;
+        }
+    }
+    return (i + findMagicScalar(data + i, npos - i, magic, magic_len));
+}
+
+/*
+ * Aligned stream: gather the magic words of 8 frames and compare them in one step.
+ */
+__attribute__((target("avx2")))
+std::size_t countFramesAvx2(const uint8_t* data, std::size_t nframes, std::size_t stride, const uint8_t* magic, std::size_t magic_len) {
+    if (stride > 0x0fffffffu) return countFramesScalar(data, nframes, stride, magic, magic_len);
+
+    const MagicWords words(magic, magic_len);
+    const __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(static_cast<int>(stride)));
+    const __m256i first = _mm256_set1_epi32(static_cast<int>(words.first));
+    const __m256i first_mask = _mm256_set1_epi32(static_cast<int>(words.first_mask));
+    const __m256i last = _mm256_set1_epi32(static_cast<int>(words.last));
+    std::size_t n = 0;
+
+    for (; (n + 8) <= nframes; n += 8) {
+        const uint8_t* p = data + n * stride;
+        __m256i valid = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_i32gather_epi32(reinterpret_cast<const int*>(p), index, 1), first_mask), first);
+        if (words.two_words) {
+            valid = _mm256_and_si256(valid,
+                    _mm256_cmpeq_epi32(_mm256_i32gather_epi32(reinterpret_cast<const int*>(p + words.last_offset), index, 1), last));
+        }
+        const unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(valid)));
+        if (mask != 0xffu) return (n + static_cast<std::size_t>(__builtin_ctz(~mask)));
+    }
+    return (n + countFramesScalar(data + n * stride, nframes - n, stride, magic, magic_len));
+}
+
+#endif // _FRAME_SCANNER_X86
+
+struct Scanner {
+    find_fn find;
+    count_fn count;
+    const char* name;
+};
+
+Scanner selectScanner() {
+#ifdef _FRAME_SCANNER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return { findMagicAvx2, countFramesAvx2, "avx2" };
+    if (__builtin_cpu_supports("sse2")) return { findMagicSse2, countFramesScalar, "sse2" };
+#endif
+    return { findMagicScalar, countFramesScalar, "scalar" };
+}
+
+const Scanner& scanner() {
+    static const Scanner selected = selectScanner();
+    return selected;
+}
+
+} // end namespace
+
+std::size_t findMagic(const uint8_t* data, std::size_t npos, const uint8_t* magic, std::size_t magic_len) {
+    if ((magic_len == 0) || (magic_len > MAX_MAGIC_LEN)) return npos;
+    return scanner().find(data, npos, magic, magic_len);
+}
+
+std::size_t countFrames(const uint8_t* data, std::size_t nframes, std::size_t stride, const uint8_t* magic, std::size_t magic_len) {
+    if ((magic_len == 0) || (magic_len > MAX_MAGIC_LEN) || (stride < 4) || (stride < magic_len)) return 0;
+    return scanner().count(data, nframes, stride, magic, magic_len);
+}
+
+const char* scannerName() {
+    return scanner().name;
+}
+
+} // namespace net
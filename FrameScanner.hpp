@@ -0,0 +1,39 @@
+/*
+ * FrameScanner.hpp
+ *
+ *  Frame header (magic) search in the received stream.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_FRAME_SCANNER_HPP_
+#define SRC_PISA_NETDEVICES_FRAME_SCANNER_HPP_
+
+#include <cstdint>
+#include <cstddef>
+
+namespace net {
+
+// the longest supported magic (bytes)
+constexpr std::size_t MAX_MAGIC_LEN = 8u;
+
+/*
+ * @brief find the first frame header candidate (resynchronization after junk / lost alignment)
+ * @param data - searched data
+ * @param npos - number of start positions to check, data[0 .. npos + magic_len - 1) has to be readable
+ * @param magic, magic_len - header bytes, 1..MAX_MAGIC_LEN
+ * @return offset of the first full magic, npos if not found
+ */
+std::size_t findMagic(const uint8_t* data, std::size_t npos, const uint8_t* magic, std::size_t magic_len);
+
+/*
+ * @brief check the aligned stream, frames placed one after the other every stride bytes
+ * @param nframes - number of complete frames available in data
+ * @return number of frames from the start having valid magic (stops on the first invalid one)
+ */
+std::size_t countFrames(const uint8_t* data, std::size_t nframes, std::size_t stride, const uint8_t* magic, std::size_t magic_len);
+
+// name of the implementation selected for this cpu: "avx2", "sse2" or "scalar"
+const char* scannerName();
+
+} // namespace net
+
+#endif /* SRC_PISA_NETDEVICES_FRAME_SCANNER_HPP_ */
@@ -6,35 +6,40 @@
  */
 
 #include "LPPS.hpp"
+#include "Logger.hpp"
 #include <memory>
 #include <sstream>
 #include <algorithm>
 #include <vector>
+#include <cstring>
 
 namespace lpps_receiver {
 
 LppsReceiver::LppsReceiver(std::string _name) :
         name(_name) {
     //Initialize
-    rem_data_len = 0;
-    rem_data_start = 0;
     async_task = 0;
 
     _main_socket = std::make_shared<net::NetDevice>(_name + "_main");
+    _scpi.reset(new net::ScpiChannel(_main_socket));
     _data_socket[lpps_channels::CHANNEL_1] = std::make_shared<net::NetDevice>(_name + "_data1");
     _data_socket[lpps_channels::CHANNEL_2] = std::make_shared<net::NetDevice>(_name + "_data2");
 
+    for (auto channel : { lpps_channels::CHANNEL_1, lpps_channels::CHANNEL_2 })
+        _framer[channel].reset(new net::ProtocolFramer<LppsProtocol>(_data_socket[channel]));
+
 }
 
 std::string LppsReceiver::sendIdnQuery() throw(std::exception) {
-    std::string query = "*IDN?" + net::NEWLINE;
-    const uint32_t bytesReceived = _main_socket->sendQuery(reinterpret_cast<const uint8_t*>(query.data()), query.size(), true);
+    // through the command channel - main socket can be non blocking, the answer is waited for by poll
+    std::future<std::string> idn = _scpi->query("*IDN?");
+    while (_scpi->poll(IDN_POLL_MS)) {}
+    const std::string answer = idn.get();
 
-    if ((bytesReceived < IDN_ACK_SIZE) || (!(bytesReceived))) {
+    if (answer.size() < IDN_ACK_SIZE) {
         throw std::runtime_error((name + ", sendQuery failed : invalid Acknowledge packet"));
     }
-    const std::vector<uint8_t>& vec = _main_socket->getBuffer();
-    return std::string(vec.begin(), vec.end());
+    return answer;
 }
 
 void LppsReceiver::sendAcq(bool activate, lpps_channels channel) {
@@ -49,15 +54,29 @@ void LppsReceiver::connect(const std::string& hostname, int main_port) throw(std
   }
 
 void LppsReceiver::connect_channel(const std::string& hostname, lpps_channels channel, int data_port) throw(std::exception) {
+    stopBusyPoll(channel);
     _data_socket[channel]->setStubbed(false);
     //_main_socket->disconnect();
     _data_socket[channel]->connect(hostname, data_port, false);//false = non blocking
 }
 
+void LppsReceiver::connect_channel(net::ConnectionManager& manager, const std::string& hostname, lpps_channels channel, int data_port,
+        std::function<void(lpps_channels channel)> connected) {
+    stopBusyPoll(channel);
+    // stubbed until the manager connects it
+    _data_socket[channel]->disconnect();
+    _data_socket[channel]->setStubbed(true);
+    manager.add(_data_socket[channel], hostname, data_port, false, [this, channel, connected](net::NetDevice&) {
+        // busy poll thread ended with the old connection
+        stopBusyPoll(channel);
+        if (connected) connected(channel);
+    });
+}
+
 uint8_t LppsReceiver::queryAcqAsync() {
     std::string query = ":ACQ?" + net::NEWLINE;
 
-    std::cout << this->name << " Query FBS ACQ status:" << std::endl;
+    NETLOG_DEBUG("{} query LPPS ACQ status", name);
     if (!_main_socket->isConnected() || _main_socket->isStubbed()) return NET_ERROR;
     size_t bytes_send = 0;
     try {
@@ -71,6 +90,21 @@ uint8_t LppsReceiver::queryAcqAsync() {
     return 0;
 }
 
+std::future<std::pair<bool, bool>> LppsReceiver::queryAcq(std::chrono::milliseconds timeout) {
+    auto promise = std::make_shared<std::promise<std::pair<bool, bool>>>();
+    std::future<std::pair<bool, bool>> acq = promise->get_future();
+    const std::string receiver = name;
+
+    _scpi->query(":ACQ?", [promise, receiver](net::scpi_status status, const std::string& answer) {
+        //0,0
+        if ((status == net::scpi_status::OK) && (answer.size() >= 3) && (answer[1] == ','))
+            promise->set_value(std::make_pair((answer[0] == '1'), (answer[2] == '1')));
+        else promise->set_exception(std::make_exception_ptr(std::runtime_error((receiver + ", ACQ query failed : "
+                + ((status == net::scpi_status::OK) ? "invalid answer <" + answer + ">" : std::string("no answer"))))));
+    }, timeout);
+    return acq;
+}
+
 uint8_t LppsReceiver::readAcqAsync(std::pair<bool, bool>& acq) {
 
     if (!_main_socket->isConnected() || _main_socket->isStubbed()) return NET_ERROR;
@@ -78,10 +112,11 @@ uint8_t LppsReceiver::readAcqAsync(std::pair<bool, bool>& acq) {
         size_t bytes_read = _main_socket->receiveNB(0);
         auto data = _main_socket->getNBBuffer();
 
-        std::cout << "LPPS " << name << " answer: <" << std::string(data->begin(), data->end()) << "> size:" << data->size() << std::endl;
+        // only the answer, not the whole buffer
+        NETLOG_DEBUG("LPPS {} answer: <{}> size: {}", name, std::string(data->begin(), data->begin() + std::min(bytes_read, data->size())), bytes_read);
 
         if ((bytes_read != 4)) {//0,0\n
-            std::cout << name << " Acq query answer fail" << std::endl;
+            NETLOG_WARNING("{} ACQ query answer fail", name);
             acq = std::make_pair(false, false);
             return NET_ERROR;
         }
@@ -96,87 +131,190 @@ uint8_t LppsReceiver::readAcqAsync(std::pair<bool, bool>& acq) {
 
 void LppsReceiver::purgeSocket(lpps_channels channel) {
     if (_data_socket[channel]->isStubbed()) return;
-    _data_socket[channel]->receiveNB(0);
-    _data_socket[channel]->clearNBBuffer();
-    rem_data_start = 0;
-    rem_data_len = 0;
+    _framer[channel]->fill();
+    _framer[channel]->reset();
 }
 
-std::size_t LppsReceiver::receiveLppsFrames(std::vector<const lpps_frame*>& frames, lpps_channels channel, uint8_t& errors) {
-
-    frames.clear();
-    if (_data_socket[channel]->isStubbed()) return 0;
+void LppsReceiver::attach(net::NetReactor& reactor, lpps_channels channel, FramesHandler handler) throw(std::exception) {
+    auto socket = _data_socket[channel];
+    if (socket->isStubbed())
+        throw std::runtime_error((name + ", attach failed : data channel is not connected"));
+
+    reactor.add(socket->getPollFd(), [this, &reactor, channel, socket, handler](uint32_t events) {
+        auto& frames = _rx_frames[channel];
+        uint8_t errors = 0;
+        try {
+            // edge triggered, read until the socket is empty
+            do {
+                errors = 0;
+                receiveLppsFrames(frames, channel, errors);
+                if (!frames.empty()) handler(channel, frames, errors);
+            } while (!socket->isDrained() && !socket->isStubbed());
+        }
+        catch (std::exception& e) {
+            events |= EPOLLERR;
+        }
 
-    /*
-     write_start  - place where recv will start writing new data
-     write_end - place where recv stop writing new data
-     write_start - write_end = amount of received data
-     */
+        if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            reactor.remove(socket->getPollFd());
+            // stubbed = lost, for the ConnectionManager
+            socket->setStubbed(true);
+            frames.clear();
+            handler(channel, frames, CHANNEL_LOST);
+        }
+    });
+}
 
-    /*
-     When in past recv we received N bytes and only X<N bytes are frames, remaining data starts from X, and has len = N-X
-     first: copy reamining data from X to N  begining of the buffer.
-     This will no impact on the frames received before because they are copied in the previous cycle. Hope :>
-     */
-    // we have to know how many data we received last cycle
-    // and where the remaining data starts
-    auto data = _data_socket[channel]->getNBBuffer();
+void LppsReceiver::detach(net::NetReactor& reactor, lpps_channels channel) {
+    reactor.remove(_data_socket[channel]->getPollFd());
+}
 
-    std::copy_n((*data).begin() + rem_data_start, rem_data_len, (*data).begin());
-    size_t write_start = rem_data_len;
+net::rx_backend LppsReceiver::setRxBackend(lpps_channels channel, net::rx_backend backend) {
+    return _data_socket[channel]->setRxBackend(backend);
+}
 
-    size_t write_end = _data_socket[channel]->receiveNB(write_start);
+bool LppsReceiver::setRxTimestamping(lpps_channels channel, net::rx_timestamping mode) {
+    return _data_socket[channel]->setRxTimestamping(mode);
+}
 
-    size_t nframes = 0;
-    frames.clear();
+bool LppsReceiver::setRxDrain(lpps_channels channel, const net::DrainConfig& drain) {
+    // frames of one receive call stay in the ring, it has to take the whole budget
+    if (drain.max_bytes > _framer[channel]->ring().capacity()) {
+        _framer[channel].reset(new net::ProtocolFramer<LppsProtocol>(_data_socket[channel], drain.max_bytes));
+        _framer[channel]->setCapture(_capture[channel].get());
+    }
+    _framer[channel]->setDrain(drain);
+    return _data_socket[channel]->setRxBuffer(drain.rcvbuf, static_cast<int>(drain.rcvlowat_frames * LPPS_FRAME_LEN));
+}
 
-    if (write_end - write_start == 0) {
-        write_start = 0;
-        return 0;
+void LppsReceiver::startBusyPoll(lpps_channels channel, const net::BusyPollConfig& config, FramesHandler handler) throw(std::exception) {
+    auto socket = _data_socket[channel];
+    if (socket->isStubbed())
+        throw std::runtime_error((name + ", busy poll failed : data channel is not connected"));
+
+    stopBusyPoll(channel);
+    _busy_poll[channel].reset(new net::BusyPollReceiver(*socket, config,
+            [this, channel, socket, handler](net::BusyPollReceiver& busy) -> std::size_t {
+                auto& frames = _rx_frames[channel];
+                std::size_t nframes = 0;
+                uint8_t errors;
+                do {
+                    errors = 0;
+                    receiveLppsFrames(frames, channel, errors);
+                    if (!frames.empty()) {
+                        busy.latency().recordSince(socket->getRxTimestamp());
+                        handler(channel, frames, errors);
+                        nframes += frames.size();
+                    }
+                    // stopped (or restarted) from the handler, the channel can have a new thread already
+                } while (!socket->isDrained() && !socket->isStubbed() && !busy.isStopping());
+                return nframes;
+            },
+            [this, channel, socket, handler]() {
+                auto& frames = _rx_frames[channel];
+                socket->setStubbed(true);
+                frames.clear();
+                handler(channel, frames, CHANNEL_LOST);
+            }));
+    try {
+        _busy_poll[channel]->start();
     }
-/*
-    std::cout<<" LPPS "<<_data_socket[channel]->getName()<<" rec:"<<write_end<<" bytes"<<std::endl;
+    catch (std::exception& e) {
+        stopBusyPoll(channel);
+        throw;
+    }
+}
 
-    std::cout << " [";
-    for (size_t n = 0; n < LPPS_FRAME_LEN; n++) {
-    std::cout << std::setfill('0') << std::setw(2) << std::hex << (0xff & (unsigned int)(*data)[n]) << " ";
+void LppsReceiver::stopBusyPoll(lpps_channels channel) {
+    // stopped from its handler before, that thread has ended since (unless it's still this one)
+    if (_busy_poll_ended[channel] && !_busy_poll_ended[channel]->isCurrentThread()) _busy_poll_ended[channel].reset();
+    if (!_busy_poll[channel]) return;
+    _busy_poll[channel]->stop();
+    if (_busy_poll[channel]->isCurrentThread()) {
+        // from the handler - not joined, the receiver has to live until its thread returns
+        _busy_poll_ended[channel] = std::move(_busy_poll[channel]);
+        return;
     }
-    std::cout << std::dec << "]" << std::endl;
-*/
-    // Analyze received buffer from start to write_end;
-    for (size_t i = 0; i < write_end;) {
-        // if below, there's no enough space to keep valid frame.
-        if ((write_end - i) < LPPS_FRAME_LEN) {
-            rem_data_len = write_end - i;
-            rem_data_start = i;
-            //std::cout << "remaining data start: " << rem_data_start << std::endl;
-            //std::cout << "remaining data len: " << rem_data_len << std::endl;
-            errors = 1;
-            return nframes;
-        }
-/*
-        std::cout << std::dec << "index:" << i << " [";
-         for (size_t n = 0; n < LPPS_FRAME_LEN; n++) {
-         std::cout << std::setfill('0') << std::setw(2) << std::hex << (0xff & (unsigned int)(*data)[i + n]) << " ";
-         }
-         std::cout << std::dec << "]" << std::endl;
- */
+    // joined, the thread used the socket and the framer until the end
+    _busy_poll[channel].reset();
+}
 
-        // shift from start find header
-        frames.push_back(reinterpret_cast<const lpps_frame*>(&((*data)[i])));
+void LppsReceiver::startCapture(lpps_channels channel, const std::string& path) throw(std::exception) {
+    stopCapture(channel);
+    _capture[channel].reset(new net::CaptureWriter(path, LPPS_FORMAT, offsetof(lpps_frame, data_timestamp_ntp),
+            name + "_data" + std::to_string(static_cast<std::size_t>(channel) + 1)));
+    _framer[channel]->setCapture(_capture[channel].get());
+}
 
-        if (((*data)[i] == 0x01) && ((*data)[i + 1] == 'L') && ((*data)[i + 2] == 'P') && ((*data)[i + 3] == 'P') && ((*data)[i + 4] == 'S')) {
-            nframes++;
-            frames.push_back(reinterpret_cast<const lpps_frame*>(&((*data)[i])));
-            i += LPPS_FRAME_LEN;
-        }
-        // if no header, move one byte
-        else i++;
-    }// for
-     //std::cout << "No remaining data" << std::endl;
+void LppsReceiver::stopCapture(lpps_channels channel) {
+    _framer[channel]->setCapture(nullptr);
+    _capture[channel].reset();
+}
+
+void LppsReceiver::exportMetrics(net::MetricsRegion& region) throw(std::exception) {
+    _main_socket->setMetrics(region.allocate(_main_socket->getName()));
+    for (auto channel : { lpps_channels::CHANNEL_1, lpps_channels::CHANNEL_2 })
+        _data_socket[channel]->setMetrics(region.allocate(_data_socket[channel]->getName()));
+}
+
+std::shared_ptr<net::ReplayDevice> LppsReceiver::replay(lpps_channels channel, const std::string& path, net::replay_pace pace) throw(std::exception) {
+    auto device = std::make_shared<net::ReplayDevice>(name + "_replay" + std::to_string(static_cast<std::size_t>(channel) + 1), path, pace);
+    const net::CaptureHeader& header = device->reader().header();
+    if ((header.frame_len != LPPS_FORMAT.frame_len) || (header.frame_magic_len != LPPS_FORMAT.magic_len)
+            || std::memcmp(header.frame_magic, LPPS_FORMAT.magic, LPPS_FORMAT.magic_len))
+        throw std::runtime_error((name + ", replay failed : " + path + " is not LPPS capture"));
+
+    stopBusyPoll(channel);
+    stopCapture(channel);
+    _data_socket[channel] = device;
+    // drain budget of the channel stays, with the ring for it
+    const net::DrainConfig drain = _framer[channel]->drain();
+    _framer[channel].reset(new net::ProtocolFramer<LppsProtocol>(device, std::max(net::RING_BUF_LENGTH, drain.max_bytes)));
+    _framer[channel]->setDrain(drain);
+    return device;
+}
+
+std::size_t LppsReceiver::receiveLppsFrames(std::vector<const lpps_frame*>& frames, lpps_channels channel, uint8_t& errors) {
+
+    frames.clear();
+    if (_data_socket[channel]->isStubbed()) return 0;
+
+    /*
+     Every channel has its own framer (receive ring + fragment of the last frame),
+     so the channels can be read in any order, or each from its own thread.
+     Frames returned in the previous call are released here, so pointers are valid until the next call.
+     */
+    const std::size_t nframes = _framer[channel]->receive(frames, errors);
+    countErrors(channel, frames.data(), nframes);
+    return nframes;
+}
+
+std::size_t LppsReceiver::receiveLppsFrames(net::FrameBatch& batch, lpps_channels channel) {
+
+    batch.frames.clear();
+    if (_data_socket[channel]->isStubbed()) return 0;
+
+    const std::size_t nframes = _framer[channel]->receive(batch);
+    countErrors(channel, batch.frames.data(), nframes);
     return nframes;
+}
 
+template <typename Frame>
+void LppsReceiver::countErrors(lpps_channels channel, const Frame* const* frames, std::size_t nframes) {
+    auto errors = [frames](std::size_t n) { return (LppsProtocol::errors::get(reinterpret_cast<const uint8_t*>(frames[n])));};
+
+    // errors are rare, look at the bits only when some frame has them
+    uint32_t any = 0;
+    for (std::size_t n = 0; n < nframes; n++) any |= errors(n);
+    if (!any) return;
+
+    net::ChannelMetrics& metrics = _data_socket[channel]->metrics();
+    for (std::size_t bit = 0; bit < net::METRICS_ERROR_BITS; bit++) {
+        if (!(any & (1u << bit))) continue;
+        uint64_t count = 0;
+        for (std::size_t n = 0; n < nframes; n++) count += (errors(n) >> bit) & 1u;
+        net::ChannelMetrics::add(metrics.error_bits[bit], count);
+    }
 }
 
 }// & _receiver
-
@@ -8,18 +8,30 @@
 #ifndef SRC_PISA_NETDEVICES_Lpps_RECEIVER_HPP_
 #define SRC_PISA_NETDEVICES_Lpps_RECEIVER_HPP_
 
+#include <cstddef>
 #include <string>
 #include <vector>
 #include <array>
 
 #include "NetDevice.hpp"
+#include "NetReactor.hpp"
+#include "StreamFramer.hpp"
+#include "FrameProtocol.hpp"
+#include "ReplayDevice.hpp"
+#include "BusyPoll.hpp"
+#include "ScpiChannel.hpp"
+#include "ConnectionManager.hpp"
 #include "pisa/utils/utils.hpp"
 #include <memory>
+#include <functional>
 
 namespace lpps_receiver {
 
 constexpr size_t IDN_ACK_SIZE = 29; //
+constexpr int IDN_POLL_MS = 10; // sendIdnQuery waits for the answer in such steps
 constexpr uint8_t NET_ERROR = 0x01;
+//errors passed to the reactor handler when the data channel is closed or broken
+constexpr uint8_t CHANNEL_LOST = 0x02;
 
 /*
  * REMEMBER LITTLE ENDIAN!!
@@ -58,6 +70,27 @@ struct lpps_frame {
 #pragma pack(pop)
 
 constexpr ssize_t LPPS_FRAME_LEN = sizeof(lpps_frame);
+// lpps_frame::frame_delay_pru_cycle unit
+constexpr uint32_t PRU_CYCLE_NS = 5u;
+constexpr uint8_t LPPS_MAGIC[] = { 0x01, 'L', 'P', 'P', 'S' };
+constexpr net::FrameFormat LPPS_FORMAT = { LPPS_MAGIC, sizeof(LPPS_MAGIC), LPPS_FRAME_LEN, 0 };
+
+// frame layout for the framer and the decoder (LPPS_FORMAT at compile time), frames are the whole lpps_frame
+struct LppsProtocol : net::FrameProtocol<LPPS_FRAME_LEN, 0u, LPPS_MAGIC[0], LPPS_MAGIC[1], LPPS_MAGIC[2], LPPS_MAGIC[3], LPPS_MAGIC[4]> {
+    using lpps_data = net::FrameField<uint32_t, offsetof(lpps_frame, lpps_data)>;
+    using delay_cycles = net::FrameField<uint32_t, offsetof(lpps_frame, frame_delay_pru_cycle)>;
+    using errors = net::FrameField<uint32_t, offsetof(lpps_frame, errors)>;
+    using data_ntp = net::FrameField<uint64_t, offsetof(lpps_frame, data_timestamp_ntp)>;
+    using pps_ntp = net::FrameField<uint64_t, offsetof(lpps_frame, pps_timestamp_ntp)>;
+};
+static_assert(LppsProtocol::magic_len == sizeof(LPPS_MAGIC), "LppsProtocol: magic of LPPS_MAGIC");
+
+/*
+ * @brief called from the reactor thread with frames parsed from one recv
+ * @param frames - pointers to the frames, valid only inside of the handler
+ * @param errors - as in receiveLppsFrames, CHANNEL_LOST when the channel was removed from the reactor
+ */
+using FramesHandler = std::function<void(lpps_channels channel, const std::vector<const lpps_frame*>& frames, uint8_t errors)>;
 
 class LppsReceiver  {
     public:
@@ -72,27 +105,130 @@ class LppsReceiver  {
          */
        void connect(const std::string& hostname, int main_port) throw(std::exception);
        void connect_channel(const std::string& hostname, lpps_channels channel, int data_port ) throw(std::exception);
+       /*
+        * data channel kept connected by the manager - connected in the background by manager.poll(),
+        * reconnected with backoff when lost (CHANNEL_LOST). connected is called after every connect,
+        * attach (or startBusyPoll) the channel there. Socket settings (setRxBackend, ...) survive the reconnects.
+        */
+       void connect_channel(net::ConnectionManager& manager, const std::string& hostname, lpps_channels channel, int data_port,
+               std::function<void(lpps_channels channel)> connected = nullptr);
        std::string sendIdnQuery() throw (std::exception);
        void sendAcq(bool activate, lpps_channels channel);
         std::size_t receiveLppsFrames(std::vector<const lpps_frame*>& pframes, lpps_channels channel, uint8_t& errors);
+
+        /*
+        @brief - frames for the other thread, see net::FrameBatchPool
+        frames are valid until the batch is released to its pool, batch.errors as errors above
+        */
+        std::size_t receiveLppsFrames(net::FrameBatch& batch, lpps_channels channel);
         void purgeSocket(lpps_channels channel);
 
+        // reassembly state and statistics of the channel
+        inline net::StreamFramer& getFramer(lpps_channels channel) { return (*_framer[channel]);}
+
+        /*
+         * Register connected data channel in the event loop, instead of polling receiveLppsFrames.
+         * Handler is called every time new frames arrive. On hang up or socket error channel is removed
+         * from the reactor and handler is called with no frames and errors = CHANNEL_LOST
+         */
+        void attach(net::NetReactor& reactor, lpps_channels channel, FramesHandler handler) throw(std::exception);
+        void detach(net::NetReactor& reactor, lpps_channels channel);
+
+        /*
+         * select how the data channel is read (recv, io_uring or zero copy), return the backend in use
+         * select before attach, the reactor waits on a different descriptor with io_uring
+         */
+        net::rx_backend setRxBackend(lpps_channels channel, net::rx_backend backend);
+
+        /*
+         * kernel RX timestamps of the data channel (FrameBatch::rx_time_ns), return false when not supported
+         * the channel is read by recv then (no io_uring), so select before attach as well
+         */
+        bool setRxTimestamping(lpps_channels channel, net::rx_timestamping mode);
+
+        /*
+         * drain mode of the data channel (see net::DrainConfig): receive keeps reading until the socket is drained
+         * or the budget is used, SO_RCVBUF/SO_RCVLOWAT (in frames) of the socket, also after reconnect.
+         * set before the channel is read, the framer is replaced when its ring is smaller than max_bytes.
+         * return false when the socket options were refused
+         */
+        bool setRxDrain(lpps_channels channel, const net::DrainConfig& drain);
+
+        /*
+        @brief - read the connected data channel by its own (pinned, spinning) thread instead of the reactor,
+        see net::BusyPollReceiver. handler is called from that thread, as from the reactor (CHANNEL_LOST too).
+        Don't use receiveLppsFrames/attach on the channel while it runs, connect_channel and replay stop it.
+        The handler (CHANNEL_LOST too) can stop or restart it (stopBusyPoll, connect_channel, startBusyPoll): the thread
+        can't join itself, it ends after the handler returns and is joined by the next stopBusyPoll/startBusyPoll
+        of the channel or by the destructor. Don't destroy the receiver from the handler.
+        */
+        void startBusyPoll(lpps_channels channel, const net::BusyPollConfig& config, FramesHandler handler) throw(std::exception);
+        void stopBusyPoll(lpps_channels channel);
+        // nullptr when not started or its thread has ended (stopped, connection lost),
+        // latency() - kernel arrival -> handler, one sample per handler call (see net::BusyPollReceiver)
+        inline net::BusyPollReceiver* getBusyPoll(lpps_channels channel) {
+            return ((_busy_poll[channel] && _busy_poll[channel]->isRunning()) ? _busy_poll[channel].get() : nullptr);
+        }
+
+        /*
+         * record raw data of the channel to the file (+ index file), see net::CaptureWriter
+         * call from the thread reading the channel (or before it starts), previous capture is closed
+         */
+        void startCapture(lpps_channels channel, const std::string& path) throw(std::exception);
+        void stopCapture(lpps_channels channel);
+
+        /*
+         * counters of the main and data sockets into the shared memory (name_main, name_data1, name_data2),
+         * see net::MetricsRegion - region has to outlive the receiver, export before connect
+         */
+        void exportMetrics(net::MetricsRegion& region) throw(std::exception);
+
+        /*
+         * replace the data channel with the capture file, frames are read as from the socket
+         * (connect_channel is not needed), return the device to check the end of the capture
+         */
+        std::shared_ptr<net::ReplayDevice> replay(lpps_channels channel, const std::string& path, net::replay_pace pace = net::replay_pace::FAST) throw(std::exception);
+
         /*
          * Send query for ACQ status, don't wait for answer, return errors in case of problems (with connection, usually)
          */
         uint8_t queryAcqAsync();
         uint8_t readAcqAsync(std::pair<bool, bool>& acq);
+
+        /*
+         * ACQ status through the command channel, completed by commands().poll() (or ScpiChannel::pollAll
+         * for many receivers), throws from get() on timeout or lost connection. Don't mix with queryAcqAsync/readAcqAsync
+         */
+        std::future<std::pair<bool, bool>> queryAcq(std::chrono::milliseconds timeout = net::SCPI_TIMEOUT);
+        // pipelined commands on the main socket, see net::ScpiChannel
+        inline net::ScpiChannel& commands() { return (*_scpi);}
+        // sockets of the receiver, for the bring-up without the blocking connect (see fleet::FleetBringUp)
+        inline std::shared_ptr<net::NetDevice> getMainSocket() { return (_main_socket);}
+        inline std::shared_ptr<net::NetDevice> getDataSocket(lpps_channels channel) { return (_data_socket[channel]);}
         bool async_task;
 
 
 
     private:
+        // tally of the lpps_frame::errors bits into the channel metrics
+        // (lpps_frame pointers or the byte pointers of a batch - the pointer array is never cast)
+        template <typename Frame>
+        void countErrors(lpps_channels channel, const Frame* const* frames, std::size_t nframes);
+
         std::shared_ptr<net::NetDevice> _main_socket;
+        std::unique_ptr<net::ScpiChannel> _scpi;
         utils::enum_array<lpps_channels, std::shared_ptr<net::NetDevice>,2> _data_socket;
+        //frames buffer for the reactor handlers, to not allocate on every event
+        utils::enum_array<lpps_channels, std::vector<const lpps_frame*>,2> _rx_frames;
+        //reassembly state per channel, the fragment of the last frame stays there until next recv
+        utils::enum_array<lpps_channels, std::unique_ptr<net::ProtocolFramer<LppsProtocol>>,2> _framer;
+        //raw data recording, nullptr when not active
+        utils::enum_array<lpps_channels, std::unique_ptr<net::CaptureWriter>,2> _capture;
+        //busy poll thread, nullptr when the channel is read by the caller/reactor (destroyed first, uses the members above)
+        utils::enum_array<lpps_channels, std::unique_ptr<net::BusyPollReceiver>,2> _busy_poll;
+        // stopped from its own thread, joined later
+        utils::enum_array<lpps_channels, std::unique_ptr<net::BusyPollReceiver>,2> _busy_poll_ended;
         std::string name;
-        //remaining data from previous packet - len, position in packet
-        size_t rem_data_len;
-        size_t rem_data_start;
 
 };//class
 
@@ -0,0 +1,318 @@
+/*
+ * Logger.cpp
+ *
+ *  Asynchronous binary logger: IO threads only copy the arguments into their own ring,
+ *  formatting and the console/file IO are done by the background thread.
+ */
+
+#include "Logger.hpp"
+
+#include <cstdio>
+#include <cerrno>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace net {
+
+namespace { // for internal use only
+
+struct ThreadRing {
+    RingBuffer ring;
+    // owning thread ended, ring is removed when empty
+    std::atomic<bool> closed;
+
+    ThreadRing(std::size_t length) : ring(length), closed(false) {}
+};
+
+class Backend {
+    public:
+        Backend() : _config(), _sink(stderr), _running(false), _written(0), _dropped(0), _suppressed(0) {}
+
+        ~Backend() {
+            stop();
+            if (_sink != stderr) std::fclose(_sink);
+        }
+
+        void configure(const LoggerConfig& config) {
+            stop();
+            std::FILE* sink = stderr;
+            if (!config.path.empty() && !(sink = std::fopen(config.path.c_str(), "a")))
+                throw std::runtime_error("Logger: cannot open " + config.path + ", error: " + std::to_string(errno));
+
+            std::lock_guard<std::mutex> lock(_mtx);
+            if (_sink != stderr) std::fclose(_sink);
+            _sink = sink;
+            _config = config;
+            if (!_rings.empty()) start();
+        }
+
+        std::shared_ptr<ThreadRing> attach() {
+            std::lock_guard<std::mutex> lock(_mtx);
+            auto ring = std::make_shared<ThreadRing>(_config.ring_length);
+            _rings.push_back(ring);
+            if (!_running) start();
+            return ring;
+        }
+
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(_mtx);
+                if (!_running) return;
+                _running = false;
+            }
+            _cv.notify_all();
+            _thread.join();
+            drain();
+        }
+
+        // all rings, records of this round sorted by time, one write
+        void drain() {
+            std::lock_guard<std::mutex> drain_lock(_drain_mtx);
+            std::vector<std::shared_ptr<ThreadRing>> rings;
+            {
+                std::lock_guard<std::mutex> lock(_mtx);
+                rings = _rings;
+            }
+
+            _records.clear();
+            std::vector<uint64_t> tails;
+            for (auto& ring : rings) {
+                const uint64_t tail = ring->ring.tail();
+                for (uint64_t pos = ring->ring.head(); pos < tail; ) {
+                    const LogRecord* record = reinterpret_cast<const LogRecord*>(ring->ring.at(pos));
+                    _records.push_back(Pending { record->time_ns, record });
+                    pos += record->size;
+                }
+                tails.push_back(tail);
+            }
+            if (_records.empty()) {
+                removeClosed();
+                return;
+            }
+
+            std::stable_sort(_records.begin(), _records.end(), [](const Pending& a, const Pending& b) { return (a.time_ns < b.time_ns); });
+            _text.clear();
+            for (auto& pending : _records) format(*pending.record);
+            // released only after formatting, the producer can't overwrite the records
+            for (std::size_t n = 0; n < rings.size(); n++) rings[n]->ring.releaseTo(tails[n]);
+
+            std::FILE* sink;
+            {
+                std::lock_guard<std::mutex> lock(_mtx);
+                sink = _sink;
+            }
+            std::fwrite(_text.data(), 1, _text.size(), sink);
+            std::fflush(sink);
+            _written.fetch_add(_records.size(), std::memory_order_relaxed);
+            removeClosed();
+        }
+
+        void dropped() { _dropped.fetch_add(1, std::memory_order_relaxed);}
+        void suppressed(uint64_t count) { _suppressed.fetch_add(count, std::memory_order_relaxed);}
+
+        LoggerStats stats() {
+            return LoggerStats { _written.load(std::memory_order_relaxed), _dropped.load(std::memory_order_relaxed),
+                    _suppressed.load(std::memory_order_relaxed) };
+        }
+
+    private:
+        struct Pending {
+            uint64_t time_ns;
+            const LogRecord* record;
+        };
+
+        // under _mtx
+        void start() {
+            _running = true;
+            _thread = std::thread([this]() {
+                std::unique_lock<std::mutex> lock(_mtx);
+                while (_running) {
+                    _cv.wait_for(lock, _config.flush_interval);
+                    lock.unlock();
+                    drain();
+                    lock.lock();
+                }
+            });
+        }
+
+        void removeClosed() {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _rings.erase(std::remove_if(_rings.begin(), _rings.end(), [](const std::shared_ptr<ThreadRing>& ring) {
+                return (ring->closed && !ring->ring.size()); }), _rings.end());
+        }
+
+        void format(const LogRecord& record);
+
+        LoggerConfig _config;
+        std::FILE* _sink;
+        std::mutex _mtx;
+        std::condition_variable _cv;
+        std::thread _thread;
+        bool _running;
+        std::vector<std::shared_ptr<ThreadRing>> _rings;
+
+        // drain state, under _drain_mtx
+        std::mutex _drain_mtx;
+        std::vector<Pending> _records;
+        std::string _text;
+
+        std::atomic<uint64_t> _written;
+        std::atomic<uint64_t> _dropped;
+        std::atomic<uint64_t> _suppressed;
+};
+
+void Backend::format(const LogRecord& record) {
+    const LogSite& site = *record.site;
+    char prefix[96];
+    const time_t seconds = static_cast<time_t>(record.time_ns / 1000000000u);
+    struct tm tm;
+    localtime_r(&seconds, &tm);
+    const std::size_t len = std::strftime(prefix, sizeof(prefix), "%Y-%m-%d %H:%M:%S", &tm);
+    std::snprintf(prefix + len, sizeof(prefix) - len, ".%06u %-7s ", static_cast<unsigned>((record.time_ns % 1000000000u) / 1000u), levelName(site.level));
+    _text += prefix;
+
+    // file name without the path
+    const char* file = std::strrchr(site.file, '/');
+    _text += file ? file + 1 : site.file;
+    _text += ':';
+    _text += std::to_string(site.line);
+    _text += " > ";
+
+    const uint8_t* arg = reinterpret_cast<const uint8_t*>(&record) + sizeof(LogRecord);
+    const uint8_t* end = reinterpret_cast<const uint8_t*>(&record) + record.size;
+    for (const char* f = site.format; *f; f++) {
+        if ((f[0] != '{') || (f[1] != '}')) {
+            _text += *f;
+            continue;
+        }
+        f++;
+        // more {} than arguments - left as is
+        if ((arg >= end) || !*arg || (*arg > static_cast<uint8_t>(logging::arg_type::STRING))) {
+            _text += "{}";
+            continue;
+        }
+        const logging::arg_type type = static_cast<logging::arg_type>(*arg++);
+        switch (type) {
+            case logging::arg_type::SIGNED: {
+                int64_t value;
+                std::memcpy(&value, arg, sizeof(value));
+                arg += sizeof(value);
+                _text += std::to_string(value);
+                break;
+            }
+            case logging::arg_type::UNSIGNED: {
+                uint64_t value;
+                std::memcpy(&value, arg, sizeof(value));
+                arg += sizeof(value);
+                _text += std::to_string(value);
+                break;
+            }
+            case logging::arg_type::DOUBLE: {
+                double value;
+                char buf[32];
+                std::memcpy(&value, arg, sizeof(value));
+                arg += sizeof(value);
+                std::snprintf(buf, sizeof(buf), "%g", value);
+                _text += buf;
+                break;
+            }
+            case logging::arg_type::BOOL:
+                _text += (*arg++ ? "true" : "false");
+                break;
+            case logging::arg_type::CHAR:
+                _text += static_cast<char>(*arg++);
+                break;
+            case logging::arg_type::STRING: {
+                uint32_t n;
+                std::memcpy(&n, arg, sizeof(n));
+                arg += sizeof(n);
+                _text.append(reinterpret_cast<const char*>(arg), n);
+                arg += n;
+                break;
+            }
+        }
+    }
+    if (record.suppressed) _text += " (" + std::to_string(record.suppressed) + " more suppressed)";
+    _text += '\n';
+}
+
+Backend& backend() {
+    static Backend instance;
+    return instance;
+}
+
+struct ThreadLog {
+    std::shared_ptr<ThreadRing> ring;
+    bool failed;
+
+    ThreadLog() : failed(false) {}
+    ~ThreadLog() {
+        if (ring) ring->closed = true;
+    }
+};
+
+} // end namespace
+
+std::atomic<int> Logger::_level(static_cast<int>(log_level::LVL_INFO));
+
+const char* levelName(log_level level) {
+    switch (level) {
+        case log_level::LVL_DEBUG: return "DEBUG";
+        case log_level::LVL_INFO: return "INFO";
+        case log_level::LVL_WARNING: return "WARNING";
+        case log_level::LVL_ERROR: return "ERROR";
+        default: return "OFF";
+    }
+}
+
+bool LogSite::allow(uint64_t time_ns) {
+    const uint64_t second = time_ns / 1000000000u;
+    uint64_t current = window.load(std::memory_order_relaxed);
+    // first thread in the new second restarts the count, the race costs at most a few records
+    if ((current != second) && window.compare_exchange_strong(current, second, std::memory_order_relaxed))
+        count.store(0, std::memory_order_relaxed);
+    if (count.fetch_add(1, std::memory_order_relaxed) < limit) return true;
+    suppressed.fetch_add(1, std::memory_order_relaxed);
+    backend().suppressed(1);
+    return false;
+}
+
+void Logger::configure(const LoggerConfig& config) throw(std::exception) {
+    backend().configure(config);
+    setLevel(config.level);
+}
+
+void Logger::flush() {
+    backend().drain();
+}
+
+void Logger::shutdown() {
+    backend().stop();
+}
+
+LoggerStats Logger::stats() {
+    return backend().stats();
+}
+
+RingBuffer* Logger::threadRing() {
+    static thread_local ThreadLog log;
+    if (!log.ring && !log.failed) {
+        try {
+            log.ring = backend().attach();
+        }
+        catch (std::exception& e) {
+            // no memfd/mmap - this thread doesn't log
+            log.failed = true;
+        }
+    }
+    return (log.ring ? &log.ring->ring : nullptr);
+}
+
+void Logger::dropped() {
+    backend().dropped();
+}
+
+} // namespace net
@@ -0,0 +1,236 @@
+/*
+ * Logger.hpp
+ *
+ *  Asynchronous binary logger: IO threads only copy the arguments into their own ring,
+ *  formatting and the console/file IO are done by the background thread.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_LOGGER_HPP_
+#define SRC_PISA_NETDEVICES_LOGGER_HPP_
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <type_traits>
+#include <stdexcept>
+#include <time.h>
+
+#include "RingBuffer.hpp"
+
+namespace net {
+
+// ring of one thread, full ring drops the records (never blocks the thread)
+constexpr std::size_t LOG_RING_LENGTH = 64u * 1024u;
+// longer strings are cut
+constexpr std::size_t LOG_MAX_STRING = 1024u;
+
+// LVL_ prefix - DEBUG/ERROR are often defined as macros (-DDEBUG)
+enum class log_level : int {
+    LVL_DEBUG = 0,
+    LVL_INFO,
+    LVL_WARNING,
+    LVL_ERROR,
+    LVL_OFF,
+};
+
+const char* levelName(log_level level);
+
+struct LoggerConfig {
+    log_level level = log_level::LVL_INFO;
+    // empty - stderr
+    std::string path;
+    // records are written in such steps (the IO threads never wake the logger up)
+    std::chrono::milliseconds flush_interval = std::chrono::milliseconds(20);
+    // ring of the threads which log for the first time after configure
+    std::size_t ring_length = LOG_RING_LENGTH;
+};
+
+struct LoggerStats {
+    uint64_t written;
+    uint64_t dropped;       // ring full
+    uint64_t suppressed;    // over the rate limit of the call site
+};
+
+/*
+ * One log statement (the static object created by the NETLOG macros), with the state
+ * of its rate limit - at most limit records per second, the rest is counted and reported
+ * with the next record which passes.
+ */
+struct LogSite {
+    const log_level level;
+    const char* const file;
+    const int line;
+    const char* const format;
+    const uint32_t limit;       // per second, 0 - no limit
+    std::atomic<uint64_t> window;
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> suppressed;
+
+    constexpr LogSite(log_level level_, const char* file_, int line_, const char* format_, uint32_t limit_) :
+            level(level_), file(file_), line(line_), format(format_), limit(limit_), window(0), count(0), suppressed(0) {}
+
+    // false - over the limit in this second
+    bool allow(uint64_t time_ns);
+};
+
+/*
+ * Process wide logger. A record is the call site pointer, time and the binary copy of the arguments
+ * (numbers, strings - no formatting) appended to the lock free ring of the calling thread (single
+ * producer - single consumer, net::RingBuffer). Background thread drains all rings every flush_interval,
+ * sorts the records by time, replaces "{}" in the format by the arguments and writes them with one write.
+ *
+ * Started with the default config by the first record, configure() to change it (level can be
+ * changed any time by setLevel). Records left in the rings are written by shutdown() or at exit.
+ * Arguments: integers, enums, floating point, bool, char, const char*, std::string.
+ *
+ * Example usage:
+ *
+ *    net::LoggerConfig config;
+ *    config.path = "/var/log/pisa_receiver.log";
+ *    net::Logger::configure(config);
+ *    NETLOG_INFO("{} connected to {}:{}", name, host, port);
+ *    NETLOG_LIMITED(net::log_level::LVL_WARNING, 1, "{} is in stub mode", name); // once per second at most
+ */
+class Logger {
+    public:
+        static void configure(const LoggerConfig& config) throw(std::exception);
+        static inline void setLevel(log_level level) { _level.store(static_cast<int>(level), std::memory_order_relaxed);}
+        static inline bool enabled(log_level level) {
+            return (static_cast<int>(level) >= _level.load(std::memory_order_relaxed));
+        }
+
+        template<typename... Args>
+        static void log(LogSite& site, const Args&... args);
+
+        // write everything logged so far (by the caller, not waiting for the flush interval)
+        static void flush();
+        // flush and stop the background thread (end of the program), configure() starts it again
+        static void shutdown();
+        static LoggerStats stats();
+
+    private:
+        // ring of the calling thread, nullptr when it can't be created
+        static RingBuffer* threadRing();
+        static void dropped();
+
+        static std::atomic<int> _level;
+};
+
+// record in the ring, followed by the arguments
+struct LogRecord {
+    uint32_t size;          // with the header, multiple of 8
+    uint32_t suppressed;
+    uint64_t time_ns;       // CLOCK_REALTIME
+    const LogSite* site;
+};
+
+namespace logging { // encoding of the arguments, for internal use only
+
+// 0 - end of the arguments (padding of the record)
+enum class arg_type : uint8_t {
+    SIGNED = 1u,
+    UNSIGNED,
+    DOUBLE,
+    BOOL,
+    CHAR,
+    STRING,     // uint32_t length + bytes
+};
+
+template<typename T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, int>::type = 0>
+inline std::size_t argSize(const T&) { return (1u + sizeof(uint64_t));}
+template<typename T, typename std::enable_if<std::is_floating_point<T>::value, int>::type = 0>
+inline std::size_t argSize(const T&) { return (1u + sizeof(double));}
+inline std::size_t argSize(bool) { return (2u);}
+inline std::size_t argSize(char) { return (2u);}
+inline std::size_t argSize(const char* s) { return (1u + sizeof(uint32_t) + (s ? std::min(std::strlen(s), LOG_MAX_STRING) : 0u));}
+inline std::size_t argSize(const std::string& s) { return (1u + sizeof(uint32_t) + std::min(s.size(), LOG_MAX_STRING));}
+
+template<typename T>
+inline void put(uint8_t*& out, arg_type type, const T& value) {
+    *out++ = static_cast<uint8_t>(type);
+    std::memcpy(out, &value, sizeof(value));
+    out += sizeof(value);
+}
+
+inline void putString(uint8_t*& out, const char* s, std::size_t len) {
+    const uint32_t n = static_cast<uint32_t>(std::min(len, LOG_MAX_STRING));
+    put(out, arg_type::STRING, n);
+    if (n) std::memcpy(out, s, n);
+    out += n;
+}
+
+template<typename T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, int>::type = 0>
+inline void putArg(uint8_t*& out, const T& value) { put(out, arg_type::SIGNED, static_cast<int64_t>(value));}
+template<typename T, typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, int>::type = 0>
+inline void putArg(uint8_t*& out, const T& value) { put(out, arg_type::UNSIGNED, static_cast<uint64_t>(value));}
+template<typename T, typename std::enable_if<std::is_enum<T>::value, int>::type = 0>
+inline void putArg(uint8_t*& out, const T& value) { put(out, arg_type::SIGNED, static_cast<int64_t>(value));}
+template<typename T, typename std::enable_if<std::is_floating_point<T>::value, int>::type = 0>
+inline void putArg(uint8_t*& out, const T& value) { put(out, arg_type::DOUBLE, static_cast<double>(value));}
+inline void putArg(uint8_t*& out, bool value) { put(out, arg_type::BOOL, static_cast<uint8_t>(value));}
+inline void putArg(uint8_t*& out, char value) { put(out, arg_type::CHAR, value);}
+inline void putArg(uint8_t*& out, const char* s) { putString(out, s ? s : "", s ? std::strlen(s) : 0u);}
+inline void putArg(uint8_t*& out, const std::string& s) { putString(out, s.data(), s.size());}
+
+inline std::size_t argsSize() { return (0u);}
+template<typename T, typename... Args>
+inline std::size_t argsSize(const T& value, const Args&... args) { return (argSize(value) + argsSize(args...));}
+
+inline void putArgs(uint8_t*&) {}
+template<typename T, typename... Args>
+inline void putArgs(uint8_t*& out, const T& value, const Args&... args) {
+    putArg(out, value);
+    putArgs(out, args...);
+}
+
+inline uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (static_cast<uint64_t>(ts.tv_sec) * 1000000000u + static_cast<uint64_t>(ts.tv_nsec));
+}
+
+} // namespace logging
+
+template<typename... Args>
+void Logger::log(LogSite& site, const Args&... args) {
+    const uint64_t now = logging::nowNs();
+    if (site.limit && !site.allow(now)) return;
+
+    RingBuffer* ring = threadRing();
+    const std::size_t size = (sizeof(LogRecord) + logging::argsSize(args...) + 7u) & ~static_cast<std::size_t>(7u);
+    if (!ring || (ring->writable() < size)) {
+        dropped();
+        return;
+    }
+
+    // contiguous also over the end of the ring
+    uint8_t* out = ring->writePtr();
+    LogRecord record = { static_cast<uint32_t>(size), site.limit ? site.suppressed.exchange(0, std::memory_order_relaxed) : 0u, now, &site };
+    std::memcpy(out, &record, sizeof(record));
+    out += sizeof(record);
+    logging::putArgs(out, args...);
+    std::memset(out, 0, size - static_cast<std::size_t>(out - ring->writePtr()));
+    ring->commit(size);
+}
+
+} // namespace net
+
+// the arguments are evaluated only when the level is enabled
+#define NETLOG_LIMITED(level, per_second, format, ...) \
+    do { \
+        if (net::Logger::enabled(level)) { \
+            static net::LogSite _netlog_site(level, __FILE__, __LINE__, format, per_second); \
+            net::Logger::log(_netlog_site, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define NETLOG(level, format, ...) NETLOG_LIMITED(level, 0u, format, ##__VA_ARGS__)
+#define NETLOG_DEBUG(format, ...) NETLOG(net::log_level::LVL_DEBUG, format, ##__VA_ARGS__)
+#define NETLOG_INFO(format, ...) NETLOG(net::log_level::LVL_INFO, format, ##__VA_ARGS__)
+#define NETLOG_WARNING(format, ...) NETLOG(net::log_level::LVL_WARNING, format, ##__VA_ARGS__)
+#define NETLOG_ERROR(format, ...) NETLOG(net::log_level::LVL_ERROR, format, ##__VA_ARGS__)
+
+#endif /* SRC_PISA_NETDEVICES_LOGGER_HPP_ */
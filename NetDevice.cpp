@@ -1,4 +1,7 @@
 #include "NetDevice.hpp"
+#include "UringReceiver.hpp"
+#include "ZeroCopyReceiver.hpp"
+#include "Logger.hpp"
 
 #include <string>
 #include <stdexcept>
@@ -13,7 +16,20 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <fcntl.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
 #include <cstring>
+#include <algorithm>
+
+// older libc headers
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
 
 //#define _NET_DEVICE_DEBUG
 
@@ -29,9 +45,24 @@ NetDevice::NetDevice(const std::string& name) :
         _name(name),
         _host(""),
         _port(0),
+        _timeout(0),
+        _connection(0),
         _sockfd(0),
         _buffer(INIT_BUF_LENGTH),
-        stubbed(true) {
+        stubbed(true),
+        blocking(true),
+        drained(true),
+        _rx_backend(rx_backend::RECV),
+        _zerocopy_stats(),
+        _rx_timestamping(rx_timestamping::NONE),
+        _rx_timestamp(0),
+        _busy_poll_us(0),
+        _prefer_busy_poll(false),
+        _busy_poll_budget(0),
+        _rcvbuf(0),
+        _rcvlowat(0),
+        _metrics(&_local_metrics) {
+    _local_metrics.setName(name);
 }
 
 const std::string NetDevice::getName() {
@@ -46,36 +77,47 @@ NetDevice::~NetDevice() {
 
 void NetDevice::connect(const std::string& host, int port, int timeout, bool _blocking) throw(std::exception) {
     if (stubbed) {
-        std::cerr << "The " << _name << " is in STUBBED mode, can't connect to " << host << ":" << port << std::endl;
+        NETLOG_WARNING("the {} is in STUBBED mode, can't connect to {}:{}", _name, host, port);
         return;
     }
+    if (startConnect(host, port, timeout, _blocking)) return;
+
+    // wait for the handshake, dead host doesn't stall us for the kernel SYN timeout
+    struct pollfd pfd = { _sockfd, POLLOUT, 0 };
+    int ready;
+    do {
+        ready = ::poll(&pfd, 1, timeout ? (timeout * 1000) : CONNECT_TIMEOUT_MS);
+    } while ((ready < 0) && (errno == EINTR));
+
+    if (ready <= 0) {
+        closeSocket();
+        stubbed = true;
+        throw std::runtime_error((_name + " connect failed : cannot connect to " + _host + ":" + std::to_string(port) + ", timeout"));
+    }
+    finishConnect();
+}
+
+bool NetDevice::startConnect(const std::string& host, int port, int timeout, bool _blocking) throw(std::exception) {
     if (_sockfd) {
-        std::cerr<<_name <<" connect failed : equipment is already connected. Disconnect first"<<std::endl;
-       // throw std::runtime_error((_name + " connect failed : equipment is already connected. Disconnect first"));
+        NETLOG_WARNING("{} connect : equipment is already connected, previous connection is closed", _name);
+        closeSocket();
     }
 
     // store host address
     _host = host;
     _port = port;
-    /*
-     std::unique_lock<std::mutex> rx_lock(_rx_mtx,std::defer_lock);
-     if (rx_lock.try_lock()) {}
-     else
-     _debug("netdevice::connect try_rx_lock fail!");
-
-
-
-     std::unique_lock<std::mutex> tx_lock(_tx_mtx,std::defer_lock);
-     if (tx_lock.try_lock()) {}
-     else
-     _debug("netdevice::connect try_tx_lock fail!");
-     */
+    _timeout = timeout;
+    blocking = _blocking;
 
-    // create socket
-    if (!(_sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP))) {
+    // create socket, non blocking for the connect, the mode is set when connected
+    if ((_sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP)) < 0) {
+        _sockfd = 0;
         stubbed = true;
         throw std::runtime_error((_name + " connect failed : cannot create client socket, error: " + std::to_string(errno)));
     }
+    // before connect - the window scale of the connection depends on it
+    if (_rcvbuf && (setsockopt(_sockfd, SOL_SOCKET, SO_RCVBUF, &_rcvbuf, sizeof(_rcvbuf)) != 0))
+        NETLOG_WARNING("{} SO_RCVBUF refused, error: {}", _name, errno);
 
     const struct sockaddr_in address =
     {
@@ -84,16 +126,37 @@ void NetDevice::connect(const std::string& host, int port, int timeout, bool _bl
       { inet_addr(_host.c_str()) } };
 
     // connect to host
-    if (::connect(_sockfd, reinterpret_cast<const struct sockaddr*>(&address), sizeof(address)) != 0) {
-        stubbed = true;
-        throw std::runtime_error((_name + " connect failed : cannot connect to " + _host + ":" + std::to_string(port) + ", error: " + std::to_string(errno)));
+    if (::connect(_sockfd, reinterpret_cast<const struct sockaddr*>(&address), sizeof(address)) == 0) {
+        setupConnection();
+        return true;
     }
+    if (errno == EINPROGRESS) return false;
 
-    if (_blocking == false) {
-        //Set non block
-        fcntl(_sockfd, F_SETFL, O_NONBLOCK);
-        //TODO:Check the keepalive config is neccesary for nb socket
+    const int error = errno;
+    closeSocket();
+    stubbed = true;
+    throw std::runtime_error((_name + " connect failed : cannot connect to " + _host + ":" + std::to_string(port) + ", error: " + std::to_string(error)));
+}
+
+bool NetDevice::finishConnect() throw(std::exception) {
+    if (!_sockfd) throw std::runtime_error((_name + " connect failed : no connection in progress"));
+
+    struct pollfd pfd = { _sockfd, POLLOUT, 0 };
+    if (::poll(&pfd, 1, 0) == 0) return false;
+
+    int error = 0;
+    socklen_t error_len = sizeof(error);
+    if ((getsockopt(_sockfd, SOL_SOCKET, SO_ERROR, &error, &error_len) != 0) || error) {
+        closeSocket();
+        stubbed = true;
+        throw std::runtime_error((_name + " connect failed : cannot connect to " + _host + ":" + std::to_string(_port) + ", error: " + std::to_string(error)));
     }
+    setupConnection();
+    return true;
+}
+
+void NetDevice::setupConnection() throw(std::exception) {
+    setBlocking(blocking);
 
     int optval = 1;
     //enable keepalive
@@ -104,23 +167,33 @@ void NetDevice::connect(const std::string& host, int port, int timeout, bool _bl
     setsockopt(_sockfd, IPPROTO_TCP, TCP_KEEPCNT, &cfg.keepcnt, sizeof cfg.keepcnt);
     setsockopt(_sockfd, IPPROTO_TCP, TCP_KEEPIDLE, &cfg.keepidle, sizeof cfg.keepidle);
     setsockopt(_sockfd, IPPROTO_TCP, TCP_KEEPINTVL, &cfg.keepintvl, sizeof cfg.keepintvl);
+    // commands are small and written at once (see ScpiChannel), don't wait for the ACK of the previous ones
+    setsockopt(_sockfd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
 
     //set timeout
 
-    if (timeout) {
+    if (_timeout) {
         struct timeval tv;
-        tv.tv_sec = timeout;
+        tv.tv_sec = _timeout;
         tv.tv_usec = 0;
         setsockopt(_sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv);
     }
 
     // test if connection is alive
     if (!isConnected()) {
+        closeSocket();
         stubbed = true;
         throw std::runtime_error((_name + " connect failed : connection is not alive: " + std::to_string(errno)));
     }
 
-    setBlocking(_blocking);
+    if (_rx_timestamping != rx_timestamping::NONE) applyRxTimestamping();
+    if (_busy_poll_us) applyBusyPoll();
+    if (_rcvbuf || _rcvlowat) applyRxBuffer();
+    if (_rx_backend == rx_backend::IO_URING) startUring();
+    else if (_rx_backend == rx_backend::ZEROCOPY) startZeroCopy();
+    drained = true;
+    _connection++;
+    ChannelMetrics::add(_metrics->connects, 1);
 }
 
 
@@ -141,7 +214,7 @@ void NetDevice::reconnect() {
 
     _debug("Device: "<<_name<<" reconnecting...");
     disconnect();
-    connect(_host, _port);
+    connect(_host, _port, _timeout, blocking);
 }
 
 void NetDevice::disconnect() {
@@ -160,8 +233,155 @@ void NetDevice::disconnect() {
         }
         else _debug("netdevice::disconnect try_tx_lock fail!");
 
-        ::close(_sockfd);
-        _sockfd = 0;
+        closeSocket();
+    }
+}
+
+void NetDevice::closeSocket() {
+    if (!_sockfd) return;
+    _uring.reset();
+    _zerocopy.reset();
+    if (_async_rx.valid()) {
+        // wake up the background recv
+        ::shutdown(_sockfd, SHUT_RDWR);
+        _async_rx.wait();
+        _async_rx = std::future<ssize_t>();
+    }
+    ::close(_sockfd);
+    _sockfd = 0;
+}
+
+int NetDevice::getPollFd() {
+    return (_uring ? _uring->getEventFd() : _sockfd);
+}
+
+rx_backend NetDevice::setRxBackend(rx_backend backend) {
+    _rx_backend = backend;
+    _uring.reset();
+    _zerocopy.reset();
+    _zerocopy_stats = ZeroCopyStats();
+    if ((backend == rx_backend::IO_URING) && _sockfd && !stubbed) startUring();
+    if ((backend == rx_backend::ZEROCOPY) && _sockfd && !stubbed) startZeroCopy();
+    return getRxBackend();
+}
+
+rx_backend NetDevice::getRxBackend() {
+    if (_uring) return rx_backend::IO_URING;
+    return (_zerocopy ? rx_backend::ZEROCOPY : rx_backend::RECV);
+}
+
+bool NetDevice::setRxTimestamping(rx_timestamping mode) {
+    _rx_timestamping = mode;
+    _rx_timestamp = 0;
+    if (!_sockfd || stubbed) return true;
+
+    if (mode != rx_timestamping::NONE) {
+        _uring.reset();
+        _zerocopy.reset();
+    }
+    // backend already running keeps its buffered completions and mapped spans
+    else if ((_rx_backend == rx_backend::IO_URING) && !_uring) startUring();
+    else if ((_rx_backend == rx_backend::ZEROCOPY) && !_zerocopy) startZeroCopy();
+    return applyRxTimestamping();
+}
+
+bool NetDevice::applyRxTimestamping() {
+    int flags = 0;
+    if (_rx_timestamping != rx_timestamping::NONE)
+        flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (_rx_timestamping == rx_timestamping::HARDWARE)
+        flags |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+
+    if (setsockopt(_sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) != 0) {
+        NETLOG_WARNING("{} SO_TIMESTAMPING not supported, error: {}", _name, errno);
+        return false;
+    }
+    return true;
+}
+
+bool NetDevice::setBusyPoll(int busy_poll_us, bool prefer, int budget) {
+    _busy_poll_us = busy_poll_us;
+    _prefer_busy_poll = prefer;
+    _busy_poll_budget = budget;
+    if (!_sockfd || stubbed) return true;
+    return applyBusyPoll();
+}
+
+bool NetDevice::setRxBuffer(int rcvbuf, int rcvlowat) {
+    _rcvbuf = rcvbuf;
+    _rcvlowat = rcvlowat;
+    if (!_sockfd || stubbed) return true;
+    return applyRxBuffer();
+}
+
+int NetDevice::getRxBuffer() {
+    if (!_sockfd || stubbed) return 0;
+    int rcvbuf = 0;
+    socklen_t len = sizeof(rcvbuf);
+    if (getsockopt(_sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &len) != 0) return 0;
+    return rcvbuf;
+}
+
+bool NetDevice::applyRxBuffer() {
+    bool applied = true;
+    if (_rcvbuf && (setsockopt(_sockfd, SOL_SOCKET, SO_RCVBUF, &_rcvbuf, sizeof(_rcvbuf)) != 0)) {
+        NETLOG_WARNING("{} SO_RCVBUF refused, error: {}", _name, errno);
+        applied = false;
+    }
+    // 1 is the kernel default
+    int rcvlowat = std::max(_rcvlowat, 1);
+    if (setsockopt(_sockfd, SOL_SOCKET, SO_RCVLOWAT, &rcvlowat, sizeof(rcvlowat)) != 0) {
+        NETLOG_WARNING("{} SO_RCVLOWAT refused, error: {}", _name, errno);
+        applied = false;
+    }
+    return applied;
+}
+
+bool NetDevice::applyBusyPoll() {
+    bool applied = true;
+    if (setsockopt(_sockfd, SOL_SOCKET, SO_BUSY_POLL, &_busy_poll_us, sizeof(_busy_poll_us)) != 0) {
+        NETLOG_WARNING("{} SO_BUSY_POLL refused, error: {}", _name, errno);
+        applied = false;
+    }
+    int prefer = (_busy_poll_us && _prefer_busy_poll) ? 1 : 0;
+    if (prefer && (setsockopt(_sockfd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer)) != 0)) {
+        NETLOG_WARNING("{} SO_PREFER_BUSY_POLL refused, error: {}", _name, errno);
+        applied = false;
+    }
+    if (_busy_poll_budget && (setsockopt(_sockfd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &_busy_poll_budget, sizeof(_busy_poll_budget)) != 0)) {
+        NETLOG_WARNING("{} SO_BUSY_POLL_BUDGET refused, error: {}", _name, errno);
+        applied = false;
+    }
+    return applied;
+}
+
+void NetDevice::setMetrics(ChannelMetrics* metrics) {
+    _metrics = metrics ? metrics : &_local_metrics;
+}
+
+void NetDevice::startUring() {
+    if (_rx_timestamping != rx_timestamping::NONE) {
+        NETLOG_WARNING("{} io_uring receive has no RX timestamps, recv is used", _name);
+        return;
+    }
+    try {
+        _uring.reset(new UringReceiver(_sockfd));
+    }
+    catch (std::exception& e) {
+        NETLOG_WARNING("{} io_uring receive not available, recv is used: {}", _name, e.what());
+    }
+}
+
+void NetDevice::startZeroCopy() {
+    if (_rx_timestamping != rx_timestamping::NONE) {
+        NETLOG_WARNING("{} zero copy receive has no RX timestamps, recv is used", _name);
+        return;
+    }
+    try {
+        _zerocopy.reset(new ZeroCopyReceiver(_sockfd));
+    }
+    catch (std::exception& e) {
+        NETLOG_WARNING("{} zero copy receive not available, recv is used: {}", _name, e.what());
     }
 }
 
@@ -195,10 +415,17 @@ int NetDevice::sendQuery(const uint8_t* cmd, const uint32_t size, const bool wai
     int bytesReceived = 0;
 
     if (waitReceive == false) {
-        // detach a thread to read answer, lock inside receive
-        std::async(std::launch::async, &NetDevice::receive, this);
+        // read answer by another thread, lock inside receive
+        // (the future is kept, temporary one would wait for the answer in its destructor);
+        // the read queues behind the previous one in that thread, the caller doesn't wait for it
+        _async_rx = std::async(std::launch::async, [this](std::future<ssize_t> previous) {
+                if (previous.valid()) previous.wait();
+                return receive();
+            }, std::move(_async_rx));
     }
     else {
+        // background reads of the previous queries take their answers first
+        if (_async_rx.valid()) _async_rx.wait();
         bytesReceived = receive();
     }_debug("from device: "<<_name<<" received "<<std::dec<<bytesReceived<<" bytes");
     //   print_debug(_buffer);
@@ -214,7 +441,7 @@ void NetDevice::sendQueryNoResponse(const uint8_t* cmd, const uint32_t size) thr
 
 ssize_t NetDevice::receive() {
     if (stubbed) {
-        std::cerr << " Warning, device: " << _name << " is already in stub mode, command can't be proceed" << std::endl;
+        NETLOG_LIMITED(log_level::LVL_WARNING, 1u, "device {} is already in stub mode, command can't be proceed", _name);
         return 0;
     }
 
@@ -232,7 +459,7 @@ ssize_t NetDevice::receive() {
     if ((bytesReceived = recv(_sockfd, _buffer.data(), _buffer.size(), 0)) < 0) {
         if (errno != EAGAIN) {
             _debug("netdevice::EAGAIN");
-            std::cerr << "bufsize:" << _buffer.size() << std::endl;
+            NETLOG_DEBUG("{} recv failed, buffer size: {}", _name, _buffer.size());
             throw std::runtime_error((_name + ", read Query failed : cannot recv data, error: " + std::to_string(errno)));
         }
     }
@@ -243,25 +470,33 @@ ssize_t NetDevice::receive() {
 size_t NetDevice::receiveNB(size_t write_index) {
 
     if (stubbed) {
-        std::cerr << " Warning, device: " << _name << " is already in stub mode, command can't be proceed" << std::endl;
+        NETLOG_LIMITED(log_level::LVL_WARNING, 1u, "device {} is already in stub mode, command can't be proceed", _name);
         return 0;
     }
 
     if (!isConnected()) {
         stubbed = true;
+        ChannelMetrics::add(_metrics->exceptions, 1);
         throw std::runtime_error(std::string(_name + ", read failed : not connected"));
     }
 
     ssize_t bytes_read = 0;
 
+         drained = false;
+         ChannelMetrics::add(_metrics->recv_calls, 1);
          if ((bytes_read = recv(_sockfd, _nbbuffer.begin() + write_index, _nbbuffer.size() - write_index, MSG_DONTWAIT)) > 0) {
              write_index += bytes_read;
+             ChannelMetrics::add(_metrics->bytes, static_cast<uint64_t>(bytes_read));
             // std::cout<<"br:"<<bytes_read<<std::endl;
             }
         else {
+            drained = true;
             // no data, posibly socket error
-            if ((errno != EAGAIN) && ( errno != EWOULDBLOCK))// error
-            throw std::runtime_error((_name + ", recv failed : cannot read data, error: " + std::to_string(errno)));
+            if ((errno != EAGAIN) && ( errno != EWOULDBLOCK)) {// error
+                ChannelMetrics::add(_metrics->exceptions, 1);
+                throw std::runtime_error((_name + ", recv failed : cannot read data, error: " + std::to_string(errno)));
+            }
+            if (bytes_read < 0) ChannelMetrics::add(_metrics->recv_eagain, 1);
         }
 
          /*
@@ -271,6 +506,122 @@ size_t NetDevice::receiveNB(size_t write_index) {
     return (write_index);
 }
 
+size_t NetDevice::receiveNB(RingBuffer& ring) {
+
+    if (stubbed) {
+        NETLOG_LIMITED(log_level::LVL_WARNING, 1u, "device {} is already in stub mode, command can't be proceed", _name);
+        return 0;
+    }
+
+    // no getsockopt(SO_ERROR) per call (isConnected), errors of the connection come from recv itself
+    if (!_sockfd) {
+        stubbed = true;
+        ChannelMetrics::add(_metrics->exceptions, 1);
+        throw std::runtime_error(std::string(_name + ", read failed : not connected"));
+    }
+
+    drained = false;
+    // ring full (frames not released yet), data stays in the socket
+    const std::size_t writable = ring.writable();
+    if (!writable) return 0;
+
+    ChannelMetrics::add(_metrics->recv_calls, 1);
+    if (_uring) {
+        size_t bytes_read = 0;
+        try {
+            bytes_read = _uring->receive(ring);
+        }
+        catch (std::exception& e) {
+            ChannelMetrics::add(_metrics->exceptions, 1);
+            throw;
+        }
+        drained = _uring->isDrained();
+        ChannelMetrics::add(_metrics->bytes, bytes_read);
+        if (!bytes_read) ChannelMetrics::add(_metrics->recv_eagain, 1);
+        return bytes_read;
+    }
+
+    ssize_t bytes_read = (_rx_timestamping == rx_timestamping::NONE)
+            ? recv(_sockfd, ring.writePtr(), writable, MSG_DONTWAIT)
+            : receiveTimestamped(ring);
+    if (bytes_read > 0) {
+        ring.commit(static_cast<size_t>(bytes_read));
+        ChannelMetrics::add(_metrics->bytes, static_cast<uint64_t>(bytes_read));
+        if (_zerocopy) {
+            _zerocopy_stats.copied_bytes += static_cast<uint64_t>(bytes_read);
+            _zerocopy_stats.copies++;
+        }
+        // TCP recv takes everything queued up to the length, less means the queue is empty -
+        // the edge triggered reader doesn't need another recv just to see EAGAIN
+        if (static_cast<size_t>(bytes_read) < writable) drained = true;
+        return (static_cast<size_t>(bytes_read));
+    }
+
+    drained = true;
+    // no data, posibly socket error
+    if ((bytes_read < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+        ChannelMetrics::add(_metrics->exceptions, 1);
+        throw std::runtime_error((_name + ", recv failed : cannot read data, error: " + std::to_string(errno)));
+    }
+    // 0 - closed by the peer, not counted as EAGAIN
+    if (bytes_read < 0) ChannelMetrics::add(_metrics->recv_eagain, 1);
+    return 0;
+}
+
+size_t NetDevice::receiveZeroCopy(RingBuffer& ring, ZeroCopySpan& span) {
+    span = ZeroCopySpan { nullptr, 0u };
+    // stubbed / not connected - receiveNB does the same checks (warning, or stub and throw)
+    if (!_zerocopy || stubbed || !_sockfd) return receiveNB(ring);
+
+    drained = false;
+    ChannelMetrics::add(_metrics->recv_calls, 1);
+    size_t bytes_read = 0;
+    try {
+        bytes_read = _zerocopy->receive(ring, span, _zerocopy_stats);
+    }
+    catch (std::exception& e) {
+        ChannelMetrics::add(_metrics->exceptions, 1);
+        throw;
+    }
+    drained = _zerocopy->isDrained();
+    ChannelMetrics::add(_metrics->bytes, bytes_read);
+    if (!bytes_read) ChannelMetrics::add(_metrics->recv_eagain, 1);
+    return bytes_read;
+}
+
+ssize_t NetDevice::receiveTimestamped(RingBuffer& ring) {
+    struct iovec iov;
+    iov.iov_base = ring.writePtr();
+    iov.iov_len = ring.writable();
+
+    union {
+        char buf[CMSG_SPACE(sizeof(struct scm_timestamping))];
+        struct cmsghdr align;
+    } control;
+
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    const ssize_t bytes_read = recvmsg(_sockfd, &msg, MSG_DONTWAIT);
+    if (bytes_read <= 0) return bytes_read;
+
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if ((cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_TIMESTAMPING)) continue;
+
+        struct scm_timestamping ts;
+        std::memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+        // ts[0] - software, ts[2] - raw hardware (zero when the NIC didn't stamp it)
+        const struct timespec& time = ((_rx_timestamping == rx_timestamping::HARDWARE) && (ts.ts[2].tv_sec || ts.ts[2].tv_nsec))
+                ? ts.ts[2] : ts.ts[0];
+        _rx_timestamp = static_cast<uint64_t>(time.tv_sec) * 1000000000ull + static_cast<uint64_t>(time.tv_nsec);
+    }
+    return bytes_read;
+}
+
 const std::vector<uint8_t>& NetDevice::getBuffer() {
     return _buffer;
 }
@@ -283,9 +634,24 @@ void NetDevice::clearNBBuffer() {
     std::fill(std::begin(_nbbuffer), std::end(_nbbuffer), 0);
 }
 
+size_t NetDevice::sendNB(const uint8_t* data, size_t size) throw(std::exception) {
+    if (stubbed) {
+        NETLOG_LIMITED(log_level::LVL_WARNING, 1u, "device {} is already in stub mode, command can't be proceed", _name);
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> tx_lock(_tx_mtx);
+    const ssize_t bytes_sent = send(_sockfd, data, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (bytes_sent >= 0) return static_cast<size_t>(bytes_sent);
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return 0;
+
+    ChannelMetrics::add(_metrics->exceptions, 1);
+    throw std::runtime_error((_name + ", send failed : cannot send data, error: " + std::to_string(errno)));
+}
+
 ssize_t NetDevice::transmit(const uint8_t* cmd, const uint32_t size) {
     if (stubbed) {
-        std::cerr << " Warning, device: " << _name << " is already in stub mode, command can't be proceed" << std::endl;
+        NETLOG_LIMITED(log_level::LVL_WARNING, 1u, "device {} is already in stub mode, command can't be proceed", _name);
         return 0;
     }
 
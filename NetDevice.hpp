@@ -3,9 +3,16 @@
 
 #include <string>
 #include <vector>
+#include <array>
 #include <mutex>
 #include <iostream>
 #include <iomanip>
+#include <memory>
+#include <future>
+
+#include "RingBuffer.hpp"
+#include "ChannelMetrics.hpp"
+#include "ZeroCopyReceiver.hpp"
 
 
 
@@ -23,6 +30,25 @@ constexpr ssize_t MAX_PACKET_LENGTH = 8000;
 static const std::string NEWLINE = "\r\n";
 using NetBuffer = std::array<uint8_t,MAX_PACKET_LENGTH>;
 
+// connect() deadline when no timeout is given
+constexpr int CONNECT_TIMEOUT_MS = 3000;
+
+// implementation of receiveNB(RingBuffer&)
+enum class rx_backend {
+    RECV = 0u,  // recv(MSG_DONTWAIT) per call
+    IO_URING,   // multishot recv with provided buffers, see UringReceiver
+    ZEROCOPY,   // TCP_ZEROCOPY_RECEIVE into the mapped window (receiveZeroCopy), recv otherwise, see ZeroCopyReceiver
+};
+
+// kernel RX timestamps of the data read by receiveNB(RingBuffer&), see setRxTimestamping
+enum class rx_timestamping {
+    NONE = 0u,
+    SOFTWARE,   // time the packet entered the network stack
+    HARDWARE,   // NIC time, when the interface has HW timestamping enabled (SIOCSHWTSTAMP), software otherwise
+};
+
+class UringReceiver;
+
 
 //based on https://stackoverflow.com/users/126769/nos
 struct KeepConfig {
@@ -47,18 +73,82 @@ public:
 
     virtual ~NetDevice();
 
-    // establish connection with network device
+    /*
+     * establish connection with network device
+     * timeout (s) - limit of the connect itself (0 - CONNECT_TIMEOUT_MS) and SO_RCVTIMEO of the blocking reads
+     */
     void connect(const std::string& hostname, int port, int timeout = 0, bool blocking = true) throw(std::exception);
+    /*
+     * non blocking connect, the same settings as connect(). return true when connected immediately,
+     * false - in progress, call finishConnect when the socket (getSocket) is writable. Throws on failure
+     */
+    bool startConnect(const std::string& hostname, int port, int timeout = 0, bool blocking = true) throw(std::exception);
+    // return true when connected, false - still in progress. Throws when refused (socket is closed then)
+    bool finishConnect() throw(std::exception);
     void setBlocking(bool _blocking);
-    // re-establish connection
+    // re-establish connection, with the same blocking mode and timeout
     void reconnect();
 
+    // incremented by every successful connect, the readers drop the data of the previous connection
+    inline uint64_t getConnection() { return (_connection);}
+
     // disconnect from network device
     void disconnect();
 
     // return connection status
     bool isConnected();
 
+    // socket handler, to register the device in the event loop (NetReactor)
+    inline int getSocket() { return (_sockfd);}
+    // descriptor the event loop has to wait on, socket or io_uring eventfd
+    int getPollFd();
+
+    /*
+     * select receive backend of the data channel, also kept for the next connect
+     * return backend in use, RECV when io_uring (zero copy) is not supported by the kernel
+     * (select it before the device is attached to the NetReactor)
+     */
+    rx_backend setRxBackend(rx_backend backend);
+    rx_backend getRxBackend();
+
+    /*
+     * SO_TIMESTAMPING on the socket, also kept for the next connect. Data are read by recvmsg then,
+     * io_uring and zero copy backends are not used (no timestamps there).
+     * return false when the kernel refused it (timestamps stay 0)
+     */
+    bool setRxTimestamping(rx_timestamping mode);
+    inline rx_timestamping getRxTimestamping() { return (_rx_timestamping);}
+    /*
+     * kernel arrival time of the last received data (CLOCK_REALTIME ns), 0 when not known
+     * for TCP it's the time of the latest segment taken by the last receiveNB
+     */
+    inline uint64_t getRxTimestamp() { return (_rx_timestamp);}
+
+    /*
+     * SO_BUSY_POLL (us of spinning in the driver on empty recv), SO_PREFER_BUSY_POLL and SO_BUSY_POLL_BUDGET
+     * (0 - not set), also kept for the next connect. Need CAP_NET_ADMIN, return false when refused
+     */
+    bool setBusyPoll(int busy_poll_us, bool prefer = true, int budget = 0);
+
+    /*
+     * SO_RCVBUF (bytes, 0 - system default) and SO_RCVLOWAT (bytes, 0 - not set) of the data socket, also kept
+     * for the next connect. SO_RCVBUF is set before connect too, the TCP window scale is negotiated there.
+     * With SO_RCVLOWAT the socket is readable (epoll) only when so many bytes are queued - fewer wakeups
+     * with more data each, for the price of latency (use a multiple of the frame length).
+     * return false when refused
+     */
+    bool setRxBuffer(int rcvbuf, int rcvlowat = 0);
+    // SO_RCVBUF of the connected socket as reported by the kernel (twice the requested), 0 when not connected
+    int getRxBuffer();
+
+    // health counters of the device (and of the framer reading it)
+    inline ChannelMetrics& metrics() { return (*_metrics);}
+    /*
+     * place the counters into the shared slot (MetricsRegion::allocate), nullptr - back to the private ones
+     * counting starts from zero in the new place, set it before connect
+     */
+    void setMetrics(ChannelMetrics* metrics);
+
     // Helper functions to retur private values
     const std::string getName();
     const std::string getHostName();
@@ -67,12 +157,17 @@ public:
     inline void setStubbed(bool stubbed_) { stubbed = stubbed_;}
 
     // send command to network device then store recieived data in _buffer, return read bytes lenght
+    // waitReceive = false - answer is read by the background task, the call returns 0 immediately
+    // (reads of such calls are done in order, waitReceive = true waits for the pending ones first)
     int sendQuery(const uint8_t* cmd, const uint32_t size, const bool waitReceive) throw (std::exception);
 
     // send command to network device
     void sendQueryNoResponse(const uint8_t* cmd, const uint32_t size) throw (std::exception);
 
     ssize_t receive();
+
+    // non blocking send, return sent bytes (0 - socket buffer full), throws on error/closed connection
+    size_t sendNB(const uint8_t* data, size_t size) throw (std::exception);
     /*
      *
      * the second fn is for non blocking, to keep compatibility with past developed code
@@ -83,6 +178,29 @@ public:
 
     size_t receiveNB(size_t writeIndex =0);
 
+    /*
+     * non blocking recv directly into the ring (data channels), appends after the data already stored
+     * return number of received bytes
+     * (virtual - other sources of the stream, see ReplayDevice)
+     */
+    virtual size_t receiveNB(RingBuffer& ring);
+
+    /*
+     * zero copy receive (rx_backend::ZEROCOPY): whole pages of the socket queue are mapped (span), the rest
+     * is copied into the ring as by receiveNB. Spans stay valid until releaseZeroCopy, then they are mapped over.
+     * Other backends (and the devices without socket) only receiveNB into the ring.
+     * return number of mapped or copied bytes
+     */
+    size_t receiveZeroCopy(RingBuffer& ring, ZeroCopySpan& span);
+    inline void releaseZeroCopy() { if (_zerocopy) _zerocopy->rewind();}
+    inline bool isZeroCopy() { return (_zerocopy != nullptr);}
+    // mapped vs copied bytes since the backend was selected (the framer adds its tail copies)
+    inline ZeroCopyStats& zeroCopyStats() { return (_zerocopy_stats);}
+
+    // true when the last receiveNB found the socket queue empty (EAGAIN, or recv returned less than the free ring space)
+    // edge triggered readers have to call receiveNB until this is set
+    inline bool isDrained() { return (drained);}
+
     //to keep the _buffer private
     const std::vector<uint8_t>& getBuffer();
 
@@ -93,6 +211,23 @@ public:
 
 
 protected:
+    // settings of the new connection, socket options, receive backend
+    void setupConnection() throw(std::exception);
+    void closeSocket();
+
+    // create io_uring receiver for connected socket, or stay with recv
+    void startUring();
+    // map the connected socket for TCP_ZEROCOPY_RECEIVE, or stay with recv
+    void startZeroCopy();
+    // SO_TIMESTAMPING of the connected socket
+    bool applyRxTimestamping();
+    // busy poll options of the connected socket
+    bool applyBusyPoll();
+    // SO_RCVBUF/SO_RCVLOWAT of the socket
+    bool applyRxBuffer();
+    // recvmsg with the timestamp control message
+    ssize_t receiveTimestamped(RingBuffer& ring);
+
     //send query frame
     ssize_t transmit(const uint8_t* cmd, const uint32_t size);
 
@@ -114,6 +249,9 @@ protected:
     std::string _host;
     // device port
     int _port;
+    // connect timeout (s), also SO_RCVTIMEO
+    int _timeout;
+    uint64_t _connection;
 
     // socket handler
     int _sockfd;
@@ -125,10 +263,31 @@ protected:
     std::vector<uint8_t> _buffer;
     //raed buffer for nb
     std::array<uint8_t, MAX_PACKET_LENGTH> _nbbuffer;
+    // answers read in background by sendQuery(..., false), the last of the chained reads
+    std::future<ssize_t> _async_rx;
 
     // stubbed
     bool stubbed;
     bool blocking;
+    bool drained;
+
+    rx_backend _rx_backend;
+    std::unique_ptr<UringReceiver> _uring;
+    std::unique_ptr<ZeroCopyReceiver> _zerocopy;
+    ZeroCopyStats _zerocopy_stats;
+
+    rx_timestamping _rx_timestamping;
+    uint64_t _rx_timestamp;
+
+    int _busy_poll_us;
+    bool _prefer_busy_poll;
+    int _busy_poll_budget;
+
+    int _rcvbuf;
+    int _rcvlowat;
+
+    ChannelMetrics _local_metrics;
+    ChannelMetrics* _metrics;
 
 };
 
@@ -0,0 +1,108 @@
+/*
+ * NetReactor.cpp
+ *
+ *  Event loop for the non blocking NetDevice sockets.
+ */
+
+#include "NetReactor.hpp"
+
+#include <string>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <cerrno>
+
+namespace net {
+
+NetReactor::NetReactor(std::size_t max_events) throw(std::exception) :
+        _epfd(-1),
+        _wakefd(-1),
+        _running(false),
+        _events(max_events ? max_events : 1) {
+
+    if ((_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        throw std::runtime_error("NetReactor: cannot create epoll, error: " + std::to_string(errno));
+
+    if ((_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        ::close(_epfd);
+        throw std::runtime_error("NetReactor: cannot create eventfd, error: " + std::to_string(errno));
+    }
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = _wakefd;
+    epoll_ctl(_epfd, EPOLL_CTL_ADD, _wakefd, &ev);
+}
+
+NetReactor::~NetReactor() {
+    ::close(_wakefd);
+    ::close(_epfd);
+}
+
+void NetReactor::add(int fd, Handler handler) throw(std::exception) {
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = fd;
+
+    if (epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+        throw std::runtime_error("NetReactor: cannot register socket " + std::to_string(fd) + ", error: " + std::to_string(errno));
+
+    _handlers[fd] = std::move(handler);
+}
+
+void NetReactor::remove(int fd) {
+    auto it = _handlers.find(fd);
+    if (it == _handlers.end()) return;
+
+    epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, nullptr);
+    // handler can be the one which is running now
+    _retired.push_back(std::move(it->second));
+    _handlers.erase(it);
+}
+
+std::size_t NetReactor::poll(int timeout_ms) {
+    int nevents = epoll_wait(_epfd, _events.data(), static_cast<int>(_events.size()), timeout_ms);
+    if (nevents < 0) {
+        if (errno == EINTR) return 0;
+        throw std::runtime_error("NetReactor: epoll_wait failed, error: " + std::to_string(errno));
+    }
+
+    std::size_t dispatched = 0;
+    for (int n = 0; n < nevents; n++) {
+        const int fd = _events[n].data.fd;
+
+        if (fd == _wakefd) {
+            uint64_t val;
+            while (::read(_wakefd, &val, sizeof(val)) > 0);
+            continue;
+        }
+        // could be removed by previous handler in this loop
+        auto it = _handlers.find(fd);
+        if (it == _handlers.end()) continue;
+
+        it->second(_events[n].events);
+        dispatched++;
+    }
+    _retired.clear();
+    return dispatched;
+}
+
+void NetReactor::run() {
+    _running = true;
+    while (_running) {
+        poll(-1);
+    }
+}
+
+void NetReactor::stop() {
+    _running = false;
+    wake();
+}
+
+void NetReactor::wake() {
+    uint64_t val = 1;
+    if (::write(_wakefd, &val, sizeof(val)) < 0) {
+        // counter full, reactor is going to wake up anyway
+    }
+}
+
+} // namespace net
@@ -0,0 +1,85 @@
+/*
+ * NetReactor.hpp
+ *
+ *  Event loop for the non blocking NetDevice sockets.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_NET_REACTOR_HPP_
+#define SRC_PISA_NETDEVICES_NET_REACTOR_HPP_
+
+#include <sys/epoll.h>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <stdexcept>
+
+namespace net {
+
+/*
+ * One epoll instance (edge triggered) serving any number of sockets.
+ * Thread sleeps in epoll_wait until some registered socket has data, so CPU use depends
+ * on the data rate, not on the number of devices.
+ *
+ * REMEMBER EDGE TRIGGERED!! Handler is called once per "new data" edge, it has to read
+ * the socket until EAGAIN (see NetDevice::isDrained), otherwise it will not be woken again.
+ *
+ * add/remove are not thread safe, call them before run() or from the handlers (reactor thread).
+ * stop() and wake() can be called from any thread.
+ *
+ * Example usage:
+ *
+ *    net::NetReactor reactor;
+ *    fbs.attach(reactor, fbs_receiver::fbs_channels::CHANNEL_1, handler);
+ *    lpps.attach(reactor, lpps_receiver::lpps_channels::CHANNEL_2, handler2);
+ *    std::thread io([&reactor] { reactor.run(); });
+ *    ...
+ *    reactor.stop();
+ *    io.join();
+ */
+class NetReactor {
+    public:
+        // events - epoll mask (EPOLLIN, EPOLLRDHUP, EPOLLHUP, EPOLLERR)
+        using Handler = std::function<void(uint32_t events)>;
+
+        NetReactor(std::size_t max_events = 64) throw(std::exception);
+        ~NetReactor();
+
+        NetReactor(const NetReactor&) = delete;
+        NetReactor& operator=(const NetReactor&) = delete;
+
+        // register socket, handler is called from the reactor thread
+        void add(int fd, Handler handler) throw(std::exception);
+        // unregister socket, safe to call from inside of the handler
+        void remove(int fd);
+
+        /*
+         * @brief wait for events and call handlers
+         * @param timeout_ms  -1 wait forever, 0 return immediately
+         * @return number of dispatched events
+         */
+        std::size_t poll(int timeout_ms);
+
+        // poll until stop()
+        void run();
+        void stop();
+        // return from the waiting poll (without stopping run), any thread
+        void wake();
+
+        inline std::size_t size() { return (_handlers.size());}
+
+    private:
+        int _epfd;
+        // eventfd to wake up epoll_wait from stop()
+        int _wakefd;
+        std::atomic<bool> _running;
+
+        std::unordered_map<int, Handler> _handlers;
+        // handlers removed during dispatch, destroyed after the dispatch loop
+        std::vector<Handler> _retired;
+        std::vector<struct epoll_event> _events;
+};
+
+} // namespace net
+
+#endif /* SRC_PISA_NETDEVICES_NET_REACTOR_HPP_ */
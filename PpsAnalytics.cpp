@@ -0,0 +1,164 @@
+/*
+ * PpsAnalytics.cpp
+ *
+ *  Online PPS quality statistics of the LPPS channels: jitter, drift, delays and Allan deviation.
+ */
+
+#include "PpsAnalytics.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <string>
+
+namespace lpps_receiver {
+
+namespace { // for internal use only
+
+constexpr uint64_t NS_PER_SECOND = 1000000000u;
+
+// bucket n: [2^(n-1), 2^n), 0 for 0
+inline std::size_t delayBucket(uint32_t cycles) {
+    return (cycles ? static_cast<std::size_t>(32 - __builtin_clz(cycles)) : 0u);
+}
+
+} // end namespace
+
+uint64_t PpsSnapshot::delayPercentile(double p) const {
+    const uint64_t total = std::accumulate(delay_histogram.begin(), delay_histogram.end(), uint64_t(0));
+    if (!total) return 0;
+    const uint64_t rank = static_cast<uint64_t>(std::ceil(std::min(std::max(p, 0.0), 1.0) * static_cast<double>(total)));
+    uint64_t seen = 0;
+    for (std::size_t n = 0; n < PPS_DELAY_BUCKETS; n++) {
+        seen += delay_histogram[n];
+        if (seen >= std::max<uint64_t>(rank, 1u)) return (n ? ((1ull << n) - 1u) : 0u);
+    }
+    return ((1ull << (PPS_DELAY_BUCKETS - 1)) - 1u);
+}
+
+PpsAnalytics::PpsAnalytics(const PpsAnalyticsConfig& config) throw(std::exception) :
+        _config(config),
+        _alpha(2.0 / (static_cast<double>(std::max(config.recent_pulses, 1u)) + 1.0)),
+        _state(),
+        _drift(),
+        _phase_pos(0),
+        _phase_count(0),
+        _adev_sum(),
+        _first_pps_ns(0) {
+    if (_config.taus.size() > PPS_MAX_TAUS)
+        throw std::runtime_error("PpsAnalytics: at most " + std::to_string(PPS_MAX_TAUS) + " taus");
+    if (std::find(_config.taus.begin(), _config.taus.end(), 0u) != _config.taus.end())
+        throw std::runtime_error("PpsAnalytics: tau has to be > 0");
+    if (!_config.nominal_interval_ns) throw std::runtime_error("PpsAnalytics: nominal interval has to be > 0");
+
+    const uint32_t max_tau = _config.taus.empty() ? 0u : *std::max_element(_config.taus.begin(), _config.taus.end());
+    _phase.resize(2u * max_tau + 1u);
+    reset();
+}
+
+void PpsAnalytics::update(const lpps_frame* const* frames, std::size_t nframes) {
+    std::lock_guard<std::mutex> lock(_mtx);
+    for (std::size_t i = 0; i < nframes; i++) {
+        const lpps_frame* frame = frames[i];
+        add(frame->frame_delay_pru_cycle, frame->errors, decoder::ntpToNs(frame->data_timestamp_ntp), decoder::ntpToNs(frame->pps_timestamp_ntp));
+    }
+}
+
+void PpsAnalytics::update(const std::vector<const lpps_frame*>& frames) {
+    update(frames.data(), frames.size());
+}
+
+void PpsAnalytics::update(const decoder::LppsColumns& columns) {
+    std::lock_guard<std::mutex> lock(_mtx);
+    const std::size_t n = columns.size();
+    for (std::size_t i = 0; i < n; i++)
+        add(columns.delay_cycles[i], columns.errors[i], columns.data_ntp_ns[i], columns.pps_ntp_ns[i]);
+}
+
+PpsSnapshot PpsAnalytics::snapshot() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    PpsSnapshot snapshot = _state;
+    snapshot.drift_ppb = _drift.slope();
+
+    // sigma^2(tau) = sum (x[i+2m] - 2x[i+m] + x[i])^2 / (2 tau^2 (N - 2m)), x in s
+    const double tau0 = static_cast<double>(_config.nominal_interval_ns) / NS_PER_SECOND;
+    for (std::size_t n = 0; n < snapshot.ntaus; n++) {
+        AllanPoint& point = snapshot.adev[n];
+        const double tau = point.tau * tau0;
+        point.adev = point.terms ? std::sqrt(_adev_sum[n] * 1e-18 / (2.0 * tau * tau * static_cast<double>(point.terms))) : 0.0;
+    }
+    return snapshot;
+}
+
+void PpsAnalytics::reset() {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _state = PpsSnapshot();
+    _state.ntaus = _config.taus.size();
+    for (std::size_t n = 0; n < _state.ntaus; n++) _state.adev[n] = AllanPoint { _config.taus[n], 0u, 0.0 };
+    _drift = RunningFit();
+    _phase_pos = 0;
+    _phase_count = 0;
+    _adev_sum.fill(0.0);
+    _first_pps_ns = 0;
+}
+
+void PpsAnalytics::add(uint32_t delay_cycles, uint32_t errors, uint64_t data_ns, uint64_t pps_ns) {
+    _state.frames++;
+    if (errors & PPS_ERROR_MASK) {
+        _state.error_frames++;
+        return;
+    }
+
+    _state.delay_cycles.add(delay_cycles);
+    _state.delay_histogram[delayBucket(delay_cycles)]++;
+    _state.data_delay_ns.add(static_cast<double>(static_cast<int64_t>(data_ns - pps_ns)));
+    if (pps_ns > _state.last_pps_ns) pulse(pps_ns);
+}
+
+void PpsAnalytics::pulse(uint64_t pps_ns) {
+    _state.pulses++;
+    // offset from the nearest whole second
+    const int64_t rest = static_cast<int64_t>(pps_ns % NS_PER_SECOND);
+    const int64_t phase = (rest < static_cast<int64_t>(NS_PER_SECOND / 2)) ? rest : (rest - static_cast<int64_t>(NS_PER_SECOND));
+    _state.last_phase_ns = phase;
+    _state.phase_ns.add(static_cast<double>(phase));
+    _state.recent_phase_ns.add(static_cast<double>(phase), _alpha);
+
+    if (!_first_pps_ns) _first_pps_ns = pps_ns;
+    _drift.add(static_cast<double>(pps_ns - _first_pps_ns) / NS_PER_SECOND, static_cast<double>(phase));
+
+    bool continuous = false;
+    if (_state.last_pps_ns) {
+        const int64_t interval = static_cast<int64_t>(pps_ns - _state.last_pps_ns);
+        _state.last_interval_ns = interval;
+        if (static_cast<uint64_t>(std::abs(interval - static_cast<int64_t>(_config.nominal_interval_ns))) > _config.gap_tolerance_ns) {
+            _state.gaps++;
+        }
+        else {
+            continuous = true;
+            _state.interval_ns.add(static_cast<double>(interval));
+            _state.recent_interval_ns.add(static_cast<double>(interval), _alpha);
+        }
+    }
+    _state.last_pps_ns = pps_ns;
+
+    // Allan deviation needs evenly spaced phases - after a gap the history starts again
+    if (_phase.empty()) return;
+    if (!continuous) _phase_count = 0;
+    const std::size_t len = _phase.size();
+    _phase_pos = (_phase_pos + 1) % len;
+    _phase[_phase_pos] = static_cast<double>(phase);
+    _phase_count = std::min(_phase_count + 1, len);
+
+    for (std::size_t n = 0; n < _state.ntaus; n++) {
+        const std::size_t m = _state.adev[n].tau;
+        if (_phase_count < (2 * m + 1)) continue;
+        const double x0 = _phase[_phase_pos];
+        const double x1 = _phase[(_phase_pos + len - m) % len];
+        const double x2 = _phase[(_phase_pos + len - 2 * m) % len];
+        const double diff = x0 - 2.0 * x1 + x2;
+        _adev_sum[n] += diff * diff;
+        _state.adev[n].terms++;
+    }
+}
+
+} // namespace lpps_receiver
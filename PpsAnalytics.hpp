@@ -0,0 +1,190 @@
+/*
+ * PpsAnalytics.hpp
+ *
+ *  Online PPS quality statistics of the LPPS channels: jitter, drift, delays and Allan deviation.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_PPS_ANALYTICS_HPP_
+#define SRC_PISA_NETDEVICES_PPS_ANALYTICS_HPP_
+
+#include <cstdint>
+#include <cmath>
+#include <array>
+#include <mutex>
+#include <vector>
+#include <stdexcept>
+
+#include "LPPS.hpp"
+#include "FrameDecoder.hpp"
+
+namespace lpps_receiver {
+
+constexpr std::size_t PPS_MAX_TAUS = 16u;
+// frame_delay_pru_cycle histogram, bucket n holds [2^(n-1), 2^n) cycles, bucket 0 the zeros
+constexpr std::size_t PPS_DELAY_BUCKETS = 33u;
+// LPPS error bits of the PPS itself (no pps, invalid PPS), such frames don't count for the PPS statistics
+constexpr uint32_t PPS_ERROR_MASK = (1u << 3) | (1u << 4);
+
+struct PpsAnalyticsConfig {
+    // Allan deviation taus in PPS periods (s at 1 PPS), up to PPS_MAX_TAUS;
+    // the largest one sets the phase history (2 * tau + 1 pulses)
+    std::vector<uint32_t> taus = { 1u, 2u, 4u, 8u, 16u, 32u, 64u, 128u, 256u, 512u, 1024u };
+    uint64_t nominal_interval_ns = 1000000000u;
+    // interval off the nominal by more is a missed/extra pulse - not in the jitter, the phase history restarts
+    uint64_t gap_tolerance_ns = 100000000u;
+    // time constant (in pulses) of the recent statistics, for the alarms
+    uint32_t recent_pulses = 10u;
+};
+
+// Welford running mean and variance, with min/max
+struct RunningStats {
+    uint64_t count;
+    double mean;
+    double m2;
+    double min;
+    double max;
+
+    inline void add(double x) {
+        count++;
+        const double delta = x - mean;
+        mean += delta / static_cast<double>(count);
+        m2 += delta * (x - mean);
+        if ((count == 1) || (x < min)) min = x;
+        if ((count == 1) || (x > max)) max = x;
+    }
+    inline double variance() const { return ((count > 1) ? m2 / static_cast<double>(count - 1) : 0.0);}
+    inline double stddev() const { return (std::sqrt(variance()));}
+};
+
+// exponentially weighted mean and variance, follows the last ~1/alpha values
+struct RecentStats {
+    double mean;
+    double variance;
+    bool valid;
+
+    inline void add(double x, double alpha) {
+        if (!valid) {
+            mean = x;
+            variance = 0.0;
+            valid = true;
+            return;
+        }
+        const double delta = x - mean;
+        mean += alpha * delta;
+        variance = (1.0 - alpha) * (variance + alpha * delta * delta);
+    }
+    inline double stddev() const { return (std::sqrt(variance));}
+};
+
+// running least squares line y = a + slope * t (Welford co-moments)
+struct RunningFit {
+    uint64_t count;
+    double mean_t;
+    double mean_y;
+    double m2_t;
+    double c_ty;
+
+    inline void add(double t, double y) {
+        count++;
+        const double dt = t - mean_t;
+        mean_t += dt / static_cast<double>(count);
+        mean_y += (y - mean_y) / static_cast<double>(count);
+        m2_t += dt * (t - mean_t);
+        c_ty += dt * (y - mean_y);
+    }
+    inline double slope() const { return ((m2_t > 0.0) ? c_ty / m2_t : 0.0);}
+};
+
+struct AllanPoint {
+    uint32_t tau;       // in PPS periods
+    uint64_t terms;     // second differences summed, 0 - not enough pulses yet
+    double adev;        // overlapping Allan deviation (fractional frequency)
+};
+
+struct PpsSnapshot {
+    uint64_t frames;
+    uint64_t error_frames;          // with PPS_ERROR_MASK bits, not used for the PPS
+    uint64_t pulses;                // PPS edges (new pps_timestamp_ntp)
+    uint64_t gaps;                  // intervals off the nominal by more than gap_tolerance_ns
+
+    RunningStats interval_ns;       // PPS interval, its stddev is the jitter
+    RunningStats phase_ns;          // PPS edge offset from the whole NTP second
+    double drift_ppb;               // phase slope (ns/s)
+    RunningStats data_delay_ns;     // data_timestamp_ntp - pps_timestamp_ntp
+    RunningStats delay_cycles;      // frame_delay_pru_cycle
+    std::array<uint64_t, PPS_DELAY_BUCKETS> delay_histogram;
+
+    // last recent_pulses pulses, for the alarms
+    RecentStats recent_interval_ns;
+    RecentStats recent_phase_ns;
+    int64_t last_interval_ns;
+    int64_t last_phase_ns;
+    uint64_t last_pps_ns;           // ns from NTP epoch, 0 - no pulse yet
+
+    std::size_t ntaus;
+    std::array<AllanPoint, PPS_MAX_TAUS> adev;
+
+    // upper bound of the histogram bucket reaching the fraction p (0..1) of the frames
+    uint64_t delayPercentile(double p) const;
+};
+
+/*
+ * Statistics of one LPPS channel, updated incrementally as the frames arrive: O(1) per frame
+ * and per tau, memory O(1) per tau plus one phase history shared by all taus (2 * max tau + 1 doubles).
+ *
+ * PPS edge is a frame with a new pps_timestamp_ntp. Its phase (offset from the whole second) is the
+ * sample of the Allan deviation, drift is the slope of the phase. Whole run statistics are Welford,
+ * recent_* follow the last pulses, so a degradation shows within seconds.
+ *
+ * update() from the receiving thread, snapshot() from any thread at any time - the lock is held only for
+ * one update call or one copy, receive is never stopped for long.
+ *
+ * Example usage:
+ *
+ *    lpps_receiver::PpsAnalytics pps;
+ *    lpps.attach(reactor, lpps_receiver::lpps_channels::CHANNEL_1, [&](lpps_receiver::lpps_channels, const std::vector<const lpps_receiver::lpps_frame*>& frames, uint8_t) {
+ *        pps.update(frames);
+ *    });
+ *
+ *    // monitoring thread
+ *    lpps_receiver::PpsSnapshot s = pps.snapshot();
+ *    if (s.recent_interval_ns.stddev() > 100.0) ... // jitter alarm
+ */
+class PpsAnalytics {
+    public:
+        PpsAnalytics(const PpsAnalyticsConfig& config = PpsAnalyticsConfig()) throw(std::exception);
+
+        PpsAnalytics(const PpsAnalytics&) = delete;
+        PpsAnalytics& operator=(const PpsAnalytics&) = delete;
+
+        void update(const lpps_frame* const* frames, std::size_t nframes);
+        void update(const std::vector<const lpps_frame*>& frames);
+        void update(const decoder::LppsColumns& columns);
+
+        // consistent copy of the statistics
+        PpsSnapshot snapshot() const;
+        void reset();
+
+    private:
+        // one frame, under the lock
+        void add(uint32_t delay_cycles, uint32_t errors, uint64_t data_ns, uint64_t pps_ns);
+        void pulse(uint64_t pps_ns);
+
+        PpsAnalyticsConfig _config;
+        double _alpha;
+        mutable std::mutex _mtx;
+        PpsSnapshot _state;
+        RunningFit _drift;
+
+        // phase history (ns) for the second differences, ring of 2 * max tau + 1
+        std::vector<double> _phase;
+        std::size_t _phase_pos;
+        std::size_t _phase_count;
+        std::array<double, PPS_MAX_TAUS> _adev_sum;
+        // time of the first pulse, drift fit is relative to it (double keeps the precision)
+        uint64_t _first_pps_ns;
+};
+
+} // namespace lpps_receiver
+
+#endif /* SRC_PISA_NETDEVICES_PPS_ANALYTICS_HPP_ */
@@ -0,0 +1,378 @@
+/*
+ * ReceiverEmulator.cpp
+ *
+ *  FBS/LPPS receiver emulator - management port and synthetic data channels,
+ *  for load and fragmentation tests of the client without the hardware.
+ */
+
+#include "ReceiverEmulator.hpp"
+#include "FBS.hpp"
+#include "LPPS.hpp"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+
+namespace emulator {
+
+namespace { // for internal use only
+
+constexpr int POLL_MS = 100;
+// seconds between 1900 (NTP epoch) and 1970
+constexpr uint64_t NTP_UNIX_OFFSET = 2208988800ull;
+constexpr char IDN_ANSWER[] = "PISA receiver emulator,000000,0,1.0\n";
+
+static_assert((sizeof(IDN_ANSWER) - 1) >= fbs_receiver::IDN_ACK_SIZE, "IDN answer too short for FbsReceiver");
+static_assert((sizeof(IDN_ANSWER) - 1) >= lpps_receiver::IDN_ACK_SIZE, "IDN answer too short for LppsReceiver");
+
+uint64_t ntpNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    const uint64_t frac = (static_cast<uint64_t>(ts.tv_nsec) << 32) / 1000000000ull;
+    return (((static_cast<uint64_t>(ts.tv_sec) + NTP_UNIX_OFFSET) << 32) | frac);
+}
+
+// xorshift32, good enough for segment sizes and junk
+uint32_t nextRandom(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// MSG_ZEROCOPY - the buffer can be changed only after the kernel reported the sends as completed
+bool waitZeroCopy(int fd, uint32_t sends, uint32_t& completed, const std::atomic<bool>& run) {
+    while (completed != sends) {
+        // error queue is signaled as POLLERR
+        struct pollfd pfd = { fd, 0, 0 };
+        poll(&pfd, 1, POLL_MS);
+        if (!run) return false;
+
+        char control[128];
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) {
+            if ((errno == EAGAIN) || (errno == EINTR)) continue;
+            return false;
+        }
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if ((cmsg->cmsg_level != SOL_IP) || (cmsg->cmsg_type != IP_RECVERR)) continue;
+            struct sock_extended_err err;
+            std::memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            // range of the completed sends
+            if (err.ee_origin == SO_EE_ORIGIN_ZEROCOPY) completed += err.ee_data - err.ee_info + 1u;
+        }
+    }
+    return true;
+}
+
+int listenOn(const std::string& address, int port, int& bound_port) throw(std::exception) {
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) throw std::runtime_error("emulator: cannot create socket, " + std::string(std::strerror(errno)));
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+        ::close(fd);
+        throw std::runtime_error("emulator: invalid address " + address);
+    }
+    if ((bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) || (listen(fd, 4) < 0)) {
+        const std::string error = "emulator: cannot listen on " + address + ":" + std::to_string(port) + ", " + std::strerror(errno);
+        ::close(fd);
+        throw std::runtime_error(error);
+    }
+
+    socklen_t len = sizeof(addr);
+    getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &len);
+    bound_port = ntohs(addr.sin_port);
+    return fd;
+}
+
+} // end namespace
+
+ReceiverEmulator::ReceiverEmulator(const EmulatorConfig& config) throw(std::exception) :
+        _config(config),
+        _main_fd(-1),
+        _main_port(0),
+        _data_fd(),
+        _data_port(),
+        _run(false) {
+
+    if (_config.segment_max < _config.segment_min) _config.segment_max = _config.segment_min;
+    if (_config.batch_frames == 0) _config.batch_frames = 1;
+    if (_config.garbage_max == 0) _config.garbage_max = 1;
+    _data_fd.fill(-1);
+    for (auto& acq : _acq) acq = !_config.acq_required;
+
+    try {
+        _main_fd = listenOn(_config.address, _config.main_port, _main_port);
+        for (std::size_t channel = 0; channel < EMULATOR_CHANNELS; channel++)
+            _data_fd[channel] = listenOn(_config.address, _config.data_ports[channel], _data_port[channel]);
+    }
+    catch (std::exception& e) {
+        if (_main_fd >= 0) ::close(_main_fd);
+        for (int fd : _data_fd)
+            if (fd >= 0) ::close(fd);
+        throw;
+    }
+}
+
+ReceiverEmulator::~ReceiverEmulator() {
+    stop();
+    ::close(_main_fd);
+    for (int fd : _data_fd) ::close(fd);
+}
+
+void ReceiverEmulator::start() {
+    if (_run.exchange(true)) return;
+
+    _threads.emplace_back(&ReceiverEmulator::serveMain, this);
+    for (std::size_t channel = 0; channel < EMULATOR_CHANNELS; channel++)
+        _threads.emplace_back(&ReceiverEmulator::serveData, this, channel);
+}
+
+void ReceiverEmulator::stop() {
+    _run = false;
+    for (auto& thread : _threads) thread.join();
+    _threads.clear();
+}
+
+int ReceiverEmulator::acceptClient(int listen_fd) {
+    struct pollfd pfd = { listen_fd, POLLIN, 0 };
+    while (_run) {
+        if (poll(&pfd, 1, POLL_MS) <= 0) continue;
+        const int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd >= 0) return fd;
+    }
+    return -1;
+}
+
+void ReceiverEmulator::serveMain() {
+    while (_run) {
+        const int fd = acceptClient(_main_fd);
+        if (fd < 0) return;
+        // answers of the pipelined queries go out at once, not delayed by Nagle
+        const int nodelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+        std::string line;
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        while (_run) {
+            if (poll(&pfd, 1, POLL_MS) <= 0) continue;
+
+            char buffer[256];
+            const ssize_t len = recv(fd, buffer, sizeof(buffer), 0);
+            if (len == 0) break;
+            if (len < 0) {
+                if ((errno == EAGAIN) || (errno == EINTR)) continue;
+                break;
+            }
+
+            for (ssize_t i = 0; i < len; i++) {
+                if (buffer[i] != '\n') {
+                    if (buffer[i] != '\r') line += buffer[i];
+                    continue;
+                }
+                const std::string answer = command(line);
+                line.clear();
+                // answers are short, socket buffer takes them
+                if (!answer.empty()) send(fd, answer.data(), answer.size(), MSG_NOSIGNAL);
+            }
+        }
+        ::close(fd);
+    }
+}
+
+std::string ReceiverEmulator::command(const std::string& line) {
+    if (line == "*IDN?") return IDN_ANSWER;
+
+    if (line == ":ACQ?")
+        return (std::string(_acq[0] ? "1" : "0") + "," + (_acq[1] ? "1" : "0") + "\n");
+
+    unsigned active, channel;
+    if ((std::sscanf(line.c_str(), "ACQ %u,%u", &active, &channel) == 2) && (channel >= 1) && (channel <= EMULATOR_CHANNELS)) {
+        _acq[channel - 1] = (active != 0);
+        return "";
+    }
+
+    std::cerr << "emulator: unknown command <" << line << ">" << std::endl;
+    return "";
+}
+
+void ReceiverEmulator::appendFrame(std::vector<uint8_t>& buffer, uint64_t counter, std::size_t channel, uint32_t& random) {
+    const uint8_t first_magic = (_config.device == emulated_device::FBS) ? fbs_receiver::FBS_MAGIC[0] : lpps_receiver::LPPS_MAGIC[0];
+
+    if ((_config.garbage_probability > 0.0)
+            && ((nextRandom(random) / 4294967296.0) < _config.garbage_probability)) {
+        const std::size_t len = 1 + (nextRandom(random) % _config.garbage_max);
+        for (std::size_t i = 0; i < len; i++) {
+            uint8_t byte = static_cast<uint8_t>(nextRandom(random));
+            if (byte == first_magic) byte++;
+            buffer.push_back(byte);
+        }
+        _stats[channel].garbage_bytes += len;
+    }
+
+    const uint64_t ntp = ntpNow();
+    const std::size_t pos = buffer.size();
+    if (_config.device == emulated_device::FBS) {
+        using namespace fbs_receiver;
+        buffer.resize(pos + REC_FRAME_LEN, 0);
+        uint8_t* frame = &buffer[pos];
+        const uint32_t tc1 = static_cast<uint32_t>(counter);
+        const uint32_t tc2 = tc1 + 1;
+        const uint32_t tc3 = tc1 + 2;
+        std::memcpy(frame, FBS_MAGIC, FBS_HEADER_LEN);
+        std::memcpy(frame + FBS_HEADER_LEN + FBS_TC1_OFFSET, &tc1, sizeof(tc1));
+        std::memcpy(frame + FBS_HEADER_LEN + FBS_TC2_OFFSET, &tc2, sizeof(tc2));
+        std::memcpy(frame + FBS_HEADER_LEN + FBS_TC3_OFFSET, &tc3, sizeof(tc3));
+        std::memcpy(frame + FBS_HEADER_LEN + FBS_NTP_OFFSET, &ntp, sizeof(ntp));
+    }
+    else {
+        using namespace lpps_receiver;
+        lpps_frame frame;
+        std::memset(&frame, 0, sizeof(frame));
+        std::memcpy(&frame.header, LPPS_MAGIC, sizeof(LPPS_MAGIC));
+        frame.lpps_data = static_cast<uint32_t>(counter);
+        frame.frame_delay_pru_cycle = 200u; // 1 us
+        frame.errors = 0;
+        frame.data_timestamp_ntp = ntp;
+        frame.pps_timestamp_ntp = ntp & 0xffffffff00000000ull; // last full second
+        buffer.resize(pos + LPPS_FRAME_LEN);
+        std::memcpy(&buffer[pos], &frame, sizeof(frame));
+    }
+}
+
+void ReceiverEmulator::serveData(std::size_t channel) {
+    ChannelStats& stats = _stats[channel];
+    const std::size_t frame_len = (_config.device == emulated_device::FBS) ? fbs_receiver::REC_FRAME_LEN : lpps_receiver::LPPS_FRAME_LEN;
+    uint32_t random = _config.seed * 2654435761u + static_cast<uint32_t>(channel) + 1u;
+    uint64_t counter = 0;
+    std::vector<uint8_t> buffer;
+    buffer.reserve(_config.batch_frames * (frame_len + _config.garbage_max) + frame_len);
+
+    // zero copy sends of the connection and their completions
+    int send_flags = MSG_NOSIGNAL;
+    uint32_t sends = 0;
+    uint32_t completed = 0;
+
+    // send everything, in pieces when splitting is configured; false when the client is gone or stopped
+    auto sendAll = [this, &random, &stats, &send_flags, &sends](int fd, const uint8_t* data, std::size_t len) -> bool {
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        while (len) {
+            std::size_t piece = len;
+            if (_config.segment_max) {
+                const std::size_t range = _config.segment_max - _config.segment_min + 1;
+                piece = std::min(len, std::max<std::size_t>(1, _config.segment_min + (nextRandom(random) % range)));
+            }
+            std::size_t done = 0;
+            while (done < piece) {
+                if (!_run) return false;
+                const ssize_t ret = send(fd, data + done, piece - done, send_flags);
+                if (ret < 0) {
+                    if ((errno == EAGAIN) || (errno == EINTR)) {
+                        poll(&pfd, 1, POLL_MS);
+                        continue;
+                    }
+                    return false;
+                }
+                done += static_cast<std::size_t>(ret);
+                if (send_flags & MSG_ZEROCOPY) sends++;
+            }
+            stats.bytes += piece;
+            data += piece;
+            len -= piece;
+        }
+        return true;
+    };
+
+    while (_run) {
+        const int fd = acceptClient(_data_fd[channel]);
+        if (fd < 0) return;
+        stats.connections++;
+        if (_config.segment_max) {
+            // every send is a separate segment
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        send_flags = MSG_NOSIGNAL;
+        sends = completed = 0;
+        if (_config.zerocopy_send) {
+            int one = 1;
+            if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0) send_flags |= MSG_ZEROCOPY;
+            else std::cerr << "emulator: SO_ZEROCOPY not supported, " << std::strerror(errno) << std::endl;
+        }
+
+        uint64_t conn_frames = 0;
+        uint64_t paced = 0;
+        auto start = std::chrono::steady_clock::now();
+        bool connected = true;
+
+        while (_run && connected) {
+            if (!_acq[channel]) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                start = std::chrono::steady_clock::now();
+                paced = 0;
+                continue;
+            }
+
+            std::size_t nframes = _config.batch_frames;
+            if (_config.frame_rate > 0.0) {
+                const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                const uint64_t due = static_cast<uint64_t>(elapsed.count() * _config.frame_rate);
+                if (due <= paced) {
+                    const double wait_us = std::min(1000.0, 1e6 / _config.frame_rate);
+                    std::this_thread::sleep_for(std::chrono::microseconds(static_cast<long>(wait_us) + 1));
+                    continue;
+                }
+                nframes = static_cast<std::size_t>(std::min<uint64_t>(nframes, due - paced));
+            }
+            if (_config.disconnect_after)
+                nframes = static_cast<std::size_t>(std::min<uint64_t>(nframes, _config.disconnect_after - conn_frames));
+
+            buffer.clear();
+            for (std::size_t n = 0; n < nframes; n++)
+                appendFrame(buffer, counter++, channel, random);
+            conn_frames += nframes;
+            paced += nframes;
+
+            const bool disconnect = _config.disconnect_after && (conn_frames >= _config.disconnect_after);
+            if (disconnect) {
+                // half of the next frame, the client keeps a fragment
+                std::vector<uint8_t> next;
+                appendFrame(next, counter, channel, random);
+                buffer.insert(buffer.end(), next.begin(), next.begin() + static_cast<std::ptrdiff_t>(next.size() - frame_len / 2));
+            }
+
+            connected = sendAll(fd, buffer.data(), buffer.size())
+                    && ((send_flags & MSG_ZEROCOPY) ? waitZeroCopy(fd, sends, completed, _run) : true);
+            if (connected) stats.frames += nframes;
+            if (disconnect) {
+                stats.disconnects++;
+                connected = false;
+            }
+        }
+        ::close(fd);
+    }
+}
+
+} // namespace emulator
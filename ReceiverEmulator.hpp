@@ -0,0 +1,131 @@
+/*
+ * ReceiverEmulator.hpp
+ *
+ *  FBS/LPPS receiver emulator - management port and synthetic data channels,
+ *  for load and fragmentation tests of the client without the hardware.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_RECEIVER_EMULATOR_HPP_
+#define SRC_PISA_NETDEVICES_RECEIVER_EMULATOR_HPP_
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdexcept>
+
+namespace emulator {
+
+constexpr std::size_t EMULATOR_CHANNELS = 2u;
+
+enum class emulated_device {
+    FBS = 0u,
+    LPPS,
+};
+
+struct EmulatorConfig {
+    emulated_device device = emulated_device::FBS;
+    std::string address = "127.0.0.1";
+    int main_port = 5025;                   // 0 - any free port, see ReceiverEmulator::mainPort()
+    std::array<int, EMULATOR_CHANNELS> data_ports = {{ 5031, 5032 }};
+
+    double frame_rate = 10000.0;            // frames per second per channel, 0 - as fast as possible
+    std::size_t batch_frames = 64u;         // frames generated at once (one send, before splitting)
+
+    // every batch is sent in random pieces of segment_min..segment_max bytes (TCP_NODELAY), 0 - whole batch
+    std::size_t segment_min = 0u;
+    std::size_t segment_max = 0u;
+
+    double garbage_probability = 0.0;       // junk (1..garbage_max bytes) inserted before a frame
+    std::size_t garbage_max = 16u;
+
+    // data connection is closed in the middle of the frame after so many frames, 0 - never
+    uint64_t disconnect_after = 0u;
+    // stream only after "ACQ 1,ch", otherwise right after the data connection is accepted
+    bool acq_required = false;
+    unsigned seed = 1u;
+    // MSG_ZEROCOPY sends - on loopback the receiver gets whole pages, to test rx_backend::ZEROCOPY
+    bool zerocopy_send = false;
+};
+
+struct ChannelStats {
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> bytes;            // all sent bytes, garbage included
+    std::atomic<uint64_t> garbage_bytes;
+    std::atomic<uint64_t> connections;
+    std::atomic<uint64_t> disconnects;      // by disconnect_after
+
+    ChannelStats() : frames(0), bytes(0), garbage_bytes(0), connections(0), disconnects(0) {}
+};
+
+/*
+ * Listens on the management port and the data ports, one client per port at a time.
+ * Management port answers the queries the way FbsReceiver/LppsReceiver expect:
+ *   "*IDN?"    -> identification line (>= IDN_ACK_SIZE)
+ *   "ACQ a,ch" -> no answer, acquisition of the channel on (a = 1) / off
+ *   ":ACQ?"    -> "a,b\n", acquisition state of both channels
+ * Data ports stream frames with the running counter (FBS TC1 / LPPS lpps_data) and the current
+ * NTP timestamp, so the client can check order and loss.
+ *
+ * Garbage never contains the first byte of the frame magic, it can't be taken for a frame.
+ *
+ * Example usage:
+ *
+ *    emulator::EmulatorConfig config;
+ *    config.main_port = 0;
+ *    config.data_ports = {{ 0, 0 }};
+ *    config.frame_rate = 0;                  // full speed
+ *    config.segment_min = 1; config.segment_max = 100;
+ *    emulator::ReceiverEmulator emu(config);
+ *    emu.start();
+ *    fbs.connect_channel("127.0.0.1", fbs_receiver::fbs_channels::CHANNEL_1, emu.dataPort(0));
+ */
+class ReceiverEmulator {
+    public:
+        // listening sockets are opened here (throws when the port is in use)
+        ReceiverEmulator(const EmulatorConfig& config) throw(std::exception);
+        ~ReceiverEmulator();
+
+        ReceiverEmulator(const ReceiverEmulator&) = delete;
+        ReceiverEmulator& operator=(const ReceiverEmulator&) = delete;
+
+        void start();
+        void stop();
+
+        // real ports (when 0 was configured)
+        inline int mainPort() const { return (_main_port);}
+        inline int dataPort(std::size_t channel) const { return (_data_port[channel]);}
+
+        inline const ChannelStats& stats(std::size_t channel) const { return (_stats[channel]);}
+        inline bool acq(std::size_t channel) const { return (_acq[channel].load());}
+        inline const EmulatorConfig& config() const { return (_config);}
+
+    private:
+        void serveMain();
+        void serveData(std::size_t channel);
+        // command from the management port, return the answer (empty - no answer)
+        std::string command(const std::string& line);
+        // wait for a client, -1 when stopped
+        int acceptClient(int listen_fd);
+        // append one frame (and maybe garbage) to the buffer
+        void appendFrame(std::vector<uint8_t>& buffer, uint64_t counter, std::size_t channel, uint32_t& random);
+
+        EmulatorConfig _config;
+        int _main_fd;
+        int _main_port;
+        std::array<int, EMULATOR_CHANNELS> _data_fd;
+        std::array<int, EMULATOR_CHANNELS> _data_port;
+
+        std::array<std::atomic<bool>, EMULATOR_CHANNELS> _acq;
+        std::array<ChannelStats, EMULATOR_CHANNELS> _stats;
+
+        std::atomic<bool> _run;
+        std::vector<std::thread> _threads;
+};
+
+} // namespace emulator
+
+#endif /* SRC_PISA_NETDEVICES_RECEIVER_EMULATOR_HPP_ */
@@ -0,0 +1,92 @@
+/*
+ * ReplayDevice.cpp
+ *
+ *  Data channel fed from the capture file, for offline reprocessing.
+ */
+
+#include "ReplayDevice.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace net {
+
+ReplayDevice::ReplayDevice(const std::string& name, const std::string& path, replay_pace pace) throw(std::exception) :
+        NetDevice(name),
+        _reader(path),
+        _pace(pace),
+        _chunk(),
+        _in_chunk(false),
+        _chunk_pos(0),
+        _next(0),
+        _finished(false),
+        _started(false),
+        _start_rx_ns(0) {
+    // "connected" to the file
+    setStubbed(false);
+    seekOffset(_reader.begin());
+}
+
+size_t ReplayDevice::receiveNB(RingBuffer& ring) {
+    size_t bytes_read = 0;
+    drained = false;
+
+    while (ring.writable()) {
+        if (!_in_chunk) {
+            if (!_reader.chunkAt(_next, _chunk)) {
+                // end of the capture (or the rest is not complete yet)
+                _finished = true;
+                break;
+            }
+
+            if (_pace == replay_pace::ORIGINAL) {
+                const auto now = std::chrono::steady_clock::now();
+                if (!_started) {
+                    _started = true;
+                    _start = now;
+                    _start_rx_ns = _chunk.header->rx_time_ns;
+                }
+                const uint64_t rx_ns = std::max(_chunk.header->rx_time_ns, _start_rx_ns);
+                if (now < (_start + std::chrono::nanoseconds(rx_ns - _start_rx_ns))) break; // not yet
+            }
+            _in_chunk = true;
+            _chunk_pos = 0;
+            // replayed batches carry the capture (flush) time of the chunk
+            _rx_timestamp = _chunk.header->rx_time_ns;
+            _next = _chunk.next;
+        }
+
+        const size_t len = std::min(ring.writable(), static_cast<size_t>(_chunk.header->length) - _chunk_pos);
+        std::memcpy(ring.writePtr(), _chunk.data + _chunk_pos, len);
+        ring.commit(len);
+        bytes_read += len;
+        _chunk_pos += len;
+        if (_chunk_pos == _chunk.header->length) _in_chunk = false;
+    }
+
+    // nothing more right now (end of capture or waiting for the pace), ring full otherwise
+    drained = !_in_chunk;
+    ChannelMetrics::add(_metrics->recv_calls, 1);
+    ChannelMetrics::add(_metrics->bytes, bytes_read);
+    return bytes_read;
+}
+
+void ReplayDevice::seek(uint64_t ntp) {
+    seekOffset(_reader.seek(ntp));
+}
+
+void ReplayDevice::rewind() {
+    seekOffset(_reader.begin());
+}
+
+void ReplayDevice::seekOffset(uint64_t offset) {
+    // as a new connection - the framer drops the fragment of the old position instead of resyncing over it
+    _connection++;
+    _in_chunk = false;
+    _chunk_pos = 0;
+    _next = offset;
+    _finished = false;
+    _started = false;
+}
+
+} // namespace net
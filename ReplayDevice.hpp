@@ -0,0 +1,74 @@
+/*
+ * ReplayDevice.hpp
+ *
+ *  Data channel fed from the capture file, for offline reprocessing.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_REPLAY_DEVICE_HPP_
+#define SRC_PISA_NETDEVICES_REPLAY_DEVICE_HPP_
+
+#include <chrono>
+#include <string>
+
+#include "NetDevice.hpp"
+#include "CaptureFile.hpp"
+
+namespace net {
+
+enum class replay_pace {
+    FAST = 0u,      // as fast as the reader takes the data
+    ORIGINAL,       // chunks are released with the recorded timing
+};
+
+/*
+ * Plays the capture back through receiveNB(RingBuffer&), so the framer (and receiveFbsFrames/receiveLppsFrames)
+ * gets the same byte stream as from the socket. Device is not stubbed, but there's no socket behind it -
+ * poll it, it can't be attached to the NetReactor.
+ *
+ * Original pace is kept per chunk (one writer flush, ~CAPTURE_FLUSH_MS), data inside the chunk
+ * are released at once.
+ *
+ * Example usage:
+ *
+ *    auto replay = fbs.replay(fbs_receiver::fbs_channels::CHANNEL_1, "/data/fbs1.cap", net::replay_pace::FAST);
+ *    while (!replay->isFinished()) {
+ *        fbs.receiveFbsFrames(frames, fbs_receiver::fbs_channels::CHANNEL_1, errors);
+ *        ...
+ *    }
+ */
+class ReplayDevice : public NetDevice {
+    public:
+        ReplayDevice(const std::string& name, const std::string& path, replay_pace pace = replay_pace::FAST) throw(std::exception);
+
+        using NetDevice::receiveNB;
+        size_t receiveNB(RingBuffer& ring) override;
+
+        // continue from the chunk with the frame timestamp ntp (NTP 32.32, as in the frames)
+        void seek(uint64_t ntp);
+        void rewind();
+
+        // whole capture was returned
+        inline bool isFinished() const { return (_finished);}
+        inline const CaptureReader& reader() const { return (_reader);}
+
+    private:
+        void seekOffset(uint64_t offset);
+
+        CaptureReader _reader;
+        replay_pace _pace;
+
+        CaptureReader::Chunk _chunk;
+        bool _in_chunk;
+        std::size_t _chunk_pos;     // bytes of the current chunk already returned
+        uint64_t _next;             // offset of the next chunk
+        bool _finished;
+
+        // original pace - wall time of the first returned chunk and its recorded time
+        bool _started;
+        std::chrono::steady_clock::time_point _start;
+        uint64_t _start_rx_ns;
+};
+
+} // namespace net
+
+#endif /* SRC_PISA_NETDEVICES_REPLAY_DEVICE_HPP_ */
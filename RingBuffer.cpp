@@ -0,0 +1,59 @@
+/*
+ * RingBuffer.cpp
+ *
+ *  Receive ring for the data channels.
+ */
+
+#include "RingBuffer.hpp"
+
+#include <string>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cerrno>
+
+namespace net {
+
+RingBuffer::RingBuffer(std::size_t capacity) throw(std::exception) :
+        _base(nullptr),
+        _capacity(static_cast<std::size_t>(sysconf(_SC_PAGESIZE))),
+        _mask(0),
+        _head(0),
+        _tail(0) {
+
+    while (_capacity < capacity)
+        _capacity <<= 1;
+    _mask = _capacity - 1;
+
+    int fd = memfd_create("net_ring", MFD_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("RingBuffer: cannot create memfd, error: " + std::to_string(errno));
+
+    if (ftruncate(fd, static_cast<off_t>(_capacity)) != 0) {
+        ::close(fd);
+        throw std::runtime_error("RingBuffer: cannot resize memfd, error: " + std::to_string(errno));
+    }
+
+    // reserve address space for both copies, then place the same pages twice
+    void* area = mmap(nullptr, 2 * _capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED) {
+        ::close(fd);
+        throw std::runtime_error("RingBuffer: cannot reserve memory, error: " + std::to_string(errno));
+    }
+    _base = static_cast<uint8_t*>(area);
+
+    if ((mmap(_base, _capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+            || (mmap(_base + _capacity, _capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)) {
+        int err = errno;
+        munmap(_base, 2 * _capacity);
+        ::close(fd);
+        throw std::runtime_error("RingBuffer: cannot map ring, error: " + std::to_string(err));
+    }
+    // mappings keep the memory
+    ::close(fd);
+}
+
+RingBuffer::~RingBuffer() {
+    munmap(_base, 2 * _capacity);
+}
+
+} // namespace net
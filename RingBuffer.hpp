@@ -0,0 +1,75 @@
+/*
+ * RingBuffer.hpp
+ *
+ *  Receive ring for the data channels.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_RING_BUFFER_HPP_
+#define SRC_PISA_NETDEVICES_RING_BUFFER_HPP_
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <stdexcept>
+
+namespace net {
+
+// 256kB, a few thousands of frames, enough to take a burst in one recv
+constexpr std::size_t RING_BUF_LENGTH = 256u * 1024u;
+
+/*
+ * "Magic" ring buffer - the same memory is mapped twice, one copy right after the other.
+ * Readable (and writable) region is always contiguous, also when it crosses the end of the ring,
+ * so recv can write directly into it and the frame placed on the wrap point can be used in place.
+ *
+ *  | mapping 1                 | mapping 2 (the same pages) |
+ *  |      ^head ....... ^tail  |                            |
+ *  |.. ^tail   ^head ..........|.. (continues here)         |
+ *
+ * head/tail are never wrapped, only masked on access.
+ * Capacity is rounded up to the power of 2 and page size.
+ *
+ * Writer (commit) and reader (consume/releaseTo) can be different threads, e.g. the consumer
+ * of FrameBatch releases the data it has processed.
+ */
+class RingBuffer {
+    public:
+        RingBuffer(std::size_t capacity = RING_BUF_LENGTH) throw(std::exception);
+        ~RingBuffer();
+
+        RingBuffer(const RingBuffer&) = delete;
+        RingBuffer& operator=(const RingBuffer&) = delete;
+
+        // data stored in the ring, size() bytes are contiguous from this pointer
+        inline const uint8_t* readPtr() const { return (at(head()));}
+        inline std::size_t size() const { return (static_cast<std::size_t>(tail() - head()));}
+        // release the data from the beginning
+        inline void consume(std::size_t len) { releaseTo(head() + len);}
+
+        // free space, writable() bytes are contiguous from this pointer
+        inline uint8_t* writePtr() { return (_base + (_tail.load(std::memory_order_relaxed) & _mask));}
+        inline std::size_t writable() const { return (_capacity - size());}
+        // append len bytes written at writePtr()
+        inline void commit(std::size_t len) { _tail.store(_tail.load(std::memory_order_relaxed) + len, std::memory_order_release);}
+
+        // absolute positions (bytes written since the ring was created)
+        inline uint64_t head() const { return (_head.load(std::memory_order_acquire));}
+        inline uint64_t tail() const { return (_tail.load(std::memory_order_acquire));}
+        inline const uint8_t* at(uint64_t pos) const { return (_base + (pos & _mask));}
+        // release all the data before pos
+        inline void releaseTo(uint64_t pos) { _head.store(pos, std::memory_order_release);}
+
+        inline void clear() { releaseTo(tail());}
+        inline std::size_t capacity() const { return (_capacity);}
+
+    private:
+        uint8_t* _base;
+        std::size_t _capacity;
+        std::size_t _mask;
+        std::atomic<uint64_t> _head;
+        std::atomic<uint64_t> _tail;
+};
+
+} // namespace net
+
+#endif /* SRC_PISA_NETDEVICES_RING_BUFFER_HPP_ */
@@ -0,0 +1,252 @@
+/*
+ * ScpiChannel.cpp
+ *
+ *  Pipelined SCPI commands on the management socket, answers matched to the queries by their order.
+ */
+
+#include "ScpiChannel.hpp"
+
+#include <poll.h>
+#include <cstring>
+#include <algorithm>
+
+namespace net {
+
+namespace { // for internal use only
+
+const char* statusText(scpi_status status) {
+    switch (status) {
+        case scpi_status::OK: return "ok";
+        case scpi_status::TIMEOUT: return "timeout";
+        default: return "connection lost";
+    }
+}
+
+} // end namespace
+
+ScpiChannel::ScpiChannel(std::shared_ptr<NetDevice> device) throw(std::exception) :
+        _device(device),
+        _waiting(0),
+        _rx(SCPI_RX_LENGTH),
+        _scanned(0),
+        _stats() {
+}
+
+ScpiChannel::~ScpiChannel() {
+    cancel();
+}
+
+void ScpiChannel::cancel() {
+    std::vector<Completion> completions;
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        fail(scpi_status::LOST, completions);
+    }
+    for (auto& completion : completions) completion.first(completion.second, "");
+}
+
+std::future<std::string> ScpiChannel::query(const std::string& command, std::chrono::milliseconds timeout) {
+    auto promise = std::make_shared<std::promise<std::string>>();
+    std::future<std::string> answer = promise->get_future();
+    const std::string name = _device->getName();
+
+    query(command, [promise, name, command](scpi_status status, const std::string& answer) {
+        if (status == scpi_status::OK) promise->set_value(answer);
+        else promise->set_exception(std::make_exception_ptr(std::runtime_error(
+                name + ", " + command + " failed : " + statusText(status))));
+    }, timeout);
+    return answer;
+}
+
+void ScpiChannel::query(const std::string& command, Callback callback, std::chrono::milliseconds timeout) {
+    std::lock_guard<std::mutex> lock(_mtx);
+    // deadline counts from the flush, but the queue is flushed soon - take it from now
+    _queries.push_back(Query { std::move(callback), std::chrono::steady_clock::now() + timeout, timeout, false });
+    _waiting++;
+    enqueue(command);
+}
+
+void ScpiChannel::command(const std::string& command) {
+    std::lock_guard<std::mutex> lock(_mtx);
+    enqueue(command);
+}
+
+void ScpiChannel::enqueue(const std::string& command) {
+    _tx += command;
+    _tx += NEWLINE;
+    _stats.commands++;
+}
+
+bool ScpiChannel::flush() {
+    std::vector<Completion> completions;
+    bool connected;
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        connected = sendQueued();
+        if (!connected) fail(scpi_status::LOST, completions);
+    }
+    for (auto& completion : completions) completion.first(completion.second, "");
+    return connected;
+}
+
+bool ScpiChannel::sendQueued() {
+    // closed device - nothing to send nor to wait for, even with the queue empty
+    if (_device->isStubbed()) return false;
+    if (_tx.empty()) return true;
+    try {
+        const std::size_t sent = _device->sendNB(reinterpret_cast<const uint8_t*>(_tx.data()), _tx.size());
+        // socket buffer full - the rest goes with the next flush
+        _tx.erase(0, sent);
+    }
+    catch (std::exception& e) {
+        _device->setStubbed(true);
+        return false;
+    }
+    return true;
+}
+
+std::size_t ScpiChannel::poll(int timeout_ms) {
+    std::vector<Completion> completions;
+    std::vector<std::pair<Callback, std::string>> answers;
+    std::size_t waiting;
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        bool connected = sendQueued();
+
+        if (connected && !_queries.empty()) {
+            struct pollfd pfd = { _device->getPollFd(), POLLIN | POLLRDHUP, 0 };
+            // don't keep the lock while sleeping, other threads can queue commands
+            lock.unlock();
+            const int ready = ::poll(&pfd, 1, timeout_ms);
+            lock.lock();
+
+            if (ready > 0) {
+                try {
+                    receiveAnswers(answers);
+                }
+                catch (std::exception& e) {
+                    connected = false;
+                }
+                // data before the hang up are already read
+                if (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR)) connected = false;
+            }
+        }
+
+        if (!connected) {
+            _device->setStubbed(true);
+            fail(scpi_status::LOST, completions);
+        }
+        else expire(completions);
+        waiting = _waiting;
+    }
+
+    // callbacks without the lock, they can queue new commands
+    for (auto& answer : answers) answer.first(scpi_status::OK, answer.second);
+    for (auto& completion : completions) completion.first(completion.second, "");
+    return waiting;
+}
+
+std::size_t ScpiChannel::pollAll(const std::vector<ScpiChannel*>& channels, int timeout_ms) {
+    std::vector<struct pollfd> fds;
+    fds.reserve(channels.size());
+    std::size_t waiting = 0;
+
+    // send everything first, all devices work in parallel
+    for (auto channel : channels) {
+        waiting += channel->poll(0);
+        if (channel->pending()) fds.push_back(pollfd { channel->_device->getPollFd(), POLLIN | POLLRDHUP, 0 });
+    }
+    if (!waiting || !timeout_ms) return waiting;
+
+    ::poll(fds.data(), fds.size(), timeout_ms);
+    waiting = 0;
+    for (auto channel : channels) waiting += channel->poll(0);
+    return waiting;
+}
+
+std::size_t ScpiChannel::pollAll(const std::vector<std::unique_ptr<ScpiChannel>>& channels, int timeout_ms) {
+    std::vector<ScpiChannel*> pointers;
+    pointers.reserve(channels.size());
+    for (auto& channel : channels) pointers.push_back(channel.get());
+    return pollAll(pointers, timeout_ms);
+}
+
+void ScpiChannel::receiveAnswers(std::vector<std::pair<Callback, std::string>>& answers) {
+    do {
+        if (!_rx.writable()) {
+            // line longer than the ring, not SCPI answer - drop it
+            _stats.unexpected++;
+            _rx.clear();
+            _scanned = _rx.tail();
+        }
+        _device->receiveNB(_rx);
+
+        // incremental - only the new data are searched for the line end
+        while (_scanned < _rx.tail()) {
+            const uint8_t* data = _rx.at(_scanned);
+            const uint8_t* end = static_cast<const uint8_t*>(std::memchr(data, '\n', static_cast<std::size_t>(_rx.tail() - _scanned)));
+            if (!end) {
+                _scanned = _rx.tail();
+                break;
+            }
+
+            // the line starts at head (previous lines are released), contiguous in the ring
+            _scanned += static_cast<uint64_t>(end - data);
+            std::size_t len = static_cast<std::size_t>(_scanned - _rx.head());
+            const char* line = reinterpret_cast<const char*>(_rx.readPtr());
+            if (len && (line[len - 1] == '\r')) len--;
+            _scanned++;
+
+            if (_queries.empty()) _stats.unexpected++;
+            else {
+                Query& query = _queries.front();
+                if (query.expired) _stats.late++;
+                else {
+                    answers.emplace_back(std::move(query.callback), std::string(line, len));
+                    _stats.answers++;
+                    _waiting--;
+                }
+                _queries.pop_front();
+            }
+            _rx.releaseTo(_scanned);
+        }
+    } while (!_device->isDrained() && !_device->isStubbed());
+}
+
+void ScpiChannel::expire(std::vector<Completion>& completions) {
+    const auto now = std::chrono::steady_clock::now();
+    for (auto& query : _queries) {
+        if (query.expired || (now < query.deadline)) continue;
+        query.expired = true;
+        completions.emplace_back(std::move(query.callback), scpi_status::TIMEOUT);
+        _stats.timeouts++;
+        _waiting--;
+    }
+    // placeholders of the answers which will never come
+    while (!_queries.empty() && _queries.front().expired && (now > (_queries.front().deadline + _queries.front().timeout)))
+        _queries.pop_front();
+}
+
+void ScpiChannel::fail(scpi_status status, std::vector<Completion>& completions) {
+    for (auto& query : _queries) {
+        if (query.expired) continue;
+        completions.emplace_back(std::move(query.callback), status);
+    }
+    _queries.clear();
+    _waiting = 0;
+    _tx.clear();
+    _rx.clear();
+    _scanned = _rx.tail();
+}
+
+std::size_t ScpiChannel::pending() {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return (_waiting);
+}
+
+ScpiStats ScpiChannel::stats() {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return (_stats);
+}
+
+} // namespace net
@@ -0,0 +1,138 @@
+/*
+ * ScpiChannel.hpp
+ *
+ *  Pipelined SCPI commands on the management socket, answers matched to the queries by their order.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_SCPI_CHANNEL_HPP_
+#define SRC_PISA_NETDEVICES_SCPI_CHANNEL_HPP_
+
+#include <cstdint>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "NetDevice.hpp"
+#include "RingBuffer.hpp"
+
+namespace net {
+
+// answers are short, the ring is rounded up to the page size anyway
+constexpr std::size_t SCPI_RX_LENGTH = 16u * 1024u;
+constexpr std::chrono::milliseconds SCPI_TIMEOUT(1000);
+
+enum class scpi_status {
+    OK = 0u,
+    TIMEOUT,    // no answer in time
+    LOST,       // connection closed or broken, or the channel was destroyed
+};
+
+struct ScpiStats {
+    uint64_t commands;      // sent, queries included
+    uint64_t answers;       // matched to the queries
+    uint64_t timeouts;
+    uint64_t late;          // answers which came after the timeout of their query (dropped)
+    uint64_t unexpected;    // answers with no query waiting (dropped)
+};
+
+/*
+ * SCPI over the TCP socket: every query (command with '?') gets exactly one answer line ("\n", "\r\n"),
+ * other commands get no answer. The device answers in order, so commands can be pipelined - any number
+ * of them is sent at once and the answers are matched to the waiting queries one by one.
+ *
+ * query/command only queue the text, flush() (or poll()) sends everything queued in one send,
+ * so polling N devices costs one round trip, not N.
+ * poll() sends, reads available answers, completes the queries and expires the old ones. It has to be called
+ * by the user (IO thread), callbacks run from it. query/command/flush can be called from any thread.
+ *
+ * Timed out query stays in the queue for one more timeout as a placeholder, so its late answer
+ * is dropped instead of being taken by the next query. REMEMBER the device has to answer every query
+ * (unknown one too), otherwise the placeholder takes the answer of the next query.
+ *
+ * Don't read the socket by other means (sendQuery, receiveNB) while the channel is used.
+ *
+ * Example usage:
+ *
+ *    // fleet status, one round trip
+ *    std::vector<std::future<std::string>> acq;
+ *    for (auto& channel : channels) acq.push_back(channel->query(":ACQ?"));
+ *    while (net::ScpiChannel::pollAll(channels, 10)) {}
+ *    for (auto& answer : acq) std::cout << answer.get() << std::endl; // throws on timeout / lost connection
+ */
+class ScpiChannel {
+    public:
+        // status != OK - answer is empty
+        using Callback = std::function<void(scpi_status status, const std::string& answer)>;
+
+        // device has to be connected (or connected later, before flush)
+        ScpiChannel(std::shared_ptr<NetDevice> device) throw(std::exception);
+        // pending queries are completed with LOST
+        ~ScpiChannel();
+
+        ScpiChannel(const ScpiChannel&) = delete;
+        ScpiChannel& operator=(const ScpiChannel&) = delete;
+
+        // command without the line end, query - command with one answer line
+        std::future<std::string> query(const std::string& command, std::chrono::milliseconds timeout = SCPI_TIMEOUT);
+        void query(const std::string& command, Callback callback, std::chrono::milliseconds timeout = SCPI_TIMEOUT);
+        // no answer expected
+        void command(const std::string& command);
+
+        // send all queued commands, return false when the connection is lost
+        bool flush();
+        // drop the queued commands, pending queries are completed with LOST (before the socket is closed)
+        void cancel();
+
+        /*
+        @brief - flush, read answers, complete and expire queries
+        @param timeout_ms - wait so long for the data when some query is waiting (0 - don't wait)
+        @return number of queries still waiting for the answer
+        */
+        std::size_t poll(int timeout_ms = 0);
+
+        // poll() of many channels, waiting for the data of any of them, return number of waiting queries
+        static std::size_t pollAll(const std::vector<ScpiChannel*>& channels, int timeout_ms);
+        static std::size_t pollAll(const std::vector<std::unique_ptr<ScpiChannel>>& channels, int timeout_ms);
+
+        // queries waiting for the answer (timed out placeholders not counted)
+        std::size_t pending();
+        ScpiStats stats();
+        inline NetDevice& device() { return (*_device);}
+
+    private:
+        struct Query {
+            Callback callback;
+            std::chrono::steady_clock::time_point deadline;
+            std::chrono::milliseconds timeout;
+            bool expired;
+        };
+        using Completion = std::pair<Callback, scpi_status>;
+
+        void enqueue(const std::string& command);
+        // under the lock
+        bool sendQueued();
+        void receiveAnswers(std::vector<std::pair<Callback, std::string>>& answers);
+        void expire(std::vector<Completion>& completions);
+        void fail(scpi_status status, std::vector<Completion>& completions);
+
+        std::shared_ptr<NetDevice> _device;
+        std::mutex _mtx;
+        // commands not sent yet (or the rest of the partial send)
+        std::string _tx;
+        std::deque<Query> _queries;
+        std::size_t _waiting;
+        RingBuffer _rx;
+        // ring position searched for the line end
+        uint64_t _scanned;
+        ScpiStats _stats;
+};
+
+} // namespace net
+
+#endif /* SRC_PISA_NETDEVICES_SCPI_CHANNEL_HPP_ */
@@ -0,0 +1,335 @@
+/*
+ * ShardedReactor.cpp
+ *
+ *  Data channels spread over N reactor threads, placed and rebalanced by their byte rate.
+ */
+
+#include "ShardedReactor.hpp"
+#include "Logger.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <string>
+
+namespace net {
+
+struct ShardedReactor::Shard {
+    std::size_t index;
+    NetReactor reactor;
+    std::unique_ptr<FrameBatchPool> pool;
+    std::thread thread;
+    std::atomic<bool> running;
+    std::atomic<uint64_t> events;
+
+    // tasks from the other threads
+    std::mutex mtx;
+    std::vector<Task> tasks;
+    // no thread - tasks run in the posting thread
+    bool direct;
+
+    // load, under ShardedReactor::_mtx
+    std::size_t channels;
+    double rate;
+    uint64_t moved_in;
+
+    Shard(std::size_t index_) : index(index_), running(false), events(0), direct(true), channels(0), rate(0.0), moved_in(0) {}
+};
+
+struct ShardedReactor::Channel {
+    std::size_t id;
+    std::shared_ptr<NetDevice> device;
+    Attach attach;
+    Detach detach;
+    std::size_t shard;
+    std::atomic<bool> removed;
+    // ready when the old shard has detached it and posted the attach, under ShardedReactor::_mtx
+    std::shared_future<void> moved;
+    // rate measurement
+    uint64_t bytes;
+    double rate;
+
+    Channel() : id(0), shard(0), removed(false), bytes(0), rate(0.0) {}
+};
+
+ShardedReactor::ShardedReactor(const ShardConfig& config) throw(std::exception) :
+        _config(config),
+        _next_id(0),
+        _measured(Clock::now()),
+        _running(false) {
+    if (!_config.shards) throw std::runtime_error("ShardedReactor: no shards");
+    if (!_config.cpus.empty() && (_config.cpus.size() < _config.shards))
+        throw std::runtime_error("ShardedReactor: " + std::to_string(_config.shards) + " shards, cpus for "
+                + std::to_string(_config.cpus.size()) + " only");
+
+    for (std::size_t n = 0; n < _config.shards; n++) {
+        _shards.emplace_back(new Shard(n));
+        if (_config.pool_batches) _shards.back()->pool.reset(new FrameBatchPool(_config.pool_batches, _config.pool_frames));
+    }
+}
+
+ShardedReactor::~ShardedReactor() {
+    stop();
+}
+
+void ShardedReactor::start() throw(std::exception) {
+    if (_running) return;
+    _running = true;
+
+    for (auto& shard : _shards) {
+        Shard* s = shard.get();
+        s->running = true;
+        {
+            std::lock_guard<std::mutex> lock(s->mtx);
+            s->direct = false;
+        }
+        s->thread = std::thread([this, s]() { run(*s); });
+
+        if (!_config.cpus.empty()) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(_config.cpus[s->index], &cpus);
+            const int error = pthread_setaffinity_np(s->thread.native_handle(), sizeof(cpus), &cpus);
+            if (error) {
+                stop();
+                throw std::runtime_error("ShardedReactor: cannot pin shard " + std::to_string(s->index) + " to cpu "
+                        + std::to_string(_config.cpus[s->index]) + ", error: " + std::to_string(error));
+            }
+        }
+    }
+
+    _measured = Clock::now();
+    if (_config.rebalance_interval.count()) _balancer = std::thread(&ShardedReactor::balancer, this);
+}
+
+void ShardedReactor::stop() {
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _running = false;
+    }
+    _balancer_cv.notify_all();
+    if (_balancer.joinable()) _balancer.join();
+
+    for (auto& shard : _shards) {
+        shard->running = false;
+        shard->reactor.wake();
+    }
+    for (auto& shard : _shards) {
+        if (!shard->thread.joinable()) continue;
+        shard->thread.join();
+
+        // posted after the last run of the thread (move in progress)
+        std::vector<Task> tasks;
+        {
+            std::lock_guard<std::mutex> lock(shard->mtx);
+            shard->direct = true;
+            tasks.swap(shard->tasks);
+        }
+        for (auto& task : tasks) task();
+    }
+}
+
+std::size_t ShardedReactor::add(std::shared_ptr<NetDevice> device, Attach attach, Detach detach) {
+    auto channel = std::make_shared<Channel>();
+    channel->device = device;
+    channel->attach = std::move(attach);
+    channel->detach = std::move(detach);
+    channel->bytes = device->metrics().bytes.load(std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(_mtx);
+    channel->id = _next_id++;
+
+    // least loaded, the rate of a new channel is not known - count of channels decides between the idle ones
+    auto least = std::min_element(_shards.begin(), _shards.end(), [](const std::unique_ptr<Shard>& a, const std::unique_ptr<Shard>& b) {
+        return (a->rate < b->rate) || ((a->rate == b->rate) && (a->channels < b->channels));
+    });
+    Shard& shard = **least;
+    channel->shard = shard.index;
+    shard.channels++;
+    _channels.push_back(channel);
+
+    post(shard, [channel, &shard]() {
+        if (channel->removed) return;
+        try {
+            channel->attach(shard.reactor, shard.index);
+        }
+        catch (std::exception& e) {
+            NETLOG_ERROR("{} : attach to shard {} failed : {}", channel->device->getName(), shard.index, e.what());
+        }
+    });
+    return channel->id;
+}
+
+void ShardedReactor::remove(std::size_t id) {
+    std::shared_ptr<Channel> channel;
+    Shard* current;
+    std::shared_future<void> moved;
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        auto it = std::find_if(_channels.begin(), _channels.end(), [id](const std::shared_ptr<Channel>& c) { return (c->id == id); });
+        if (it == _channels.end()) return;
+        channel = *it;
+        _channels.erase(it);
+        current = _shards[channel->shard].get();
+        current->channels--;
+        current->rate -= channel->rate;
+        moved = channel->moved;
+    }
+    // move in progress attaches nothing after this
+    channel->removed = true;
+    // the old shard can still be reading it, its detach has to be done before ours
+    if (moved.valid()) moved.wait();
+
+    Shard& shard = *current;
+    auto done = std::make_shared<std::promise<void>>();
+    std::future<void> detached = done->get_future();
+    post(shard, [channel, &shard, done]() {
+        channel->detach(shard.reactor);
+        done->set_value();
+    });
+    detached.wait();
+}
+
+bool ShardedReactor::rebalance() {
+    std::lock_guard<std::mutex> lock(_mtx);
+    measure(Clock::now());
+
+    double total = 0.0;
+    for (auto& shard : _shards) total += shard->rate;
+    const double mean = total / static_cast<double>(_shards.size());
+
+    auto hot = std::max_element(_shards.begin(), _shards.end(), [](const std::unique_ptr<Shard>& a, const std::unique_ptr<Shard>& b) {
+        return (a->rate < b->rate); });
+    auto cold = std::min_element(_shards.begin(), _shards.end(), [](const std::unique_ptr<Shard>& a, const std::unique_ptr<Shard>& b) {
+        return (a->rate < b->rate); });
+    if ((hot == cold) || ((*hot)->rate < _config.min_rate) || ((*hot)->rate <= (_config.imbalance * mean))) return false;
+
+    // channel closest to the half of the difference evens the two shards the most,
+    // moving more than the difference would only swap them
+    const double gap = (*hot)->rate - (*cold)->rate;
+    std::shared_ptr<Channel> best;
+    for (auto& channel : _channels) {
+        if ((channel->shard != (*hot)->index) || (channel->rate <= 0.0) || (channel->rate >= gap)) continue;
+        // the previous move is not finished yet
+        if (moving(*channel)) continue;
+        if (!best || (std::fabs(channel->rate - gap / 2.0) < std::fabs(best->rate - gap / 2.0))) best = channel;
+    }
+    if (!best) return false;
+
+    move(best, (*cold)->index);
+    return true;
+}
+
+std::size_t ShardedReactor::shardOf(std::size_t id) {
+    std::lock_guard<std::mutex> lock(_mtx);
+    for (auto& channel : _channels) {
+        if (channel->id == id) return channel->shard;
+    }
+    throw std::out_of_range("ShardedReactor: no channel " + std::to_string(id));
+}
+
+FrameBatchPool& ShardedReactor::pool(std::size_t shard) throw(std::exception) {
+    if (!_shards.at(shard)->pool) throw std::runtime_error("ShardedReactor: no batch pools (ShardConfig::pool_batches)");
+    return (*_shards[shard]->pool);
+}
+
+std::vector<ShardStats> ShardedReactor::stats() {
+    std::lock_guard<std::mutex> lock(_mtx);
+    std::vector<ShardStats> stats;
+    for (auto& shard : _shards)
+        stats.push_back(ShardStats { shard->channels, shard->rate, shard->events.load(std::memory_order_relaxed), shard->moved_in });
+    return stats;
+}
+
+void ShardedReactor::post(Shard& shard, Task task) {
+    {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        if (!shard.direct) {
+            shard.tasks.push_back(std::move(task));
+            shard.reactor.wake();
+            return;
+        }
+    }
+    task();
+}
+
+void ShardedReactor::run(Shard& shard) {
+    std::vector<Task> tasks;
+    // events and tasks of the last round after stop are left, stop() runs the tasks
+    while (shard.running) {
+        {
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            tasks.swap(shard.tasks);
+        }
+        for (auto& task : tasks) task();
+        tasks.clear();
+
+        const std::size_t events = shard.reactor.poll(-1);
+        shard.events.store(shard.events.load(std::memory_order_relaxed) + events, std::memory_order_relaxed);
+    }
+}
+
+void ShardedReactor::balancer() {
+    std::unique_lock<std::mutex> lock(_mtx);
+    while (_running) {
+        _balancer_cv.wait_for(lock, _config.rebalance_interval);
+        if (!_running) break;
+        lock.unlock();
+        rebalance();
+        lock.lock();
+    }
+}
+
+void ShardedReactor::measure(Clock::time_point now) {
+    const double seconds = std::chrono::duration<double>(now - _measured).count();
+    if (seconds <= 0.0) return;
+    _measured = now;
+
+    for (auto& shard : _shards) shard->rate = 0.0;
+    for (auto& channel : _channels) {
+        const uint64_t bytes = channel->device->metrics().bytes.load(std::memory_order_relaxed);
+        // reconnect can reset the counters of a replaced device
+        const double rate = (bytes >= channel->bytes) ? (static_cast<double>(bytes - channel->bytes) / seconds) : 0.0;
+        channel->bytes = bytes;
+        channel->rate = _config.rate_alpha * rate + (1.0 - _config.rate_alpha) * channel->rate;
+        _shards[channel->shard]->rate += channel->rate;
+    }
+}
+
+void ShardedReactor::move(const std::shared_ptr<Channel>& channel, std::size_t to) {
+    Shard& from = *_shards[channel->shard];
+    Shard& dest = *_shards[to];
+
+    from.channels--;
+    from.rate -= channel->rate;
+    dest.channels++;
+    dest.rate += channel->rate;
+    dest.moved_in++;
+    channel->shard = to;
+
+    auto done = std::make_shared<std::promise<void>>();
+    channel->moved = done->get_future().share();
+
+    // attach is posted by the old shard after its detach - never two threads on the socket
+    post(from, [this, channel, &from, &dest, done]() {
+        channel->detach(from.reactor);
+        post(dest, [channel, &dest]() {
+            if (channel->removed) return;
+            try {
+                channel->attach(dest.reactor, dest.index);
+            }
+            catch (std::exception& e) {
+                NETLOG_ERROR("{} : attach to shard {} failed : {}", channel->device->getName(), dest.index, e.what());
+            }
+        });
+        done->set_value();
+    });
+}
+
+bool ShardedReactor::moving(const Channel& channel) {
+    return (channel.moved.valid() && (channel.moved.wait_for(std::chrono::seconds(0)) != std::future_status::ready));
+}
+
+} // namespace net
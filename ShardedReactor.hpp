@@ -0,0 +1,150 @@
+/*
+ * ShardedReactor.hpp
+ *
+ *  Data channels spread over N reactor threads, placed and rebalanced by their byte rate.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_SHARDED_REACTOR_HPP_
+#define SRC_PISA_NETDEVICES_SHARDED_REACTOR_HPP_
+
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdexcept>
+
+#include "NetDevice.hpp"
+#include "NetReactor.hpp"
+#include "FrameBatch.hpp"
+
+namespace net {
+
+struct ShardConfig {
+    std::size_t shards = std::max(1u, std::thread::hardware_concurrency());
+    // cpu of shard n = cpus[n], empty - threads not pinned
+    std::vector<int> cpus;
+    // period of the rate measurement and rebalancing, 0 - only by rebalance()
+    std::chrono::milliseconds rebalance_interval = std::chrono::milliseconds(1000);
+    // channel is moved when the hottest shard has so many times the mean load
+    double imbalance = 1.25;
+    // shards below this load (bytes/s) are not worth moving anything
+    double min_rate = 1e6;
+    // smoothing of the measured rates (weight of the last interval)
+    double rate_alpha = 0.5;
+    // FrameBatchPool per shard (pool(shard)), 0 batches - no pools
+    std::size_t pool_batches = 0u;
+    std::size_t pool_frames = 1024u;
+};
+
+struct ShardStats {
+    std::size_t channels;
+    double rate;            // bytes/s of its channels
+    uint64_t events;        // dispatched by the reactor
+    uint64_t moved_in;      // channels taken over by rebalancing
+};
+
+/*
+ * N reactor threads, every data channel is served by exactly one of them. A shard owns
+ * the sockets registered in its reactor (and with them the framers of the receivers) and its
+ * batch pool, so the hot path has no locks shared between the shards.
+ *
+ * New channel goes to the shard with the least load. Every rebalance_interval the rates are
+ * measured (NetDevice::metrics().bytes), and when one shard is overloaded its channel which
+ * evens the load the most is moved to the least loaded shard - one move per interval, so a burst
+ * doesn't shuffle everything. The move is: detach in the old shard thread, then attach in the new one,
+ * the channel is never read by two threads.
+ *
+ * attach/detach are the receiver calls with the shard's reactor (FbsReceiver::attach/detach), the handler
+ * runs in the thread of the shard, shard index can be used to pick the shard's pool.
+ *
+ * add/remove/rebalance/stats from one control thread (not from the handlers), remove waits for the detach
+ * (of the old shard too, when the channel is just being moved).
+ *
+ * Example usage:
+ *
+ *    net::ShardConfig config;
+ *    config.shards = 4;
+ *    config.cpus = {2, 3, 4, 5};
+ *    net::ShardedReactor shards(config);
+ *    shards.start();
+ *    // called from the shard thread of the channel
+ *    fbs_receiver::FramesHandler handler = [](fbs_receiver::fbs_channels channel, const std::vector<const uint8_t*>& frames, uint8_t errors) {
+ *        ...
+ *    };
+ *    // receivers - std::vector<std::shared_ptr<fbs_receiver::FbsReceiver>>, they outlive the shards
+ *    for (auto& fbs : receivers) {
+ *        fbs_receiver::FbsReceiver* receiver = fbs.get();
+ *        shards.add(receiver->getDataSocket(fbs_receiver::fbs_channels::CHANNEL_1),
+ *                [receiver, handler](net::NetReactor& reactor, std::size_t) { receiver->attach(reactor, fbs_receiver::fbs_channels::CHANNEL_1, handler); },
+ *                [receiver](net::NetReactor& reactor) { receiver->detach(reactor, fbs_receiver::fbs_channels::CHANNEL_1); });
+ *    }
+ *    ...
+ *    shards.stop();
+ */
+class ShardedReactor {
+    public:
+        using Attach = std::function<void(NetReactor& reactor, std::size_t shard)>;
+        using Detach = std::function<void(NetReactor& reactor)>;
+
+        ShardedReactor(const ShardConfig& config = ShardConfig()) throw(std::exception);
+        // stop()
+        ~ShardedReactor();
+
+        ShardedReactor(const ShardedReactor&) = delete;
+        ShardedReactor& operator=(const ShardedReactor&) = delete;
+
+        // start the shard threads (and the rebalancing), channels can be added before
+        void start() throw(std::exception);
+        void stop();
+
+        // register the channel, return its id
+        std::size_t add(std::shared_ptr<NetDevice> device, Attach attach, Detach detach);
+        // detach the channel (waits for its shard when running)
+        void remove(std::size_t id);
+
+        // measure the rates, move a channel when needed, return true when moved
+        bool rebalance();
+
+        std::size_t shardOf(std::size_t id);
+        std::vector<ShardStats> stats();
+        inline std::size_t shards() const { return (_shards.size());}
+        // batch pool of the shard, only for the handlers running in the shard (single producer)
+        FrameBatchPool& pool(std::size_t shard) throw(std::exception);
+
+    private:
+        struct Shard;
+        struct Channel;
+        using Clock = std::chrono::steady_clock;
+        using Task = std::function<void()>;
+
+        // run the task in the thread of the shard (now, when not running)
+        void post(Shard& shard, Task task);
+        void run(Shard& shard);
+        void balancer();
+        void measure(Clock::time_point now);
+        // under the lock
+        void move(const std::shared_ptr<Channel>& channel, std::size_t to);
+        // detach of the last move not done yet by the old shard, under the lock
+        static bool moving(const Channel& channel);
+
+        ShardConfig _config;
+        std::vector<std::unique_ptr<Shard>> _shards;
+        std::mutex _mtx;
+        std::vector<std::shared_ptr<Channel>> _channels;
+        std::size_t _next_id;
+        Clock::time_point _measured;
+        std::atomic<bool> _running;
+        std::condition_variable _balancer_cv;
+        std::thread _balancer;
+};
+
+} // namespace net
+
+#endif /* SRC_PISA_NETDEVICES_SHARDED_REACTOR_HPP_ */
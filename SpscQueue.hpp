@@ -0,0 +1,99 @@
+/*
+ * SpscQueue.hpp
+ *
+ *  Bounded single producer / single consumer queue.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_SPSC_QUEUE_HPP_
+#define SRC_PISA_NETDEVICES_SPSC_QUEUE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace net {
+
+constexpr std::size_t CACHE_LINE = 64u;
+
+/*
+ * Wait free queue for exactly one producer thread and one consumer thread.
+ * push/pop never block and never allocate (storage is allocated in the constructor).
+ * Capacity is rounded up to the power of 2.
+ *
+ * Example usage:
+ *
+ *    net::SpscQueue<net::FrameBatch*> queue(64);
+ *    // producer                        // consumer
+ *    if (!queue.push(batch)) ...        net::FrameBatch* batch;
+ *                                       if (queue.pop(batch)) ...
+ */
+template <typename T>
+class SpscQueue {
+    public:
+        explicit SpscQueue(std::size_t capacity) :
+                _slots(roundCapacity(capacity)),
+                _mask(_slots.size() - 1),
+                _head(0),
+                _tail_cache(0),
+                _tail(0),
+                _head_cache(0) {
+        }
+
+        SpscQueue(const SpscQueue&) = delete;
+        SpscQueue& operator=(const SpscQueue&) = delete;
+
+        // producer side, return false when the queue is full
+        bool push(const T& val) {
+            const std::size_t tail = _tail.load(std::memory_order_relaxed);
+            if ((tail - _head_cache) > _mask) {
+                _head_cache = _head.load(std::memory_order_acquire);
+                if ((tail - _head_cache) > _mask) return false;
+            }
+            _slots[tail & _mask] = val;
+            _tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        // consumer side, return false when the queue is empty
+        bool pop(T& val) {
+            const std::size_t head = _head.load(std::memory_order_relaxed);
+            if (head == _tail_cache) {
+                _tail_cache = _tail.load(std::memory_order_acquire);
+                if (head == _tail_cache) return false;
+            }
+            val = _slots[head & _mask];
+            _head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        // approximate, exact only when called from producer or consumer with the other one idle
+        inline std::size_t size() const {
+            return (_tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire));
+        }
+        inline bool empty() const { return (size() == 0);}
+        inline std::size_t capacity() const { return (_slots.size());}
+
+    private:
+        static std::size_t roundCapacity(std::size_t capacity) {
+            std::size_t rounded = 1;
+            while (rounded < capacity)
+                rounded <<= 1;
+            return rounded;
+        }
+
+        std::vector<T> _slots;
+        const std::size_t _mask;
+
+        // consumer data, producer data - separate cache lines
+        std::atomic<std::size_t> _head;
+        std::size_t _tail_cache;
+        char _pad_consumer[CACHE_LINE - sizeof(std::atomic<std::size_t>) - sizeof(std::size_t)];
+
+        std::atomic<std::size_t> _tail;
+        std::size_t _head_cache;
+        char _pad_producer[CACHE_LINE - sizeof(std::atomic<std::size_t>) - sizeof(std::size_t)];
+};
+
+} // namespace net
+
+#endif /* SRC_PISA_NETDEVICES_SPSC_QUEUE_HPP_ */
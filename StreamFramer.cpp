@@ -0,0 +1,64 @@
+/*
+ * StreamFramer.cpp
+ *
+ *  Splitting of the TCP data stream into frames, one instance per data socket.
+ */
+
+#include "StreamFramer.hpp"
+
+namespace net {
+
+StreamFramer::StreamFramer(std::shared_ptr<NetDevice> device, const FrameFormat& format, std::size_t ring_capacity) throw(std::exception) :
+        _device(device),
+        _format(format),
+        _ring(ring_capacity),
+        _parsed(0),
+        _stats(),
+        _capture(nullptr),
+        _connection(device->getConnection()),
+        _drain() {
+}
+
+std::size_t StreamFramer::fill() {
+    if (_device->isStubbed()) return 0;
+    checkConnection();
+
+    const std::size_t bytes_read = _device->receiveNB(_ring);
+    received(_ring.at(_ring.tail() - bytes_read), bytes_read);
+    return bytes_read;
+}
+
+std::size_t StreamFramer::fill(ZeroCopySpan& span) {
+    span = ZeroCopySpan { nullptr, 0u };
+    if (_device->isStubbed()) return 0;
+    checkConnection();
+
+    const std::size_t bytes_read = _device->receiveZeroCopy(_ring, span);
+    received(span.len ? span.data : _ring.at(_ring.tail() - bytes_read), bytes_read);
+    return bytes_read;
+}
+
+std::size_t StreamFramer::receive(FrameBatch& batch) {
+    return receiveBatch(FormatScan(_format), batch);
+}
+
+void StreamFramer::checkConnection() {
+    if (_device->getConnection() != _connection) {
+        // not parsed data belong to the old connection, frames of the pending batches stay untouched
+        _connection = _device->getConnection();
+        _parsed = _ring.tail();
+        _stats.reconnects++;
+    }
+}
+
+void StreamFramer::received(const uint8_t* data, std::size_t len) {
+    _stats.bytes += len;
+    if (_capture && len) _capture->write(data, len);
+}
+
+void StreamFramer::reset() {
+    _parsed = _ring.tail();
+    _ring.releaseTo(_parsed);
+}
+
+} // namespace net
@@ -0,0 +1,361 @@
+/*
+ * StreamFramer.hpp
+ *
+ *  Splitting of the TCP data stream into frames, one instance per data socket.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_STREAM_FRAMER_HPP_
+#define SRC_PISA_NETDEVICES_STREAM_FRAMER_HPP_
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "NetDevice.hpp"
+#include "RingBuffer.hpp"
+#include "FrameScanner.hpp"
+#include "FrameBatch.hpp"
+#include "CaptureFile.hpp"
+
+namespace net {
+
+// frame layout in the stream
+struct FrameFormat {
+    const uint8_t* magic;       // header, at the frame start
+    std::size_t magic_len;
+    std::size_t frame_len;      // whole frame, header included
+    std::size_t payload_offset; // frames are returned from this offset
+};
+
+struct FramerStats {
+    uint64_t bytes;         // received bytes
+    uint64_t frames;        // accepted frames
+    uint64_t resyncs;       // lost alignment events
+    uint64_t resync_bytes;  // bytes skipped while searching for the header
+    uint64_t fragments;     // receive calls which left an incomplete frame for the next one
+    uint64_t reconnects;    // new connections of the device, the fragment of the old stream was dropped
+    uint64_t budget_stops;  // drain mode: receive calls which left data in the socket (budget or full ring)
+};
+
+/*
+ * Drain mode of receive(): reads and splits until the socket is drained (NetDevice::isDrained)
+ * or the budget of the call is used, instead of one read per call. The frames of one call stay in the ring
+ * until the next call (batch: until released), so a call never takes more than the free ring space -
+ * make the ring at least max_bytes (FbsReceiver/LppsReceiver::setRxDrain does).
+ */
+struct DrainConfig {
+    std::size_t max_bytes = 0;              // per receive call, 0 - drain mode off (one read per call)
+    std::size_t max_frames = SIZE_MAX;      // checked after every read, frames of the last read are all returned
+    int rcvbuf = 0;                         // SO_RCVBUF of the socket, 0 - system default
+    std::size_t rcvlowat_frames = 0;        // SO_RCVLOWAT in frames (wakeup with so many frames queued), 0 - not set
+};
+
+/*
+ * Owns the receive ring of one data socket and all the reassembly state:
+ * fragment of the last frame waits in the ring until the rest arrives.
+ * When the device reconnects (NetDevice::getConnection changes), the fragment is dropped,
+ * the new stream is not glued to the old one.
+ *
+ * With the zero copy backend (rx_backend::ZEROCOPY) receive(frames) splits the mapped spans in place,
+ * only the frames across the span boundaries go through the ring. Batches need the frames longer than
+ * until the next call, receive(batch) copies everything into the ring as with recv.
+ *
+ * Framers are independent, the framer of every channel can be used from its own thread.
+ * One framer itself is not thread safe.
+ *
+ * Example usage:
+ *
+ *    net::StreamFramer framer(device, fbs_receiver::FBS_FORMAT);
+ *    std::vector<const uint8_t*> frames;
+ *    uint8_t errors;
+ *    while (run) {
+ *        framer.receive(frames, errors);
+ *        for (auto frame : frames) ... // valid until the next receive
+ *    }
+ */
+class StreamFramer {
+    public:
+        StreamFramer(std::shared_ptr<NetDevice> device, const FrameFormat& format, std::size_t ring_capacity = RING_BUF_LENGTH) throw(std::exception);
+
+        StreamFramer(const StreamFramer&) = delete;
+        StreamFramer& operator=(const StreamFramer&) = delete;
+
+        /*
+        @brief - recv available data and split it into frames
+        @param frames - pointers to the frames (from payload_offset), valid until the next receive/parse/reset
+        @param errors - 0 - no errors, 1 - fragmented data waiting for future analyse
+        @return number of frames
+        */
+        template <typename T>
+        std::size_t receive(std::vector<const T*>& frames, uint8_t& errors) {
+            return receiveFrames(FormatScan(_format), frames, errors);
+        }
+
+        /*
+        @brief - recv available data and split it into the batch (up to batch capacity)
+        frames stay in the ring until the batch is released to its pool, so the batch can be
+        processed by another thread. Don't mix with receive(frames) on the same framer.
+        When all batches are in use and the ring is full, nothing is received until some batch is released.
+        batch.rx_time_ns is the kernel timestamp of the last read, when the device has timestamping on.
+        @return number of frames
+        */
+        std::size_t receive(FrameBatch& batch);
+
+        // non blocking recv into the ring, return received bytes
+        std::size_t fill();
+        // zero copy: mapped data are in the span (not in the ring), see NetDevice::receiveZeroCopy
+        std::size_t fill(ZeroCopySpan& span);
+
+        /*
+        @brief - split data received since the last parse, call visit(const uint8_t* frame) for every frame
+        @param max_frames - stop after so many frames, the rest is parsed in the next call
+        */
+        template <typename Visitor>
+        std::size_t parse(Visitor&& visit, uint8_t& errors, std::size_t max_frames = SIZE_MAX) {
+            return parseWith(FormatScan(_format), std::forward<Visitor>(visit), errors, max_frames);
+        }
+
+        // drop the stored fragment, next frame is expected from the next received byte
+        // (don't call when some batches are not released yet)
+        void reset();
+
+        // copy of every received byte goes to the writer (nullptr - no capture), see CaptureWriter
+        inline void setCapture(CaptureWriter* capture) { _capture = capture;}
+
+        // receive() budget (max_bytes, max_frames), the socket options are set by the receivers
+        inline void setDrain(const DrainConfig& drain) { _drain = drain;}
+        inline const DrainConfig& drain() const { return (_drain);}
+
+        inline const FramerStats& stats() const { return (_stats);}
+        inline const FrameFormat& format() const { return (_format);}
+        inline NetDevice& device() { return (*_device);}
+        inline RingBuffer& ring() { return (_ring);}
+
+    protected:
+        /*
+         * Frame checks of the layout known at run time (FrameFormat). The parsing below is written
+         * for any Scan with frame_len, payload_offset, count(data, nframes) and find(data, npos),
+         * ProtocolFramer passes its compile time FrameProtocol instead.
+         */
+        struct FormatScan {
+            const FrameFormat& format;
+            const std::size_t frame_len;
+            const std::size_t payload_offset;
+
+            FormatScan(const FrameFormat& format_) : format(format_), frame_len(format_.frame_len), payload_offset(format_.payload_offset) {}
+            inline std::size_t count(const uint8_t* data, std::size_t nframes) const {
+                return countFrames(data, nframes, frame_len, format.magic, format.magic_len);
+            }
+            inline std::size_t find(const uint8_t* data, std::size_t npos) const {
+                return findMagic(data, npos, format.magic, format.magic_len);
+            }
+        };
+
+        template <typename Scan, typename T>
+        std::size_t receiveFrames(const Scan& scan, std::vector<const T*>& frames, uint8_t& errors) {
+            frames.clear();
+            errors = 0;
+            auto visit = [&frames](const uint8_t* frame) { frames.push_back(reinterpret_cast<const T*>(frame)); };
+            if (_device->isZeroCopy()) return receiveZeroCopy(scan, visit, errors);
+
+            std::size_t bytes = fill();
+            if (!bytes) return 0;
+            std::size_t nframes = parseWith(scan, visit, errors);
+            while (draining(bytes, nframes)) {
+                const std::size_t n = fill();
+                if (!n) break;
+                bytes += n;
+                nframes += parseWith(scan, visit, errors);
+            }
+            // frames stay untouched until the next recv
+            _ring.releaseTo(_parsed);
+            return nframes;
+        }
+
+        template <typename Scan>
+        std::size_t receiveBatch(const Scan& scan, FrameBatch& batch) {
+            batch.frames.clear();
+            batch.errors = 0;
+            batch.ring = &_ring;
+
+            std::size_t bytes = fill();
+            // when the previous batch was full, some frames can be already waiting
+            auto visit = [&batch](const uint8_t* frame) { batch.frames.push_back(frame); };
+            std::size_t nframes = parseWith(scan, visit, batch.errors, batch.frames.capacity());
+            while ((nframes < batch.frames.capacity()) && draining(bytes, nframes)) {
+                const std::size_t n = fill();
+                if (!n) break;
+                bytes += n;
+                nframes += parseWith(scan, visit, batch.errors, batch.frames.capacity() - nframes);
+            }
+            batch.rx_time_ns = _device->getRxTimestamp();
+            batch.release_pos = _parsed;
+            return nframes;
+        }
+
+        template <typename Scan, typename Visitor>
+        std::size_t parseWith(const Scan& scan, Visitor&& visit, uint8_t& errors, std::size_t max_frames = SIZE_MAX);
+
+        // frames of data_len bytes from data, return the bytes consumed (the rest is shorter than a frame, unless max_frames stopped it)
+        template <typename Scan, typename Visitor>
+        std::size_t split(const Scan& scan, const uint8_t* data, std::size_t data_len, Visitor&& visit, std::size_t max_frames, std::size_t& nframes);
+
+        template <typename Scan, typename Visitor>
+        std::size_t receiveZeroCopy(const Scan& scan, Visitor&& visit, uint8_t& errors);
+        // one read of receiveZeroCopy, frames of the span are split in place
+        template <typename Scan, typename Visitor>
+        std::size_t readZeroCopy(const Scan& scan, Visitor&& visit, uint8_t& errors, std::size_t& nframes);
+
+        // drain mode: read again after bytes/nframes of this call
+        inline bool draining(std::size_t bytes, std::size_t nframes) {
+            if (!_drain.max_bytes || _device->isDrained() || _device->isStubbed()) return false;
+            if ((bytes < _drain.max_bytes) && (nframes < _drain.max_frames) && _ring.writable()) return true;
+            _stats.budget_stops++;
+            return false;
+        }
+
+    private:
+        // new connection of the device drops the not parsed data
+        void checkConnection();
+        void received(const uint8_t* data, std::size_t len);
+
+        std::shared_ptr<NetDevice> _device;
+        FrameFormat _format;
+        RingBuffer _ring;
+        // ring position of the first not parsed byte
+        uint64_t _parsed;
+        FramerStats _stats;
+        CaptureWriter* _capture;
+        // NetDevice::getConnection of the data in the ring
+        uint64_t _connection;
+        DrainConfig _drain;
+};
+
+template <typename Scan, typename Visitor>
+std::size_t StreamFramer::parseWith(const Scan& scan, Visitor&& visit, uint8_t& errors, std::size_t max_frames) {
+    const std::size_t data_len = static_cast<std::size_t>(_ring.tail() - _parsed);
+    std::size_t nframes = 0;
+    const std::size_t i = split(scan, _ring.at(_parsed), data_len, visit, max_frames, nframes);
+
+    // remaining data wait in the ring for the next recv, it's a fragment when no complete frame is left
+    // (stopping at max_frames is not an error)
+    errors = ((i < data_len) && ((data_len - i) < scan.frame_len)) ? 1 : 0;
+    _stats.fragments += errors;
+    _stats.frames += nframes;
+    _parsed += i;
+
+    ChannelMetrics& metrics = _device->metrics();
+    ChannelMetrics::add(metrics.frames, nframes);
+    ChannelMetrics::add(metrics.fragments, errors);
+    return nframes;
+}
+
+template <typename Scan, typename Visitor>
+std::size_t StreamFramer::split(const Scan& scan, const uint8_t* data, std::size_t data_len, Visitor&& visit, std::size_t max_frames, std::size_t& nframes) {
+    const std::size_t frame_len = scan.frame_len;
+    std::size_t i = 0;
+    uint64_t resyncs = 0;
+    uint64_t resync_bytes = 0;
+
+    // stop when there's no enough space to keep valid frame.
+    while (((data_len - i) >= frame_len) && (nframes < max_frames)) {
+        // aligned stream - check headers of all complete frames in one pass
+        const std::size_t complete = std::min((data_len - i) / frame_len, max_frames - nframes);
+        const std::size_t aligned = scan.count(&data[i], complete);
+        for (std::size_t n = 0; n < aligned; n++) {
+            visit(&data[i + scan.payload_offset]);
+            i += frame_len;
+        }
+        nframes += aligned;
+        if (((data_len - i) < frame_len) || (aligned == complete)) break;
+
+        // no header at i, jump to the next one (or behind the last position where full frame fits)
+        const std::size_t lost = i++;
+        i += scan.find(&data[i], data_len - frame_len + 1 - i);
+        resyncs++;
+        resync_bytes += i - lost;
+    }
+
+    if (resyncs) {
+        _stats.resyncs += resyncs;
+        _stats.resync_bytes += resync_bytes;
+        ChannelMetrics& metrics = _device->metrics();
+        ChannelMetrics::add(metrics.resyncs, resyncs);
+        ChannelMetrics::add(metrics.resync_bytes, resync_bytes);
+    }
+    return i;
+}
+
+template <typename Scan, typename Visitor>
+std::size_t StreamFramer::receiveZeroCopy(const Scan& scan, Visitor&& visit, uint8_t& errors) {
+    // frames of the previous call are not used anymore, their pages can be mapped over
+    _device->releaseZeroCopy();
+    std::size_t bytes = 0;
+    std::size_t nframes = 0;
+    do {
+        const std::size_t n = readZeroCopy(scan, visit, errors, nframes);
+        if (!n) break;
+        bytes += n;
+    } while (draining(bytes, nframes));
+    // frames in the ring stay untouched until the next recv
+    _ring.releaseTo(_parsed);
+    return nframes;
+}
+
+template <typename Scan, typename Visitor>
+std::size_t StreamFramer::readZeroCopy(const Scan& scan, Visitor&& visit, uint8_t& errors, std::size_t& nframes) {
+    const std::size_t frame_len = scan.frame_len;
+    // room for the copies of a span (fragment completion and the tail)
+    if (_ring.writable() < 2 * frame_len) return 0;
+
+    ZeroCopySpan span;
+    const std::size_t bytes = fill(span);
+    if (!span.len) {
+        if (bytes) nframes += parseWith(scan, visit, errors);
+        return bytes;
+    }
+
+    std::size_t frames = 0;
+    std::size_t offset = 0;
+    std::size_t copied = 0;
+    // fragment in the ring - frames starting in it end within frame_len - 1 bytes of the span,
+    // parsing continues in the span from where it stopped in the copy
+    const std::size_t fragment = static_cast<std::size_t>(_ring.tail() - _parsed);
+    if (fragment) {
+        const std::size_t glue = std::min(span.len, frame_len - 1);
+        std::memcpy(_ring.writePtr(), span.data, glue);
+        _ring.commit(glue);
+        copied += glue;
+        const std::size_t i = split(scan, _ring.at(_parsed), fragment + glue, visit, SIZE_MAX, frames);
+        _parsed += i;
+        if (i >= fragment) {
+            offset = i - fragment;
+            _parsed = _ring.tail();
+        }
+        else offset = glue; // short span, all of it waits in the ring
+    }
+
+    offset += split(scan, span.data + offset, span.len - offset, visit, SIZE_MAX, frames);
+    // incomplete frame at the end waits in the ring
+    const std::size_t tail = span.len - offset;
+    std::memcpy(_ring.writePtr(), span.data + offset, tail);
+    _ring.commit(tail);
+    copied += tail;
+
+    errors = (_ring.tail() > _parsed) ? 1 : 0;
+    _stats.fragments += errors;
+    _stats.frames += frames;
+    _device->zeroCopyStats().tail_bytes += copied;
+    ChannelMetrics& metrics = _device->metrics();
+    ChannelMetrics::add(metrics.frames, frames);
+    ChannelMetrics::add(metrics.fragments, errors);
+    nframes += frames;
+    return bytes;
+}
+
+} // namespace net
+
+#endif /* SRC_PISA_NETDEVICES_STREAM_FRAMER_HPP_ */
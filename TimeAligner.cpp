@@ -0,0 +1,99 @@
+/*
+ * TimeAligner.cpp
+ *
+ *  Streaming k-way merge of the FBS/LPPS streams by NTP time into time-aligned tuples.
+ */
+
+#include "TimeAligner.hpp"
+
+namespace align {
+
+namespace detail {
+
+constexpr std::size_t IndexedHeap::NONE;
+
+void IndexedHeap::resize(std::size_t ids) {
+    _pos.resize(ids, NONE);
+    _key.resize(ids, 0u);
+}
+
+void IndexedHeap::set(std::size_t id, uint64_t key) {
+    if (_pos[id] == NONE) {
+        _key[id] = key;
+        _heap.push_back(id);
+        _pos[id] = _heap.size() - 1;
+        up(_pos[id]);
+        return;
+    }
+    const uint64_t old = _key[id];
+    _key[id] = key;
+    if (key < old) up(_pos[id]);
+    else if (key > old) down(_pos[id]);
+}
+
+void IndexedHeap::erase(std::size_t id) {
+    const std::size_t n = _pos[id];
+    if (n == NONE) return;
+    _pos[id] = NONE;
+
+    const std::size_t last = _heap.back();
+    _heap.pop_back();
+    if (n == _heap.size()) return;
+    // last one fills the hole, it can go either way
+    place(n, last);
+    up(n);
+    down(_pos[last]);
+}
+
+void IndexedHeap::place(std::size_t n, std::size_t id) {
+    _heap[n] = id;
+    _pos[id] = n;
+}
+
+void IndexedHeap::up(std::size_t n) {
+    const std::size_t id = _heap[n];
+    const uint64_t key = _key[id];
+    while (n) {
+        const std::size_t parent = (n - 1) / 2;
+        if (_key[_heap[parent]] <= key) break;
+        place(n, _heap[parent]);
+        n = parent;
+    }
+    place(n, id);
+}
+
+void IndexedHeap::down(std::size_t n) {
+    const std::size_t id = _heap[n];
+    const uint64_t key = _key[id];
+    const std::size_t size = _heap.size();
+    while (true) {
+        std::size_t child = 2 * n + 1;
+        if (child >= size) break;
+        if (((child + 1) < size) && (_key[_heap[child + 1]] < _key[_heap[child]])) child++;
+        if (key <= _key[_heap[child]]) break;
+        place(n, _heap[child]);
+        n = child;
+    }
+    place(n, id);
+}
+
+} // namespace detail
+
+void pushFbs(FrameAligner& aligner, std::size_t stream, const decoder::FbsColumns& columns) {
+    const std::size_t n = columns.size();
+    for (std::size_t i = 0; i < n; i++)
+        aligner.push(stream, columns.ntp_ns[i], FrameValues { { columns.tc1[i], columns.tc2[i], columns.tc3[i] } });
+}
+
+void pushLpps(FrameAligner& aligner, std::size_t stream, const decoder::LppsColumns& columns) {
+    const std::size_t n = columns.size();
+    for (std::size_t i = 0; i < n; i++) {
+        // newer pps than the last pushed one is the next edge, not the stream time - data time of the frame
+        // with the old pps can already be past the new edge (latched after the PRU delay)
+        if (columns.pps_ntp_ns[i] > aligner.lastSample(stream))
+            aligner.push(stream, columns.pps_ntp_ns[i], FrameValues { { columns.lpps_data[i], columns.errors[i], columns.delay_cycles[i] } });
+        aligner.advance(stream, columns.data_ntp_ns[i]);
+    }
+}
+
+} // namespace align
@@ -0,0 +1,475 @@
+/*
+ * TimeAligner.hpp
+ *
+ *  Streaming k-way merge of the FBS/LPPS streams by NTP time into time-aligned tuples.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_TIME_ALIGNER_HPP_
+#define SRC_PISA_NETDEVICES_TIME_ALIGNER_HPP_
+
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "FrameDecoder.hpp"
+
+namespace align {
+
+constexpr std::size_t ALIGN_STREAM_CAPACITY = 4096u;
+
+struct AlignConfig {
+    // time grid: samples of the streams in the same slot form one tuple, at most the sample period of the streams
+    uint64_t slot_ns = 1000000u;
+    // stream whose watermark is so far behind the most advanced stream is lagging: not waited for,
+    // missing in the tuples until it catches up (data of the emitted slots are late then)
+    uint64_t idle_ns = 1000000000u;
+};
+
+struct StreamConfig {
+    std::string name;
+    // samples come out of order by at most so much, the stream watermark is the newest time - reorder_ns
+    uint64_t reorder_ns = 10000000u;
+    // last sample is repeated (HELD) in the next tuples for so long, 0 - only in its own slot (e.g. 1.5 s for PPS)
+    uint64_t hold_ns = 0u;
+    // buffered samples, when full the oldest slot is emitted without the streams behind (bounded memory)
+    std::size_t capacity = ALIGN_STREAM_CAPACITY;
+};
+
+enum class sample_state : uint8_t {
+    MISSING = 0u,   // no sample in the slot
+    FRESH,          // sample of this slot
+    HELD,           // last sample of the stream, within hold_ns
+    LAGGING,        // stream is behind (or never came), not waited for
+};
+
+template <typename Payload>
+struct TimedSample {
+    uint64_t time_ns;
+    Payload value;
+};
+
+// one slot of all the streams, state and samples by the stream id
+template <typename Payload>
+struct AlignedTuple {
+    uint64_t time_ns;                               // slot start
+    std::size_t fresh;                              // streams with a sample in the slot
+    std::vector<sample_state> state;
+    std::vector<TimedSample<Payload>> samples;      // valid when FRESH or HELD
+};
+
+struct AlignStreamStats {
+    uint64_t samples;
+    uint64_t late;          // dropped, their slot was emitted already
+    uint64_t duplicates;    // dropped, second sample of the stream in one slot
+    uint64_t overflows;     // buffer full, slots emitted early
+    uint64_t lagging;       // times the stream was declared lagging
+    bool is_lagging;
+    uint64_t watermark_ns;
+    std::size_t buffered;
+};
+
+struct AlignStats {
+    uint64_t tuples;
+    uint64_t samples;       // emitted as FRESH
+    uint64_t forced;        // emissions forced by full buffers
+    std::size_t lagging;    // streams lagging now
+};
+
+namespace detail { // for internal use only
+
+/*
+ * Binary min heap of ids by key with the position of every id, so the key of any id can be changed
+ * or the id removed in O(log n).
+ */
+class IndexedHeap {
+    public:
+        static constexpr std::size_t NONE = SIZE_MAX;
+
+        void resize(std::size_t ids);
+
+        inline bool empty() const { return (_heap.empty());}
+        inline bool contains(std::size_t id) const { return (_pos[id] != NONE);}
+        inline std::size_t top() const { return (_heap.front());}
+        inline uint64_t topKey() const { return (_key[_heap.front()]);}
+
+        // insert or change the key
+        void set(std::size_t id, uint64_t key);
+        void erase(std::size_t id);
+
+    private:
+        void place(std::size_t n, std::size_t id);
+        void up(std::size_t n);
+        void down(std::size_t n);
+
+        std::vector<std::size_t> _heap;
+        std::vector<std::size_t> _pos;
+        std::vector<uint64_t> _key;
+};
+
+} // end namespace detail
+
+/*
+ * Joins many streams (FBS channels of many receivers, LPPS PPS) by time. Every stream is buffered
+ * (sorted, out of order by reorder_ns at most), its watermark is the newest time - reorder_ns.
+ * Slot is emitted once all the streams which are not lagging have their watermark past its end:
+ * the heads of the stream buffers are merged through a heap, O(log k) per sample, and every
+ * stream keeps its watermark in a second heap, O(log k) per push. No per tuple work over all k streams,
+ * only over the streams in the tuple (and the lagging/held ones).
+ *
+ * Late samples (slot already emitted) are dropped and counted. Memory is bounded by the capacity of
+ * the streams - full buffer forces the emission, the streams behind become lagging.
+ * Stream with no data waits idle_ns (of the time of the others) before it is lagging.
+ *
+ * Not thread safe, push from one thread (the reactor thread, or the consumer of the batches).
+ * The handler is called from push/advance/flush, the tuple is valid during the call only.
+ *
+ * Example usage:
+ *
+ *    align::FrameAligner aligner(config, [](const align::AlignedTuple<align::FrameValues>& tuple) {
+ *        if (tuple.state[pps] == align::sample_state::LAGGING) ...
+ *        ... tuple.samples[fbs1].value.value[0] // TC1 of the slot
+ *    });
+ *    const std::size_t fbs1 = aligner.addStream({ "fbs1/ch1" });
+ *    const std::size_t pps = aligner.addStream({ "lpps1", 10000000u, 1500000000u });
+ *    ...
+ *    decoder::decodeFbs(frames, columns);
+ *    align::pushFbs(aligner, fbs1, columns);
+ */
+template <typename Payload>
+class TimeAligner {
+    public:
+        using Handler = std::function<void(const AlignedTuple<Payload>& tuple)>;
+
+        TimeAligner(const AlignConfig& config, Handler handler) throw(std::exception);
+
+        TimeAligner(const TimeAligner&) = delete;
+        TimeAligner& operator=(const TimeAligner&) = delete;
+
+        // return the stream id (0, 1, ...), stream added later has to catch up within idle_ns
+        std::size_t addStream(const StreamConfig& config) throw(std::exception);
+
+        /*
+        @brief - sample of the stream, emits the slots completed by it
+        @return false when late (dropped)
+        */
+        bool push(std::size_t stream, uint64_t time_ns, const Payload& value);
+        // time of the stream moves without a sample (e.g. LPPS data time between the PPS edges)
+        void advance(std::size_t stream, uint64_t time_ns);
+        // end of data - emit everything buffered, older samples are late after this
+        void flush();
+
+        inline std::size_t streams() const { return (_streams.size());}
+        inline const std::string& name(std::size_t stream) const { return (_streams[stream].config.name);}
+        // newest time of the stream (sample or advance), 0 - nothing yet
+        inline uint64_t lastTime(std::size_t stream) const { return (_streams[stream].max_time);}
+        // newest pushed sample of the stream (late ones too), 0 - nothing yet
+        inline uint64_t lastSample(std::size_t stream) const { return (_streams[stream].max_sample);}
+        // all slots ending up to here are emitted
+        inline uint64_t watermark() const { return (_emitted);}
+
+        AlignStreamStats streamStats(std::size_t stream) const;
+        inline AlignStats stats() const { return (AlignStats { _stats.tuples, _stats.samples, _stats.forced, _lagging.size() });}
+
+    private:
+        struct Stream {
+            StreamConfig config;
+            // sorted ring, power of 2
+            std::vector<TimedSample<Payload>> buffer;
+            std::size_t mask;
+            std::size_t head;
+            std::size_t count;
+
+            uint64_t max_time;
+            uint64_t max_sample;
+            uint64_t watermark;
+            bool seen;
+            bool lagging;
+            // for hold_ns
+            bool has_last;
+            TimedSample<Payload> last;
+            AlignStreamStats stats;
+
+            inline const TimedSample<Payload>& front() const { return (buffer[head]);}
+            inline TimedSample<Payload>& at(std::size_t n) { return (buffer[(head + n) & mask]);}
+        };
+
+        inline uint64_t slotStart(uint64_t time_ns) const { return (time_ns - time_ns % _config.slot_ns);}
+        inline uint64_t slotEnd(uint64_t time_ns) const { return (slotStart(time_ns) + _config.slot_ns);}
+
+        void insert(std::size_t id, const TimedSample<Payload>& sample);
+        // new time of the stream, watermark and emission
+        void observe(std::size_t id, uint64_t time_ns);
+        void update();
+        void lag(std::size_t id);
+        void rejoin(std::size_t id);
+        // more than idle_ns behind the newest stream (stream added after force/flush can be ahead of it)
+        inline bool isBehind(uint64_t watermark) const {
+            return ((watermark < _high) && ((_high - watermark) > _config.idle_ns));
+        }
+        // emit all slots ending up to limit
+        void drain(uint64_t limit);
+        void force(uint64_t limit);
+        void emit(uint64_t slot);
+
+        AlignConfig _config;
+        Handler _handler;
+        std::vector<Stream> _streams;
+        // heads of the stream buffers (merge), watermarks of the streams not lagging
+        detail::IndexedHeap _heads;
+        detail::IndexedHeap _watermarks;
+        std::vector<std::size_t> _lagging;
+        std::vector<std::size_t> _holding;
+
+        // most advanced watermark, the first one (waiting for the streams with no data starts there)
+        uint64_t _high;
+        uint64_t _origin;
+        bool _started;
+        uint64_t _emitted;
+
+        AlignedTuple<Payload> _tuple;
+        // tuple entries set by the last emit
+        std::vector<std::size_t> _touched;
+        AlignStats _stats;
+};
+
+template <typename Payload>
+TimeAligner<Payload>::TimeAligner(const AlignConfig& config, Handler handler) throw(std::exception) :
+        _config(config),
+        _handler(std::move(handler)),
+        _high(0),
+        _origin(0),
+        _started(false),
+        _emitted(0),
+        _tuple(),
+        _stats() {
+    if (!_config.slot_ns) throw std::runtime_error("TimeAligner: slot_ns has to be > 0");
+}
+
+template <typename Payload>
+std::size_t TimeAligner<Payload>::addStream(const StreamConfig& config) throw(std::exception) {
+    if (!config.capacity) throw std::runtime_error("TimeAligner: stream " + config.name + " with no capacity");
+
+    Stream stream;
+    stream.config = config;
+    std::size_t capacity = 1u;
+    while (capacity < config.capacity) capacity <<= 1;
+    stream.buffer.resize(capacity);
+    stream.mask = capacity - 1;
+    stream.head = 0;
+    stream.count = 0;
+    stream.max_time = 0;
+    stream.max_sample = 0;
+    // not before the emitted slots - the new stream holds nothing back
+    stream.watermark = _emitted;
+    stream.seen = false;
+    stream.lagging = false;
+    stream.has_last = false;
+    stream.last = TimedSample<Payload>();
+    stream.stats = AlignStreamStats();
+
+    const std::size_t id = _streams.size();
+    _streams.push_back(std::move(stream));
+    _heads.resize(_streams.size());
+    _watermarks.resize(_streams.size());
+    _tuple.state.resize(_streams.size(), sample_state::MISSING);
+    _tuple.samples.resize(_streams.size());
+    if (config.hold_ns) _holding.push_back(id);
+
+    _watermarks.set(id, _streams[id].watermark);
+    return id;
+}
+
+template <typename Payload>
+bool TimeAligner<Payload>::push(std::size_t id, uint64_t time_ns, const Payload& value) {
+    Stream& s = _streams[id];
+    s.stats.samples++;
+    s.max_sample = std::max(s.max_sample, time_ns);
+    if (slotEnd(time_ns) <= _emitted) {
+        s.stats.late++;
+        return false;
+    }
+    if (s.count == s.buffer.size()) {
+        // bounded memory - the oldest slot goes out without the streams behind
+        s.stats.overflows++;
+        force(slotEnd(s.front().time_ns));
+        if (slotEnd(time_ns) <= _emitted) {
+            s.stats.late++;
+            return false;
+        }
+    }
+    insert(id, TimedSample<Payload> { time_ns, value });
+    observe(id, time_ns);
+    return true;
+}
+
+template <typename Payload>
+void TimeAligner<Payload>::advance(std::size_t id, uint64_t time_ns) {
+    observe(id, time_ns);
+}
+
+template <typename Payload>
+void TimeAligner<Payload>::flush() {
+    uint64_t newest = 0;
+    for (auto& s : _streams) newest = std::max(newest, s.max_time);
+    const uint64_t limit = slotEnd(newest);
+    if (limit > _emitted) drain(limit);
+}
+
+template <typename Payload>
+AlignStreamStats TimeAligner<Payload>::streamStats(std::size_t id) const {
+    const Stream& s = _streams[id];
+    AlignStreamStats stats = s.stats;
+    stats.is_lagging = s.lagging;
+    stats.watermark_ns = s.watermark;
+    stats.buffered = s.count;
+    return stats;
+}
+
+template <typename Payload>
+void TimeAligner<Payload>::insert(std::size_t id, const TimedSample<Payload>& sample) {
+    Stream& s = _streams[id];
+    // in order in most cases, otherwise moved back by the few newer ones
+    std::size_t n = s.count++;
+    while (n && (s.at(n - 1).time_ns > sample.time_ns)) {
+        s.at(n) = s.at(n - 1);
+        n--;
+    }
+    s.at(n) = sample;
+    if (!n) _heads.set(id, sample.time_ns);
+}
+
+template <typename Payload>
+void TimeAligner<Payload>::observe(std::size_t id, uint64_t time_ns) {
+    Stream& s = _streams[id];
+    if (s.seen && (time_ns <= s.max_time)) return;
+    s.seen = true;
+    s.max_time = time_ns;
+
+    const uint64_t watermark = (time_ns > s.config.reorder_ns) ? (time_ns - s.config.reorder_ns) : 0u;
+    if (!_started) {
+        _started = true;
+        _origin = watermark;
+    }
+    if (watermark <= s.watermark) return;
+    s.watermark = watermark;
+    _high = std::max(_high, watermark);
+
+    if (!s.lagging) _watermarks.set(id, watermark);
+    else if (!isBehind(watermark)) rejoin(id);
+    update();
+}
+
+template <typename Payload>
+void TimeAligner<Payload>::update() {
+    // streams too far behind don't hold the others, the ones with no data are measured from the first data
+    while (!_watermarks.empty()) {
+        const Stream& s = _streams[_watermarks.top()];
+        const uint64_t watermark = s.seen ? s.watermark : std::max(s.watermark, _origin);
+        if (!isBehind(watermark)) break;
+        lag(_watermarks.top());
+    }
+    const uint64_t limit = _watermarks.empty() ? _high : _watermarks.topKey();
+    if (limit > _emitted) drain(limit);
+}
+
+template <typename Payload>
+void TimeAligner<Payload>::lag(std::size_t id) {
+    _watermarks.erase(id);
+    _streams[id].lagging = true;
+    _streams[id].stats.lagging++;
+    _lagging.push_back(id);
+}
+
+template <typename Payload>
+void TimeAligner<Payload>::rejoin(std::size_t id) {
+    _streams[id].lagging = false;
+    _lagging.erase(std::find(_lagging.begin(), _lagging.end(), id));
+    _watermarks.set(id, _streams[id].watermark);
+}
+
+template <typename Payload>
+void TimeAligner<Payload>::drain(uint64_t limit) {
+    while (!_heads.empty()) {
+        const uint64_t slot = slotStart(_heads.topKey());
+        if ((slot + _config.slot_ns) > limit) break;
+        emit(slot);
+    }
+    _emitted = limit;
+}
+
+template <typename Payload>
+void TimeAligner<Payload>::force(uint64_t limit) {
+    _stats.forced++;
+    while (!_watermarks.empty() && (_watermarks.topKey() < limit)) lag(_watermarks.top());
+    if (limit > _emitted) drain(limit);
+}
+
+template <typename Payload>
+void TimeAligner<Payload>::emit(uint64_t slot) {
+    AlignedTuple<Payload>& tuple = _tuple;
+    for (auto id : _touched) tuple.state[id] = sample_state::MISSING;
+    _touched.clear();
+    tuple.time_ns = slot;
+    tuple.fresh = 0;
+
+    // merge - heads of all streams in this slot
+    while (!_heads.empty() && (slotStart(_heads.topKey()) == slot)) {
+        const std::size_t id = _heads.top();
+        Stream& s = _streams[id];
+        if (tuple.state[id] == sample_state::FRESH) s.stats.duplicates++;
+        else {
+            tuple.state[id] = sample_state::FRESH;
+            tuple.samples[id] = s.front();
+            _touched.push_back(id);
+            tuple.fresh++;
+            if (s.config.hold_ns) {
+                s.last = s.front();
+                s.has_last = true;
+            }
+        }
+        s.head = (s.head + 1) & s.mask;
+        if (--s.count) _heads.set(id, s.front().time_ns);
+        else _heads.erase(id);
+    }
+
+    for (auto id : _holding) {
+        const Stream& s = _streams[id];
+        if ((tuple.state[id] == sample_state::FRESH) || !s.has_last || ((slot - s.last.time_ns) > s.config.hold_ns)) continue;
+        tuple.state[id] = sample_state::HELD;
+        tuple.samples[id] = s.last;
+        _touched.push_back(id);
+    }
+    for (auto id : _lagging) {
+        if (tuple.state[id] != sample_state::MISSING) continue;
+        tuple.state[id] = sample_state::LAGGING;
+        _touched.push_back(id);
+    }
+
+    _stats.tuples++;
+    _stats.samples += tuple.fresh;
+    _handler(tuple);
+}
+
+// payload of the receiver streams: FBS - tc1, tc2, tc3; LPPS - lpps_data, errors, delay_cycles
+struct FrameValues {
+    uint32_t value[3];
+};
+
+using FrameAligner = TimeAligner<FrameValues>;
+
+// FBS frames of one channel (decoded), sample at the frame NTP time
+void pushFbs(FrameAligner& aligner, std::size_t stream, const decoder::FbsColumns& columns);
+
+/*
+ * LPPS frames of one receiver as the PPS stream: sample at pps_ntp when it changes (new PPS edge),
+ * the stream time moves with data_ntp of every frame. reorder_ns of the stream has to cover
+ * the delay of the first frame after the edge. Use hold_ns, so every tuple has the last PPS.
+ */
+void pushLpps(FrameAligner& aligner, std::size_t stream, const decoder::LppsColumns& columns);
+
+} // namespace align
+
+#endif /* SRC_PISA_NETDEVICES_TIME_ALIGNER_HPP_ */
@@ -0,0 +1,318 @@
+/*
+ * UringReceiver.cpp
+ *
+ *  io_uring receive backend for the NetDevice data sockets.
+ *  No liburing, the few syscalls and the shared rings are handled here directly.
+ */
+
+#include "UringReceiver.hpp"
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <string>
+
+namespace net {
+
+namespace { // for internal use only
+
+constexpr uint16_t BUFFER_GROUP = 0u;
+constexpr uint64_t RECV_USER_DATA = 1u;
+constexpr uint64_t CANCEL_USER_DATA = 2u;
+constexpr unsigned SQ_ENTRIES = 4u;
+
+int uringSetup(unsigned entries, struct io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int uringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int uringRegister(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+template <typename T>
+inline T loadAcquire(const T* ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+template <typename T>
+inline void storeRelease(T* ptr, T val) {
+    __atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+
+std::string errorText(const std::string& what, int err) {
+    return ("UringReceiver: " + what + ", error: " + std::to_string(err));
+}
+
+} // end namespace
+
+UringReceiver::UringReceiver(int sockfd, std::size_t nbuffers, std::size_t buffer_len) throw(std::exception) :
+        _sockfd(sockfd),
+        _ringfd(-1),
+        _eventfd(-1),
+        _queue_ptr(MAP_FAILED),
+        _queue_len(0),
+        _sq_tail(nullptr),
+        _sq_mask(nullptr),
+        _sq_array(nullptr),
+        _sqes(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+        _sqes_len(0),
+        _cq_head(nullptr),
+        _cq_tail(nullptr),
+        _cq_mask(nullptr),
+        _cqes(nullptr),
+        _buf_ring(static_cast<struct io_uring_buf_ring*>(MAP_FAILED)),
+        _buf_ring_len(0),
+        _buffers(static_cast<uint8_t*>(MAP_FAILED)),
+        _nbuffers(1),
+        _buffer_len(buffer_len),
+        _buf_tail(0),
+        _pending_bid(-1),
+        _pending_offset(0),
+        _pending_len(0),
+        _armed(false),
+        _drained(true) {
+
+    // buffer ring size has to be power of 2
+    while ((_nbuffers < nbuffers) && (_nbuffers < 0x8000u))
+        _nbuffers <<= 1;
+
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    // every buffer can wait in the completion queue
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = static_cast<uint32_t>(2 * _nbuffers);
+
+    if ((_ringfd = uringSetup(SQ_ENTRIES, &params)) < 0)
+        throw std::runtime_error(errorText("io_uring_setup failed", errno));
+
+    try {
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+            throw std::runtime_error(errorText("kernel too old (no IORING_FEAT_SINGLE_MMAP)", 0));
+
+        _queue_len = std::max(params.sq_off.array + params.sq_entries * sizeof(uint32_t),
+                params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+        _queue_ptr = mmap(nullptr, _queue_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringfd, IORING_OFF_SQ_RING);
+        if (_queue_ptr == MAP_FAILED) throw std::runtime_error(errorText("cannot map queues", errno));
+
+        _sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+        _sqes = static_cast<struct io_uring_sqe*>(mmap(nullptr, _sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringfd, IORING_OFF_SQES));
+        if (_sqes == MAP_FAILED) throw std::runtime_error(errorText("cannot map submission entries", errno));
+
+        uint8_t* queue = static_cast<uint8_t*>(_queue_ptr);
+        _sq_tail = reinterpret_cast<uint32_t*>(queue + params.sq_off.tail);
+        _sq_mask = reinterpret_cast<uint32_t*>(queue + params.sq_off.ring_mask);
+        _sq_array = reinterpret_cast<uint32_t*>(queue + params.sq_off.array);
+        _cq_head = reinterpret_cast<uint32_t*>(queue + params.cq_off.head);
+        _cq_tail = reinterpret_cast<uint32_t*>(queue + params.cq_off.tail);
+        _cq_mask = reinterpret_cast<uint32_t*>(queue + params.cq_off.ring_mask);
+        _cqes = reinterpret_cast<struct io_uring_cqe*>(queue + params.cq_off.cqes);
+
+        // provided buffers, kernel picks them in the ring order
+        _buf_ring_len = _nbuffers * sizeof(struct io_uring_buf);
+        _buf_ring = static_cast<struct io_uring_buf_ring*>(mmap(nullptr, _buf_ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (_buf_ring == MAP_FAILED) throw std::runtime_error(errorText("cannot allocate buffer ring", errno));
+
+        _buffers = static_cast<uint8_t*>(mmap(nullptr, _nbuffers * _buffer_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (_buffers == MAP_FAILED) throw std::runtime_error(errorText("cannot allocate buffers", errno));
+
+        struct io_uring_buf_reg reg;
+        std::memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<uint64_t>(_buf_ring);
+        reg.ring_entries = static_cast<uint32_t>(_nbuffers);
+        reg.bgid = BUFFER_GROUP;
+        if (uringRegister(_ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+            throw std::runtime_error(errorText("cannot register buffer ring (kernel < 5.19?)", errno));
+
+        for (std::size_t bid = 0; bid < _nbuffers; bid++)
+            recycle(static_cast<uint16_t>(bid));
+
+        if ((_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+            throw std::runtime_error(errorText("cannot create eventfd", errno));
+        if (uringRegister(_ringfd, IORING_REGISTER_EVENTFD, &_eventfd, 1) != 0)
+            throw std::runtime_error(errorText("cannot register eventfd", errno));
+
+        arm();
+
+        // invalid request is completed right in the submit call, look for it (data completions stay in the queue)
+        const uint32_t cq_tail = loadAcquire(_cq_tail);
+        for (uint32_t head = *_cq_head; head != cq_tail; head++) {
+            const struct io_uring_cqe* cqe = &_cqes[head & *_cq_mask];
+            if ((cqe->user_data == RECV_USER_DATA) && (cqe->res < 0) && (cqe->res != -ENOBUFS))
+                throw std::runtime_error(errorText("multishot recv rejected (kernel < 6.0?)", -cqe->res));
+        }
+    }
+    catch (std::exception& e) {
+        release();
+        throw;
+    }
+}
+
+UringReceiver::~UringReceiver() {
+    cancel();
+    release();
+}
+
+void UringReceiver::arm() throw(std::exception) {
+    // the only producer, no need to read the tail atomically
+    const uint32_t tail = *_sq_tail;
+    const uint32_t index = tail & *_sq_mask;
+    struct io_uring_sqe* sqe = &_sqes[index];
+
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = _sockfd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = RECV_USER_DATA;
+
+    _sq_array[index] = index;
+    storeRelease(_sq_tail, tail + 1);
+
+    if (uringEnter(_ringfd, 1, 0, 0) < 0)
+        throw std::runtime_error(errorText("cannot submit recv", errno));
+    _armed = true;
+}
+
+void UringReceiver::recycle(uint16_t bid) {
+    // bufs[0].resv is the ring tail, don't touch it
+    // (entries are indexed from the ring start: in C++ the kernel header puts the bufs flex array at offset 8)
+    struct io_uring_buf* buf = reinterpret_cast<struct io_uring_buf*>(_buf_ring) + (_buf_tail & (_nbuffers - 1));
+    buf->addr = reinterpret_cast<uint64_t>(_buffers + bid * _buffer_len);
+    buf->len = static_cast<uint32_t>(_buffer_len);
+    buf->bid = bid;
+    _buf_tail++;
+    storeRelease(&_buf_ring->tail, _buf_tail);
+}
+
+std::size_t UringReceiver::receive(RingBuffer& ring) throw(std::exception) {
+    std::size_t added = 0;
+    _drained = false;
+
+    // buffer left from the previous call
+    if (_pending_bid >= 0) {
+        const std::size_t len = std::min(_pending_len, ring.writable());
+        std::memcpy(ring.writePtr(), _buffers + _pending_bid * _buffer_len + _pending_offset, len);
+        ring.commit(len);
+        added += len;
+        _pending_offset += len;
+        _pending_len -= len;
+        if (_pending_len) return added;
+
+        recycle(static_cast<uint16_t>(_pending_bid));
+        _pending_bid = -1;
+    }
+
+    // completions are read from the shared memory, no syscall while there are some
+    if (reap(ring, added)) return added;
+    if (!added) {
+        // queue is empty - reset the eventfd, completion posted after this signals it again,
+        // one posted before the reset would not, so look at the queue once more
+        uint64_t signaled;
+        if ((read(_eventfd, &signaled, sizeof(signaled)) < 0) && (errno != EAGAIN))
+            throw std::runtime_error(errorText("cannot read eventfd", errno));
+        if (reap(ring, added)) return added;
+    }
+
+    if (!_armed) arm();
+    _drained = true;
+    return added;
+}
+
+bool UringReceiver::reap(RingBuffer& ring, std::size_t& added) throw(std::exception) {
+    uint32_t head = *_cq_head;
+    const uint32_t tail = loadAcquire(_cq_tail);
+
+    while (head != tail) {
+        const struct io_uring_cqe* cqe = &_cqes[head & *_cq_mask];
+        head++;
+        if (cqe->user_data != RECV_USER_DATA) continue;
+
+        const int32_t res = cqe->res;
+        const uint32_t flags = cqe->flags;
+        // multishot finished, has to be submitted again
+        if (!(flags & IORING_CQE_F_MORE)) _armed = false;
+
+        if (res > 0) {
+            const uint16_t bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+            const std::size_t len = std::min(static_cast<std::size_t>(res), ring.writable());
+            std::memcpy(ring.writePtr(), _buffers + bid * _buffer_len, len);
+            ring.commit(len);
+            added += len;
+
+            if (len < static_cast<std::size_t>(res)) {
+                // ring is full, the rest waits for the next call
+                _pending_bid = bid;
+                _pending_offset = len;
+                _pending_len = static_cast<std::size_t>(res) - len;
+                storeRelease(_cq_head, head);
+                return true;
+            }
+            recycle(bid);
+        }
+        else if (res == 0) {
+            storeRelease(_cq_head, head);
+            throw std::runtime_error("UringReceiver: connection closed by peer");
+        }
+        else if (res != -ENOBUFS) { // no free buffers, just arm again
+            storeRelease(_cq_head, head);
+            throw std::runtime_error(errorText("recv failed", -res));
+        }
+    }
+    storeRelease(_cq_head, head);
+    return false;
+}
+
+void UringReceiver::cancel() {
+    if (!_armed || (_ringfd < 0)) return;
+
+    const uint32_t tail = *_sq_tail;
+    const uint32_t index = tail & *_sq_mask;
+    struct io_uring_sqe* sqe = &_sqes[index];
+
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = RECV_USER_DATA;
+    sqe->user_data = CANCEL_USER_DATA;
+    _sq_array[index] = index;
+    storeRelease(_sq_tail, tail + 1);
+
+    // wait until the recv is finished, kernel must not write into the buffers after unmap
+    if (uringEnter(_ringfd, 1, 0, 0) < 0) return;
+    for (int attempt = 0; (attempt < 100) && _armed; attempt++) {
+        uint32_t head = *_cq_head;
+        const uint32_t cq_tail = loadAcquire(_cq_tail);
+        for (; head != cq_tail; head++) {
+            const struct io_uring_cqe* cqe = &_cqes[head & *_cq_mask];
+            if ((cqe->user_data == RECV_USER_DATA) && !(cqe->flags & IORING_CQE_F_MORE)) _armed = false;
+        }
+        storeRelease(_cq_head, head);
+        if (_armed && (uringEnter(_ringfd, 0, 1, IORING_ENTER_GETEVENTS) < 0) && (errno != EINTR)) return;
+    }
+}
+
+void UringReceiver::release() {
+    if (_ringfd >= 0) ::close(_ringfd);
+    if (_eventfd >= 0) ::close(_eventfd);
+    if (_queue_ptr != MAP_FAILED) munmap(_queue_ptr, _queue_len);
+    if (_sqes != MAP_FAILED) munmap(_sqes, _sqes_len);
+    if (_buf_ring != MAP_FAILED) munmap(_buf_ring, _buf_ring_len);
+    if (_buffers != MAP_FAILED) munmap(_buffers, _nbuffers * _buffer_len);
+    _ringfd = -1;
+    _eventfd = -1;
+    _queue_ptr = MAP_FAILED;
+    _sqes = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+    _buf_ring = static_cast<struct io_uring_buf_ring*>(MAP_FAILED);
+    _buffers = static_cast<uint8_t*>(MAP_FAILED);
+}
+
+} // namespace net
@@ -0,0 +1,102 @@
+/*
+ * UringReceiver.hpp
+ *
+ *  io_uring receive backend for the NetDevice data sockets.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_URING_RECEIVER_HPP_
+#define SRC_PISA_NETDEVICES_URING_RECEIVER_HPP_
+
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+
+#include "RingBuffer.hpp"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+namespace net {
+
+constexpr std::size_t URING_BUFFERS = 16u;
+constexpr std::size_t URING_BUFFER_LEN = 16u * 1024u;
+
+/*
+ * One io_uring per socket with a single multishot recv (kernel >= 6.0) and a ring of provided buffers.
+ * Once armed, kernel puts the data into our buffers as they arrive and posts completions into the
+ * shared memory, reading them needs no syscall. Data are copied from the buffer into the channel
+ * RingBuffer (frames have to be contiguous) and the buffer goes back to the kernel.
+ *
+ * The socket itself doesn't become readable anymore (kernel takes the data), so the event loop
+ * has to wait on getEventFd().
+ *
+ * Constructor throws when io_uring, provided buffer rings or multishot recv are not available,
+ * NetDevice falls back to recv then.
+ */
+class UringReceiver {
+    public:
+        UringReceiver(int sockfd, std::size_t nbuffers = URING_BUFFERS, std::size_t buffer_len = URING_BUFFER_LEN) throw(std::exception);
+        ~UringReceiver();
+
+        UringReceiver(const UringReceiver&) = delete;
+        UringReceiver& operator=(const UringReceiver&) = delete;
+
+        /*
+         * @brief copy received data into the ring
+         * @return number of bytes added, throws on socket error or when the peer closed the connection
+         */
+        std::size_t receive(RingBuffer& ring) throw(std::exception);
+
+        // last receive took everything the kernel had (more data will signal the eventfd);
+        // eventfd is reset only by a call finding no completions, it can stay signaled after a call that read some
+        inline bool isDrained() const { return (_drained);}
+        // signaled on every completion, for the event loop
+        inline int getEventFd() const { return (_eventfd);}
+
+    private:
+        void arm() throw(std::exception);
+        void recycle(uint16_t bid);
+        // copy the completed buffers into the ring, return true when the ring got full
+        bool reap(RingBuffer& ring, std::size_t& added) throw(std::exception);
+        void cancel();
+        void release();
+
+        int _sockfd;
+        int _ringfd;
+        int _eventfd;
+
+        // submission and completion queue (single mmap)
+        void* _queue_ptr;
+        std::size_t _queue_len;
+        uint32_t* _sq_tail;
+        uint32_t* _sq_mask;
+        uint32_t* _sq_array;
+        struct io_uring_sqe* _sqes;
+        std::size_t _sqes_len;
+
+        uint32_t* _cq_head;
+        uint32_t* _cq_tail;
+        uint32_t* _cq_mask;
+        struct io_uring_cqe* _cqes;
+
+        // provided buffers
+        struct io_uring_buf_ring* _buf_ring;
+        std::size_t _buf_ring_len;
+        uint8_t* _buffers;
+        std::size_t _nbuffers;
+        std::size_t _buffer_len;
+        uint16_t _buf_tail;
+
+        // buffer not fully copied because the RingBuffer was full
+        int32_t _pending_bid;
+        std::size_t _pending_offset;
+        std::size_t _pending_len;
+
+        bool _armed;
+        bool _drained;
+};
+
+} // namespace net
+
+#endif /* SRC_PISA_NETDEVICES_URING_RECEIVER_HPP_ */
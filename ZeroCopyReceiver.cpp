@@ -0,0 +1,134 @@
+/*
+ * ZeroCopyReceiver.cpp
+ *
+ *  TCP_ZEROCOPY_RECEIVE backend for the NetDevice data sockets.
+ */
+
+#include "ZeroCopyReceiver.hpp"
+
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstddef>
+#include <cerrno>
+#include <string>
+
+#ifndef TCP_ZEROCOPY_RECEIVE
+#define TCP_ZEROCOPY_RECEIVE 35
+#endif
+
+namespace net {
+
+namespace { // for internal use only
+
+/*
+ * struct tcp_zerocopy_receive of linux/tcp.h up to err (kernel >= 5.10), libc has only the first 3 fields.
+ * Older kernels fill less, the returned length says what's valid.
+ */
+struct ZeroCopyArgs {
+    uint64_t address;
+    uint32_t length;
+    uint32_t recv_skip_hint;
+    uint32_t inq;
+    int32_t err;
+};
+
+std::string errorText(const std::string& what, int err) {
+    return ("ZeroCopyReceiver: " + what + ", error: " + std::to_string(err));
+}
+
+} // end namespace
+
+ZeroCopyReceiver::ZeroCopyReceiver(int sockfd, std::size_t window_len) throw(std::exception) :
+        _sockfd(sockfd),
+        _window(nullptr),
+        _window_len(0),
+        _page(static_cast<std::size_t>(sysconf(_SC_PAGESIZE))),
+        _used(0),
+        _skip(0),
+        _inq(false),
+        _drained(true) {
+    _window_len = std::max(_page, (window_len + _page - 1) & ~(_page - 1));
+
+    void* window = mmap(nullptr, _window_len, PROT_READ, MAP_SHARED, sockfd, 0);
+    if (window == MAP_FAILED) throw std::runtime_error(errorText("cannot map the socket", errno));
+    _window = static_cast<uint8_t*>(window);
+
+    // probe - nothing is queued yet or it's mapped later, the call only tells if the kernel knows it
+    ZeroCopyArgs args = {};
+    socklen_t args_len = sizeof(args);
+    if (getsockopt(_sockfd, IPPROTO_TCP, TCP_ZEROCOPY_RECEIVE, &args, &args_len) != 0) {
+        const int err = errno;
+        munmap(_window, _window_len);
+        throw std::runtime_error(errorText("TCP_ZEROCOPY_RECEIVE not supported", err));
+    }
+    _inq = (args_len >= offsetof(ZeroCopyArgs, inq) + sizeof(args.inq));
+}
+
+ZeroCopyReceiver::~ZeroCopyReceiver() {
+    munmap(_window, _window_len);
+}
+
+std::size_t ZeroCopyReceiver::receive(RingBuffer& ring, ZeroCopySpan& span, ZeroCopyStats& stats) throw(std::exception) {
+    span = ZeroCopySpan { nullptr, 0u };
+    _drained = false;
+
+    // sub-page data reported by the last mapping are next in the stream
+    if (_skip) return copy(ring, _skip, stats);
+
+    const std::size_t len = (_window_len - _used) & ~(_page - 1);
+    if (!len) return 0;
+
+    ZeroCopyArgs args = {};
+    args.address = reinterpret_cast<uint64_t>(_window + _used);
+    args.length = static_cast<uint32_t>(len);
+    socklen_t args_len = sizeof(args);
+    if (getsockopt(_sockfd, IPPROTO_TCP, TCP_ZEROCOPY_RECEIVE, &args, &args_len) != 0) {
+        // queue is empty and the peer closed the connection - as recv returning 0
+        if (errno == EIO) {
+            _drained = true;
+            return 0;
+        }
+        throw std::runtime_error(errorText("TCP_ZEROCOPY_RECEIVE failed", errno));
+    }
+    if (args.err) throw std::runtime_error(errorText("socket error", -args.err));
+
+    _skip = args.recv_skip_hint;
+    if (!args.length) {
+        if (_skip) return copy(ring, _skip, stats);
+        _drained = true;
+        return 0;
+    }
+
+    span = ZeroCopySpan { _window + _used, args.length };
+    _used += args.length;
+    stats.mapped_bytes += args.length;
+    stats.maps++;
+    _drained = _inq && !args.inq;
+    return args.length;
+}
+
+std::size_t ZeroCopyReceiver::copy(RingBuffer& ring, std::size_t len, ZeroCopyStats& stats) throw(std::exception) {
+    len = std::min(len, ring.writable());
+    if (!len) return 0;
+
+    const ssize_t bytes_read = recv(_sockfd, ring.writePtr(), len, MSG_DONTWAIT);
+    if (bytes_read <= 0) {
+        _drained = true;
+        _skip = 0;
+        if ((bytes_read < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK))
+            throw std::runtime_error(errorText("recv failed", errno));
+        return 0;
+    }
+
+    ring.commit(static_cast<std::size_t>(bytes_read));
+    _skip -= std::min(_skip, static_cast<std::size_t>(bytes_read));
+    stats.copied_bytes += static_cast<uint64_t>(bytes_read);
+    stats.copies++;
+    return static_cast<std::size_t>(bytes_read);
+}
+
+} // namespace net
@@ -0,0 +1,94 @@
+/*
+ * ZeroCopyReceiver.hpp
+ *
+ *  TCP_ZEROCOPY_RECEIVE backend for the NetDevice data sockets.
+ */
+
+#ifndef SRC_PISA_NETDEVICES_ZERO_COPY_RECEIVER_HPP_
+#define SRC_PISA_NETDEVICES_ZERO_COPY_RECEIVER_HPP_
+
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+
+#include "RingBuffer.hpp"
+
+namespace net {
+
+// 2MB of the address space per socket, the most mapped by one receive call
+constexpr std::size_t ZEROCOPY_WINDOW = 2u * 1024u * 1024u;
+
+// received data mapped in place, len 0 - nothing mapped
+struct ZeroCopySpan {
+    const uint8_t* data;
+    std::size_t len;
+};
+
+/*
+ * Does the mode pay off: mapped_bytes against all received bytes. Sub-page data (the kernel maps whole pages only,
+ * recv_skip_hint) are copied by recv, tail_bytes are mapped bytes the framer had to copy into the ring anyway
+ * (frames across the span boundaries).
+ */
+struct ZeroCopyStats {
+    uint64_t mapped_bytes;
+    uint64_t copied_bytes;
+    uint64_t tail_bytes;
+    uint64_t maps;          // TCP_ZEROCOPY_RECEIVE calls which mapped some data
+    uint64_t copies;        // recv calls
+};
+
+/*
+ * REMEMBER, only whole pages can be mapped:
+ * the kernel maps the pages of the socket queue into our window (mmap of the socket) instead of copying
+ * them, the page (skb fragment) has to be full and page aligned. Data in the linear part of the packets or in
+ * partial fragments are copied by recv. Pays off with large segments (MTU 9000 and header split on the NIC,
+ * GRO, loopback with MSG_ZEROCOPY sender), with 1500 MTU almost everything is copied.
+ *
+ * Spans are mapped one after the other into the window, mapping the same part again replaces the pages,
+ * so a span is valid until rewind() and the next receive. The window is not contiguous with the RingBuffer -
+ * the framer splits the span in place and copies only the frames across its boundaries.
+ *
+ * Constructor throws when the socket can't be mapped (not TCP, kernel < 4.18), NetDevice falls back to recv then.
+ */
+class ZeroCopyReceiver {
+    public:
+        ZeroCopyReceiver(int sockfd, std::size_t window_len = ZEROCOPY_WINDOW) throw(std::exception);
+        ~ZeroCopyReceiver();
+
+        ZeroCopyReceiver(const ZeroCopyReceiver&) = delete;
+        ZeroCopyReceiver& operator=(const ZeroCopyReceiver&) = delete;
+
+        /*
+         * @brief map whole pages of the socket queue after the previous span, or recv the sub-page data into the ring
+         * @param span - mapped data, len 0 when the data were copied into the ring (or there were none)
+         * @return number of bytes mapped or copied, 0 also when the window is used up (rewind) or the peer closed the connection,
+         * throws on socket error
+         */
+        std::size_t receive(RingBuffer& ring, ZeroCopySpan& span, ZeroCopyStats& stats) throw(std::exception);
+
+        // spans returned so far are not used anymore, next one is mapped at the window start
+        inline void rewind() { _used = 0;}
+
+        // last receive took everything the kernel had
+        inline bool isDrained() const { return (_drained);}
+
+    private:
+        // recv of len bytes into the ring
+        std::size_t copy(RingBuffer& ring, std::size_t len, ZeroCopyStats& stats) throw(std::exception);
+
+        int _sockfd;
+        uint8_t* _window;
+        std::size_t _window_len;
+        std::size_t _page;
+        // mapped part of the window
+        std::size_t _used;
+        // bytes the kernel can't map, to be copied before the next mapping
+        std::size_t _skip;
+        // kernel reports the queue length (inq) after the call
+        bool _inq;
+        bool _drained;
+};
+
+} // namespace net
+
+#endif /* SRC_PISA_NETDEVICES_ZERO_COPY_RECEIVER_HPP_ */
@@ -0,0 +1,126 @@
+/*
+ * csv_reader_check.cpp
+ *
+ *  Checks that the in place CSV parser (utils::CsvReader::parse(data, size)) accepts the same lines
+ *  and gives the same values as the stream parser (parse(istream)). Returns 0 when they agree.
+ *
+ *  csv_reader_check [file.csv]  - the file is parsed as int,unsigned,short,double,float,bool,char,string
+ */
+
+#include "csv_readerwriter.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace { // for internal use only
+
+using Reader = utils::CsvReader<int, unsigned, short, double, float, bool, char, std::string>;
+
+// valid value of every column, each case replaces one of them
+const std::vector<std::string> VALID = { "1", "2", "3", "4.5", "5.5", "1", "c", "text" };
+
+const std::vector<std::vector<std::string>> CASES = {
+    // int
+    { "12abc", "  7 ", "+5", "-0", "007", "2147483647", "2147483648", "-2147483648", "-2147483649", "1 2", "0x10", "abc", "-", "+", "--5" },
+    // unsigned
+    { "-1", "-0", "+3", "4294967295", "4294967296", "99999999999999999999", "3u" },
+    // short
+    { "32767", "32768", "-32768", "-32769", "40000" },
+    // double
+    { "nan", "NAN", "inf", "-inf", "infinity", "0x1p3", "1e", "1e+", "1e999", "-1e999", "1e-400", "1.5e3xyz", ".5", "5.", ".", "-.5e-2", "1,5" },
+    // float
+    { "3.4e39", "1e-50", "3.4e38", "0x10" },
+    // bool
+    { "0", "1", "2", "01", "1x", "-1", "true" },
+    // char
+    { "ab", "x", "7 8" },
+    // std::string
+    { "hello world", "a\tb", "word" },
+};
+
+// line level rules (trailing commas, empty lines, missing and extra fields)
+const std::vector<std::string> LINES = {
+    "", "   ", "\t", "1,2,3,4.5,5.5,1,c,text,", "1,2,3,4.5,5.5,1,c,text,,", "1,2,3,4.5,5.5,1,c,text, ,",
+    "1,2,3,4.5,5.5,1,c,text\r", "1,2,3,4.5,5.5,1,c", "1,2,3,4.5,5.5,1,c,text,extra", " ,2,3,4.5,5.5,1,c,text",
+    ",", "1,,3,4.5,5.5,1,c,text", "1,2,3,4.5,5.5,1,c,text word", "  1 , 2 , 3 , 4.5 , 5.5 , 1 , c , text  ",
+};
+
+std::string join(const std::vector<std::string>& fields) {
+    std::string line;
+    for (std::size_t n = 0; n < fields.size(); n++) {
+        if (n) line += ",";
+        line += fields[n];
+    }
+    return (line);
+}
+
+std::string generate() {
+    std::string data;
+    for (std::size_t column = 0; column < CASES.size(); column++) {
+        for (const std::string& value : CASES[column]) {
+            // "1,5" splits the field, it is a line rule too
+            std::vector<std::string> fields = VALID;
+            fields[column] = value;
+            data += join(fields) + "\n";
+        }
+    }
+    for (const std::string& line : LINES) data += line + "\n";
+    // last line without the newline
+    data += join(VALID);
+    return (data);
+}
+
+} // end namespace
+
+int main(int argc, char* argv[]) {
+    std::string data;
+    if (argc > 1) {
+        std::ifstream file(argv[1]);
+        if (!file) {
+            std::cerr << "cannot open " << argv[1] << std::endl;
+            return 1;
+        }
+        std::ostringstream content;
+        content << file.rdbuf();
+        data = content.str();
+    }
+    else {
+        data = generate();
+    }
+
+    Reader stream;
+    std::istringstream input(data);
+    const bool stream_ok = stream.parse(input);
+
+    Reader in_place;
+    const bool in_place_ok = in_place.parse(data.data(), data.size());
+
+    int failures = 0;
+    if (stream_ok != in_place_ok) {
+        std::printf("result: stream %d, in place %d\n", stream_ok, in_place_ok);
+        failures++;
+    }
+    const Reader::TableType& expected = stream.lines();
+    const Reader::TableType& got = in_place.lines();
+    if (expected.size() != got.size()) {
+        std::printf("rows: stream %zu, in place %zu\n", expected.size(), got.size());
+        failures++;
+    }
+    for (std::size_t n = 0; n < std::min(expected.size(), got.size()); n++) {
+        if (expected[n] == got[n]) continue;
+        std::ostringstream a, b;
+        utils::writeCsvLine(a, std::get<0>(expected[n]), std::get<1>(expected[n]), std::get<2>(expected[n]), std::get<3>(expected[n]),
+                std::get<4>(expected[n]), std::get<5>(expected[n]), std::get<6>(expected[n]), std::get<7>(expected[n]));
+        utils::writeCsvLine(b, std::get<0>(got[n]), std::get<1>(got[n]), std::get<2>(got[n]), std::get<3>(got[n]),
+                std::get<4>(got[n]), std::get<5>(got[n]), std::get<6>(got[n]), std::get<7>(got[n]));
+        std::printf("row %zu differs:\n  stream   %s  in place %s", n, a.str().c_str(), b.str().c_str());
+        failures++;
+    }
+
+    std::printf("%zu rows, first skipped line %zu, %s\n", got.size(), in_place.errLine(), failures ? "FAILED" : "OK");
+    return (failures ? 1 : 0);
+}
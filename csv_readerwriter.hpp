@@ -8,6 +8,19 @@
 #include <vector>
 #include <map>
 #include <fstream>
+#include <tuple>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <limits>
+#include <locale>
+#include <type_traits>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 namespace utils {
 
@@ -35,6 +48,177 @@ void writeCsvIter(std::ostream& output_, bool prependComma, const T& val, const
     writeCsvIter<RemArgs...>(output_, true, args...);
 }
 
+// Read only mapping of the whole file, for the in place parsing.
+class MappedFile {
+    public:
+        MappedFile(const std::string& path) : _data(nullptr), _size(0) {
+            const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) throw std::runtime_error("MappedFile: cannot open " + path + ", error: " + std::to_string(errno));
+
+            struct stat st;
+            if (fstat(fd, &st) != 0) {
+                const int error = errno;
+                ::close(fd);
+                throw std::runtime_error("MappedFile: cannot stat " + path + ", error: " + std::to_string(error));
+            }
+            _size = static_cast<std::size_t>(st.st_size);
+            // empty file can't be mapped, nothing to parse anyway
+            if (_size) {
+                void* data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data == MAP_FAILED) {
+                    const int error = errno;
+                    ::close(fd);
+                    throw std::runtime_error("MappedFile: cannot map " + path + ", error: " + std::to_string(error));
+                }
+                madvise(data, _size, MADV_SEQUENTIAL);
+                _data = static_cast<const char*>(data);
+            }
+            // the mapping stays valid without the descriptor
+            ::close(fd);
+        }
+
+        ~MappedFile() {
+            if (_data) munmap(const_cast<char*>(_data), _size);
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        inline const char* data() const { return (_data);}
+        inline std::size_t size() const { return (_size);}
+
+    private:
+        const char* _data;
+        std::size_t _size;
+};
+
+// Whitespace as for the stream extraction (" \t\r\v\f", '\n' never gets here).
+inline bool isSpace(char c) {
+    return ((c == ' ') || (c == '\t') || (c == '\r') || (c == '\v') || (c == '\f'));
+}
+
+inline void trim(const char*& begin, const char*& end) {
+    while ((begin < end) && isSpace(*begin)) ++begin;
+    while ((end > begin) && isSpace(*(end - 1))) --end;
+}
+
+// char types are single characters for the streams (int8_t too), not numbers
+template <typename T>
+struct isCharType : std::integral_constant<bool, std::is_same<T, char>::value || std::is_same<T, signed char>::value
+        || std::is_same<T, unsigned char>::value> {};
+
+// operator>> of the arithmetic types without the stream: the same std::num_get, reading from the buffer.
+struct NumGet : std::num_get<char, const char*> {
+    NumGet() : std::num_get<char, const char*>(1) {}
+};
+
+template <typename T>
+inline bool numGet(const char* begin, const char* end, T& value) {
+    static const NumGet facet;
+    // flags and locale of a default constructed stream, as the one of the stream parser
+    static thread_local std::istringstream format;
+    std::ios_base::iostate err = std::ios_base::goodbit;
+    facet.get(begin, end, format, err, value);
+    return (!(err & std::ios_base::failbit));
+}
+
+// num_get has no short/int, operator>> reads long and checks the range
+template <typename T>
+inline typename std::enable_if<std::is_same<T, short>::value || std::is_same<T, int>::value, bool>::type
+extract(const char* begin, const char* end, T& value) {
+    long result;
+    if (!numGet(begin, end, result)) return (false);
+    if ((result < std::numeric_limits<T>::min()) || (result > std::numeric_limits<T>::max())) return (false);
+    value = static_cast<T>(result);
+    return (true);
+}
+
+template <typename T>
+inline typename std::enable_if<!std::is_same<T, short>::value && !std::is_same<T, int>::value, bool>::type
+extract(const char* begin, const char* end, T& value) {
+    return (numGet(begin, end, value));
+}
+
+// Parsers of the trimmed, non empty field [begin, end), no allocation (except of the strings).
+// Accept exactly what operator>> of the stream parser accepts: the value is the longest prefix
+// ("12abc" is 12), numbers in other forms (nan, inf, hex) are errors.
+// Integers of plain digits are parsed here, anything else goes to num_get.
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value && !isCharType<T>::value, bool>::type
+parseField(const char* begin, const char* end, T& value) {
+    const char* digits = begin;
+    const bool negative = (*digits == '-');
+    if ((*digits == '-') || (*digits == '+')) ++digits;
+    if (digits == end) return (false);
+
+    // accumulated as negative, the range of T is not symmetric
+    using Wide = long long;
+    const Wide min = static_cast<Wide>(std::numeric_limits<T>::min());
+    Wide result = 0;
+    for (const char* p = digits; p < end; ++p) {
+        const unsigned digit = static_cast<unsigned>(*p - '0');
+        if ((digit > 9) || (result < ((min + static_cast<Wide>(digit)) / 10))) return (extract(begin, end, value));
+        result = result * 10 - static_cast<Wide>(digit);
+    }
+    if (!negative) {
+        if (result < -static_cast<Wide>(std::numeric_limits<T>::max())) return (false);
+        result = -result;
+    }
+    value = static_cast<T>(result);
+    return (true);
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value && !std::is_same<T, bool>::value && !isCharType<T>::value, bool>::type
+parseField(const char* begin, const char* end, T& value) {
+    const char* digits = begin;
+    if (*digits == '+') ++digits;
+    if (digits == end) return (false);
+
+    // "-1" is accepted by the stream (wraps around), num_get does it
+    using Wide = unsigned long long;
+    const Wide max = static_cast<Wide>(std::numeric_limits<T>::max());
+    Wide result = 0;
+    for (const char* p = digits; p < end; ++p) {
+        const unsigned digit = static_cast<unsigned>(*p - '0');
+        if ((digit > 9) || (result > ((max - digit) / 10))) return (extract(begin, end, value));
+        result = result * 10 + digit;
+    }
+    value = static_cast<T>(result);
+    return (true);
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value || std::is_same<T, bool>::value, bool>::type
+parseField(const char* begin, const char* end, T& value) {
+    return (extract(begin, end, value));
+}
+
+// The first character, as the stream.
+template <typename T>
+inline typename std::enable_if<isCharType<T>::value, bool>::type
+parseField(const char* begin, const char*, T& value) {
+    value = static_cast<T>(*begin);
+    return (true);
+}
+
+// The first word, as the stream.
+inline bool parseField(const char* begin, const char* end, std::string& value) {
+    const char* word = begin;
+    while ((word < end) && !isSpace(*word)) ++word;
+    value.assign(begin, word);
+    return (true);
+}
+
+// Other types through their operator>> (allocates, as the stream parser).
+template <typename T>
+inline typename std::enable_if<!std::is_arithmetic<T>::value && !std::is_same<T, std::string>::value, bool>::type
+parseField(const char* begin, const char* end, T& value) {
+    std::istringstream valueStream(std::string(begin, end));
+    valueStream >> value;
+    return (!valueStream.fail());
+}
+
 } // end namespace detail
 
 
@@ -88,6 +272,23 @@ bool writeCsvLine(std::ostream& output_, const Args& ... args) {
  *            ... // Do something with a and b
  *        }
  *    }
+ *
+ * Large files: parseFile/forEachInFile/parseColumnsFile map the file and parse the fields
+ * in place (no line or field strings, numbers without streams). Same rules as parse(istream):
+ * trailing commas and empty lines are accepted, malformed lines are skipped - errLine() is
+ * the number of the first of them (0 - none).
+ *
+ *    // streaming - one reused tuple, nothing is stored
+ *    reader.forEachInFile("myfile.csv", [](const CsvReader<std::string, int>::LineType& line) {
+ *        ... // std::get<0>(line), std::get<1>(line)
+ *    });
+ *
+ *    // columnar - one vector per column
+ *    CsvReader<double, double>::ColumnsType columns;
+ *    if (reader.parseColumnsFile("samples.csv", columns)) {
+ *        const std::vector<double>& x = std::get<0>(columns);
+ *        ...
+ *    }
  */
 template <typename... Args>
 class CsvReader {
@@ -97,6 +298,7 @@ class CsvReader {
     public:
         using LineType = std::tuple<Args...>;
         using TableType = std::vector<LineType>;
+        using ColumnsType = std::tuple<std::vector<Args>...>;
 
     public:
         CsvReader() = default;
@@ -140,6 +342,49 @@ class CsvReader {
             }
         }
 
+        // In place parsing of the buffer (no copy of lines or fields), lines() as after parse(istream).
+        bool parse(const char* data_, std::size_t size_) {
+            _data.clear();
+            LineType lineArgs;
+            return (scan(data_, size_, lineArgs, [this](LineType& line) { _data.push_back(line); }));
+        }
+
+        bool parseFile(const std::string& path_) {
+            detail::MappedFile file(path_);
+            return (parse(file.data(), file.size()));
+        }
+
+        // Callback is called for every good line with the same (overwritten) tuple, lines() stays empty.
+        template <typename F>
+        bool forEach(const char* data_, std::size_t size_, F callback_) {
+            _data.clear();
+            LineType lineArgs;
+            return (scan(data_, size_, lineArgs, [&callback_](const LineType& line) { callback_(line); }));
+        }
+
+        template <typename F>
+        bool forEachInFile(const std::string& path_, F callback_) {
+            detail::MappedFile file(path_);
+            return (forEach(file.data(), file.size(), callback_));
+        }
+
+        // Values appended to the column vectors (cleared first), lines() stays empty.
+        bool parseColumns(const char* data_, std::size_t size_, ColumnsType& columns_) {
+            _data.clear();
+            clearColumns<0>(columns_);
+            // the lines count is a good guess of the rows (nothing to do for a single pass over the mapping)
+            const std::size_t rows = countLines(data_, size_);
+            reserveColumns<0>(columns_, rows);
+
+            LineType lineArgs;
+            return (scan(data_, size_, lineArgs, [this, &columns_](LineType& line) { appendColumns<0>(columns_, line); }));
+        }
+
+        bool parseColumnsFile(const std::string& path_, ColumnsType& columns_) {
+            detail::MappedFile file(path_);
+            return (parseColumns(file.data(), file.size(), columns_));
+        }
+
         const TableType& lines() {
             return (_data);
         }
@@ -209,6 +454,93 @@ class CsvReader {
                 return (parseIter<I + 1, RemArgs...>(lineStream_, lineArgs_));
             }
 
+        // Lines of the buffer, bad ones are skipped as by parse(istream), _errLine is the first of them.
+        template <typename F>
+        bool scan(const char* data_, std::size_t size_, LineType& lineArgs_, F onLine_) {
+            _errLine = 0;
+            std::size_t lineNo = 0;
+            const char* end = data_ + size_;
+            for (const char* line = data_; line < end; ) {
+                const char* eol = static_cast<const char*>(std::memchr(line, '\n', static_cast<std::size_t>(end - line)));
+                if (!eol) eol = end;
+                ++lineNo;
+
+                const char* pos = line;
+                const Result result = scanIter<0>(pos, eol, lineArgs_);
+                if (result == Result::BAD) {
+                    if (!_errLine) _errLine = lineNo;
+                } else if (result == Result::GOOD) {
+                    onLine_(lineArgs_);
+                }
+                line = eol + 1;
+            }
+            return (true);
+        }
+
+        // Same rules as parseIter, the fields are [pos, next comma).
+        template<std::size_t I>
+            inline typename std::enable_if<I == sizeof...(Args), Result>::type
+            scanIter(const char*& pos_, const char* end_, LineType&) {
+                for (; pos_ < end_; ++pos_) {
+                    if (!detail::isSpace(*pos_)) return (Result::BAD);
+                }
+                return (Result::GOOD);
+            }
+
+        template<std::size_t I>
+            inline typename std::enable_if<I < sizeof...(Args), Result>::type
+            scanIter(const char*& pos_, const char* end_, LineType& lineArgs_) {
+                const char* comma = static_cast<const char*>(std::memchr(pos_, ',', static_cast<std::size_t>(end_ - pos_)));
+                const char* begin = pos_;
+                const char* fieldEnd = comma ? comma : end_;
+                detail::trim(begin, fieldEnd);
+
+                if (begin == fieldEnd) {
+                    return ((I == 0 && !comma) ? Result::EMPTY : Result::BAD);
+                }
+                if (!detail::parseField(begin, fieldEnd, std::get<I>(lineArgs_))) {
+                    return (Result::BAD);
+                }
+
+                pos_ = comma ? comma + 1 : end_;
+                return (scanIter<I + 1>(pos_, end_, lineArgs_));
+            }
+
+        static std::size_t countLines(const char* data_, std::size_t size_) {
+            std::size_t count = 0;
+            const char* end = data_ + size_;
+            for (const char* p = data_; p < end; ++count) {
+                p = static_cast<const char*>(std::memchr(p, '\n', static_cast<std::size_t>(end - p)));
+                if (!p) break;
+                ++p;
+            }
+            return (count + 1);
+        }
+
+        template<std::size_t I>
+            inline typename std::enable_if<I == sizeof...(Args)>::type clearColumns(ColumnsType&) {}
+        template<std::size_t I>
+            inline typename std::enable_if<I < sizeof...(Args)>::type clearColumns(ColumnsType& columns_) {
+                std::get<I>(columns_).clear();
+                clearColumns<I + 1>(columns_);
+            }
+
+        template<std::size_t I>
+            inline typename std::enable_if<I == sizeof...(Args)>::type reserveColumns(ColumnsType&, std::size_t) {}
+        template<std::size_t I>
+            inline typename std::enable_if<I < sizeof...(Args)>::type reserveColumns(ColumnsType& columns_, std::size_t rows_) {
+                std::get<I>(columns_).reserve(rows_);
+                reserveColumns<I + 1>(columns_, rows_);
+            }
+
+        template<std::size_t I>
+            inline typename std::enable_if<I == sizeof...(Args)>::type appendColumns(ColumnsType&, LineType&) {}
+        template<std::size_t I>
+            inline typename std::enable_if<I < sizeof...(Args)>::type appendColumns(ColumnsType& columns_, LineType& lineArgs_) {
+                std::get<I>(columns_).push_back(std::get<I>(lineArgs_));
+                appendColumns<I + 1>(columns_, lineArgs_);
+            }
+
 
     private:
         TableType _data;
@@ -0,0 +1,52 @@
+/*
+ * metrics_monitor.cpp
+ *
+ *  Prints the channel counters exported by the receiver process (net::MetricsRegion).
+ *
+ *  metrics_monitor region_name [interval_s]
+ */
+
+#include "ChannelMetrics.hpp"
+
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " region_name [interval_s]" << std::endl;
+        return 1;
+    }
+    const unsigned interval = (argc > 2) ? static_cast<unsigned>(std::atoi(argv[2])) : 1u;
+
+    try {
+        net::MetricsReader reader(argv[1]);
+        std::cout << "receiver pid " << reader.header().pid << std::endl;
+        std::vector<net::MetricsSnapshot> last;
+
+        while (true) {
+            std::printf("%-20s %14s %12s %10s %8s %10s %8s %10s %6s %5s %s\n", "channel", "bytes", "frames", "frames/s",
+                    "resyncs", "skipped", "frags", "eagain", "exc", "conn", "lpps err b0..b7");
+            for (std::size_t n = 0; n < reader.size(); n++) {
+                const net::MetricsSnapshot s = reader.snapshot(n);
+                const uint64_t rate = (n < last.size()) ? (s.frames - last[n].frames) / interval : 0;
+                std::printf("%-20s %14lu %12lu %10lu %8lu %10lu %8lu %10lu %6lu %5lu ", s.name.c_str(), s.bytes, s.frames, rate,
+                        s.resyncs, s.resync_bytes, s.fragments, s.recv_eagain, s.exceptions, s.connects);
+                for (auto bit : s.error_bits) std::printf(" %lu", bit);
+                std::printf("\n");
+                if (n < last.size()) last[n] = s;
+                else last.push_back(s);
+            }
+            std::printf("\n");
+            std::fflush(stdout);
+            sleep(interval);
+        }
+    }
+    catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,493 @@
+/*
+ * receiver_bench.cpp
+ *
+ *  Benchmark of the receive/parse hot path (StreamFramer, receiveFbsFrames/receiveLppsFrames, NetDevice::receiveNB).
+ *
+ *  receiver_bench [--lpps] [--scenario name|all] [--frames n] [--receivers n] [--duration s] [--rate n] [--cpu n] [--generic]
+ *
+ *  in memory (the stream is served by MemoryDevice, parser + copy only; ProtocolFramer as the receivers use,
+ *  --generic - StreamFramer with the run time FrameFormat):
+ *    aligned     - whole frames, 64kB reads
+ *    fragmented  - reads split at every offset inside the frame
+ *    junk        - random junk before 1% of the frames (resync path)
+ *    interleaved - both channels read alternately, fragmented
+ *  loopback socket (ReceiverEmulator at full speed, one emulator per receiver):
+ *    loopback     - FbsReceiver/LppsReceiver, both channels, 1..n receivers each in its own thread
+ *    loopback-raw - NetDevice::receiveNB into the ring, no parsing
+ *    latency      - paced stream (--rate frames/s, one frame per send), kernel arrival -> handler latency
+ *                   of the reactor and of the busy poll thread (spin, adaptive; --cpu n pins it), CPU used
+ *
+ *  Reported: frames/s, ns/frame, MB/s, latency of the receive calls returning frames (percentiles)
+ *  and heap allocations per frame (should stay 0 in steady state).
+ */
+
+#include "FBS.hpp"
+#include "LPPS.hpp"
+#include "StreamFramer.hpp"
+#include "ReceiverEmulator.hpp"
+#include "BusyPoll.hpp"
+
+#include <getopt.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::atomic<uint64_t> allocations(0);
+
+} // end namespace
+
+// every heap allocation of the process is counted
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::size_t MEM_READ_LEN = 64u * 1024u;
+constexpr double JUNK_PROBABILITY = 0.01;
+constexpr std::size_t JUNK_MAX = 16u;
+
+struct BenchConfig {
+    bool lpps = false;
+    std::string scenario = "all";
+    uint64_t frames = 5000000u;
+    std::size_t receivers = 1u;
+    double duration = 2.0;
+    double rate = 1000.0;
+    int cpu = -1;
+    bool generic = false;
+};
+
+struct BenchResult {
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+    double seconds = 0.0;
+    uint64_t allocations = 0;
+    std::vector<uint32_t> latency_ns;   // per receive call returning frames
+};
+
+/*
+ * Stream served from the memory, read sizes are taken from the list in turn.
+ * The stream is repeated, it has to contain whole frames (junk included) to keep the alignment.
+ */
+class MemoryDevice : public net::NetDevice {
+    public:
+        MemoryDevice(const std::vector<uint8_t>& stream, const std::vector<std::size_t>& read_sizes) :
+                NetDevice("bench_memory"),
+                _stream(stream),
+                _read_sizes(read_sizes),
+                _pos(0),
+                _read(0) {
+            setStubbed(false);
+        }
+
+        using NetDevice::receiveNB;
+        size_t receiveNB(net::RingBuffer& ring) override {
+            std::size_t len = std::min(_read_sizes[_read++ % _read_sizes.size()], ring.writable());
+            const std::size_t total = len;
+            uint8_t* dst = ring.writePtr();
+            while (len) {
+                const std::size_t n = std::min(len, _stream.size() - _pos);
+                std::memcpy(dst, &_stream[_pos], n);
+                dst += n;
+                len -= n;
+                _pos = (_pos + n) % _stream.size();
+            }
+            ring.commit(total);
+            drained = false;
+            return total;
+        }
+
+    private:
+        const std::vector<uint8_t>& _stream;
+        std::vector<std::size_t> _read_sizes;
+        std::size_t _pos;
+        std::size_t _read;
+};
+
+std::vector<uint8_t> makeStream(bool lpps, std::size_t nframes, bool junk) {
+    const std::size_t frame_len = lpps ? lpps_receiver::LPPS_FRAME_LEN : fbs_receiver::REC_FRAME_LEN;
+    std::vector<uint8_t> stream;
+    stream.reserve(nframes * (frame_len + JUNK_MAX));
+    uint32_t random = 12345u;
+
+    for (std::size_t n = 0; n < nframes; n++) {
+        random = random * 1664525u + 1013904223u;
+        if (junk && ((random >> 8) % 1000u) < static_cast<uint32_t>(JUNK_PROBABILITY * 1000.0)) {
+            const std::size_t len = 1 + (random >> 20) % JUNK_MAX;
+            for (std::size_t i = 0; i < len; i++) stream.push_back(static_cast<uint8_t>(0x80u + i));
+        }
+
+        const std::size_t pos = stream.size();
+        stream.resize(pos + frame_len, 0);
+        const uint32_t counter = static_cast<uint32_t>(n);
+        if (lpps) {
+            std::memcpy(&stream[pos], lpps_receiver::LPPS_MAGIC, sizeof(lpps_receiver::LPPS_MAGIC));
+            std::memcpy(&stream[pos + offsetof(lpps_receiver::lpps_frame, lpps_data)], &counter, sizeof(counter));
+        }
+        else {
+            std::memcpy(&stream[pos], fbs_receiver::FBS_MAGIC, fbs_receiver::FBS_HEADER_LEN);
+            std::memcpy(&stream[pos + fbs_receiver::FBS_HEADER_LEN], &counter, sizeof(counter));
+        }
+    }
+    return stream;
+}
+
+// reads of k frames + every offset inside the frame, so the fragment is at every position
+std::vector<std::size_t> fragmentedReads(std::size_t frame_len) {
+    std::vector<std::size_t> sizes;
+    for (std::size_t offset = 1; offset < frame_len; offset++)
+        sizes.push_back((offset % 7u) * frame_len + offset);
+    return sizes;
+}
+
+template <typename Receive>
+void timedReceive(BenchResult& result, Receive&& receive) {
+    const auto start = Clock::now();
+    const std::size_t nframes = receive();
+    if (nframes) {
+        result.latency_ns.push_back(static_cast<uint32_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()));
+        result.frames += nframes;
+    }
+}
+
+template <typename Framer>
+Framer* makeFramer(std::shared_ptr<net::NetDevice> device, const net::FrameFormat&) {
+    return new Framer(device);
+}
+
+template <>
+net::StreamFramer* makeFramer<net::StreamFramer>(std::shared_ptr<net::NetDevice> device, const net::FrameFormat& format) {
+    return new net::StreamFramer(device, format);
+}
+
+template <typename Framer>
+BenchResult benchMemory(const BenchConfig& config, bool junk, bool fragmented, std::size_t nchannels) {
+    const net::FrameFormat& format = config.lpps ? lpps_receiver::LPPS_FORMAT : fbs_receiver::FBS_FORMAT;
+    // stream of ~4MB repeated, whole frames
+    const std::vector<uint8_t> stream = makeStream(config.lpps, (4u << 20) / format.frame_len, junk);
+    const std::vector<std::size_t> reads = fragmented ? fragmentedReads(format.frame_len) : std::vector<std::size_t>{ MEM_READ_LEN };
+
+    std::vector<std::unique_ptr<Framer>> framers;
+    for (std::size_t channel = 0; channel < nchannels; channel++)
+        framers.emplace_back(makeFramer<Framer>(std::make_shared<MemoryDevice>(stream, reads), format));
+
+    BenchResult result;
+    result.latency_ns.reserve(config.frames + 1);
+    std::vector<const uint8_t*> frames;
+    frames.reserve(net::RING_BUF_LENGTH / format.frame_len + 1);
+    uint8_t errors;
+
+    // warm up (first touch of the rings, vectors)
+    for (auto& framer : framers) {
+        framer->receive(frames, errors);
+        result.bytes -= framer->stats().bytes;
+    }
+
+    const uint64_t allocs = allocations.load();
+    const auto start = Clock::now();
+    while (result.frames < config.frames) {
+        for (auto& framer : framers)
+            timedReceive(result, [&]() { return framer->receive(frames, errors); });
+    }
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    result.allocations = allocations.load() - allocs;
+    for (auto& framer : framers) result.bytes += framer->stats().bytes;
+    return result;
+}
+
+BenchResult benchMemory(const BenchConfig& config, bool junk, bool fragmented, std::size_t nchannels) {
+    if (config.generic) return benchMemory<net::StreamFramer>(config, junk, fragmented, nchannels);
+    return config.lpps ? benchMemory<net::ProtocolFramer<lpps_receiver::LppsProtocol>>(config, junk, fragmented, nchannels)
+            : benchMemory<net::ProtocolFramer<fbs_receiver::FbsProtocol>>(config, junk, fragmented, nchannels);
+}
+
+std::size_t receive(fbs_receiver::FbsReceiver& receiver, std::vector<const uint8_t*>& frames, fbs_receiver::fbs_channels channel, uint8_t& errors) {
+    return receiver.receiveFbsFrames(frames, channel, errors);
+}
+
+std::size_t receive(lpps_receiver::LppsReceiver& receiver, std::vector<const lpps_receiver::lpps_frame*>& frames, lpps_receiver::lpps_channels channel, uint8_t& errors) {
+    return receiver.receiveLppsFrames(frames, channel, errors);
+}
+
+// one receiver (own emulator) per thread, both channels read alternately
+template <typename Receiver, typename Frame, typename Channels>
+BenchResult benchLoopback(const BenchConfig& config, emulator::emulated_device device, bool raw) {
+    std::vector<std::unique_ptr<emulator::ReceiverEmulator>> emulators;
+    std::vector<BenchResult> results(config.receivers);
+    std::vector<std::thread> threads;
+    std::atomic<bool> run(true);
+
+    for (std::size_t r = 0; r < config.receivers; r++) {
+        emulator::EmulatorConfig emu;
+        emu.device = device;
+        emu.main_port = 0;
+        emu.data_ports = {{ 0, 0 }};
+        emu.frame_rate = 0.0;
+        emu.batch_frames = 256u;
+        emulators.emplace_back(new emulator::ReceiverEmulator(emu));
+        emulators.back()->start();
+    }
+
+    const uint64_t allocs = allocations.load();
+    const auto start = Clock::now();
+    for (std::size_t r = 0; r < config.receivers; r++) {
+        threads.emplace_back([&, r]() {
+            BenchResult& result = results[r];
+            result.latency_ns.reserve(static_cast<std::size_t>(config.duration * 2e6));
+            const Channels channels[] = { Channels::CHANNEL_1, Channels::CHANNEL_2 };
+
+            if (raw) {
+                net::NetDevice socket1("bench_raw1"), socket2("bench_raw2");
+                net::NetDevice* socket[] = { &socket1, &socket2 };
+                net::RingBuffer ring[2];
+                for (std::size_t ch = 0; ch < 2; ch++) {
+                    socket[ch]->setStubbed(false);
+                    socket[ch]->connect("127.0.0.1", emulators[r]->dataPort(ch), 0, false);
+                }
+                while (run) {
+                    for (std::size_t ch = 0; ch < 2; ch++) {
+                        result.bytes += socket[ch]->receiveNB(ring[ch]);
+                        ring[ch].clear();
+                    }
+                    if (socket[0]->isDrained() && socket[1]->isDrained()) std::this_thread::yield();
+                }
+                return;
+            }
+
+            Receiver receiver("bench" + std::to_string(r));
+            for (std::size_t ch = 0; ch < 2; ch++)
+                receiver.connect_channel("127.0.0.1", channels[ch], emulators[r]->dataPort(ch));
+            std::vector<const Frame*> frames;
+            uint8_t errors;
+            while (run) {
+                bool idle = true;
+                for (auto channel : channels) {
+                    timedReceive(result, [&]() { return receive(receiver, frames, channel, errors); });
+                    idle &= frames.empty();
+                }
+                if (idle) std::this_thread::yield();
+            }
+            for (auto channel : channels) result.bytes += receiver.getFramer(channel).stats().bytes;
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(config.duration));
+    run = false;
+    for (auto& thread : threads) thread.join();
+
+    BenchResult total;
+    total.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    total.allocations = allocations.load() - allocs;
+    for (auto& result : results) {
+        total.frames += result.frames;
+        total.bytes += result.bytes;
+        total.latency_ns.insert(total.latency_ns.end(), result.latency_ns.begin(), result.latency_ns.end());
+    }
+    for (auto& emu : emulators) emu->stop();
+    return total;
+}
+
+double cpuSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+void reportLatency(const std::string& name, const net::LatencyHistogram& latency, double cpu) {
+    std::printf("%-13s %8lu frames | arrival->handler us p50 %7.2f p99 %7.2f p99.9 %7.2f max %8.2f | cpu %5.1f%%\n",
+            name.c_str(), static_cast<unsigned long>(latency.count()), latency.percentile(0.5) / 1000.0,
+            latency.percentile(0.99) / 1000.0, latency.percentile(0.999) / 1000.0, latency.max() / 1000.0, cpu * 100.0);
+    std::fflush(stdout);
+}
+
+// channel 1 of one receiver: reactor, then busy poll thread in both modes, the same paced stream
+template <typename Receiver, typename Channels>
+void benchLatency(const BenchConfig& config, emulator::emulated_device device) {
+    struct Mode {
+        const char* name;
+        bool busy_poll;
+        net::busy_poll_mode mode;
+    };
+    const Mode modes[] = {
+        { "reactor", false, net::busy_poll_mode::ADAPTIVE },
+        { "busy-spin", true, net::busy_poll_mode::SPIN },
+        { "busy-adaptive", true, net::busy_poll_mode::ADAPTIVE },
+    };
+
+    for (const Mode& mode : modes) {
+        emulator::EmulatorConfig emu;
+        emu.device = device;
+        emu.main_port = 0;
+        emu.data_ports = {{ 0, 0 }};
+        emu.frame_rate = config.rate;
+        emu.batch_frames = 1u;
+        emulator::ReceiverEmulator emulator(emu);
+        emulator.start();
+
+        Receiver receiver("bench_latency");
+        receiver.setRxTimestamping(Channels::CHANNEL_1, net::rx_timestamping::SOFTWARE);
+        receiver.connect_channel("127.0.0.1", Channels::CHANNEL_1, emulator.dataPort(0));
+        auto& socket = receiver.getFramer(Channels::CHANNEL_1).device();
+
+        net::LatencyHistogram reactor_latency;
+        net::NetReactor reactor;
+        std::thread io;
+        const double cpu = cpuSeconds();
+        const auto start = Clock::now();
+
+        if (mode.busy_poll) {
+            net::BusyPollConfig busy;
+            busy.mode = mode.mode;
+            busy.cpu = config.cpu;
+            receiver.startBusyPoll(Channels::CHANNEL_1, busy, [](Channels, const auto&, uint8_t) {});
+        }
+        else {
+            receiver.attach(reactor, Channels::CHANNEL_1, [&reactor_latency, &socket](Channels, const auto& frames, uint8_t) {
+                if (!frames.empty()) reactor_latency.recordSince(socket.getRxTimestamp());
+            });
+            io = std::thread([&reactor] { reactor.run(); });
+        }
+
+        std::this_thread::sleep_for(std::chrono::duration<double>(config.duration));
+        // emulator threads are included, the same for every mode
+        const double used = (cpuSeconds() - cpu) / std::chrono::duration<double>(Clock::now() - start).count();
+        if (mode.busy_poll) {
+            reportLatency(mode.name, receiver.getBusyPoll(Channels::CHANNEL_1)->latency(), used);
+            receiver.stopBusyPoll(Channels::CHANNEL_1);
+        }
+        else {
+            reactor.stop();
+            io.join();
+            reportLatency(mode.name, reactor_latency, used);
+        }
+        emulator.stop();
+    }
+}
+
+void report(const std::string& name, BenchResult& result, bool frames_valid = true) {
+    std::sort(result.latency_ns.begin(), result.latency_ns.end());
+    auto percentile = [&result](double p) -> double {
+        if (result.latency_ns.empty()) return 0.0;
+        const std::size_t n = std::min(result.latency_ns.size() - 1, static_cast<std::size_t>(p * result.latency_ns.size()));
+        return result.latency_ns[n] / 1000.0;
+    };
+
+    if (frames_valid) {
+        std::printf("%-13s %10.0f frames/s %7.2f ns/frame %9.1f MB/s | call us p50 %7.2f p99 %7.2f p99.9 %7.2f max %8.2f | allocs/frame %.4f\n",
+                name.c_str(), result.frames / result.seconds, (result.seconds * 1e9) / std::max<uint64_t>(result.frames, 1),
+                result.bytes / result.seconds / 1e6, percentile(0.5), percentile(0.99), percentile(0.999),
+                result.latency_ns.empty() ? 0.0 : result.latency_ns.back() / 1000.0,
+                static_cast<double>(result.allocations) / std::max<uint64_t>(result.frames, 1));
+    }
+    else {
+        std::printf("%-13s %9.1f MB/s (recv only, no frames) | allocs %lu\n", name.c_str(), result.bytes / result.seconds / 1e6,
+                static_cast<unsigned long>(result.allocations));
+    }
+    std::fflush(stdout);
+}
+
+void usage(const char* name) {
+    std::cerr << "usage: " << name << " [--lpps] [--scenario aligned|fragmented|junk|interleaved|loopback|loopback-raw|latency|all]\n"
+              << "       [--frames n (in memory)] [--receivers n] [--duration s (loopback, latency)]\n"
+              << "       [--rate frames/s (latency)] [--cpu n (latency, busy poll thread)] [--generic (in memory, run time format)]" << std::endl;
+}
+
+} // end namespace
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+
+    const struct option options[] = {
+        { "lpps",      no_argument,       nullptr, 'l' },
+        { "scenario",  required_argument, nullptr, 's' },
+        { "frames",    required_argument, nullptr, 'f' },
+        { "receivers", required_argument, nullptr, 'r' },
+        { "duration",  required_argument, nullptr, 'd' },
+        { "rate",      required_argument, nullptr, 'R' },
+        { "cpu",       required_argument, nullptr, 'c' },
+        { "generic",   no_argument,       nullptr, 'g' },
+        { "help",      no_argument,       nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, nullptr)) != -1) {
+        switch (opt) {
+            case 'l': config.lpps = true; break;
+            case 's': config.scenario = optarg; break;
+            case 'f': config.frames = std::strtoull(optarg, nullptr, 10); break;
+            case 'r': config.receivers = std::max<std::size_t>(1, std::strtoul(optarg, nullptr, 10)); break;
+            case 'd': config.duration = std::atof(optarg); break;
+            case 'R': config.rate = std::atof(optarg); break;
+            case 'c': config.cpu = std::atoi(optarg); break;
+            case 'g': config.generic = true; break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    auto selected = [&config](const char* name) { return ((config.scenario == "all") || (config.scenario == name)); };
+    std::printf("%s frames, scanner %s, %s framer\n", config.lpps ? "LPPS" : "FBS", net::scannerName(), config.generic ? "generic" : "protocol");
+
+    try {
+        if (selected("aligned")) {
+            BenchResult result = benchMemory(config, false, false, 1);
+            report("aligned", result);
+        }
+        if (selected("fragmented")) {
+            BenchResult result = benchMemory(config, false, true, 1);
+            report("fragmented", result);
+        }
+        if (selected("junk")) {
+            BenchResult result = benchMemory(config, true, true, 1);
+            report("junk", result);
+        }
+        if (selected("interleaved")) {
+            BenchResult result = benchMemory(config, false, true, 2);
+            report("interleaved", result);
+        }
+
+        for (const bool raw : { false, true }) {
+            if (!selected(raw ? "loopback-raw" : "loopback")) continue;
+            BenchResult result = config.lpps
+                    ? benchLoopback<lpps_receiver::LppsReceiver, lpps_receiver::lpps_frame, lpps_receiver::lpps_channels>(config, emulator::emulated_device::LPPS, raw)
+                    : benchLoopback<fbs_receiver::FbsReceiver, uint8_t, fbs_receiver::fbs_channels>(config, emulator::emulated_device::FBS, raw);
+            report((raw ? "loopback-raw x" : "loopback x") + std::to_string(config.receivers), result, !raw);
+        }
+
+        if (selected("latency")) {
+            if (config.lpps) benchLatency<lpps_receiver::LppsReceiver, lpps_receiver::lpps_channels>(config, emulator::emulated_device::LPPS);
+            else benchLatency<fbs_receiver::FbsReceiver, fbs_receiver::fbs_channels>(config, emulator::emulated_device::FBS);
+        }
+    }
+    catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
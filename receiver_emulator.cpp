@@ -0,0 +1,118 @@
+/*
+ * receiver_emulator.cpp
+ *
+ *  Standalone FBS/LPPS receiver emulator, see ReceiverEmulator.
+ *
+ *  receiver_emulator [--lpps] [--address a.b.c.d] [--port 5025] [--data-ports 5031,5032]
+ *                    [--rate frames_per_s] [--batch frames] [--split min,max]
+ *                    [--garbage probability[,max_len]] [--disconnect frames] [--acq] [--seed n] [--zerocopy]
+ */
+
+#include "ReceiverEmulator.hpp"
+
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+namespace {
+
+volatile sig_atomic_t stop_requested = 0;
+
+void onSignal(int) {
+    stop_requested = 1;
+}
+
+void usage(const char* name) {
+    std::cerr << "usage: " << name << " [--lpps] [--address a.b.c.d] [--port 5025] [--data-ports 5031,5032]\n"
+              << "       [--rate frames_per_s (0 - full speed)] [--batch frames] [--split min,max]\n"
+              << "       [--garbage probability[,max_len]] [--disconnect frames] [--acq] [--seed n] [--zerocopy]" << std::endl;
+}
+
+} // end namespace
+
+int main(int argc, char* argv[]) {
+    emulator::EmulatorConfig config;
+
+    const struct option options[] = {
+        { "lpps",       no_argument,       nullptr, 'l' },
+        { "address",    required_argument, nullptr, 'a' },
+        { "port",       required_argument, nullptr, 'p' },
+        { "data-ports", required_argument, nullptr, 'd' },
+        { "rate",       required_argument, nullptr, 'r' },
+        { "batch",      required_argument, nullptr, 'b' },
+        { "split",      required_argument, nullptr, 's' },
+        { "garbage",    required_argument, nullptr, 'g' },
+        { "disconnect", required_argument, nullptr, 'x' },
+        { "acq",        no_argument,       nullptr, 'q' },
+        { "seed",       required_argument, nullptr, 'e' },
+        { "zerocopy",   no_argument,       nullptr, 'z' },
+        { "help",       no_argument,       nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, nullptr)) != -1) {
+        switch (opt) {
+            case 'l': config.device = emulator::emulated_device::LPPS; break;
+            case 'a': config.address = optarg; break;
+            case 'p': config.main_port = std::atoi(optarg); break;
+            case 'd':
+                if (std::sscanf(optarg, "%d,%d", &config.data_ports[0], &config.data_ports[1]) != 2) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'r': config.frame_rate = std::atof(optarg); break;
+            case 'b': config.batch_frames = std::strtoul(optarg, nullptr, 10); break;
+            case 's':
+                if (std::sscanf(optarg, "%zu,%zu", &config.segment_min, &config.segment_max) != 2) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'g':
+                std::sscanf(optarg, "%lf,%zu", &config.garbage_probability, &config.garbage_max);
+                break;
+            case 'x': config.disconnect_after = std::strtoull(optarg, nullptr, 10); break;
+            case 'q': config.acq_required = true; break;
+            case 'e': config.seed = static_cast<unsigned>(std::strtoul(optarg, nullptr, 10)); break;
+            case 'z': config.zerocopy_send = true; break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    try {
+        emulator::ReceiverEmulator emu(config);
+        emu.start();
+        std::cout << ((config.device == emulator::emulated_device::FBS) ? "FBS" : "LPPS") << " emulator, main port "
+                  << emu.mainPort() << ", data ports " << emu.dataPort(0) << "," << emu.dataPort(1) << std::endl;
+
+        uint64_t last[emulator::EMULATOR_CHANNELS] = {};
+        while (!stop_requested) {
+            sleep(1);
+            for (std::size_t channel = 0; channel < emulator::EMULATOR_CHANNELS; channel++) {
+                const emulator::ChannelStats& stats = emu.stats(channel);
+                const uint64_t frames = stats.frames.load();
+                std::cout << "ch" << channel + 1 << ": " << (frames - last[channel]) << " frames/s, total "
+                          << frames << " frames " << stats.bytes.load() << " B, garbage " << stats.garbage_bytes.load()
+                          << " B, connections " << stats.connections.load() << ((channel == 0) ? " | " : "\n");
+                last[channel] = frames;
+            }
+            std::cout.flush();
+        }
+        emu.stop();
+    }
+    catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}